@@ -0,0 +1,1096 @@
+/* Simple Plugin API
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __SPA_GRAPH_SCHEDULER_H__
+#define __SPA_GRAPH_SCHEDULER_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <spa/graph/graph.h>
+
+/*
+ * Scheduler that runs the graph from a flat execution plan.
+ *
+ * The nodes are kept in an array sorted in topological order, upstream
+ * nodes first, and the links of each node are kept in a second array
+ * with the index of the peer node. The plan is rebuilt when the serial
+ * of the graph changes.
+ *
+ * The plan is rebuilt by the thread that runs the graph and it does not
+ * allocate memory. Before nodes or ports are added, the main thread makes
+ * room with spa_graph_data_reserve(), the new memory is picked up at the
+ * start of the next cycle and the old memory is freed by the main thread
+ * on the next reserve. A cycle fails with -ENOSPC when the graph does not
+ * fit in the plan.
+ *
+ * A cycle walks the plan backwards to pull data, calling process_output
+ * on the nodes that all their consumers asked data from, and then walks
+ * it forwards to push data, calling process_input on the nodes that have
+ * all their inputs. Because of the ordering, the counters of a node are
+ * complete when it is visited and every node is visited at most once per
+ * walk.
+ *
+ * Nodes that are not part of the graph, like the in and out nodes of
+ * remote nodes, can be linked to the graph and trigger cycles. They are
+ * handled like scheduler6 does, except for ports with the ASYNC flag: the
+ * peer of those is run by another graph so it is never called, an input
+ * is ready when the peer left a buffer in the io area and outputs are left
+ * in the io area for the peer to pick up. A node that asks for more input after
+ * process_input is pulled again in the next cycle and a cycle can not be
+ * started from inside a node while another cycle is running.
+ *
+ * When workers are configured with spa_graph_data_set_workers(), the
+ * walks are replaced by a dataflow over the plan. Each node has an atomic
+ * counter of the downstream nodes that still need to be pulled and one of
+ * the upstream nodes that still need to be pushed. The node that brings
+ * a counter to 0 queues the next step of the peer on its own queue.
+ * Independent branches are then run in parallel by the thread that starts
+ * the cycle and the workers, idle threads steal work from the queues of
+ * the others. The thread that started the cycle returns when all nodes
+ * are done. Calls into nodes that are not in the graph are serialized.
+ * Threads spin for a short while when there is no work or a lock is taken,
+ * then workers go back to sleep and the thread that started the cycle and
+ * the lock waiters sleep on a futex.
+ *
+ * With spa_graph_data_set_profile() the process calls of the nodes that
+ * have stats are timed. A node has an xrun when it finishes later than
+ * the deadline after the start of the cycle, the default deadline is the
+ * time between the last two cycles.
+ */
+
+#define SPA_GRAPH_PLAN_PULL	(1 << 0)	/**< node asked for input */
+#define SPA_GRAPH_PLAN_PUSH	(1 << 1)	/**< node produced output */
+
+#define SPA_GRAPH_TASK_PULL	0		/**< run the pull step of a node */
+#define SPA_GRAPH_TASK_PUSH	1		/**< run the push step of a node */
+#define SPA_GRAPH_TASK(index,step)	(((index) << 1) | (step))
+
+#define SPA_GRAPH_SPIN_COUNT	128	/**< spins before a thread sleeps */
+
+struct spa_graph_plan_link {
+	struct spa_graph_port *port;	/**< port of the node */
+	uint32_t peer;			/**< index of the peer node or SPA_ID_INVALID when
+					  *  the peer is not in the graph */
+};
+
+struct spa_graph_plan_node {
+	struct spa_graph_node *node;
+	uint32_t links[2];		/**< index of the first input and output link */
+	uint32_t n_links[2];		/**< number of input and output links */
+	uint32_t required[2];		/**< number of required linked ports */
+	uint32_t n_peers[2];		/**< number of input and output links with
+					  *  a peer in the graph */
+
+	/* per cycle state */
+	uint32_t flags;
+	uint32_t ready[2];		/**< number of ready inputs and pulled outputs */
+	uint32_t pending;		/**< number of inputs asked when pulled */
+	uint32_t wait[2];		/**< number of upstream nodes to push and
+					  *  downstream nodes to pull before the step
+					  *  can run, only used with workers */
+};
+
+/** memory of a plan, made by spa_graph_data_reserve() */
+struct spa_graph_plan_mem {
+	uint32_t max_nodes;
+	uint32_t max_links;
+	uint32_t max_tasks;		/**< tasks in each queue */
+	uint32_t n_queues;
+	struct spa_graph_plan_node *nodes;
+	struct spa_graph_plan_link *links;
+	struct spa_graph_node **order;
+	uint32_t *tasks;
+};
+
+/** queue of tasks for one thread, other threads can steal from it */
+struct spa_graph_queue {
+	uint32_t lock;
+	uint32_t head;			/**< first task, taken by thieves */
+	uint32_t tail;			/**< last task, taken by the owner */
+	uint32_t *tasks;
+};
+
+/** executor callbacks, implemented by the owner of the worker threads */
+struct spa_graph_executor_callbacks {
+#define SPA_VERSION_GRAPH_EXECUTOR_CALLBACKS	0
+	uint32_t version;
+
+	/** a cycle started, wake up the workers so that they call
+	 * spa_graph_data_work() */
+	void (*wakeup) (void *data);
+};
+
+struct spa_graph_data {
+	struct spa_graph *graph;
+	uint32_t serial;		/**< graph serial of the plan */
+	struct spa_graph_plan_mem *mem;	/**< memory used by the plan */
+	struct spa_graph_plan_mem *pending;	/**< new memory for the plan */
+	struct spa_graph_plan_mem *old;	/**< memory to free in the main thread */
+	uint32_t mem_lock;		/**< lock for pending and old */
+	uint32_t max_nodes;		/**< nodes reserved by the main thread */
+	uint32_t max_links;		/**< links reserved by the main thread */
+	struct spa_graph_plan_node *nodes;
+	uint32_t n_nodes;
+	struct spa_graph_plan_link *links;
+	uint32_t n_links;
+	struct spa_graph_node **order;	/**< scratch space for sorting */
+	bool running;			/**< a cycle is running */
+	bool loop;			/**< the graph has a loop */
+
+	uint32_t n_workers;		/**< number of worker threads */
+	struct spa_graph_queue *queues;	/**< one queue per worker and one for the
+					  *  thread running the cycle */
+	uint32_t remaining;		/**< nodes left in the current cycle */
+	uint32_t sleeping;		/**< the thread that started the cycle sleeps */
+	uint32_t foreign_lock;		/**< lock for calls to foreign nodes */
+	const struct spa_graph_executor_callbacks *callbacks;
+	void *callbacks_data;
+
+	bool profile;			/**< update the stats of the nodes */
+	uint64_t deadline;		/**< max time of a cycle or 0 for the quantum */
+	uint64_t cycle_start;		/**< start of the current cycle */
+	uint64_t quantum;		/**< time between the last two cycles */
+};
+
+static inline void spa_graph_pause(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__) || (defined(__arm__) && __ARM_ARCH >= 7)
+	__asm__ __volatile__("yield" ::: "memory");
+#else
+	__asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+static inline void spa_graph_futex_wait(uint32_t *addr, uint32_t val)
+{
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static inline void spa_graph_futex_wake(uint32_t *addr, int n)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+/* the lock is 0 when free, 1 when taken and 2 when taken and other
+ * threads sleep on it */
+static inline void spa_graph_lock(uint32_t *lock)
+{
+	uint32_t i, c;
+
+	for (i = 0; i < SPA_GRAPH_SPIN_COUNT; i++) {
+		c = 0;
+		if (__atomic_compare_exchange_n(lock, &c, 1, false,
+						__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			return;
+		spa_graph_pause();
+	}
+	while (__atomic_exchange_n(lock, 2, __ATOMIC_ACQUIRE) != 0)
+		spa_graph_futex_wait(lock, 2);
+}
+
+static inline void spa_graph_unlock(uint32_t *lock)
+{
+	if (__atomic_exchange_n(lock, 0, __ATOMIC_RELEASE) == 2)
+		spa_graph_futex_wake(lock, 1);
+}
+
+static inline void spa_graph_data_init(struct spa_graph_data *data,
+				       struct spa_graph *graph)
+{
+	data->graph = graph;
+	data->serial = graph->serial - 1;
+	data->mem = data->pending = data->old = NULL;
+	data->mem_lock = 0;
+	data->max_nodes = data->max_links = 0;
+	data->nodes = NULL;
+	data->n_nodes = 0;
+	data->links = NULL;
+	data->n_links = 0;
+	data->order = NULL;
+	data->running = false;
+	data->loop = false;
+	data->n_workers = 0;
+	data->queues = NULL;
+	data->remaining = 0;
+	data->sleeping = 0;
+	data->foreign_lock = 0;
+	data->callbacks = NULL;
+	data->callbacks_data = NULL;
+	data->profile = false;
+	data->deadline = 0;
+	data->cycle_start = 0;
+	data->quantum = 0;
+}
+
+/** Enable profiling of the nodes with stats
+ *
+ * \param data the graph data
+ * \param profile if profiling is enabled
+ * \param deadline the deadline of a cycle in nanoseconds, 0 to use the time
+ *        between two cycles
+ */
+static inline void spa_graph_data_set_profile(struct spa_graph_data *data,
+					      bool profile, uint64_t deadline)
+{
+	data->profile = profile;
+	data->deadline = deadline;
+	data->cycle_start = data->quantum = 0;
+}
+
+static inline uint64_t spa_graph_data_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return SPA_TIMESPEC_TO_TIME(&now);
+}
+
+static inline void spa_graph_data_start_cycle(struct spa_graph_data *data)
+{
+	uint64_t now;
+
+	if (SPA_LIKELY(!data->profile))
+		return;
+
+	now = spa_graph_data_now();
+	if (data->cycle_start > 0)
+		data->quantum = now - data->cycle_start;
+	data->cycle_start = now;
+}
+
+static inline void spa_graph_node_update_stats(struct spa_graph_data *data,
+					       struct spa_graph_node *node, uint64_t start)
+{
+	struct spa_graph_node_stats *s = node->stats;
+	uint64_t end = spa_graph_data_now(), elapsed = end - start, deadline;
+
+	__atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	s->last = elapsed;
+	s->avg = s->count ? (s->avg * 7 + elapsed) / 8 : elapsed;
+	if (elapsed > s->max)
+		s->max = elapsed;
+	s->count++;
+	s->quantum = data->quantum;
+
+	deadline = data->deadline ? data->deadline : data->quantum;
+	if (deadline > 0 && end - data->cycle_start > deadline)
+		s->xruns++;
+
+	__atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+static inline int spa_graph_node_process_input(struct spa_graph_data *data,
+					       struct spa_graph_node *node)
+{
+	uint64_t start;
+	int res;
+
+	if (SPA_LIKELY(!data->profile || node->stats == NULL))
+		return spa_node_process_input(node->implementation);
+
+	start = spa_graph_data_now();
+	res = spa_node_process_input(node->implementation);
+	spa_graph_node_update_stats(data, node, start);
+	return res;
+}
+
+static inline int spa_graph_node_process_output(struct spa_graph_data *data,
+						struct spa_graph_node *node)
+{
+	uint64_t start;
+	int res;
+
+	if (SPA_LIKELY(!data->profile || node->stats == NULL))
+		return spa_node_process_output(node->implementation);
+
+	start = spa_graph_data_now();
+	res = spa_node_process_output(node->implementation);
+	spa_graph_node_update_stats(data, node, start);
+	return res;
+}
+
+static inline struct spa_graph_plan_mem *
+spa_graph_plan_mem_new(uint32_t max_nodes, uint32_t max_links, uint32_t n_queues)
+{
+	struct spa_graph_plan_mem *m;
+	uint32_t max_tasks = max_nodes * 2;
+
+	m = calloc(1, sizeof(struct spa_graph_plan_mem) +
+		      max_nodes * sizeof(struct spa_graph_plan_node) +
+		      max_links * sizeof(struct spa_graph_plan_link) +
+		      max_nodes * sizeof(struct spa_graph_node *) +
+		      n_queues * max_tasks * sizeof(uint32_t));
+	if (m == NULL)
+		return NULL;
+
+	m->max_nodes = max_nodes;
+	m->max_links = max_links;
+	m->max_tasks = max_tasks;
+	m->n_queues = n_queues;
+	m->nodes = SPA_MEMBER(m, sizeof(struct spa_graph_plan_mem),
+			      struct spa_graph_plan_node);
+	m->links = SPA_MEMBER(m->nodes, max_nodes * sizeof(struct spa_graph_plan_node),
+			      struct spa_graph_plan_link);
+	m->order = SPA_MEMBER(m->links, max_links * sizeof(struct spa_graph_plan_link),
+			      struct spa_graph_node *);
+	m->tasks = SPA_MEMBER(m->order, max_nodes * sizeof(struct spa_graph_node *),
+			      uint32_t);
+	return m;
+}
+
+/* use the memory for the plan, the plan must be rebuilt after this */
+static inline void spa_graph_plan_set_mem(struct spa_graph_data *data,
+					  struct spa_graph_plan_mem *m)
+{
+	uint32_t i;
+
+	for (i = 0; data->queues && i <= data->n_workers; i++) {
+		struct spa_graph_queue *q = &data->queues[i];
+
+		/* workers can still look at their queue after a cycle */
+		spa_graph_lock(&q->lock);
+		q->tasks = m ? m->tasks + i * m->max_tasks : NULL;
+		spa_graph_unlock(&q->lock);
+	}
+	data->mem = m;
+	data->nodes = m ? m->nodes : NULL;
+	data->links = m ? m->links : NULL;
+	data->order = m ? m->order : NULL;
+	data->n_nodes = data->n_links = 0;
+	data->serial = data->graph->serial - 1;
+}
+
+static inline void spa_graph_data_clear(struct spa_graph_data *data)
+{
+	free(data->mem);
+	free(data->pending);
+	free(data->old);
+	data->mem = data->pending = data->old = NULL;
+	data->max_nodes = data->max_links = 0;
+	data->nodes = NULL;
+	data->links = NULL;
+	data->order = NULL;
+	data->n_nodes = data->n_links = 0;
+	free(data->queues);
+	data->queues = NULL;
+	data->n_workers = 0;
+}
+
+static inline struct spa_graph_plan_node *
+spa_graph_plan_find(struct spa_graph_data *data, struct spa_graph_node *node)
+{
+	if (node == NULL || node->graph != data->graph)
+		return NULL;
+	return node->scheduler_data;
+}
+
+/** Count the nodes and the links of the plan of \a graph */
+static inline void spa_graph_plan_count(struct spa_graph *graph,
+					uint32_t *n_nodes, uint32_t *n_links)
+{
+	struct spa_graph_node *n;
+	struct spa_graph_port *p;
+
+	*n_nodes = *n_links = 0;
+	spa_list_for_each(n, &graph->nodes, link) {
+		(*n_nodes)++;
+		spa_list_for_each(p, &n->ports[SPA_DIRECTION_INPUT], link)
+			(*n_links)++;
+		spa_list_for_each(p, &n->ports[SPA_DIRECTION_OUTPUT], link)
+			(*n_links)++;
+	}
+}
+
+/** Make room in the plan
+ *
+ * \param data the graph data
+ * \param n_nodes the number of nodes the plan should hold
+ * \param n_links the number of ports of the nodes in the plan
+ * \return 0 on success, < 0 on error
+ *
+ * This allocates memory and is called from the main thread before
+ * nodes or ports are added to the graph. Use spa_graph_plan_count() on
+ * the thread running the graph to find the current size.
+ */
+static inline int spa_graph_data_reserve(struct spa_graph_data *data,
+					 uint32_t n_nodes, uint32_t n_links)
+{
+	struct spa_graph_plan_mem *m = NULL, *old, *pending;
+
+	if (n_nodes > data->max_nodes || n_links > data->max_links) {
+		n_nodes = SPA_MAX(n_nodes, data->max_nodes * 2);
+		n_links = SPA_MAX(n_links, data->max_links * 2);
+
+		m = spa_graph_plan_mem_new(n_nodes, n_links,
+					   data->queues ? data->n_workers + 1 : 0);
+		if (m == NULL)
+			return -errno;
+		data->max_nodes = n_nodes;
+		data->max_links = n_links;
+	}
+
+	spa_graph_lock(&data->mem_lock);
+	old = data->old;
+	data->old = NULL;
+	pending = data->pending;
+	if (m != NULL)
+		__atomic_store_n(&data->pending, m, __ATOMIC_RELEASE);
+	else
+		pending = NULL;
+	spa_graph_unlock(&data->mem_lock);
+
+	/* pending memory that was not picked up yet was never used */
+	free(old);
+	free(pending);
+	return 0;
+}
+
+/* pick up the memory of spa_graph_data_reserve() and hand back the old
+ * memory. The main thread frees the old memory before it makes new memory
+ * so there is only one. */
+static inline void spa_graph_plan_take_mem(struct spa_graph_data *data)
+{
+	struct spa_graph_plan_mem *m;
+
+	spa_graph_lock(&data->mem_lock);
+	if ((m = data->pending) != NULL) {
+		data->pending = NULL;
+		data->old = data->mem;
+		spa_graph_plan_set_mem(data, m);
+	}
+	spa_graph_unlock(&data->mem_lock);
+}
+
+static inline void spa_graph_plan_add_links(struct spa_graph_data *data,
+					    struct spa_graph_plan_node *e,
+					    enum spa_direction direction)
+{
+	struct spa_graph_port *p;
+	struct spa_graph_plan_node *pe;
+
+	e->links[direction] = data->n_links;
+	e->n_links[direction] = 0;
+	e->required[direction] = 0;
+	e->n_peers[direction] = 0;
+
+	spa_list_for_each(p, &e->node->ports[direction], link) {
+		struct spa_graph_plan_link *l;
+
+		if (p->peer == NULL)
+			continue;
+
+		l = &data->links[data->n_links++];
+		l->port = p;
+		pe = spa_graph_plan_find(data, p->peer->node);
+		l->peer = pe ? pe - data->nodes : SPA_ID_INVALID;
+		if (pe)
+			e->n_peers[direction]++;
+
+		e->n_links[direction]++;
+		if (!(p->flags & (SPA_PORT_INFO_FLAG_OPTIONAL | SPA_GRAPH_PORT_FLAG_ASYNC)))
+			e->required[direction]++;
+	}
+}
+
+/** Sort the nodes of the graph and make the plan */
+static inline int spa_graph_plan_build(struct spa_graph_data *data)
+{
+	struct spa_graph *graph = data->graph;
+	struct spa_graph_node *n, *pn;
+	struct spa_graph_port *p;
+	uint32_t i, n_nodes, n_links, head, tail;
+
+	spa_graph_plan_count(graph, &n_nodes, &n_links);
+	if (n_nodes > 0 &&
+	    (data->mem == NULL ||
+	     n_nodes > data->mem->max_nodes || n_links > data->mem->max_links)) {
+		spa_debug("graph %p: no room for %d nodes and %d links", graph,
+				n_nodes, n_links);
+		data->n_nodes = data->n_links = 0;
+		return -ENOSPC;
+	}
+
+	/* count the inputs coming from nodes in the graph, the node can
+	 * be run when all of them are done */
+	tail = 0;
+	data->loop = false;
+	spa_list_for_each(n, &graph->nodes, link) {
+		n->ready[SPA_DIRECTION_INPUT] = 0;
+		spa_list_for_each(p, &n->ports[SPA_DIRECTION_INPUT], link) {
+			if (p->peer && p->peer->node && p->peer->node->graph == graph)
+				n->ready[SPA_DIRECTION_INPUT]++;
+		}
+		if (n->ready[SPA_DIRECTION_INPUT] == 0)
+			data->order[tail++] = n;
+	}
+	for (head = 0; head < tail; head++) {
+		n = data->order[head];
+		spa_list_for_each(p, &n->ports[SPA_DIRECTION_OUTPUT], link) {
+			if (p->peer == NULL || (pn = p->peer->node) == NULL || pn->graph != graph)
+				continue;
+			if (pn->ready[SPA_DIRECTION_INPUT] > 0 &&
+			    --pn->ready[SPA_DIRECTION_INPUT] == 0)
+				data->order[tail++] = pn;
+		}
+	}
+	if (tail < n_nodes) {
+		/* there is a loop in the graph, run the remaining nodes in the
+		 * order they were added */
+		spa_debug("graph %p: %d nodes in a loop", graph, n_nodes - tail);
+		data->loop = true;
+		spa_list_for_each(n, &graph->nodes, link) {
+			if (n->ready[SPA_DIRECTION_INPUT] > 0) {
+				n->ready[SPA_DIRECTION_INPUT] = 0;
+				data->order[tail++] = n;
+			}
+		}
+	}
+
+	for (i = 0; i < n_nodes; i++) {
+		struct spa_graph_plan_node *e = &data->nodes[i];
+
+		e->node = data->order[i];
+		e->node->scheduler_data = e;
+		e->flags = 0;
+		e->ready[SPA_DIRECTION_INPUT] = e->ready[SPA_DIRECTION_OUTPUT] = 0;
+		e->pending = 0;
+	}
+	data->n_nodes = n_nodes;
+
+	data->n_links = 0;
+	for (i = 0; i < n_nodes; i++) {
+		spa_graph_plan_add_links(data, &data->nodes[i], SPA_DIRECTION_INPUT);
+		spa_graph_plan_add_links(data, &data->nodes[i], SPA_DIRECTION_OUTPUT);
+	}
+	data->serial = graph->serial;
+
+	spa_debug("graph %p: plan with %d nodes and %d links", graph, n_nodes, data->n_links);
+
+	return 0;
+}
+
+static inline int spa_graph_plan_check(struct spa_graph_data *data)
+{
+	if (SPA_UNLIKELY(__atomic_load_n(&data->pending, __ATOMIC_RELAXED) != NULL))
+		spa_graph_plan_take_mem(data);
+	if (SPA_LIKELY(data->serial == data->graph->serial))
+		return 0;
+	return spa_graph_plan_build(data);
+}
+
+static inline bool spa_graph_plan_port_enabled(struct spa_graph_port *port)
+{
+	return port->peer != NULL &&
+		!(port->flags & SPA_GRAPH_PORT_FLAG_DISABLED) &&
+		!(port->peer->flags & SPA_GRAPH_PORT_FLAG_DISABLED);
+}
+
+static inline void spa_graph_plan_lock_foreign(struct spa_graph_data *data)
+{
+	if (data->n_workers > 0)
+		spa_graph_lock(&data->foreign_lock);
+}
+
+static inline void spa_graph_plan_unlock_foreign(struct spa_graph_data *data)
+{
+	if (data->n_workers > 0)
+		spa_graph_unlock(&data->foreign_lock);
+}
+
+/* counters can be updated from multiple workers, only pay for the atomic
+ * operation when there are workers */
+static inline void spa_graph_plan_inc(struct spa_graph_data *data, uint32_t *count)
+{
+	if (data->n_workers > 0)
+		__atomic_add_fetch(count, 1, __ATOMIC_RELAXED);
+	else
+		(*count)++;
+}
+
+/* a node not in the graph has data on its output port */
+static inline void spa_graph_plan_push_foreign(struct spa_graph_data *data,
+					       struct spa_graph_port *port)
+{
+	struct spa_graph_node *pn = port->peer->node;
+	uint32_t required;
+
+	spa_graph_plan_lock_foreign(data);
+	pn->ready[SPA_DIRECTION_INPUT]++;
+	required = pn->required[SPA_DIRECTION_INPUT];
+
+	spa_debug("node %p push foreign %p %d %d", port->node, pn,
+			pn->ready[SPA_DIRECTION_INPUT], required);
+
+	if (required > 0 && pn->ready[SPA_DIRECTION_INPUT] >= required)
+		pn->state = spa_node_process_input(pn->implementation);
+	spa_graph_plan_unlock_foreign(data);
+}
+
+/* a node asks for data on its inputs */
+static inline void spa_graph_plan_pull_inputs(struct spa_graph_data *data,
+					      struct spa_graph_plan_node *e)
+{
+	struct spa_graph_plan_link *l = &data->links[e->links[SPA_DIRECTION_INPUT]];
+	uint32_t i;
+
+	e->flags |= SPA_GRAPH_PLAN_PULL;
+
+	for (i = 0; i < e->n_links[SPA_DIRECTION_INPUT]; i++, l++) {
+		struct spa_graph_node *pn;
+		int state;
+
+		if (!spa_graph_plan_port_enabled(l->port))
+			continue;
+
+		if (l->port->flags & SPA_GRAPH_PORT_FLAG_ASYNC) {
+			/* don't wait for the other graph, take what is there */
+			if (__atomic_load_n(&l->port->io->status, __ATOMIC_ACQUIRE) ==
+			    SPA_STATUS_HAVE_BUFFER) {
+				e->pending++;
+				spa_graph_plan_inc(data, &e->ready[SPA_DIRECTION_INPUT]);
+			}
+			continue;
+		}
+		if (l->port->io->status != SPA_STATUS_NEED_BUFFER)
+			continue;
+
+		e->pending++;
+		if (l->peer != SPA_ID_INVALID) {
+			spa_graph_plan_inc(data, &data->nodes[l->peer].ready[SPA_DIRECTION_OUTPUT]);
+			continue;
+		}
+		/* the peer is not in the graph, ask it directly */
+		pn = l->port->peer->node;
+		spa_graph_plan_lock_foreign(data);
+		pn->state = state = spa_node_process_output(pn->implementation);
+		spa_graph_plan_unlock_foreign(data);
+		spa_debug("node %p pull foreign %p %d", e->node, pn, state);
+		if (state == SPA_STATUS_HAVE_BUFFER)
+			spa_graph_plan_inc(data, &e->ready[SPA_DIRECTION_INPUT]);
+	}
+}
+
+/* a node produced data on its outputs */
+static inline void spa_graph_plan_push_outputs(struct spa_graph_data *data,
+					       struct spa_graph_plan_node *e)
+{
+	struct spa_graph_plan_link *l = &data->links[e->links[SPA_DIRECTION_OUTPUT]];
+	uint32_t i;
+
+	for (i = 0; i < e->n_links[SPA_DIRECTION_OUTPUT]; i++, l++) {
+		if (!spa_graph_plan_port_enabled(l->port) ||
+		    l->port->io->status != SPA_STATUS_HAVE_BUFFER)
+			continue;
+
+		if (l->peer != SPA_ID_INVALID)
+			spa_graph_plan_inc(data, &data->nodes[l->peer].ready[SPA_DIRECTION_INPUT]);
+		else if (!(l->port->flags & SPA_GRAPH_PORT_FLAG_ASYNC))
+			spa_graph_plan_push_foreign(data, l->port);
+	}
+}
+
+/* run a node that was asked for data by all its consumers */
+static inline void spa_graph_plan_pull_node(struct spa_graph_data *data,
+					    struct spa_graph_plan_node *e)
+{
+	uint32_t ready = __atomic_load_n(&e->ready[SPA_DIRECTION_OUTPUT], __ATOMIC_RELAXED);
+	int state;
+
+	if (ready == 0 || ready < e->required[SPA_DIRECTION_OUTPUT])
+		return;
+
+	e->node->state = state = spa_graph_node_process_output(data, e->node);
+	spa_debug("node %p processed out %d", e->node, state);
+
+	if (state == SPA_STATUS_HAVE_BUFFER)
+		e->flags |= SPA_GRAPH_PLAN_PUSH;
+	else if (state == SPA_STATUS_NEED_BUFFER)
+		spa_graph_plan_pull_inputs(data, e);
+}
+
+/* run a node that has all its inputs and clear the cycle state */
+static inline void spa_graph_plan_push_node(struct spa_graph_data *data,
+					    struct spa_graph_plan_node *e)
+{
+	uint32_t ready, required;
+
+	ready = __atomic_load_n(&e->ready[SPA_DIRECTION_INPUT], __ATOMIC_RELAXED);
+	required = e->flags & SPA_GRAPH_PLAN_PULL ?
+		e->pending : e->required[SPA_DIRECTION_INPUT];
+
+	if (ready > 0 && ready >= required) {
+		int state;
+
+		e->node->state = state = spa_graph_node_process_input(data, e->node);
+		spa_debug("node %p processed in %d", e->node, state);
+
+		if (state == SPA_STATUS_HAVE_BUFFER)
+			e->flags |= SPA_GRAPH_PLAN_PUSH;
+	}
+	if (e->flags & SPA_GRAPH_PLAN_PUSH)
+		spa_graph_plan_push_outputs(data, e);
+
+	e->flags = 0;
+	e->ready[SPA_DIRECTION_INPUT] = e->ready[SPA_DIRECTION_OUTPUT] = 0;
+	e->pending = 0;
+}
+
+/* walk upstream, because of the ordering all consumers of a node are
+ * done when it is visited */
+static inline void spa_graph_plan_pull(struct spa_graph_data *data)
+{
+	uint32_t i;
+
+	for (i = data->n_nodes; i > 0; i--)
+		spa_graph_plan_pull_node(data, &data->nodes[i - 1]);
+}
+
+/* walk downstream */
+static inline void spa_graph_plan_push(struct spa_graph_data *data)
+{
+	uint32_t i;
+
+	for (i = 0; i < data->n_nodes; i++)
+		spa_graph_plan_push_node(data, &data->nodes[i]);
+}
+
+static inline void spa_graph_queue_push(struct spa_graph_data *data, uint32_t id, uint32_t task)
+{
+	struct spa_graph_queue *q = &data->queues[id];
+
+	spa_graph_lock(&q->lock);
+	q->tasks[q->tail] = task;
+	__atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_RELAXED);
+	spa_graph_unlock(&q->lock);
+}
+
+/* the owner takes the most recent task, it is likely still in the cache.
+ * A node adds at most two tasks per cycle and the queue is rewound when
+ * empty so it never holds more than max_tasks. */
+static inline bool spa_graph_queue_pop(struct spa_graph_data *data, uint32_t id, uint32_t *task)
+{
+	struct spa_graph_queue *q = &data->queues[id];
+	bool res = false;
+
+	if (__atomic_load_n(&q->tail, __ATOMIC_RELAXED) == 0)
+		return false;
+
+	spa_graph_lock(&q->lock);
+	if (q->head < q->tail) {
+		uint32_t tail = q->tail - 1;
+
+		*task = q->tasks[tail];
+		if (q->head == tail)
+			q->head = tail = 0;
+		__atomic_store_n(&q->tail, tail, __ATOMIC_RELAXED);
+		res = true;
+	}
+	spa_graph_unlock(&q->lock);
+	return res;
+}
+
+/* take the oldest task from the queue of another thread */
+static inline bool spa_graph_queue_steal(struct spa_graph_data *data, uint32_t id, uint32_t *task)
+{
+	uint32_t i;
+
+	for (i = 1; i <= data->n_workers; i++) {
+		struct spa_graph_queue *q = &data->queues[(id + i) % (data->n_workers + 1)];
+		bool res = false;
+
+		if (__atomic_load_n(&q->tail, __ATOMIC_RELAXED) == 0)
+			continue;
+
+		spa_graph_lock(&q->lock);
+		if (q->head < q->tail) {
+			*task = q->tasks[q->head++];
+			if (q->head == q->tail) {
+				q->head = 0;
+				__atomic_store_n(&q->tail, 0, __ATOMIC_RELAXED);
+			}
+			res = true;
+		}
+		spa_graph_unlock(&q->lock);
+		if (res)
+			return true;
+	}
+	return false;
+}
+
+static inline void spa_graph_plan_run_task(struct spa_graph_data *data, uint32_t id, uint32_t task)
+{
+	uint32_t index = task >> 1, i;
+	struct spa_graph_plan_node *e = &data->nodes[index];
+	struct spa_graph_plan_link *l;
+
+	if ((task & 1) == SPA_GRAPH_TASK_PULL) {
+		spa_graph_plan_pull_node(data, e);
+
+		/* upstream nodes can be pulled when all their consumers are done */
+		l = &data->links[e->links[SPA_DIRECTION_INPUT]];
+		for (i = 0; i < e->n_links[SPA_DIRECTION_INPUT]; i++, l++) {
+			if (l->peer == SPA_ID_INVALID)
+				continue;
+			if (__atomic_sub_fetch(&data->nodes[l->peer].wait[SPA_DIRECTION_OUTPUT],
+						1, __ATOMIC_ACQ_REL) == 0)
+				spa_graph_queue_push(data, id, SPA_GRAPH_TASK(l->peer, SPA_GRAPH_TASK_PULL));
+		}
+		if (__atomic_sub_fetch(&e->wait[SPA_DIRECTION_INPUT], 1, __ATOMIC_ACQ_REL) == 0)
+			spa_graph_queue_push(data, id, SPA_GRAPH_TASK(index, SPA_GRAPH_TASK_PUSH));
+	} else {
+		spa_graph_plan_push_node(data, e);
+
+		/* downstream nodes can be pushed when all their inputs are done */
+		l = &data->links[e->links[SPA_DIRECTION_OUTPUT]];
+		for (i = 0; i < e->n_links[SPA_DIRECTION_OUTPUT]; i++, l++) {
+			if (l->peer == SPA_ID_INVALID)
+				continue;
+			if (__atomic_sub_fetch(&data->nodes[l->peer].wait[SPA_DIRECTION_INPUT],
+						1, __ATOMIC_ACQ_REL) == 0)
+				spa_graph_queue_push(data, id, SPA_GRAPH_TASK(l->peer, SPA_GRAPH_TASK_PUSH));
+		}
+		if (__atomic_sub_fetch(&data->remaining, 1, __ATOMIC_SEQ_CST) == 0 &&
+		    __atomic_load_n(&data->sleeping, __ATOMIC_SEQ_CST))
+			spa_graph_futex_wake(&data->remaining, 1);
+	}
+}
+
+/** Run tasks of the current cycle until all nodes are done
+ *
+ * \param data the graph data
+ * \param id the id of the worker, 1 up to the number of workers
+ * \return 0
+ *
+ * This is called by the workers after the wakeup callback. It returns
+ * immediately when no cycle is running and when it found no work for a
+ * while. A thread only queues tasks on its own queue and runs them before
+ * it stops so no task is left behind.
+ */
+static inline int spa_graph_data_work(struct spa_graph_data *data, uint32_t id)
+{
+	uint32_t task, idle = 0, remaining;
+
+	while ((remaining = __atomic_load_n(&data->remaining, __ATOMIC_ACQUIRE)) > 0) {
+		if (spa_graph_queue_pop(data, id, &task) ||
+		    spa_graph_queue_steal(data, id, &task)) {
+			spa_graph_plan_run_task(data, id, task);
+			idle = 0;
+			continue;
+		}
+		if (++idle < SPA_GRAPH_SPIN_COUNT) {
+			spa_graph_pause();
+			continue;
+		}
+		if (id > 0)
+			break;
+
+		/* the other threads run the last nodes, wait for them */
+		__atomic_store_n(&data->sleeping, 1, __ATOMIC_SEQ_CST);
+		if ((remaining = __atomic_load_n(&data->remaining, __ATOMIC_SEQ_CST)) > 0)
+			spa_graph_futex_wait(&data->remaining, remaining);
+		__atomic_store_n(&data->sleeping, 0, __ATOMIC_RELAXED);
+		idle = 0;
+	}
+	return 0;
+}
+
+/** Configure the worker threads
+ *
+ * \param data the graph data
+ * \param n_workers the number of workers, 0 runs the graph in the
+ *        thread that starts the cycle
+ * \param callbacks callbacks to wake up the workers
+ * \param callbacks_data data for \a callbacks
+ * \return 0 on success, < 0 on error
+ *
+ * This allocates memory and can only be called from the main thread when
+ * the graph is not running.
+ */
+static inline int spa_graph_data_set_workers(struct spa_graph_data *data, uint32_t n_workers,
+					     const struct spa_graph_executor_callbacks *callbacks,
+					     void *callbacks_data)
+{
+	struct spa_graph_queue *queues = NULL;
+	struct spa_graph_plan_mem *m;
+
+	if (data->running)
+		return -EBUSY;
+
+	/* the memory of the plan has the tasks of the queues */
+	if ((m = spa_graph_plan_mem_new(data->max_nodes, data->max_links,
+					n_workers > 0 ? n_workers + 1 : 0)) == NULL)
+		return -errno;
+
+	if (n_workers > 0 &&
+	    (queues = calloc(n_workers + 1, sizeof(struct spa_graph_queue))) == NULL) {
+		free(m);
+		return -errno;
+	}
+
+	free(data->mem);
+	free(data->pending);
+	free(data->old);
+	data->pending = data->old = NULL;
+	free(data->queues);
+
+	data->queues = queues;
+	data->n_workers = n_workers;
+	data->callbacks = callbacks;
+	data->callbacks_data = callbacks_data;
+	spa_graph_plan_set_mem(data, m);
+
+	return 0;
+}
+
+/* run a cycle, starting with a pull when \a pull is true */
+static inline void spa_graph_plan_run(struct spa_graph_data *data, bool pull)
+{
+	uint32_t i;
+
+	if (data->n_workers == 0 || data->loop) {
+		if (pull)
+			spa_graph_plan_pull(data);
+		spa_graph_plan_push(data);
+		return;
+	}
+
+	/* the push step of a node also waits for its own pull step */
+	for (i = 0; i < data->n_nodes; i++) {
+		struct spa_graph_plan_node *e = &data->nodes[i];
+
+		e->wait[SPA_DIRECTION_INPUT] = e->n_peers[SPA_DIRECTION_INPUT] + (pull ? 1 : 0);
+		e->wait[SPA_DIRECTION_OUTPUT] = e->n_peers[SPA_DIRECTION_OUTPUT];
+	}
+	__atomic_store_n(&data->remaining, data->n_nodes, __ATOMIC_RELEASE);
+
+	for (i = 0; i < data->n_nodes; i++) {
+		struct spa_graph_plan_node *e = &data->nodes[i];
+
+		if (pull && e->n_peers[SPA_DIRECTION_OUTPUT] == 0)
+			spa_graph_queue_push(data, 0, SPA_GRAPH_TASK(i, SPA_GRAPH_TASK_PULL));
+		else if (!pull && e->n_peers[SPA_DIRECTION_INPUT] == 0)
+			spa_graph_queue_push(data, 0, SPA_GRAPH_TASK(i, SPA_GRAPH_TASK_PUSH));
+	}
+	if (data->callbacks && data->callbacks->wakeup)
+		data->callbacks->wakeup(data->callbacks_data);
+
+	spa_graph_data_work(data, 0);
+}
+
+static inline int spa_graph_impl_need_input(void *data, struct spa_graph_node *node)
+{
+	struct spa_graph_data *d = data;
+	struct spa_graph_plan_node *e;
+	struct spa_graph_port *p;
+	int res;
+
+	if (d->running)
+		return -EBUSY;
+	if ((res = spa_graph_plan_check(d)) < 0)
+		return res;
+
+	spa_debug("node %p start pull", node);
+	d->running = true;
+	spa_graph_data_start_cycle(d);
+
+	if ((e = spa_graph_plan_find(d, node)) != NULL) {
+		spa_graph_plan_pull_inputs(d, e);
+	} else {
+		node->required[SPA_DIRECTION_INPUT] = 0;
+		node->ready[SPA_DIRECTION_INPUT] = 0;
+		spa_list_for_each(p, &node->ports[SPA_DIRECTION_INPUT], link) {
+			struct spa_graph_plan_node *pe;
+
+			if (!spa_graph_plan_port_enabled(p) ||
+			    p->io->status != SPA_STATUS_NEED_BUFFER)
+				continue;
+
+			node->required[SPA_DIRECTION_INPUT]++;
+			if ((pe = spa_graph_plan_find(d, p->peer->node)) != NULL)
+				pe->ready[SPA_DIRECTION_OUTPUT]++;
+		}
+	}
+	spa_graph_plan_run(d, true);
+	d->running = false;
+
+	spa_debug("node %p end pull", node);
+	return 0;
+}
+
+static inline int spa_graph_impl_have_output(void *data, struct spa_graph_node *node)
+{
+	struct spa_graph_data *d = data;
+	struct spa_graph_plan_node *e;
+	struct spa_graph_port *p;
+	int res;
+
+	if (d->running)
+		return -EBUSY;
+	if ((res = spa_graph_plan_check(d)) < 0)
+		return res;
+
+	spa_debug("node %p start push", node);
+	d->running = true;
+	spa_graph_data_start_cycle(d);
+
+	if ((e = spa_graph_plan_find(d, node)) != NULL) {
+		e->flags |= SPA_GRAPH_PLAN_PUSH;
+	} else {
+		spa_list_for_each(p, &node->ports[SPA_DIRECTION_OUTPUT], link) {
+			struct spa_graph_plan_node *pe;
+
+			if (!spa_graph_plan_port_enabled(p) ||
+			    p->io->status != SPA_STATUS_HAVE_BUFFER)
+				continue;
+
+			if ((pe = spa_graph_plan_find(d, p->peer->node)) != NULL)
+				pe->ready[SPA_DIRECTION_INPUT]++;
+		}
+	}
+	spa_graph_plan_run(d, false);
+	d->running = false;
+
+	spa_debug("node %p end push", node);
+	return 0;
+}
+
+static const struct spa_graph_callbacks spa_graph_impl_default = {
+	SPA_VERSION_GRAPH_CALLBACKS,
+	.need_input = spa_graph_impl_need_input,
+	.have_output = spa_graph_impl_have_output,
+};
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif /* __SPA_GRAPH_SCHEDULER_H__ */
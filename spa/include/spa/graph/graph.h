@@ -24,6 +24,8 @@
 extern "C" {
 #endif
 
+#include <errno.h>
+
 #include <spa/utils/defs.h>
 #include <spa/utils/list.h>
 #include <spa/node/node.h>
@@ -47,6 +49,7 @@ struct spa_graph_callbacks {
 
 struct spa_graph {
 	struct spa_list nodes;
+	uint32_t serial;		/**< incremented when the topology changes */
 	const struct spa_graph_callbacks *callbacks;
 	void *callbacks_data;
 };
@@ -55,6 +58,43 @@ struct spa_graph {
 #define spa_graph_have_output(g,n)	((g)->callbacks->have_output((g)->callbacks_data, (n)))
 #define spa_graph_reuse_buffer(g,n,p,i)	((g)->callbacks->reuse_buffer((g)->callbacks_data, (n),(p),(i)))
 
+/** process statistics of a node, updated by schedulers that support
+ * profiling. Times are in nanoseconds. */
+/** Stats of a node, updated by the scheduler. The seq is odd while the
+ * stats are updated, use spa_graph_node_stats_read() to get a consistent
+ * copy from another thread. */
+struct spa_graph_node_stats {
+	uint32_t seq;			/**< incremented before and after each update */
+	uint64_t last;			/**< last process time */
+	uint64_t avg;			/**< average process time */
+	uint64_t max;			/**< max process time */
+	uint64_t quantum;		/**< time between the last two cycles */
+	uint32_t count;			/**< number of process calls */
+	uint32_t xruns;			/**< number of times the node finished after
+					  *  the cycle deadline */
+};
+
+/** Get a consistent copy of \a stats, returns -EAGAIN when the stats
+ * kept changing */
+static inline int spa_graph_node_stats_read(const struct spa_graph_node_stats *stats,
+					    struct spa_graph_node_stats *copy)
+{
+	uint32_t seq, retry;
+
+	for (retry = 0; retry < 64; retry++) {
+		seq = __atomic_load_n(&stats->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+
+		*copy = *stats;
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&stats->seq, __ATOMIC_RELAXED) == seq)
+			return 0;
+	}
+	return -EAGAIN;
+}
+
 struct spa_graph_node {
 	struct spa_list link;		/**< link in graph nodes list */
 	struct spa_graph *graph;	/**< owner graph */
@@ -67,6 +107,7 @@ struct spa_graph_node {
 	int state;			/**< state of the node */
 	struct spa_node *implementation;/**< node implementation */
 	void *scheduler_data;		/**< scheduler private data */
+	struct spa_graph_node_stats *stats;	/**< stats to update or NULL */
 };
 
 struct spa_graph_port {
@@ -75,6 +116,9 @@ struct spa_graph_port {
 	enum spa_direction direction;	/**< port direction */
 	uint32_t port_id;		/**< port id */
 #define SPA_GRAPH_PORT_FLAG_DISABLED	(1 << 0)
+#define SPA_GRAPH_PORT_FLAG_ASYNC	(1 << 16)	/**< the peer is run from another
+							  *  graph, data is only exchanged
+							  *  through the io area */
 	uint32_t flags;			/**< port flags */
 	struct spa_io_buffers *io;	/**< io area of the port */
 	struct spa_graph_port *peer;	/**< peer */
@@ -84,6 +128,13 @@ struct spa_graph_port {
 static inline void spa_graph_init(struct spa_graph *graph)
 {
 	spa_list_init(&graph->nodes);
+	graph->serial = 0;
+}
+
+static inline void spa_graph_node_changed(struct spa_graph_node *node)
+{
+	if (node && node->graph)
+		node->graph->serial++;
 }
 
 static inline void
@@ -100,7 +151,9 @@ spa_graph_node_init(struct spa_graph_node *node)
 {
 	spa_list_init(&node->ports[SPA_DIRECTION_INPUT]);
 	spa_list_init(&node->ports[SPA_DIRECTION_OUTPUT]);
+	node->graph = NULL;
 	node->flags = 0;
+	node->stats = NULL;
 	node->required[SPA_DIRECTION_INPUT] = node->ready[SPA_DIRECTION_INPUT] = 0;
 	node->required[SPA_DIRECTION_OUTPUT] = node->ready[SPA_DIRECTION_OUTPUT] = 0;
 	spa_debug("node %p init", node);
@@ -121,6 +174,7 @@ spa_graph_node_add(struct spa_graph *graph,
 	node->state = SPA_STATUS_OK;
 	node->ready_link.next = NULL;
 	spa_list_append(&graph->nodes, &node->link);
+	graph->serial++;
 	spa_debug("node %p add", node);
 }
 
@@ -136,6 +190,8 @@ spa_graph_port_init(struct spa_graph_port *port,
 	port->port_id = port_id;
 	port->flags = flags;
 	port->io = io;
+	port->node = NULL;
+	port->peer = NULL;
 }
 
 static inline void
@@ -147,6 +203,7 @@ spa_graph_port_add(struct spa_graph_node *node,
 	spa_list_append(&node->ports[port->direction], &port->link);
 	if (!(port->flags & SPA_PORT_INFO_FLAG_OPTIONAL))
 		node->required[port->direction]++;
+	spa_graph_node_changed(node);
 }
 
 static inline void spa_graph_node_remove(struct spa_graph_node *node)
@@ -155,6 +212,8 @@ static inline void spa_graph_node_remove(struct spa_graph_node *node)
 	spa_list_remove(&node->link);
 	if (node->ready_link.next)
 		spa_list_remove(&node->ready_link);
+	spa_graph_node_changed(node);
+	node->graph = NULL;
 }
 
 static inline void spa_graph_port_remove(struct spa_graph_port *port)
@@ -165,6 +224,7 @@ static inline void spa_graph_port_remove(struct spa_graph_port *port)
 	    port->node->required[port->direction] > 0) {
 		port->node->required[port->direction]--;
 	}
+	spa_graph_node_changed(port->node);
 }
 
 static inline void
@@ -173,6 +233,8 @@ spa_graph_port_link(struct spa_graph_port *out, struct spa_graph_port *in)
 	spa_debug("port %p link to %p", out, in);
 	out->peer = in;
 	in->peer = out;
+	spa_graph_node_changed(out->node);
+	spa_graph_node_changed(in->node);
 }
 
 static inline void
@@ -180,9 +242,11 @@ spa_graph_port_unlink(struct spa_graph_port *port)
 {
 	spa_debug("port %p unlink from %p", port, port->peer);
 	if (port->peer) {
+		spa_graph_node_changed(port->peer->node);
 		port->peer->peer = NULL;
 		port->peer = NULL;
 	}
+	spa_graph_node_changed(port->node);
 }
 
 #ifdef __cplusplus
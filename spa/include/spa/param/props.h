@@ -50,6 +50,7 @@ extern "C" {
 #define SPA_TYPE_PROPS__frequency	SPA_TYPE_PROPS_BASE "frequency"
 #define SPA_TYPE_PROPS__volume		SPA_TYPE_PROPS_BASE "volume"
 #define SPA_TYPE_PROPS__mute		SPA_TYPE_PROPS_BASE "mute"
+#define SPA_TYPE_PROPS__channelMatrix	SPA_TYPE_PROPS_BASE "channelMatrix"
 #define SPA_TYPE_PROPS__patternType	SPA_TYPE_PROPS_BASE "patternType"
 
 #define SPA_TYPE_PROPS__brightness	SPA_TYPE_PROPS_BASE "brightness"
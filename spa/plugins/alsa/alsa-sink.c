@@ -460,24 +460,15 @@ impl_node_port_set_param(struct spa_node *node,
 		return -ENOENT;
 }
 
-static int
-impl_node_port_use_buffers(struct spa_node *node,
-			   enum spa_direction direction,
-			   uint32_t port_id, struct spa_buffer **buffers, uint32_t n_buffers)
+/* with zero_copy, the data of the buffers is set before they are filled */
+static int use_buffers(struct state *this, struct spa_buffer **buffers, uint32_t n_buffers,
+		       bool zero_copy)
 {
-	struct state *this;
 	int i;
 
-	spa_return_val_if_fail(node != NULL, -EINVAL);
-
-	this = SPA_CONTAINER_OF(node, struct state, node);
-
-	spa_return_val_if_fail(CHECK_PORT(this, direction, port_id), -EINVAL);
-
 	spa_log_info(this->log, "use buffers %d", n_buffers);
 
-	if (!this->have_format)
-		return -EIO;
+	this->zero_copy = zero_copy;
 
 	if (n_buffers == 0) {
 		spa_alsa_pause(this, false);
@@ -497,7 +488,8 @@ impl_node_port_use_buffers(struct spa_node *node,
 		type = buffers[i]->datas[0].type;
 		if ((type == this->type.data.MemFd ||
 		     type == this->type.data.DmaBuf ||
-		     type == this->type.data.MemPtr) && buffers[i]->datas[0].data == NULL) {
+		     type == this->type.data.MemPtr) && buffers[i]->datas[0].data == NULL &&
+		    !zero_copy) {
 			spa_log_error(this->log, NAME " %p: need mapped memory", this);
 			return -EINVAL;
 		}
@@ -507,6 +499,25 @@ impl_node_port_use_buffers(struct spa_node *node,
 	return 0;
 }
 
+static int
+impl_node_port_use_buffers(struct spa_node *node,
+			   enum spa_direction direction,
+			   uint32_t port_id, struct spa_buffer **buffers, uint32_t n_buffers)
+{
+	struct state *this;
+
+	spa_return_val_if_fail(node != NULL, -EINVAL);
+
+	this = SPA_CONTAINER_OF(node, struct state, node);
+
+	spa_return_val_if_fail(CHECK_PORT(this, direction, port_id), -EINVAL);
+
+	if (!this->have_format)
+		return -EIO;
+
+	return use_buffers(this, buffers, n_buffers, false);
+}
+
 static int
 impl_node_port_alloc_buffers(struct spa_node *node,
 			     enum spa_direction direction,
@@ -517,6 +528,7 @@ impl_node_port_alloc_buffers(struct spa_node *node,
 			     uint32_t *n_buffers)
 {
 	struct state *this;
+	int res;
 
 	spa_return_val_if_fail(node != NULL, -EINVAL);
 	spa_return_val_if_fail(buffers != NULL, -EINVAL);
@@ -527,8 +539,14 @@ impl_node_port_alloc_buffers(struct spa_node *node,
 
 	if (!this->have_format)
 		return -EIO;
+	if (!this->mmap_buffers)
+		return -ENOTSUP;
 
-	return -ENOTSUP;
+	spa_alsa_pause(this, false);
+
+	if ((res = spa_alsa_alloc_buffers(this, buffers, *n_buffers)) < 0)
+		return res;
+	return use_buffers(this, buffers, *n_buffers, true);
 }
 
 static int
@@ -638,6 +656,43 @@ static const struct spa_node impl_node = {
 	impl_node_process_output,
 };
 
+static int impl_clock_enum_params(struct spa_clock *clock, uint32_t id, uint32_t *index,
+				  struct spa_pod **param,
+				  struct spa_pod_builder *builder)
+{
+	return -ENOTSUP;
+}
+
+static int impl_clock_set_param(struct spa_clock *clock,
+				uint32_t id, uint32_t flags,
+				const struct spa_pod *param)
+{
+	return -ENOTSUP;
+}
+
+static int impl_clock_get_time(struct spa_clock *clock,
+			       int32_t *rate,
+			       int64_t *ticks,
+			       int64_t *monotonic_time)
+{
+	struct state *this;
+
+	spa_return_val_if_fail(clock != NULL, -EINVAL);
+
+	this = SPA_CONTAINER_OF(clock, struct state, clock);
+
+	return spa_alsa_get_time(this, rate, ticks, monotonic_time);
+}
+
+static const struct spa_clock impl_clock = {
+	SPA_VERSION_CLOCK,
+	NULL,
+	SPA_CLOCK_STATE_STOPPED,
+	impl_clock_enum_params,
+	impl_clock_set_param,
+	impl_clock_get_time,
+};
+
 static int impl_get_interface(struct spa_handle *handle, uint32_t interface_id, void **interface)
 {
 	struct state *this;
@@ -649,6 +704,8 @@ static int impl_get_interface(struct spa_handle *handle, uint32_t interface_id,
 
 	if (interface_id == this->type.node)
 		*interface = &this->node;
+	else if (interface_id == this->type.clock)
+		*interface = &this->clock;
 	else
 		return -ENOENT;
 
@@ -700,6 +757,7 @@ impl_init(const struct spa_handle_factory *factory,
 	init_type(&this->type, this->map);
 
 	this->node = impl_node;
+	this->clock = impl_clock;
 	this->stream = SND_PCM_STREAM_PLAYBACK;
 	reset_props(&this->props);
 
@@ -714,13 +772,20 @@ impl_init(const struct spa_handle_factory *factory,
 		if (!strcmp(info->items[i].key, "alsa.card")) {
 			snprintf(this->props.device, 63, "%s", info->items[i].value);
 		}
+		else if (!strcmp(info->items[i].key, "alsa.mmap-buffers")) {
+			this->mmap_buffers = !strcmp(info->items[i].value, "true") ||
+					     atoi(info->items[i].value) == 1;
+		}
 	}
+	if (this->mmap_buffers)
+		this->info.flags |= SPA_PORT_INFO_FLAG_CAN_ALLOC_BUFFERS;
 
 	return 0;
 }
 
 static const struct spa_interface_info impl_interfaces[] = {
 	{SPA_TYPE__Node,},
+	{SPA_TYPE__Clock,},
 };
 
 static int
@@ -731,14 +796,11 @@ impl_enum_interface_info(const struct spa_handle_factory *factory,
 	spa_return_val_if_fail(info != NULL, -EINVAL);
 	spa_return_val_if_fail(index != NULL, -EINVAL);
 
-	switch (*index) {
-	case 0:
-		*info = &impl_interfaces[*index];
-		break;
-	default:
+	if (*index >= SPA_N_ELEMENTS(impl_interfaces))
 		return 0;
-	}
-	(*index)++;
+
+	*info = &impl_interfaces[(*index)++];
+
 	return 1;
 }
 
@@ -285,6 +285,9 @@ static void recycle_buffer(struct state *this, uint32_t buffer_id)
 
 	b->outstanding = false;
 	spa_list_append(&this->free, &b->link);
+
+	if (b == this->mmap_buffer)
+		spa_alsa_commit_mmap(this);
 }
 
 static int port_get_format(struct spa_node *node,
@@ -471,29 +474,20 @@ impl_node_port_set_param(struct spa_node *node,
 		return -ENOENT;
 }
 
-static int
-impl_node_port_use_buffers(struct spa_node *node,
-			   enum spa_direction direction,
-			   uint32_t port_id, struct spa_buffer **buffers, uint32_t n_buffers)
+/* with zero_copy, the data of the buffers is set when they are handed out */
+static int use_buffers(struct state *this, struct spa_buffer **buffers, uint32_t n_buffers,
+		       bool zero_copy)
 {
-	struct state *this;
 	int res;
 	int i;
 
-	spa_return_val_if_fail(node != NULL, -EINVAL);
-
-	this = SPA_CONTAINER_OF(node, struct state, node);
-
-	spa_return_val_if_fail(CHECK_PORT(this, direction, port_id), -EINVAL);
-
-	if (!this->have_format)
-		return -EIO;
-
 	if (this->n_buffers > 0) {
 		spa_alsa_pause(this, false);
 		if ((res = clear_buffers(this)) < 0)
 			return res;
 	}
+	this->zero_copy = zero_copy;
+
 	for (i = 0; i < n_buffers; i++) {
 		struct buffer *b = &this->buffers[i];
 		struct spa_data *d = buffers[i]->datas;
@@ -505,7 +499,7 @@ impl_node_port_use_buffers(struct spa_node *node,
 
 		if (!((d[0].type == this->type.data.MemFd ||
 		       d[0].type == this->type.data.DmaBuf ||
-		       d[0].type == this->type.data.MemPtr) && d[0].data != NULL)) {
+		       d[0].type == this->type.data.MemPtr) && (d[0].data != NULL || zero_copy))) {
 			spa_log_error(this->log, NAME " %p: need mapped memory", this);
 			return -EINVAL;
 		}
@@ -516,6 +510,25 @@ impl_node_port_use_buffers(struct spa_node *node,
 	return 0;
 }
 
+static int
+impl_node_port_use_buffers(struct spa_node *node,
+			   enum spa_direction direction,
+			   uint32_t port_id, struct spa_buffer **buffers, uint32_t n_buffers)
+{
+	struct state *this;
+
+	spa_return_val_if_fail(node != NULL, -EINVAL);
+
+	this = SPA_CONTAINER_OF(node, struct state, node);
+
+	spa_return_val_if_fail(CHECK_PORT(this, direction, port_id), -EINVAL);
+
+	if (!this->have_format)
+		return -EIO;
+
+	return use_buffers(this, buffers, n_buffers, false);
+}
+
 
 static int
 impl_node_port_alloc_buffers(struct spa_node *node,
@@ -527,6 +540,7 @@ impl_node_port_alloc_buffers(struct spa_node *node,
 			     uint32_t *n_buffers)
 {
 	struct state *this;
+	int res;
 
 	spa_return_val_if_fail(node != NULL, -EINVAL);
 	spa_return_val_if_fail(buffers != NULL, -EINVAL);
@@ -535,10 +549,16 @@ impl_node_port_alloc_buffers(struct spa_node *node,
 
 	spa_return_val_if_fail(CHECK_PORT(this, direction, port_id), -EINVAL);
 
-	if (this->n_buffers == 0)
+	if (!this->have_format)
 		return -EIO;
+	if (!this->mmap_buffers)
+		return -ENOTSUP;
 
-	return -ENOTSUP;
+	spa_alsa_pause(this, false);
+
+	if ((res = spa_alsa_alloc_buffers(this, buffers, *n_buffers)) < 0)
+		return res;
+	return use_buffers(this, buffers, *n_buffers, true);
 }
 
 static int
@@ -678,14 +698,7 @@ static int impl_clock_get_time(struct spa_clock *clock,
 
 	this = SPA_CONTAINER_OF(clock, struct state, clock);
 
-	if (rate)
-		*rate = SPA_USEC_PER_SEC;
-	if (ticks)
-		*ticks = this->last_ticks;
-	if (monotonic_time)
-		*monotonic_time = this->last_monotonic;
-
-	return 0;
+	return spa_alsa_get_time(this, rate, ticks, monotonic_time);
 }
 
 static const struct spa_clock impl_clock = {
@@ -780,7 +793,14 @@ impl_init(const struct spa_handle_factory *factory,
 		if (!strcmp(info->items[i].key, "alsa.card")) {
 			snprintf(this->props.device, 63, "%s", info->items[i].value);
 		}
+		else if (!strcmp(info->items[i].key, "alsa.mmap-buffers")) {
+			this->mmap_buffers = !strcmp(info->items[i].value, "true") ||
+					     atoi(info->items[i].value) == 1;
+		}
 	}
+	if (this->mmap_buffers)
+		this->info.flags |= SPA_PORT_INFO_FLAG_CAN_ALLOC_BUFFERS;
+
 	return 0;
 }
 
@@ -14,6 +14,10 @@
 
 #include "alsa-utils.h"
 
+#define DLL_BW_MAX	1.0	/* bandwidth in Hz when the loop starts */
+#define DLL_BW_MIN	0.05	/* bandwidth in Hz when the loop is locked */
+#define DLL_MAX_ERROR	(10 * SPA_NSEC_PER_MSEC)
+
 #define CHECK(s,msg) if ((err = (s)) < 0) { spa_log_error(state->log, msg ": %s", snd_strerror(err)); return err; }
 
 static int spa_alsa_open(struct state *state)
@@ -305,6 +309,13 @@ static int set_swparams(struct state *state)
 	CHECK(snd_pcm_sw_params_current(hndl, params), "sw_params_current");
 
 	CHECK(snd_pcm_sw_params_set_tstamp_mode(hndl, params, SND_PCM_TSTAMP_ENABLE), "sw_params_set_tstamp_mode");
+	/* our timer runs on the monotonic clock, without monotonic htstamps the
+	 * time of a status is read from the monotonic clock instead */
+	err = snd_pcm_sw_params_set_tstamp_type(hndl, params, SND_PCM_TSTAMP_TYPE_MONOTONIC);
+	state->monotonic_tstamp = err >= 0;
+	if (err < 0)
+		spa_log_warn(state->log, "sw_params_set_tstamp_type: %s, using the monotonic clock",
+			     snd_strerror(err));
 
 	/* start the transfer */
 	CHECK(snd_pcm_sw_params_set_start_threshold(hndl, params, LONG_MAX), "set_start_threshold");
@@ -320,18 +331,95 @@ static int set_swparams(struct state *state)
 	return 0;
 }
 
-static inline void calc_timeout(size_t target, size_t current,
-				size_t rate, snd_htimestamp_t *now,
-				struct timespec *ts)
+/* the monotonic time of a status */
+static void get_status_time(struct state *state, snd_pcm_status_t *status, snd_htimestamp_t *ts)
+{
+	if (state->monotonic_tstamp)
+		snd_pcm_status_get_htstamp(status, ts);
+	else
+		clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
+static void dll_reset(struct state *state, int64_t position, int64_t time)
+{
+	struct dll *dll = &state->dll;
+
+	dll->bw = DLL_BW_MAX;
+	dll->period = (double) SPA_NSEC_PER_SEC / state->rate;
+	dll->base = time;
+	dll->position = position;
+	state->clock_rate = state->rate;
+}
+
+/* Feed the hardware position of the device and the time it was measured to
+ * the loop. The loop filters the jitter of the timestamps and estimates the
+ * real rate of the device, the bandwidth is lowered while it locks. */
+static void dll_update(struct state *state, int64_t position, int64_t time)
 {
-	ts->tv_sec = now->tv_sec;
-	ts->tv_nsec = now->tv_nsec;
-	if (target > current)
-		ts->tv_nsec += ((target - current) * SPA_NSEC_PER_SEC) / rate;
-
-	while (ts->tv_nsec >= SPA_NSEC_PER_SEC) {
-		ts->tv_sec++;
-		ts->tv_nsec -= SPA_NSEC_PER_SEC;
+	struct dll *dll = &state->dll;
+	int64_t frames = position - dll->position;
+	double predicted, err, w;
+
+	if (dll->bw == 0.0 || frames < 0)
+		goto reset;
+	/* the device did not move, the last estimate is still valid */
+	if (frames == 0)
+		return;
+
+	predicted = dll->base + frames * dll->period;
+	err = time - predicted;
+	if (fabs(err) > DLL_MAX_ERROR) {
+		spa_log_debug(state->log, "alsa %p: dll error %f, reset", state, err);
+		goto reset;
+	}
+
+	w = 2.0 * M_PI * dll->bw * frames * dll->period / SPA_NSEC_PER_SEC;
+	w = SPA_MIN(w, 0.5);
+
+	dll->base = predicted + M_SQRT2 * w * err;
+	dll->period += w * w * err / frames;
+	dll->position = position;
+	dll->bw = SPA_MAX(dll->bw * 0.95, DLL_BW_MIN);
+
+	state->clock_rate = lround(SPA_NSEC_PER_SEC / dll->period);
+
+	spa_log_trace(state->log, "alsa %p: dll err %f rate %f", state, err,
+		      SPA_NSEC_PER_SEC / dll->period);
+	return;
+
+      reset:
+	dll_reset(state, position, time);
+}
+
+/* wake up when the device reaches position, as predicted by the loop */
+static void set_timeout(struct state *state, int64_t position)
+{
+	struct dll *dll = &state->dll;
+	struct itimerspec ts;
+	int64_t time;
+
+	time = dll->base + (position - dll->position) * dll->period;
+
+	ts.it_value.tv_sec = time / SPA_NSEC_PER_SEC;
+	ts.it_value.tv_nsec = time % SPA_NSEC_PER_SEC;
+	ts.it_interval.tv_sec = 0;
+	ts.it_interval.tv_nsec = 0;
+	timerfd_settime(state->timerfd, TFD_TIMER_ABSTIME, &ts, NULL);
+}
+
+/* let the buffers point to the part of the ring that is written next */
+static void set_mmap_buffers(struct state *state,
+			     const snd_pcm_channel_area_t *my_areas,
+			     snd_pcm_uframes_t offset,
+			     snd_pcm_uframes_t frames)
+{
+	uint32_t i;
+
+	for (i = 0; i < state->n_buffers; i++) {
+		struct spa_data *d = state->buffers[i].outbuf->datas;
+
+		d[0].data = SPA_MEMBER(my_areas[0].addr, offset * state->frame_size, void);
+		d[0].maxsize = frames * state->frame_size;
 	}
 }
 
@@ -363,6 +451,9 @@ pull_frames(struct state *state,
 	snd_pcm_uframes_t total_frames = 0, to_write = SPA_MIN(frames, state->props.max_latency);
 	bool underrun = false;
 
+	if (state->zero_copy && spa_list_is_empty(&state->ready))
+		set_mmap_buffers(state, my_areas, offset, to_write);
+
 	try_pull(state, frames, 0, do_pull);
 
 	while (!spa_list_is_empty(&state->ready) && to_write > 0) {
@@ -389,9 +480,12 @@ pull_frames(struct state *state,
 		l0 = SPA_MIN(n_bytes, d[0].maxsize - offs);
 		l1 = n_bytes - l0;
 
-		memcpy(dst, src + offs, l0);
-		if (l1 > 0)
-			memcpy(dst + l0, src, l1);
+		/* nothing to copy when the peer rendered into the ring */
+		if (src + offs != dst) {
+			memcpy(dst, src + offs, l0);
+			if (l1 > 0)
+				memcpy(dst + l0, src, l1);
+		}
 
 		state->ready_offset += n_bytes;
 
@@ -402,7 +496,9 @@ pull_frames(struct state *state,
 			state->callbacks->reuse_buffer(state->callbacks_data, 0, b->outbuf->id);
 			state->ready_offset = 0;
 
-			try_pull(state, frames, total_frames, do_pull);
+			/* the buffers point to the start of the ring area */
+			if (!state->zero_copy)
+				try_pull(state, frames, total_frames, do_pull);
 		}
 		total_frames += n_frames;
 		to_write -= n_frames;
@@ -460,18 +556,32 @@ push_frames(struct state *state,
 
 		src = SPA_MEMBER(my_areas[0].addr, offset * state->frame_size, uint8_t);
 
-		avail = d[0].maxsize / state->frame_size;
-		index = 0;
-		total_frames = SPA_MIN(avail, frames);
-		n_bytes = total_frames * state->frame_size;
-
-		offs = index % d[0].maxsize;
-		l0 = SPA_MIN(n_bytes, d[0].maxsize - offs);
-		l1 = n_bytes - l0;
-
-		memcpy(src, d[0].data + offs, l0);
-		if (l1 > 0)
-			memcpy(src + l0, d[0].data, l1);
+		if (state->zero_copy) {
+			/* hand out the ring, it is committed when the buffer is recycled */
+			index = 0;
+			total_frames = frames;
+			n_bytes = total_frames * state->frame_size;
+
+			d[0].data = src;
+			d[0].maxsize = n_bytes;
+
+			state->mmap_buffer = b;
+			state->mmap_offset = offset;
+			state->mmap_frames = total_frames;
+		} else {
+			avail = d[0].maxsize / state->frame_size;
+			index = 0;
+			total_frames = SPA_MIN(avail, frames);
+			n_bytes = total_frames * state->frame_size;
+
+			offs = index % d[0].maxsize;
+			l0 = SPA_MIN(n_bytes, d[0].maxsize - offs);
+			l1 = n_bytes - l0;
+
+			memcpy(src, d[0].data + offs, l0);
+			if (l1 > 0)
+				memcpy(src + l0, d[0].data, l1);
+		}
 
 		d[0].chunk->offset = index;
 		d[0].chunk->size = n_bytes;
@@ -507,7 +617,6 @@ static void alsa_on_playback_timeout_event(struct spa_source *source)
 	struct state *state = source->data;
 	snd_pcm_t *hndl = state->hndl;
 	snd_pcm_sframes_t avail;
-	struct itimerspec ts;
 	snd_pcm_uframes_t total_written = 0;
 	const snd_pcm_channel_area_t *my_areas;
 	snd_pcm_status_t *status;
@@ -523,7 +632,7 @@ static void alsa_on_playback_timeout_event(struct spa_source *source)
 	}
 
 	avail = snd_pcm_status_get_avail(status);
-	snd_pcm_status_get_htstamp(status, &state->now);
+	get_status_time(state, status, &state->now);
 
 	if (avail > state->buffer_frames)
 		avail = state->buffer_frames;
@@ -531,7 +640,8 @@ static void alsa_on_playback_timeout_event(struct spa_source *source)
 	state->filled = state->buffer_frames - avail;
 
 	state->last_ticks = state->sample_count - state->filled;
-	state->last_monotonic = (int64_t) state->now.tv_sec * SPA_NSEC_PER_SEC + (int64_t) state->now.tv_nsec;
+	dll_update(state, state->last_ticks, SPA_TIMESPEC_TO_TIME(&state->now));
+	state->last_monotonic = state->dll.base;
 
 	spa_log_trace(state->log, "timeout %ld %d %ld %ld %ld", state->filled, state->threshold,
 		      state->sample_count, state->now.tv_sec, state->now.tv_nsec);
@@ -581,11 +691,8 @@ static void alsa_on_playback_timeout_event(struct spa_source *source)
 		state->alsa_started = true;
 	}
 
-	calc_timeout(state->filled, state->threshold, state->rate, &state->now, &ts.it_value);
-
-	ts.it_interval.tv_sec = 0;
-	ts.it_interval.tv_nsec = 0;
-	timerfd_settime(state->timerfd, TFD_TIMER_ABSTIME, &ts, NULL);
+	/* wake up when the device consumed all but threshold frames */
+	set_timeout(state, state->sample_count - state->threshold);
 }
 
 
@@ -597,7 +704,6 @@ static void alsa_on_capture_timeout_event(struct spa_source *source)
 	snd_pcm_t *hndl = state->hndl;
 	snd_pcm_sframes_t avail;
 	snd_pcm_uframes_t total_read = 0;
-	struct itimerspec ts;
 	const snd_pcm_channel_area_t *my_areas;
 	snd_pcm_status_t *status;
 	snd_htimestamp_t htstamp;
@@ -613,15 +719,20 @@ static void alsa_on_capture_timeout_event(struct spa_source *source)
 	}
 
 	avail = snd_pcm_status_get_avail(status);
-	snd_pcm_status_get_htstamp(status, &htstamp);
+	get_status_time(state, status, &htstamp);
+
+	/* the frames of a buffer that is not recycled yet are not committed */
+	if (state->mmap_buffer)
+		avail -= state->mmap_frames;
 
 	state->last_ticks = state->sample_count + avail;
-	state->last_monotonic = (int64_t) htstamp.tv_sec * SPA_NSEC_PER_SEC + (int64_t) htstamp.tv_nsec;
+	dll_update(state, state->last_ticks, SPA_TIMESPEC_TO_TIME(&htstamp));
+	state->last_monotonic = state->dll.base;
 
 	spa_log_trace(state->log, "timeout %ld %d %ld %ld %ld", avail, state->threshold,
 		      state->sample_count, htstamp.tv_sec, htstamp.tv_nsec);
 
-	if (avail < state->threshold) {
+	if (avail < state->threshold || state->mmap_buffer) {
 		if (snd_pcm_state(hndl) == SND_PCM_STATE_SUSPENDED) {
 			spa_log_error(state->log, "suspended: try resume");
 			if ((res = alsa_try_resume(state)) < 0)
@@ -643,20 +754,25 @@ static void alsa_on_capture_timeout_event(struct spa_source *source)
 			if (read < frames)
 				to_read = 0;
 
+			total_read += read;
+			if (state->mmap_buffer)
+				break;
+
 			if ((res = snd_pcm_mmap_commit(hndl, offset, read)) < 0) {
 				spa_log_error(state->log, "snd_pcm_mmap_commit error: %s", snd_strerror(res));
 				if (res != -EPIPE && res != -ESTRPIPE)
 					return;
 			}
-			total_read += read;
 		}
 		state->sample_count += total_read;
 	}
-	calc_timeout(state->threshold, avail - total_read, state->rate, &htstamp, &ts.it_value);
+	/* no frames are read while a buffer is in the ring, the timeout is set
+	 * again when the buffer is recycled */
+	if (state->mmap_buffer)
+		return;
 
-	ts.it_interval.tv_sec = 0;
-	ts.it_interval.tv_nsec = 0;
-	timerfd_settime(state->timerfd, TFD_TIMER_ABSTIME, &ts, NULL);
+	/* wake up when the device captured threshold frames */
+	set_timeout(state, state->sample_count + state->threshold);
 }
 
 int spa_alsa_start(struct state *state, bool xrun_recover)
@@ -690,6 +806,9 @@ int spa_alsa_start(struct state *state, bool xrun_recover)
 	spa_loop_add_source(state->data_loop, &state->source);
 
 	state->threshold = state->props.min_latency;
+	state->mmap_buffer = NULL;
+	state->dll.bw = 0.0;
+	state->clock_rate = state->rate;
 
 	if (state->stream == SND_PCM_STREAM_PLAYBACK) {
 		state->alsa_started = false;
@@ -732,6 +851,64 @@ static int do_remove_source(struct spa_loop *loop,
 	return 0;
 }
 
+/* Make MemPtr buffers for the mmap ring of the device. They don't point
+ * anywhere yet. In each cycle, the data and maxsize of the buffers are set to
+ * the part of the ring that is processed, between snd_pcm_mmap_begin() and
+ * snd_pcm_mmap_commit(): before need_input for playback and when the buffer
+ * is handed out for capture. The peer must read data and maxsize again in
+ * every cycle and must not keep the pointer. Only peers in the same process
+ * can use the buffers, the ring can't be shared. */
+int spa_alsa_alloc_buffers(struct state *state, struct spa_buffer **buffers, uint32_t n_buffers)
+{
+	uint32_t i;
+
+	for (i = 0; i < n_buffers; i++) {
+		struct spa_data *d = buffers[i]->datas;
+
+		if (buffers[i]->n_datas < 1) {
+			spa_log_error(state->log, "alsa %p: buffer %u has no data", state, i);
+			return -EINVAL;
+		}
+		d[0].type = state->type.data.MemPtr;
+		d[0].flags = 0;
+		d[0].fd = -1;
+		d[0].mapoffset = 0;
+		d[0].maxsize = 0;
+		d[0].data = NULL;
+	}
+	return 0;
+}
+
+/* release the frames of the recycled capture buffer to the device and wait
+ * for the next frames again */
+int spa_alsa_commit_mmap(struct state *state)
+{
+	int err;
+
+	if (state->mmap_buffer == NULL)
+		return 0;
+
+	state->mmap_buffer = NULL;
+	CHECK(snd_pcm_mmap_commit(state->hndl, state->mmap_offset, state->mmap_frames), "mmap_commit");
+
+	if (state->started)
+		set_timeout(state, state->sample_count + state->threshold);
+
+	return 0;
+}
+
+int spa_alsa_get_time(struct state *state, int32_t *rate, int64_t *ticks, int64_t *monotonic_time)
+{
+	if (rate)
+		*rate = state->clock_rate;
+	if (ticks)
+		*ticks = state->last_ticks;
+	if (monotonic_time)
+		*monotonic_time = state->last_monotonic;
+
+	return 0;
+}
+
 int spa_alsa_pause(struct state *state, bool xrun_recover)
 {
 	int err;
@@ -746,6 +923,7 @@ int spa_alsa_pause(struct state *state, bool xrun_recover)
 	if ((err = snd_pcm_drop(state->hndl)) < 0)
 		spa_log_error(state->log, "snd_pcm_drop %s", snd_strerror(err));
 
+	state->mmap_buffer = NULL;
 	state->started = false;
 
 	return 0;
@@ -57,6 +57,14 @@ struct buffer {
 	struct spa_list link;
 };
 
+/* delay-locked loop that follows the hardware pointer of the device */
+struct dll {
+	double bw;		/**< bandwidth in Hz, 0.0 when not running */
+	double period;		/**< filtered duration of one frame in nsec */
+	double base;		/**< filtered time of position in nsec */
+	int64_t position;	/**< hardware position in frames */
+};
+
 struct type {
 	uint32_t node;
 	uint32_t clock;
@@ -155,6 +163,12 @@ struct state {
 
 	size_t ready_offset;
 
+	bool mmap_buffers;		/**< offer the mmap ring as buffer memory */
+	bool zero_copy;			/**< the buffers point into the mmap ring */
+	struct buffer *mmap_buffer;	/**< capture buffer with uncommitted frames */
+	snd_pcm_uframes_t mmap_offset;
+	snd_pcm_uframes_t mmap_frames;
+
 	bool started;
 	struct spa_source source;
 	int timerfd;
@@ -162,10 +176,13 @@ struct state {
 	int threshold;
 
 	snd_htimestamp_t now;
+	bool monotonic_tstamp;		/**< the htstamps are on the monotonic clock */
 	int64_t sample_count;
 	int64_t filled;
 	int64_t last_ticks;
 	int64_t last_monotonic;
+	int32_t clock_rate;
+	struct dll dll;
 
 	uint64_t underrun;
 };
@@ -183,6 +200,11 @@ int spa_alsa_start(struct state *state, bool xrun_recover);
 int spa_alsa_pause(struct state *state, bool xrun_recover);
 int spa_alsa_close(struct state *state);
 
+int spa_alsa_alloc_buffers(struct state *state, struct spa_buffer **buffers, uint32_t n_buffers);
+int spa_alsa_commit_mmap(struct state *state);
+
+int spa_alsa_get_time(struct state *state, int32_t *rate, int64_t *ticks, int64_t *monotonic_time);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -20,6 +20,7 @@
 #include <errno.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include <spa/support/log.h>
 #include <spa/support/type-map.h>
@@ -39,6 +40,16 @@
 
 #define MAX_BUFFERS     64
 #define MAX_PORTS       128
+/* ports with more channels can not be remixed */
+#define MAX_CHANNELS	8
+
+#define MIX_BLOCK_SIZE	4096
+
+#define DEFAULT_RAMP_FRAMES	256
+#define MAX_RAMP_FRAMES		65536
+
+#define MAX_BOUNCE_PLANES	64
+#define MAX_BOUNCE_SIZE		1024
 
 #define PORT_DEFAULT_VOLUME	1.0
 #define PORT_DEFAULT_MUTE	false
@@ -65,6 +76,8 @@ struct buffer {
 
 struct port {
 	bool valid;
+	bool active;
+	uint32_t id;
 
 	struct port_props props;
 
@@ -72,10 +85,27 @@ struct port {
 	struct spa_io_control_range *io_range;
 	double *io_volume;
 	int32_t *io_mute;
+	struct spa_pod_array *io_matrix;
+	size_t io_matrix_size;
 
 	struct spa_port_info info;
 
+	bool have_volume;
+	double volume;
+	double ramp_target;
+	double ramp_step;
+	uint32_t ramp_left;
+
+	bool remix;
+	float matrix[MAX_CHANNELS * MAX_CHANNELS];	/* gain of each input channel
+							 * in each output channel */
+	float mix_matrix[MAX_CHANNELS * MAX_CHANNELS];	/* matrix with the volume */
+
 	bool have_format;
+	bool planar;
+	uint32_t channels;
+	uint32_t n_planes;
+	uint32_t frame_size;
 
 	struct buffer buffers[MAX_BUFFERS];
 	uint32_t n_buffers;
@@ -84,6 +114,24 @@ struct port {
 	size_t queued_bytes;
 };
 
+struct mix_source {
+	struct spa_data *datas;
+	uint32_t plane;		/* first data plane to mix */
+	uint32_t n_planes;	/* number of planes to interleave */
+	uint32_t maxsize;
+	uint32_t offset;	/* byte offset of the next frame */
+	uint32_t frame_size;	/* bytes per frame in a plane */
+	uint32_t src_offset;	/* byte offset of the channel in the frame */
+	int src_stride;		/* sample strides, 0 when contiguous */
+	int dst_stride;
+	double volume;		/* gain of the next frame */
+	double step;		/* gain change per frame while ramping */
+	double target;
+	uint32_t ramp_left;	/* frames until the target is reached */
+	struct port *remix;	/* port with the gain matrix to apply */
+	int channel;		/* output channel of the plane or -1 for all */
+};
+
 struct type {
 	uint32_t node;
 	uint32_t format;
@@ -91,6 +139,8 @@ struct type {
 	uint32_t prop_mute;
 	uint32_t io_prop_volume;
 	uint32_t io_prop_mute;
+	uint32_t prop_channel_matrix;
+	uint32_t io_prop_channel_matrix;
 	struct spa_type_io io;
 	struct spa_type_param param;
 	struct spa_type_media_type media_type;
@@ -113,6 +163,8 @@ static inline void init_type(struct type *type, struct spa_type_map *map)
 	type->prop_mute = spa_type_map_get_id(map, SPA_TYPE_PROPS__mute);
 	type->io_prop_volume = spa_type_map_get_id(map, SPA_TYPE_IO_PROP_BASE "volume");
 	type->io_prop_mute = spa_type_map_get_id(map, SPA_TYPE_IO_PROP_BASE "mute");
+	type->prop_channel_matrix = spa_type_map_get_id(map, SPA_TYPE_PROPS__channelMatrix);
+	type->io_prop_channel_matrix = spa_type_map_get_id(map, SPA_TYPE_IO_PROP_BASE "channelMatrix");
 	spa_type_io_map(map, &type->io);
 	spa_type_param_map(map, &type->param);
 	spa_type_media_type_map(map, &type->media_type);
@@ -145,16 +197,39 @@ struct impl {
 	struct port in_ports[MAX_PORTS];
 	struct port out_ports[1];
 
+	/* input ports with io, the only ones the processing looks at */
+	struct port *active[MAX_PORTS];
+	uint32_t n_active;
+
 	bool have_format;
 	int n_formats;
 	struct spa_audio_info format;
-	uint32_t bpf;
+	uint32_t sample_size;
+	uint32_t block_frames;
+	uint32_t out_frame_size;
+	uint32_t out_channels;
 
 	mix_clear_func_t clear;
 	mix_func_t copy;
 	mix_func_t add;
 	mix_scale_func_t copy_scale;
 	mix_scale_func_t add_scale;
+	mix_i_func_t copy_i;
+	mix_i_func_t add_i;
+	mix_scale_i_func_t copy_scale_i;
+	mix_scale_i_func_t add_scale_i;
+	mix_ramp_func_t copy_ramp;
+	mix_ramp_func_t add_ramp;
+	mix_matrix_func_t *copy_matrix;
+	mix_matrix_func_t *add_matrix;
+	uint32_t ramp_frames;
+
+	struct mix_source sources[MAX_PORTS];
+	uint32_t n_sources;
+
+	/* a frame that straddles the end of a ringbuffer, see mix_wrapped_frame() */
+	struct spa_data bounce_datas[MAX_BOUNCE_PLANES];
+	uint8_t bounce[MAX_BOUNCE_SIZE];
 
 	bool started;
 };
@@ -269,6 +344,28 @@ impl_node_get_port_ids(struct spa_node *node,
 	return 0;
 }
 
+/* keep the input ports with io in the active list */
+static void update_active(struct impl *this, struct port *port)
+{
+	bool active = port->valid && port->io != NULL;
+	uint32_t i;
+
+	if (active == port->active)
+		return;
+
+	if (active) {
+		this->active[this->n_active++] = port;
+	} else {
+		for (i = 0; i < this->n_active; i++) {
+			if (this->active[i] == port) {
+				this->active[i] = this->active[--this->n_active];
+				break;
+			}
+		}
+	}
+	port->active = active;
+}
+
 static int impl_node_add_port(struct spa_node *node, enum spa_direction direction, uint32_t port_id)
 {
 	struct impl *this;
@@ -282,10 +379,12 @@ static int impl_node_add_port(struct spa_node *node, enum spa_direction directio
 
 	port = GET_IN_PORT (this, port_id);
 	port->valid = true;
+	port->id = port_id;
 
 	port_props_reset(&port->props);
 	port->io_volume = &port->props.volume;
 	port->io_mute = &port->props.mute;
+	port->io_matrix = NULL;
 
 	spa_list_init(&port->queue);
 	port->info.flags = SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS |
@@ -316,6 +415,9 @@ impl_node_remove_port(struct spa_node *node, enum spa_direction direction, uint3
 
 	port = GET_IN_PORT (this, port_id);
 
+	port->valid = false;
+	update_active(this, port);
+
 	this->port_count--;
 	if (port->have_format && this->have_format) {
 		if (--this->n_formats == 0)
@@ -323,10 +425,10 @@ impl_node_remove_port(struct spa_node *node, enum spa_direction direction, uint3
 	}
 	spa_memzero(port, sizeof(struct port));
 
-	if (port_id == this->last_port + 1) {
+	if ((int) port_id + 1 == this->last_port) {
 		int i;
 
-		for (i = this->last_port; i >= 0; i--)
+		for (i = port_id - 1; i >= 0; i--)
 			if (GET_IN_PORT (this, i)->valid)
 				break;
 
@@ -371,21 +473,40 @@ static int port_enum_formats(struct spa_node *node,
 	switch (*index) {
 	case 0:
 		if (this->have_format) {
+			uint32_t channels = this->format.info.raw.channels;
+			uint32_t min = channels, max = channels;
+
+			/* other channel counts can be remixed */
+			if (channels <= MAX_CHANNELS) {
+				min = 1;
+				max = MAX_CHANNELS;
+			}
 			*param = spa_pod_builder_object(builder,
 				t->param.idEnumFormat, t->format,
 				"I", t->media_type.audio,
 				"I", t->media_subtype.raw,
 				":", t->format_audio.format,   "I", this->format.info.raw.format,
+				":", t->format_audio.layout,   "ieu", this->format.info.raw.layout,
+					SPA_POD_PROP_ENUM(2, SPA_AUDIO_LAYOUT_INTERLEAVED,
+							     SPA_AUDIO_LAYOUT_NON_INTERLEAVED),
 				":", t->format_audio.rate,     "i", this->format.info.raw.rate,
-				":", t->format_audio.channels, "i", this->format.info.raw.channels);
+				":", t->format_audio.channels, "iru", channels,
+					SPA_POD_PROP_MIN_MAX(min, max));
 		} else {
 			*param = spa_pod_builder_object(builder,
 				t->param.idEnumFormat, t->format,
 				"I", t->media_type.audio,
 				"I", t->media_subtype.raw,
 				":", t->format_audio.format,   "Ieu", t->audio_format.S16,
-					SPA_POD_PROP_ENUM(2, t->audio_format.S16,
-							     t->audio_format.F32),
+					SPA_POD_PROP_ENUM(6, t->audio_format.S16,
+							     t->audio_format.S24,
+							     t->audio_format.S24_32,
+							     t->audio_format.S32,
+							     t->audio_format.F32,
+							     t->audio_format.F64),
+				":", t->format_audio.layout,   "ieu", SPA_AUDIO_LAYOUT_INTERLEAVED,
+					SPA_POD_PROP_ENUM(2, SPA_AUDIO_LAYOUT_INTERLEAVED,
+							     SPA_AUDIO_LAYOUT_NON_INTERLEAVED),
 				":", t->format_audio.rate,     "iru", 44100,
 					SPA_POD_PROP_MIN_MAX(1, INT32_MAX),
 				":", t->format_audio.channels, "iru", 2,
@@ -418,8 +539,11 @@ static int port_get_format(struct spa_node *node,
 		"I", t->media_type.audio,
 		"I", t->media_subtype.raw,
 		":", t->format_audio.format,   "I", this->format.info.raw.format,
+		":", t->format_audio.layout,   "i", port->planar ?
+						SPA_AUDIO_LAYOUT_NON_INTERLEAVED :
+						SPA_AUDIO_LAYOUT_INTERLEAVED,
 		":", t->format_audio.rate,     "i", this->format.info.raw.rate,
-		":", t->format_audio.channels, "i", this->format.info.raw.channels);
+		":", t->format_audio.channels, "i", port->channels);
 
 	return 1;
 }
@@ -485,8 +609,9 @@ impl_node_port_enum_params(struct spa_node *node,
 
 		param = spa_pod_builder_object(&b,
 			id, t->param_buffers.Buffers,
-			":", t->param_buffers.size,    "iru", 1024 * this->bpf,
-				SPA_POD_PROP_MIN_MAX(16 * this->bpf, INT32_MAX / this->bpf),
+			":", t->param_buffers.size,    "iru", 1024 * port->frame_size,
+				SPA_POD_PROP_MIN_MAX(16 * port->frame_size,
+						     INT32_MAX / port->frame_size),
 			":", t->param_buffers.stride,  "i", 0,
 			":", t->param_buffers.buffers, "iru", 1,
 				SPA_POD_PROP_MIN_MAX(1, MAX_BUFFERS),
@@ -555,6 +680,24 @@ impl_node_port_enum_params(struct spa_node *node,
 				":", t->param.propId,   "I", t->prop_mute,
 				":", t->param.propType, "b", p->mute);
 			break;
+		case 2:
+		{
+			struct port *outport = GET_OUT_PORT(this, 0);
+			uint32_t n_elems = 0;
+
+			if (port->remix)
+				n_elems = port->channels * outport->channels;
+
+			param = spa_pod_builder_object(&b,
+				id, t->param_io.Prop,
+				":", t->param_io.id,    "I", t->io_prop_channel_matrix,
+				":", t->param_io.size,  "i", sizeof(struct spa_pod_array) +
+						MAX_CHANNELS * MAX_CHANNELS * sizeof(float),
+				":", t->param.propId,   "I", t->prop_channel_matrix,
+				":", t->param.propType, "a", sizeof(float), SPA_POD_TYPE_FLOAT,
+						n_elems, port->matrix);
+			break;
+		}
 		default:
 			return 0;
 		}
@@ -601,6 +744,7 @@ static int port_set_format(struct spa_node *node,
 		}
 	} else {
 		struct spa_audio_info info = { 0 };
+		uint32_t layout, channels;
 
 		spa_pod_object_parse(format,
 			"I", &info.media_type,
@@ -613,32 +757,83 @@ static int port_set_format(struct spa_node *node,
 		if (spa_format_audio_raw_parse(format, &info.info.raw, &t->format_audio) < 0)
 			return -EINVAL;
 
+		if (info.info.raw.layout != SPA_AUDIO_LAYOUT_INTERLEAVED &&
+		    info.info.raw.layout != SPA_AUDIO_LAYOUT_NON_INTERLEAVED)
+			return -EINVAL;
+
+		layout = info.info.raw.layout;
+		channels = info.info.raw.channels;
+
 		if (this->have_format) {
+			/* ports can only differ in the layout and in the number
+			 * of channels when they can be remixed */
+			info.info.raw.layout = this->format.info.raw.layout;
+			if (channels <= MAX_CHANNELS &&
+			    this->format.info.raw.channels <= MAX_CHANNELS) {
+				info.info.raw.channels = this->format.info.raw.channels;
+				info.info.raw.channel_mask = this->format.info.raw.channel_mask;
+			}
 			if (memcmp(&info, &this->format, sizeof(struct spa_audio_info)))
 				return -EINVAL;
 		} else {
+			int fmt;
+			uint32_t size;
+
 			if (info.info.raw.format == t->audio_format.S16) {
-				this->clear = this->ops.clear[FMT_S16];
-				this->copy = this->ops.copy[FMT_S16];
-				this->add = this->ops.add[FMT_S16];
-				this->copy_scale = this->ops.copy_scale[FMT_S16];
-				this->add_scale = this->ops.add_scale[FMT_S16];
-				this->bpf = sizeof(int16_t) * info.info.raw.channels;
+				fmt = FMT_S16;
+				size = sizeof(int16_t);
+			}
+			else if (info.info.raw.format == t->audio_format.S24) {
+				fmt = FMT_S24;
+				size = 3;
+			}
+			else if (info.info.raw.format == t->audio_format.S24_32) {
+				fmt = FMT_S24_32;
+				size = sizeof(int32_t);
+			}
+			else if (info.info.raw.format == t->audio_format.S32) {
+				fmt = FMT_S32;
+				size = sizeof(int32_t);
 			}
 			else if (info.info.raw.format == t->audio_format.F32) {
-				this->clear = this->ops.clear[FMT_F32];
-				this->copy = this->ops.copy[FMT_F32];
-				this->add = this->ops.add[FMT_F32];
-				this->copy_scale = this->ops.copy_scale[FMT_F32];
-				this->add_scale = this->ops.add_scale[FMT_F32];
-				this->bpf = sizeof(float) * info.info.raw.channels;
+				fmt = FMT_F32;
+				size = sizeof(float);
+			}
+			else if (info.info.raw.format == t->audio_format.F64) {
+				fmt = FMT_F64;
+				size = sizeof(double);
 			}
 			else
 				return -EINVAL;
 
+			this->clear = this->ops.clear[fmt];
+			this->copy = this->ops.copy[fmt];
+			this->add = this->ops.add[fmt];
+			this->copy_scale = this->ops.copy_scale[fmt];
+			this->add_scale = this->ops.add_scale[fmt];
+			this->copy_i = this->ops.copy_i[fmt];
+			this->add_i = this->ops.add_i[fmt];
+			this->copy_scale_i = this->ops.copy_scale_i[fmt];
+			this->add_scale_i = this->ops.add_scale_i[fmt];
+			this->copy_ramp = this->ops.copy_ramp[fmt];
+			this->add_ramp = this->ops.add_ramp[fmt];
+			this->copy_matrix = this->ops.copy_matrix[fmt];
+			this->add_matrix = this->ops.add_matrix[fmt];
+			this->sample_size = size;
+
 			this->have_format = true;
 			this->format = info;
 		}
+		port->planar = layout == SPA_AUDIO_LAYOUT_NON_INTERLEAVED;
+		port->channels = channels;
+		if (port->planar) {
+			port->n_planes = channels;
+			port->frame_size = this->sample_size;
+		} else {
+			port->n_planes = 1;
+			port->frame_size = this->sample_size * channels;
+		}
+
 		if (!port->have_format) {
 			this->n_formats++;
 			port->have_format = true;
@@ -699,23 +894,32 @@ impl_node_port_use_buffers(struct spa_node *node,
 	spa_log_info(this->log, NAME " %p: use buffers %d on port %d", this, n_buffers, port_id);
 
 	clear_buffers(this, port);
+	port->have_volume = false;
 
 	for (i = 0; i < n_buffers; i++) {
 		struct buffer *b;
 		struct spa_data *d = buffers[i]->datas;
+		uint32_t j;
 
 		b = &port->buffers[i];
 		b->outbuf = buffers[i];
 		b->outstanding = (direction == SPA_DIRECTION_INPUT);
 		b->h = spa_buffer_find_meta(buffers[i], t->meta.Header);
 
-		if (!((d[0].type == t->data.MemPtr ||
-		       d[0].type == t->data.MemFd ||
-		       d[0].type == t->data.DmaBuf) && d[0].data != NULL)) {
-			spa_log_error(this->log, NAME " %p: invalid memory on buffer %p", this,
-				      buffers[i]);
+		if (buffers[i]->n_datas < port->n_planes) {
+			spa_log_error(this->log, NAME " %p: need %d planes on buffer %p", this,
+				      port->n_planes, buffers[i]);
 			return -EINVAL;
 		}
+		for (j = 0; j < port->n_planes; j++) {
+			if (!((d[j].type == t->data.MemPtr ||
+			       d[j].type == t->data.MemFd ||
+			       d[j].type == t->data.DmaBuf) && d[j].data != NULL)) {
+				spa_log_error(this->log, NAME " %p: invalid memory on buffer %p", this,
+					      buffers[i]);
+				return -EINVAL;
+			}
+		}
 		if (!b->outstanding)
 			spa_list_append(&port->queue, &b->link);
 
@@ -758,8 +962,11 @@ impl_node_port_set_io(struct spa_node *node,
 
 	port = GET_PORT(this, direction, port_id);
 
-	if (id == t->io.Buffers)
+	if (id == t->io.Buffers) {
 		port->io = data;
+		if (direction == SPA_DIRECTION_INPUT)
+			update_active(this, port);
+	}
 	else if (id == t->io.ControlRange)
 		port->io_range = data;
 	else if (id == t->io_prop_volume && direction == SPA_DIRECTION_INPUT)
@@ -772,6 +979,13 @@ impl_node_port_set_io(struct spa_node *node,
 			port->io_mute = &SPA_POD_VALUE(struct spa_pod_bool, data);
 		else
 			port->io_mute = &port->props.mute;
+	else if (id == t->io_prop_channel_matrix && direction == SPA_DIRECTION_INPUT) {
+		if (data && size >= sizeof(struct spa_pod_array)) {
+			port->io_matrix = data;
+			port->io_matrix_size = size;
+		} else
+			port->io_matrix = NULL;
+	}
 	else
 		return -ENOENT;
 
@@ -818,77 +1032,384 @@ impl_node_port_send_command(struct spa_node *node,
 }
 
 static inline void
-add_port_data(struct impl *this, void *out, size_t outsize, struct port *port, int layer)
+mix_plane(struct impl *this, void *out, void *data, struct mix_source *src,
+	  uint32_t n_frames, int layer)
 {
-	size_t insize;
-	struct buffer *b;
-	uint32_t index, offset, len1, len2, maxsize;
-	struct spa_data *d;
-	void *data;
-	double volume = *port->io_volume;
-	bool mute = *port->io_mute;
+	uint32_t n_bytes;
+	double volume = src->volume;
+
+	if (src->src_stride == 0 && src->dst_stride == 0) {
+		/* same layout, mix the contiguous samples */
+		n_bytes = n_frames * src->frame_size;
+
+		if (src->ramp_left > 0) {
+			mix_ramp_func_t mix = layer == 0 ? this->copy_ramp : this->add_ramp;
+			mix(out, data, src->frame_size / this->sample_size,
+			    volume, src->step, n_bytes);
+		} else if (volume < 0.999 || volume > 1.001) {
+			mix_scale_func_t mix = layer == 0 ? this->copy_scale : this->add_scale;
+			mix(out, data, volume, n_bytes);
+		} else {
+			mix_func_t mix = layer == 0 ? this->copy : this->add;
+			mix(out, data, n_bytes);
+		}
+	}
+	else {
+		/* layout conversion, mix with strides */
+		int dst_stride = SPA_MAX(src->dst_stride, 1);
+		int src_stride = SPA_MAX(src->src_stride, 1);
+
+		n_bytes = n_frames * this->sample_size;
+
+		if (src->ramp_left > 0) {
+			/* the strided kernels have no ramp, scale frame by frame.
+			 * Layout conversion during a ramp is rare and short. */
+			mix_scale_i_func_t mix = layer == 0 ? this->copy_scale_i : this->add_scale_i;
+			uint32_t i;
+
+			for (i = 0; i < n_frames; i++) {
+				mix(SPA_MEMBER(out, i * dst_stride * this->sample_size, void), dst_stride,
+				    SPA_MEMBER(data, i * src_stride * this->sample_size, void), src_stride,
+				    volume + src->step * i, this->sample_size);
+			}
+		} else if (volume < 0.999 || volume > 1.001) {
+			mix_scale_i_func_t mix = layer == 0 ? this->copy_scale_i : this->add_scale_i;
+			mix(out, dst_stride, data, src_stride, volume, n_bytes);
+		} else {
+			mix_i_func_t mix = layer == 0 ? this->copy_i : this->add_i;
+			mix(out, dst_stride, data, src_stride, n_bytes);
+		}
+	}
+}
+
+/* remix the channels of the source into out with the gain matrix of its port */
+static void
+mix_remix(struct impl *this, void *out, struct mix_source *src, uint32_t n_frames, int layer)
+{
+	struct port *port = src->remix;
+	uint32_t size = this->sample_size, n_src = port->channels, n_dst = this->out_channels;
+	uint32_t c, c_end, i, j;
+	int dst_stride, src_stride = port->planar ? 1 : n_src;
+
+	if (src->channel < 0 && !port->planar && src->ramp_left == 0) {
+		/* interleaved to interleaved, one pass over all channels */
+		int shape = mix_matrix_shape(n_dst, n_src);
+		mix_matrix_func_t mix = layer == 0 ? this->copy_matrix[shape] : this->add_matrix[shape];
+
+		mix(out, SPA_MEMBER(src->datas[0].data, src->offset, void),
+		    port->mix_matrix, n_dst, n_src, n_frames);
+		return;
+	}
 
-	b = spa_list_first(&port->queue, struct buffer, link);
+	/* add the input channels to the output channels one by one */
+	if (layer == 0)
+		this->clear(out, n_frames * this->out_frame_size);
+
+	if (src->channel < 0) {
+		c = 0;
+		c_end = n_dst;
+		dst_stride = n_dst;
+	} else {
+		c = src->channel;
+		c_end = c + 1;
+		dst_stride = 1;
+	}
+	for (; c < c_end; c++) {
+		void *d = SPA_MEMBER(out, src->channel < 0 ? c * size : 0, void);
 
-	d = b->outbuf->datas;
+		for (j = 0; j < n_src; j++) {
+			float gain = port->matrix[c * n_src + j];
+			void *s;
 
-	maxsize = d[0].maxsize;
-	data = d[0].data;
+			if (gain == 0.0f)
+				continue;
 
-	insize = SPA_MIN(d[0].chunk->size, maxsize);
-	outsize = SPA_MIN(outsize, insize);
+			if (port->planar)
+				s = SPA_MEMBER(src->datas[j].data, src->offset, void);
+			else
+				s = SPA_MEMBER(src->datas[0].data, src->offset + j * size, void);
+
+			if (src->ramp_left > 0) {
+				for (i = 0; i < n_frames; i++) {
+					this->add_scale_i(SPA_MEMBER(d, i * dst_stride * size, void), dst_stride,
+							  SPA_MEMBER(s, i * src_stride * size, void), src_stride,
+							  (src->volume + src->step * i) * gain, size);
+				}
+			} else {
+				this->add_scale_i(d, dst_stride, s, src_stride,
+						  src->volume * gain, n_frames * size);
+			}
+		}
+	}
+}
 
-	index = d[0].chunk->offset + (insize - port->queued_bytes);
-	offset = index % maxsize;
+/* mix n_frames contiguous frames of the source at its offset */
+static inline void
+mix_frames(struct impl *this, void *out, struct mix_source *src, uint32_t n_frames, int layer)
+{
+	uint32_t i;
 
-	len1 = SPA_MIN(outsize, maxsize - offset);
-	len2 = outsize - len1;
+	if (src->remix) {
+		mix_remix(this, out, src, n_frames, layer);
+	} else {
+		for (i = 0; i < src->n_planes; i++) {
+			void *data = src->datas[src->plane + i].data;
 
-	if (volume < 0.001 || mute) {
-		/* silence, for the first layer clear, otherwise do nothing */
-		if (layer == 0) {
-			this->clear(out, len1);
-			if (len2 > 0)
-				this->clear(out + len1, len2);
+			mix_plane(this, SPA_MEMBER(out, i * this->sample_size, void),
+				  SPA_MEMBER(data, src->offset + src->src_offset, void),
+				  src, n_frames, layer);
 		}
 	}
-	else if (volume < 0.999 || volume > 1.001) {
-		mix_scale_func_t mix = layer == 0 ? this->copy_scale : this->add_scale;
+}
+
+/* mix the frame that starts at the end of the ringbuffer and continues at
+ * the start, from a copy of the frame in each plane */
+static void
+mix_wrapped_frame(struct impl *this, void *out, struct mix_source *src, int layer)
+{
+	uint32_t i, first, n_planes;
+	uint32_t size = src->frame_size, head = src->maxsize - src->offset;
+	struct mix_source tmp;
 
-		mix(out, SPA_MEMBER(data, offset, void), volume, len1);
-		if (len2 > 0)
-			mix(out + len1, data, volume, len2);
+	if (src->remix) {
+		first = 0;
+		n_planes = src->remix->n_planes;
+	} else {
+		first = src->plane;
+		n_planes = src->n_planes;
 	}
-	else {
-		mix_func_t mix = layer == 0 ? this->copy : this->add;
+	if (first + n_planes > MAX_BOUNCE_PLANES || n_planes * size > MAX_BOUNCE_SIZE) {
+		/* too big to copy, skip the frame */
+		if (layer == 0)
+			this->clear(out, this->out_frame_size);
+		return;
+	}
+	for (i = 0; i < n_planes; i++) {
+		uint8_t *bounce = &this->bounce[i * size];
+		uint8_t *data = src->datas[first + i].data;
+
+		memcpy(bounce, data + src->offset, head);
+		memcpy(bounce + head, data, size - head);
+		this->bounce_datas[first + i].data = bounce;
+	}
+	tmp = *src;
+	tmp.datas = this->bounce_datas;
+	tmp.offset = 0;
+	mix_frames(this, out, &tmp, 1, layer);
+}
 
-		mix(out, SPA_MEMBER(data, offset, void), len1);
-		if (len2 > 0)
-			mix(out + len1, data, len2);
+static inline void
+mix_source(struct impl *this, void *out, struct mix_source *src, uint32_t n_frames, int layer)
+{
+	uint32_t n, avail;
+
+	while (n_frames > 0) {
+		avail = src->maxsize - src->offset;
+		if (avail < src->frame_size) {
+			/* a frame straddles the end of the ringbuffer */
+			mix_wrapped_frame(this, out, src, layer);
+			n = 1;
+		} else {
+			/* split at the end of the ringbuffer and the end of the ramp */
+			n = SPA_MIN(n_frames, avail / src->frame_size);
+			if (src->ramp_left > 0)
+				n = SPA_MIN(n, src->ramp_left);
+
+			mix_frames(this, out, src, n, layer);
+		}
+		spa_assert_se(n > 0);
+
+		src->offset = (src->offset + n * src->frame_size) % src->maxsize;
+
+		if (src->ramp_left > 0) {
+			src->ramp_left -= n;
+			src->volume = src->ramp_left > 0 ?
+				src->volume + src->step * n : src->target;
+		}
+		out = SPA_MEMBER(out, n * this->out_frame_size, void);
+		n_frames -= n;
+	}
+}
+
+/* mix all sources into out, one block at a time so that the output block
+ * stays in the cache while the sources are added to it */
+static void mix_sources(struct impl *this, void *out, uint32_t n_frames)
+{
+	uint32_t i, done, len;
+
+	if (this->n_sources == 0) {
+		this->clear(out, n_frames * this->out_frame_size);
+		return;
+	}
+	for (done = 0; done < n_frames; done += len) {
+		len = SPA_MIN(n_frames - done, this->block_frames);
+
+		for (i = 0; i < this->n_sources; i++)
+			mix_source(this, SPA_MEMBER(out, done * this->out_frame_size, void),
+				   &this->sources[i], len, i);
+	}
+}
+
+/* the bytes of whole frames in the chunk of a buffer, a partial frame at the
+ * end can't be mixed and is dropped */
+static inline uint32_t chunk_frames_size(struct port *port, struct spa_data *d)
+{
+	uint32_t size = SPA_MIN(d[0].chunk->size, d[0].maxsize);
+	return size - size % port->frame_size;
+}
+
+/* collect the data of all ports that have something to mix into
+ * the given plane of the output port */
+static void collect_sources(struct impl *this, struct port *outport, uint32_t plane)
+{
+	uint32_t i;
+	uint32_t channels = outport->channels;
+
+	this->n_sources = 0;
+	for (i = 0; i < this->n_active; i++) {
+		struct port *in_port = this->active[i];
+		struct mix_source *src;
+		struct buffer *b;
+		struct spa_data *d;
+		uint32_t insize;
+
+		if (in_port->n_buffers == 0)
+			continue;
+
+		if (in_port->queued_bytes == 0) {
+			if (plane == 0)
+				spa_log_warn(this->log, NAME " %p: underrun stream %d", this,
+					     in_port->id);
+			continue;
+		}
+		if (in_port->volume < 0.001 && in_port->ramp_left == 0)
+			continue;
+
+		b = spa_list_first(&in_port->queue, struct buffer, link);
+		d = b->outbuf->datas;
+
+		src = &this->sources[this->n_sources++];
+		src->datas = d;
+		src->maxsize = d[0].maxsize;
+		src->frame_size = in_port->frame_size;
+		src->volume = in_port->volume;
+		src->step = in_port->ramp_step;
+		src->target = in_port->ramp_target;
+		src->ramp_left = in_port->ramp_left;
+		src->plane = 0;
+		src->n_planes = 1;
+		src->src_offset = 0;
+		src->src_stride = 0;
+		src->dst_stride = 0;
+		src->remix = NULL;
+		src->channel = outport->planar ? (int) plane : -1;
+
+		if (in_port->remix) {
+			src->remix = in_port;
+		}
+		else if (in_port->planar == outport->planar) {
+			if (in_port->planar)
+				src->plane = plane;
+		}
+		else if (outport->planar) {
+			/* take one channel out of the interleaved input */
+			src->src_offset = plane * this->sample_size;
+			src->src_stride = channels;
+		}
+		else {
+			/* interleave all input planes */
+			src->n_planes = channels;
+			src->dst_stride = channels;
+		}
+
+		insize = chunk_frames_size(in_port, d);
+		src->offset = (d[0].chunk->offset + (insize - in_port->queued_bytes)) % src->maxsize;
+	}
+}
+
+/* start a new ramp when the volume or mute of the port changed */
+static void update_volume(struct impl *this, struct port *port)
+{
+	double target = *port->io_mute ? 0.0 : *port->io_volume;
+
+	if (!port->have_volume || this->ramp_frames == 0) {
+		port->volume = port->ramp_target = target;
+		port->ramp_left = 0;
+		port->have_volume = true;
+	}
+	else if (target != port->ramp_target) {
+		spa_log_trace(this->log, NAME " %p: ramp port %p from %f to %f", this,
+			      port, port->volume, target);
+		port->ramp_target = target;
+		port->ramp_step = (target - port->volume) / this->ramp_frames;
+		port->ramp_left = this->ramp_frames;
 	}
+}
+
+/* take the gains from the io area or map the channels one to one,
+ * mono inputs go to all output channels */
+static void update_matrix(struct impl *this, struct port *port, uint32_t n_dst)
+{
+	struct spa_pod_array *arr = port->io_matrix;
+	uint32_t i, j, n_src = port->channels, n = n_dst * n_src;
 
-	port->queued_bytes -= outsize;
+	port->remix = (arr != NULL || n_src != n_dst) &&
+		n_src <= MAX_CHANNELS && n_dst <= MAX_CHANNELS;
+	if (!port->remix)
+		return;
+
+	if (arr != NULL &&
+	    port->io_matrix_size >= sizeof(struct spa_pod_array) + n * sizeof(float) &&
+	    arr->pod.size >= sizeof(struct spa_pod_array_body) + n * sizeof(float) &&
+	    arr->body.child.type == SPA_POD_TYPE_FLOAT &&
+	    arr->body.child.size == sizeof(float)) {
+		memcpy(port->matrix, SPA_MEMBER(arr, sizeof(struct spa_pod_array), float),
+		       n * sizeof(float));
+	} else {
+		for (i = 0; i < n_dst; i++)
+			for (j = 0; j < n_src; j++)
+				port->matrix[i * n_src + j] = (n_src == 1 || i == j) ? 1.0f : 0.0f;
+	}
+	/* only used without a ramp, when the volume is at the target */
+	for (i = 0; i < n; i++)
+		port->mix_matrix[i] = port->matrix[i] * port->ramp_target;
+}
+
+static inline void
+consume_port_data(struct impl *this, struct port *port, uint32_t n_frames)
+{
+	struct buffer *b = spa_list_first(&port->queue, struct buffer, link);
+
+	if (port->ramp_left > n_frames) {
+		port->ramp_left -= n_frames;
+		port->volume += port->ramp_step * n_frames;
+	} else {
+		port->ramp_left = 0;
+		port->volume = port->ramp_target;
+	}
+
+	port->queued_bytes -= n_frames * port->frame_size;
 
 	if (port->queued_bytes == 0) {
-		spa_log_trace(this->log, NAME " %p: return buffer %d on port %p %zd",
-			      this, b->outbuf->id, port, outsize);
+		spa_log_trace(this->log, NAME " %p: return buffer %d on port %p %d",
+			      this, b->outbuf->id, port, n_frames);
 		port->io->buffer_id = b->outbuf->id;
 		spa_list_remove(&b->link);
 		b->outstanding = true;
 	} else {
-		spa_log_trace(this->log, NAME " %p: keeping buffer %d on port %p %zd %zd",
-			      this, b->outbuf->id, port, port->queued_bytes, outsize);
+		spa_log_trace(this->log, NAME " %p: keeping buffer %d on port %p %zd %d",
+			      this, b->outbuf->id, port, port->queued_bytes, n_frames);
 	}
 }
 
-static int mix_output(struct impl *this, size_t n_bytes)
+static int mix_output(struct impl *this, uint32_t n_frames)
 {
 	struct buffer *outbuf;
-	int i, layer;
+	uint32_t i;
+	uint32_t p;
 	struct port *outport;
 	struct spa_io_buffers *outio;
 	struct spa_data *od;
-	uint32_t avail, index, maxsize, len1, len2, offset;
 
 	outport = GET_OUT_PORT(this, 0);
 	outio = outport->io;
@@ -903,39 +1424,42 @@ static int mix_output(struct impl *this, size_t n_bytes)
 	outbuf->outstanding = true;
 
 	od = outbuf->outbuf->datas;
-	maxsize = od[0].maxsize;
+	n_frames = SPA_MIN(n_frames, od[0].maxsize / outport->frame_size);
 
-	avail = maxsize;
-	index = 0;
-	n_bytes = SPA_MIN(n_bytes, avail);
+	spa_log_trace(this->log, NAME " %p: dequeue output buffer %d %d",
+		      this, outbuf->outbuf->id, n_frames);
 
-	offset = index % maxsize;
-	len1 = SPA_MIN(n_bytes, maxsize - offset);
-	len2 = n_bytes - len1;
+	this->out_frame_size = outport->frame_size;
+	this->out_channels = outport->channels;
+	this->block_frames = SPA_MAX(MIX_BLOCK_SIZE / (this->sample_size * outport->channels), 1);
 
-	spa_log_trace(this->log, NAME " %p: dequeue output buffer %d %zd %d %d %d",
-		      this, outbuf->outbuf->id, n_bytes, offset, len1, len2);
+	for (i = 0; i < this->n_active; i++) {
+		struct port *in_port = this->active[i];
 
-	for (layer = 0, i = 0; i < this->last_port; i++) {
-		struct port *in_port = GET_IN_PORT(this, i);
-
-		if (in_port->io == NULL || in_port->n_buffers == 0)
+		if (in_port->n_buffers == 0 || in_port->queued_bytes == 0)
 			continue;
 
-		if (in_port->queued_bytes == 0) {
-			spa_log_warn(this->log, NAME " %p: underrun stream %d", this, i);
-			continue;
-		}
+		update_volume(this, in_port);
+		update_matrix(this, in_port, outport->channels);
+	}
 
-		add_port_data(this, SPA_MEMBER(od[0].data, offset, void), len1, in_port, layer);
-		if (len2 > 0)
-			add_port_data(this, od[0].data, len2, in_port, layer);
-		layer++;
+	for (p = 0; p < outport->n_planes; p++) {
+		collect_sources(this, outport, p);
+		mix_sources(this, od[p].data, n_frames);
+
+		od[p].chunk->offset = 0;
+		od[p].chunk->size = n_frames * outport->frame_size;
+		od[p].chunk->stride = 0;
 	}
 
-	od[0].chunk->offset = index;
-	od[0].chunk->size = n_bytes;
-	od[0].chunk->stride = 0;
+	for (i = 0; i < this->n_active; i++) {
+		struct port *in_port = this->active[i];
+
+		if (in_port->n_buffers == 0 || in_port->queued_bytes == 0)
+			continue;
+
+		consume_port_data(this, in_port, n_frames);
+	}
 
 	outio->buffer_id = outbuf->outbuf->id;
 	outio->status = SPA_STATUS_HAVE_BUFFER;
@@ -948,7 +1472,7 @@ static int impl_node_process_input(struct spa_node *node)
 	struct impl *this;
 	uint32_t i;
 	struct port *outport;
-	size_t min_queued = SIZE_MAX;
+	uint32_t min_queued = UINT32_MAX;
 	struct spa_io_buffers *outio;
 
 	spa_return_val_if_fail(node != NULL, -EINVAL);
@@ -962,12 +1486,9 @@ static int impl_node_process_input(struct spa_node *node)
 	if (outio->status == SPA_STATUS_HAVE_BUFFER)
 		return SPA_STATUS_HAVE_BUFFER;
 
-	for (i = 0; i < this->last_port; i++) {
-		struct port *inport = GET_IN_PORT(this, i);
-		struct spa_io_buffers *inio;
-
-		if ((inio = inport->io) == NULL)
-			continue;
+	for (i = 0; i < this->n_active; i++) {
+		struct port *inport = this->active[i];
+		struct spa_io_buffers *inio = inport->io;
 
 		if (inport->queued_bytes == 0 &&
 		    inio->status == SPA_STATUS_HAVE_BUFFER && inio->buffer_id < inport->n_buffers) {
@@ -981,22 +1502,27 @@ static int impl_node_process_input(struct spa_node *node)
 				continue;
 			}
 
+			inport->queued_bytes = chunk_frames_size(inport, d);
+			if (inport->queued_bytes == 0) {
+				/* nothing to mix, give the buffer back */
+				inio->status = SPA_STATUS_NEED_BUFFER;
+				continue;
+			}
+
 			b->outstanding = false;
 			inio->buffer_id = SPA_ID_INVALID;
 			inio->status = SPA_STATUS_OK;
 
 			spa_list_append(&inport->queue, &b->link);
 
-			inport->queued_bytes = SPA_MIN(d[0].chunk->size, d[0].maxsize);
-
-			spa_log_trace(this->log, NAME " %p: queue buffer %d on port %d %zd %zd",
-				      this, b->outbuf->id, i, inport->queued_bytes, min_queued);
+			spa_log_trace(this->log, NAME " %p: queue buffer %d on port %d %zd %d",
+				      this, b->outbuf->id, inport->id, inport->queued_bytes, min_queued);
 		}
-		if (inport->queued_bytes > 0 && inport->queued_bytes < min_queued)
-			min_queued = inport->queued_bytes;
+		if (inport->queued_bytes > 0)
+			min_queued = SPA_MIN(min_queued, inport->queued_bytes / inport->frame_size);
 	}
 
-	if (min_queued != SIZE_MAX && min_queued > 0) {
+	if (min_queued != UINT32_MAX && min_queued > 0) {
 		outio->status = mix_output(this, min_queued);
 	} else {
 		outio->status = SPA_STATUS_NEED_BUFFER;
@@ -1009,8 +1535,8 @@ static int impl_node_process_output(struct spa_node *node)
 	struct impl *this;
 	struct port *outport;
 	struct spa_io_buffers *outio;
-	int i;
-	size_t min_queued = SIZE_MAX;
+	uint32_t i;
+	uint32_t min_queued = UINT32_MAX;
 
 	spa_return_val_if_fail(node != NULL, -EINVAL);
 
@@ -1029,28 +1555,27 @@ static int impl_node_process_output(struct spa_node *node)
 		outio->buffer_id = SPA_ID_INVALID;
 	}
 	/* produce more output if possible */
-	for (i = 0; i < this->last_port; i++) {
-		struct port *inport = GET_IN_PORT(this, i);
+	for (i = 0; i < this->n_active; i++) {
+		struct port *inport = this->active[i];
 
-		if (inport->io == NULL || inport->n_buffers == 0)
+		if (inport->n_buffers == 0)
 			continue;
 
-		if (inport->queued_bytes < min_queued)
-			min_queued = inport->queued_bytes;
+		min_queued = SPA_MIN(min_queued, inport->queued_bytes / inport->frame_size);
 	}
-	if (min_queued != SIZE_MAX && min_queued > 0) {
+	if (min_queued != UINT32_MAX && min_queued > 0) {
 		outio->status = mix_output(this, min_queued);
 	} else {
 		/* take requested output range and apply to input */
-		for (i = 0; i < this->last_port; i++) {
-			struct port *inport = GET_IN_PORT(this, i);
-			struct spa_io_buffers *inio;
+		for (i = 0; i < this->n_active; i++) {
+			struct port *inport = this->active[i];
+			struct spa_io_buffers *inio = inport->io;
 
-			if ((inio = inport->io) == NULL || inport->n_buffers == 0)
+			if (inport->n_buffers == 0)
 				continue;
 
 			spa_log_trace(this->log, NAME " %p: port %d queued %zd, res %d", this,
-				      i, inport->queued_bytes, inio->status);
+				      inport->id, inport->queued_bytes, inio->status);
 
 			if (inport->queued_bytes == 0 && inio->status == SPA_STATUS_OK) {
 				if (inport->io_range && outport->io_range)
@@ -1117,6 +1642,7 @@ impl_init(const struct spa_handle_factory *factory,
 	struct impl *this;
 	struct port *port;
 	uint32_t i;
+	const char *str;
 
 	spa_return_val_if_fail(factory != NULL, -EINVAL);
 	spa_return_val_if_fail(handle != NULL, -EINVAL);
@@ -1146,7 +1672,22 @@ impl_init(const struct spa_handle_factory *factory,
 	    SPA_PORT_INFO_FLAG_NO_REF;
 	spa_list_init(&port->queue);
 
+	this->ramp_frames = DEFAULT_RAMP_FRAMES;
+	if (info && (str = spa_dict_lookup(info, "audiomixer.ramp-frames"))) {
+		char *end;
+		unsigned long val;
+
+		errno = 0;
+		val = strtoul(str, &end, 0);
+		if (errno != 0 || end == str || *end != '\0' || str[strspn(str, " \t")] == '-') {
+			spa_log_warn(this->log, NAME " %p: invalid ramp-frames \"%s\"", this, str);
+		} else {
+			this->ramp_frames = SPA_MIN(val, MAX_RAMP_FRAMES);
+		}
+	}
+
 	spa_audiomixer_get_ops(&this->ops);
+	spa_log_debug(this->log, NAME " %p: cpu flags %08x", this, this->ops.cpu_flags);
 
 	return 0;
 }
@@ -0,0 +1,168 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <immintrin.h>
+
+#include "mix-ops.h"
+
+/* multiply 16 samples with the 5.11 fixed point volume in v and
+ * return the two halves as 32 bits values. The unpack operates per
+ * 128 bits lane, this is undone again by the per lane pack. */
+static inline void
+scale_s16_avx2(__m256i s, __m256i v, __m256i *r0, __m256i *r1)
+{
+	__m256i lo = _mm256_mullo_epi16(s, v);
+	__m256i hi = _mm256_mulhi_epi16(s, v);
+
+	*r0 = _mm256_srai_epi32(_mm256_unpacklo_epi16(lo, hi), 11);
+	*r1 = _mm256_srai_epi32(_mm256_unpackhi_epi16(lo, hi), 11);
+}
+
+static void
+add_s16_avx2(void *dst, const void *src, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int n, n_samples = n_bytes / sizeof(int16_t);
+	int32_t t;
+
+	for (n = 0; n + 16 <= n_samples; n += 16) {
+		__m256i in = _mm256_loadu_si256((const __m256i *)&s[n]);
+		__m256i out = _mm256_loadu_si256((const __m256i *)&d[n]);
+		_mm256_storeu_si256((__m256i *)&d[n], _mm256_adds_epi16(out, in));
+	}
+	for (; n < n_samples; n++) {
+		t = d[n] + s[n];
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+static void
+add_f32_avx2(void *dst, const void *src, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	int n, n_samples = n_bytes / sizeof(float);
+
+	for (n = 0; n + 16 <= n_samples; n += 16) {
+		__m256 in0 = _mm256_loadu_ps(&s[n]);
+		__m256 in1 = _mm256_loadu_ps(&s[n + 8]);
+		__m256 out0 = _mm256_loadu_ps(&d[n]);
+		__m256 out1 = _mm256_loadu_ps(&d[n + 8]);
+		_mm256_storeu_ps(&d[n], _mm256_add_ps(out0, in0));
+		_mm256_storeu_ps(&d[n + 8], _mm256_add_ps(out1, in1));
+	}
+	for (; n < n_samples; n++)
+		d[n] += s[n];
+}
+
+static void
+copy_scale_s16_avx2(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int n = 0, n_samples = n_bytes / sizeof(int16_t);
+	int32_t v = scale * (1 << 11), t;
+
+	/* the vector path needs the volume to fit in 16 bits */
+	if (v <= INT16_MAX) {
+		__m256i vv = _mm256_set1_epi16(v), r0, r1;
+
+		for (; n + 16 <= n_samples; n += 16) {
+			scale_s16_avx2(_mm256_loadu_si256((const __m256i *)&s[n]), vv, &r0, &r1);
+			_mm256_storeu_si256((__m256i *)&d[n], _mm256_packs_epi32(r0, r1));
+		}
+	}
+	for (; n < n_samples; n++) {
+		t = (s[n] * v) >> 11;
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+static void
+copy_scale_f32_avx2(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	int n, n_samples = n_bytes / sizeof(float);
+	float v = scale;
+	__m256 vv = _mm256_set1_ps(v);
+
+	for (n = 0; n + 16 <= n_samples; n += 16) {
+		_mm256_storeu_ps(&d[n], _mm256_mul_ps(_mm256_loadu_ps(&s[n]), vv));
+		_mm256_storeu_ps(&d[n + 8], _mm256_mul_ps(_mm256_loadu_ps(&s[n + 8]), vv));
+	}
+	for (; n < n_samples; n++)
+		d[n] = s[n] * v;
+}
+
+static void
+add_scale_s16_avx2(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int n = 0, n_samples = n_bytes / sizeof(int16_t);
+	int32_t v = scale * (1 << 11), t;
+
+	if (v <= INT16_MAX) {
+		__m256i vv = _mm256_set1_epi16(v), r0, r1, out;
+
+		for (; n + 16 <= n_samples; n += 16) {
+			scale_s16_avx2(_mm256_loadu_si256((const __m256i *)&s[n]), vv, &r0, &r1);
+			out = _mm256_loadu_si256((const __m256i *)&d[n]);
+			/* sign extend the destination to 32 bits */
+			r0 = _mm256_add_epi32(r0, _mm256_srai_epi32(_mm256_unpacklo_epi16(out, out), 16));
+			r1 = _mm256_add_epi32(r1, _mm256_srai_epi32(_mm256_unpackhi_epi16(out, out), 16));
+			_mm256_storeu_si256((__m256i *)&d[n], _mm256_packs_epi32(r0, r1));
+		}
+	}
+	for (; n < n_samples; n++) {
+		t = d[n] + ((s[n] * v) >> 11);
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+static void
+add_scale_f32_avx2(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	int n, n_samples = n_bytes / sizeof(float);
+	float v = scale;
+	__m256 vv = _mm256_set1_ps(v);
+
+	for (n = 0; n + 16 <= n_samples; n += 16) {
+		__m256 in0 = _mm256_mul_ps(_mm256_loadu_ps(&s[n]), vv);
+		__m256 in1 = _mm256_mul_ps(_mm256_loadu_ps(&s[n + 8]), vv);
+		_mm256_storeu_ps(&d[n], _mm256_add_ps(_mm256_loadu_ps(&d[n]), in0));
+		_mm256_storeu_ps(&d[n + 8], _mm256_add_ps(_mm256_loadu_ps(&d[n + 8]), in1));
+	}
+	for (; n < n_samples; n++)
+		d[n] += s[n] * v;
+}
+
+void spa_audiomixer_get_ops_avx2(struct spa_audiomixer_ops *ops)
+{
+	ops->add[FMT_S16] = add_s16_avx2;
+	ops->add[FMT_F32] = add_f32_avx2;
+	ops->copy_scale[FMT_S16] = copy_scale_s16_avx2;
+	ops->copy_scale[FMT_F32] = copy_scale_f32_avx2;
+	ops->add_scale[FMT_S16] = add_scale_s16_avx2;
+	ops->add_scale[FMT_F32] = add_scale_f32_avx2;
+}
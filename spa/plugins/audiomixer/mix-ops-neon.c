@@ -0,0 +1,329 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <arm_neon.h>
+
+#include "mix-ops.h"
+
+static void
+add_s16_neon(void *dst, const void *src, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int n, n_samples = n_bytes / sizeof(int16_t);
+	int32_t t;
+
+	for (n = 0; n + 8 <= n_samples; n += 8)
+		vst1q_s16(&d[n], vqaddq_s16(vld1q_s16(&d[n]), vld1q_s16(&s[n])));
+
+	for (; n < n_samples; n++) {
+		t = d[n] + s[n];
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+static void
+add_f32_neon(void *dst, const void *src, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	int n, n_samples = n_bytes / sizeof(float);
+
+	for (n = 0; n + 8 <= n_samples; n += 8) {
+		vst1q_f32(&d[n], vaddq_f32(vld1q_f32(&d[n]), vld1q_f32(&s[n])));
+		vst1q_f32(&d[n + 4], vaddq_f32(vld1q_f32(&d[n + 4]), vld1q_f32(&s[n + 4])));
+	}
+	for (; n < n_samples; n++)
+		d[n] += s[n];
+}
+
+static void
+copy_scale_s16_neon(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int n = 0, n_samples = n_bytes / sizeof(int16_t);
+	int32_t v = scale * (1 << 11), t;
+
+	/* the vector path needs the volume to fit in 16 bits */
+	if (v <= INT16_MAX) {
+		int16x4_t vv = vdup_n_s16(v);
+
+		for (; n + 8 <= n_samples; n += 8) {
+			int16x8_t in = vld1q_s16(&s[n]);
+			int32x4_t r0 = vshrq_n_s32(vmull_s16(vget_low_s16(in), vv), 11);
+			int32x4_t r1 = vshrq_n_s32(vmull_s16(vget_high_s16(in), vv), 11);
+			vst1q_s16(&d[n], vcombine_s16(vqmovn_s32(r0), vqmovn_s32(r1)));
+		}
+	}
+	for (; n < n_samples; n++) {
+		t = (s[n] * v) >> 11;
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+static void
+copy_scale_f32_neon(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	int n, n_samples = n_bytes / sizeof(float);
+	float v = scale;
+
+	for (n = 0; n + 8 <= n_samples; n += 8) {
+		vst1q_f32(&d[n], vmulq_n_f32(vld1q_f32(&s[n]), v));
+		vst1q_f32(&d[n + 4], vmulq_n_f32(vld1q_f32(&s[n + 4]), v));
+	}
+	for (; n < n_samples; n++)
+		d[n] = s[n] * v;
+}
+
+static void
+add_scale_s16_neon(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int n = 0, n_samples = n_bytes / sizeof(int16_t);
+	int32_t v = scale * (1 << 11), t;
+
+	if (v <= INT16_MAX) {
+		int16x4_t vv = vdup_n_s16(v);
+
+		for (; n + 8 <= n_samples; n += 8) {
+			int16x8_t in = vld1q_s16(&s[n]);
+			int16x8_t out = vld1q_s16(&d[n]);
+			int32x4_t r0 = vshrq_n_s32(vmull_s16(vget_low_s16(in), vv), 11);
+			int32x4_t r1 = vshrq_n_s32(vmull_s16(vget_high_s16(in), vv), 11);
+			r0 = vaddw_s16(r0, vget_low_s16(out));
+			r1 = vaddw_s16(r1, vget_high_s16(out));
+			vst1q_s16(&d[n], vcombine_s16(vqmovn_s32(r0), vqmovn_s32(r1)));
+		}
+	}
+	for (; n < n_samples; n++) {
+		t = d[n] + ((s[n] * v) >> 11);
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+static void
+add_scale_f32_neon(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	int n, n_samples = n_bytes / sizeof(float);
+	float v = scale;
+
+	for (n = 0; n + 8 <= n_samples; n += 8) {
+		vst1q_f32(&d[n], vmlaq_n_f32(vld1q_f32(&d[n]), vld1q_f32(&s[n]), v));
+		vst1q_f32(&d[n + 4], vmlaq_n_f32(vld1q_f32(&d[n + 4]), vld1q_f32(&s[n + 4]), v));
+	}
+	for (; n < n_samples; n++)
+		d[n] += s[n] * v;
+}
+
+/* 4 samples with the same gain pattern cover 4 / n_channels frames, this
+ * works for 1, 2 and 4 channels, the other layouts use the plain loop */
+static inline void
+ramp_f32_neon(float *d, const float *s, int n_channels, double start, double step,
+	      int n_bytes, bool add)
+{
+	int i, n = 0, n_samples = n_bytes / sizeof(float);
+	float v;
+
+	if (n_channels == 1 || n_channels == 2 || n_channels == 4) {
+		float32_t init[4] = { 0, 1 / n_channels, 2 / n_channels, 3 / n_channels };
+		float32x4_t frame = vld1q_f32(init);
+		float32x4_t inc = vdupq_n_f32(4 / n_channels);
+		float32x4_t st = vdupq_n_f32(start), g, in;
+
+		for (; n + 4 <= n_samples; n += 4) {
+			g = vmlaq_n_f32(st, frame, step);
+			in = vmulq_f32(vld1q_f32(&s[n]), g);
+			if (add)
+				in = vaddq_f32(vld1q_f32(&d[n]), in);
+			vst1q_f32(&d[n], in);
+			frame = vaddq_f32(frame, inc);
+		}
+	}
+	for (; n < n_samples; n += n_channels) {
+		v = start + step * (n / n_channels);
+		for (i = 0; i < n_channels; i++) {
+			if (add)
+				d[n + i] += s[n + i] * v;
+			else
+				d[n + i] = s[n + i] * v;
+		}
+	}
+}
+
+static void
+copy_ramp_f32_neon(void *dst, const void *src, int n_channels, double start, double step, int n_bytes)
+{
+	ramp_f32_neon(dst, src, n_channels, start, step, n_bytes, false);
+}
+
+static void
+add_ramp_f32_neon(void *dst, const void *src, int n_channels, double start, double step, int n_bytes)
+{
+	ramp_f32_neon(dst, src, n_channels, start, step, n_bytes, true);
+}
+
+/* mono to stereo, 4 frames at a time */
+static inline void
+matrix_1_2_f32_neon(float *d, const float *s, const float *m, int n_frames, bool add)
+{
+	float32x4x2_t out;
+	float32x4_t in;
+	int n = 0;
+
+	for (; n + 4 <= n_frames; n += 4) {
+		in = vld1q_f32(&s[n]);
+		out.val[0] = vmulq_n_f32(in, m[0]);
+		out.val[1] = vmulq_n_f32(in, m[1]);
+		if (add) {
+			float32x4x2_t o = vld2q_f32(&d[2 * n]);
+			out.val[0] = vaddq_f32(o.val[0], out.val[0]);
+			out.val[1] = vaddq_f32(o.val[1], out.val[1]);
+		}
+		vst2q_f32(&d[2 * n], out);
+	}
+	for (; n < n_frames; n++) {
+		if (add) {
+			d[2 * n] += s[n] * m[0];
+			d[2 * n + 1] += s[n] * m[1];
+		} else {
+			d[2 * n] = s[n] * m[0];
+			d[2 * n + 1] = s[n] * m[1];
+		}
+	}
+}
+
+/* stereo to stereo, 2 frames at a time. The straight gains multiply the
+ * samples, the cross gains multiply the samples with left and right
+ * swapped */
+static inline void
+matrix_2_2_f32_neon(float *d, const float *s, const float *m, int n_frames, bool add)
+{
+	const float straight[4] = { m[0], m[3], m[0], m[3] };
+	const float cross[4] = { m[1], m[2], m[1], m[2] };
+	float32x4_t ms = vld1q_f32(straight), mx = vld1q_f32(cross), in, out;
+	int n = 0;
+
+	for (; n + 2 <= n_frames; n += 2) {
+		in = vld1q_f32(&s[2 * n]);
+		out = vmlaq_f32(vmulq_f32(in, ms), vrev64q_f32(in), mx);
+		if (add)
+			out = vaddq_f32(vld1q_f32(&d[2 * n]), out);
+		vst1q_f32(&d[2 * n], out);
+	}
+	for (; n < n_frames; n++) {
+		float l = s[2 * n] * m[0] + s[2 * n + 1] * m[1];
+		float r = s[2 * n] * m[2] + s[2 * n + 1] * m[3];
+		if (add) {
+			d[2 * n] += l;
+			d[2 * n + 1] += r;
+		} else {
+			d[2 * n] = l;
+			d[2 * n + 1] = r;
+		}
+	}
+}
+
+/* 5.1 to stereo, one frame at a time with pairwise sums of the products */
+static inline void
+matrix_6_2_f32_neon(float *d, const float *s, const float *m, int n_frames, bool add)
+{
+	float32x4_t ml0 = vld1q_f32(&m[0]), mr0 = vld1q_f32(&m[6]), l, r;
+	float32x2_t ml1 = vld1_f32(&m[4]), mr1 = vld1_f32(&m[10]), in1, pl, pr, out;
+	float32x4_t in0;
+	int n;
+
+	for (n = 0; n < n_frames; n++) {
+		in0 = vld1q_f32(&s[6 * n]);
+		in1 = vld1_f32(&s[6 * n + 4]);
+		l = vmulq_f32(in0, ml0);
+		r = vmulq_f32(in0, mr0);
+		pl = vmla_f32(vadd_f32(vget_low_f32(l), vget_high_f32(l)), in1, ml1);
+		pr = vmla_f32(vadd_f32(vget_low_f32(r), vget_high_f32(r)), in1, mr1);
+		out = vpadd_f32(pl, pr);
+		if (add)
+			out = vadd_f32(vld1_f32(&d[2 * n]), out);
+		vst1_f32(&d[2 * n], out);
+	}
+}
+
+static void
+copy_matrix_1_2_f32_neon(void *dst, const void *src, const float *matrix,
+		int n_dst, int n_src, int n_frames)
+{
+	matrix_1_2_f32_neon(dst, src, matrix, n_frames, false);
+}
+
+static void
+add_matrix_1_2_f32_neon(void *dst, const void *src, const float *matrix,
+		int n_dst, int n_src, int n_frames)
+{
+	matrix_1_2_f32_neon(dst, src, matrix, n_frames, true);
+}
+
+static void
+copy_matrix_2_2_f32_neon(void *dst, const void *src, const float *matrix,
+		int n_dst, int n_src, int n_frames)
+{
+	matrix_2_2_f32_neon(dst, src, matrix, n_frames, false);
+}
+
+static void
+add_matrix_2_2_f32_neon(void *dst, const void *src, const float *matrix,
+		int n_dst, int n_src, int n_frames)
+{
+	matrix_2_2_f32_neon(dst, src, matrix, n_frames, true);
+}
+
+static void
+copy_matrix_6_2_f32_neon(void *dst, const void *src, const float *matrix,
+		int n_dst, int n_src, int n_frames)
+{
+	matrix_6_2_f32_neon(dst, src, matrix, n_frames, false);
+}
+
+static void
+add_matrix_6_2_f32_neon(void *dst, const void *src, const float *matrix,
+		int n_dst, int n_src, int n_frames)
+{
+	matrix_6_2_f32_neon(dst, src, matrix, n_frames, true);
+}
+
+void spa_audiomixer_get_ops_neon(struct spa_audiomixer_ops *ops)
+{
+	ops->add[FMT_S16] = add_s16_neon;
+	ops->add[FMT_F32] = add_f32_neon;
+	ops->copy_scale[FMT_S16] = copy_scale_s16_neon;
+	ops->copy_scale[FMT_F32] = copy_scale_f32_neon;
+	ops->add_scale[FMT_S16] = add_scale_s16_neon;
+	ops->add_scale[FMT_F32] = add_scale_f32_neon;
+	ops->copy_ramp[FMT_F32] = copy_ramp_f32_neon;
+	ops->add_ramp[FMT_F32] = add_ramp_f32_neon;
+	ops->copy_matrix[FMT_F32][MIX_MATRIX_1_2] = copy_matrix_1_2_f32_neon;
+	ops->copy_matrix[FMT_F32][MIX_MATRIX_2_2] = copy_matrix_2_2_f32_neon;
+	ops->copy_matrix[FMT_F32][MIX_MATRIX_6_2] = copy_matrix_6_2_f32_neon;
+	ops->add_matrix[FMT_F32][MIX_MATRIX_1_2] = add_matrix_1_2_f32_neon;
+	ops->add_matrix[FMT_F32][MIX_MATRIX_2_2] = add_matrix_2_2_f32_neon;
+	ops->add_matrix[FMT_F32][MIX_MATRIX_6_2] = add_matrix_6_2_f32_neon;
+}
@@ -0,0 +1,352 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <emmintrin.h>
+
+#include "mix-ops.h"
+
+/* multiply 8 samples with the 5.11 fixed point volume in v and
+ * return the two halves as 32 bits values */
+static inline void
+scale_s16_sse2(__m128i s, __m128i v, __m128i *r0, __m128i *r1)
+{
+	__m128i lo = _mm_mullo_epi16(s, v);
+	__m128i hi = _mm_mulhi_epi16(s, v);
+
+	*r0 = _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), 11);
+	*r1 = _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), 11);
+}
+
+static void
+add_s16_sse2(void *dst, const void *src, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int n, n_samples = n_bytes / sizeof(int16_t);
+	int32_t t;
+
+	for (n = 0; n + 8 <= n_samples; n += 8) {
+		__m128i in = _mm_loadu_si128((const __m128i *)&s[n]);
+		__m128i out = _mm_loadu_si128((const __m128i *)&d[n]);
+		_mm_storeu_si128((__m128i *)&d[n], _mm_adds_epi16(out, in));
+	}
+	for (; n < n_samples; n++) {
+		t = d[n] + s[n];
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+static void
+add_f32_sse2(void *dst, const void *src, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	int n, n_samples = n_bytes / sizeof(float);
+
+	for (n = 0; n + 8 <= n_samples; n += 8) {
+		__m128 in0 = _mm_loadu_ps(&s[n]);
+		__m128 in1 = _mm_loadu_ps(&s[n + 4]);
+		__m128 out0 = _mm_loadu_ps(&d[n]);
+		__m128 out1 = _mm_loadu_ps(&d[n + 4]);
+		_mm_storeu_ps(&d[n], _mm_add_ps(out0, in0));
+		_mm_storeu_ps(&d[n + 4], _mm_add_ps(out1, in1));
+	}
+	for (; n < n_samples; n++)
+		d[n] += s[n];
+}
+
+static void
+copy_scale_s16_sse2(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int n = 0, n_samples = n_bytes / sizeof(int16_t);
+	int32_t v = scale * (1 << 11), t;
+
+	/* the vector path needs the volume to fit in 16 bits */
+	if (v <= INT16_MAX) {
+		__m128i vv = _mm_set1_epi16(v), r0, r1;
+
+		for (; n + 8 <= n_samples; n += 8) {
+			scale_s16_sse2(_mm_loadu_si128((const __m128i *)&s[n]), vv, &r0, &r1);
+			_mm_storeu_si128((__m128i *)&d[n], _mm_packs_epi32(r0, r1));
+		}
+	}
+	for (; n < n_samples; n++) {
+		t = (s[n] * v) >> 11;
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+static void
+copy_scale_f32_sse2(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	int n, n_samples = n_bytes / sizeof(float);
+	float v = scale;
+	__m128 vv = _mm_set1_ps(v);
+
+	for (n = 0; n + 8 <= n_samples; n += 8) {
+		_mm_storeu_ps(&d[n], _mm_mul_ps(_mm_loadu_ps(&s[n]), vv));
+		_mm_storeu_ps(&d[n + 4], _mm_mul_ps(_mm_loadu_ps(&s[n + 4]), vv));
+	}
+	for (; n < n_samples; n++)
+		d[n] = s[n] * v;
+}
+
+static void
+add_scale_s16_sse2(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int n = 0, n_samples = n_bytes / sizeof(int16_t);
+	int32_t v = scale * (1 << 11), t;
+
+	if (v <= INT16_MAX) {
+		__m128i vv = _mm_set1_epi16(v), r0, r1, out;
+
+		for (; n + 8 <= n_samples; n += 8) {
+			scale_s16_sse2(_mm_loadu_si128((const __m128i *)&s[n]), vv, &r0, &r1);
+			out = _mm_loadu_si128((const __m128i *)&d[n]);
+			/* sign extend the destination to 32 bits */
+			r0 = _mm_add_epi32(r0, _mm_srai_epi32(_mm_unpacklo_epi16(out, out), 16));
+			r1 = _mm_add_epi32(r1, _mm_srai_epi32(_mm_unpackhi_epi16(out, out), 16));
+			_mm_storeu_si128((__m128i *)&d[n], _mm_packs_epi32(r0, r1));
+		}
+	}
+	for (; n < n_samples; n++) {
+		t = d[n] + ((s[n] * v) >> 11);
+		d[n] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+	}
+}
+
+static void
+add_scale_f32_sse2(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	int n, n_samples = n_bytes / sizeof(float);
+	float v = scale;
+	__m128 vv = _mm_set1_ps(v);
+
+	for (n = 0; n + 8 <= n_samples; n += 8) {
+		__m128 in0 = _mm_mul_ps(_mm_loadu_ps(&s[n]), vv);
+		__m128 in1 = _mm_mul_ps(_mm_loadu_ps(&s[n + 4]), vv);
+		_mm_storeu_ps(&d[n], _mm_add_ps(_mm_loadu_ps(&d[n]), in0));
+		_mm_storeu_ps(&d[n + 4], _mm_add_ps(_mm_loadu_ps(&d[n + 4]), in1));
+	}
+	for (; n < n_samples; n++)
+		d[n] += s[n] * v;
+}
+
+/* 4 samples with the same gain pattern cover 4 / n_channels frames, this
+ * works for 1, 2 and 4 channels, the other layouts use the plain loop */
+static inline void
+ramp_f32_sse2(float *d, const float *s, int n_channels, double start, double step,
+	      int n_bytes, bool add)
+{
+	int i, n = 0, n_samples = n_bytes / sizeof(float);
+	float v;
+
+	if (n_channels == 1 || n_channels == 2 || n_channels == 4) {
+		__m128 frame = _mm_setr_ps(0, 1 / n_channels, 2 / n_channels, 3 / n_channels);
+		__m128 inc = _mm_set1_ps(4 / n_channels);
+		__m128 st = _mm_set1_ps(start), sp = _mm_set1_ps(step), g, in;
+
+		for (; n + 4 <= n_samples; n += 4) {
+			g = _mm_add_ps(st, _mm_mul_ps(frame, sp));
+			in = _mm_mul_ps(_mm_loadu_ps(&s[n]), g);
+			if (add)
+				in = _mm_add_ps(_mm_loadu_ps(&d[n]), in);
+			_mm_storeu_ps(&d[n], in);
+			frame = _mm_add_ps(frame, inc);
+		}
+	}
+	for (; n < n_samples; n += n_channels) {
+		v = start + step * (n / n_channels);
+		for (i = 0; i < n_channels; i++) {
+			if (add)
+				d[n + i] += s[n + i] * v;
+			else
+				d[n + i] = s[n + i] * v;
+		}
+	}
+}
+
+static void
+copy_ramp_f32_sse2(void *dst, const void *src, int n_channels, double start, double step, int n_bytes)
+{
+	ramp_f32_sse2(dst, src, n_channels, start, step, n_bytes, false);
+}
+
+static void
+add_ramp_f32_sse2(void *dst, const void *src, int n_channels, double start, double step, int n_bytes)
+{
+	ramp_f32_sse2(dst, src, n_channels, start, step, n_bytes, true);
+}
+
+/* mono to stereo, 4 frames at a time */
+static inline void
+matrix_1_2_f32_sse2(float *d, const float *s, const float *m, int n_frames, bool add)
+{
+	__m128 m0 = _mm_set1_ps(m[0]), m1 = _mm_set1_ps(m[1]), in, l, r, o0, o1;
+	int n = 0;
+
+	for (; n + 4 <= n_frames; n += 4) {
+		in = _mm_loadu_ps(&s[n]);
+		l = _mm_mul_ps(in, m0);
+		r = _mm_mul_ps(in, m1);
+		o0 = _mm_unpacklo_ps(l, r);
+		o1 = _mm_unpackhi_ps(l, r);
+		if (add) {
+			o0 = _mm_add_ps(_mm_loadu_ps(&d[2 * n]), o0);
+			o1 = _mm_add_ps(_mm_loadu_ps(&d[2 * n + 4]), o1);
+		}
+		_mm_storeu_ps(&d[2 * n], o0);
+		_mm_storeu_ps(&d[2 * n + 4], o1);
+	}
+	for (; n < n_frames; n++) {
+		if (add) {
+			d[2 * n] += s[n] * m[0];
+			d[2 * n + 1] += s[n] * m[1];
+		} else {
+			d[2 * n] = s[n] * m[0];
+			d[2 * n + 1] = s[n] * m[1];
+		}
+	}
+}
+
+/* stereo to stereo, 2 frames at a time. The straight gains multiply the
+ * samples, the cross gains multiply the samples with left and right
+ * swapped */
+static inline void
+matrix_2_2_f32_sse2(float *d, const float *s, const float *m, int n_frames, bool add)
+{
+	__m128 ms = _mm_setr_ps(m[0], m[3], m[0], m[3]);
+	__m128 mx = _mm_setr_ps(m[1], m[2], m[1], m[2]);
+	__m128 in, out;
+	int n = 0;
+
+	for (; n + 2 <= n_frames; n += 2) {
+		in = _mm_loadu_ps(&s[2 * n]);
+		out = _mm_add_ps(_mm_mul_ps(in, ms),
+				 _mm_mul_ps(_mm_shuffle_ps(in, in, _MM_SHUFFLE(2, 3, 0, 1)), mx));
+		if (add)
+			out = _mm_add_ps(_mm_loadu_ps(&d[2 * n]), out);
+		_mm_storeu_ps(&d[2 * n], out);
+	}
+	for (; n < n_frames; n++) {
+		float l = s[2 * n] * m[0] + s[2 * n + 1] * m[1];
+		float r = s[2 * n] * m[2] + s[2 * n + 1] * m[3];
+		if (add) {
+			d[2 * n] += l;
+			d[2 * n + 1] += r;
+		} else {
+			d[2 * n] = l;
+			d[2 * n + 1] = r;
+		}
+	}
+}
+
+/* 5.1 to stereo, one frame at a time. The 6 products of each output
+ * channel are summed horizontally */
+static inline void
+matrix_6_2_f32_sse2(float *d, const float *s, const float *m, int n_frames, bool add)
+{
+	__m128 ml0 = _mm_loadu_ps(&m[0]);
+	__m128 ml1 = _mm_setr_ps(m[4], m[5], 0.0f, 0.0f);
+	__m128 mr0 = _mm_loadu_ps(&m[6]);
+	__m128 mr1 = _mm_setr_ps(m[10], m[11], 0.0f, 0.0f);
+	__m128 in0, in1, l, r, t;
+	int n;
+
+	for (n = 0; n < n_frames; n++) {
+		in0 = _mm_loadu_ps(&s[6 * n]);
+		in1 = _mm_loadl_pi(_mm_setzero_ps(), (const __m64 *)&s[6 * n + 4]);
+		l = _mm_add_ps(_mm_mul_ps(in0, ml0), _mm_mul_ps(in1, ml1));
+		r = _mm_add_ps(_mm_mul_ps(in0, mr0), _mm_mul_ps(in1, mr1));
+		/* l0+l2 r0+r2 l1+l3 r1+r3 */
+		t = _mm_add_ps(_mm_unpacklo_ps(l, r), _mm_unpackhi_ps(l, r));
+		t = _mm_add_ps(t, _mm_movehl_ps(t, t));
+		if (add)
+			t = _mm_add_ps(_mm_loadl_pi(_mm_setzero_ps(), (const __m64 *)&d[2 * n]), t);
+		_mm_storel_pi((__m64 *)&d[2 * n], t);
+	}
+}
+
+static void
+copy_matrix_1_2_f32_sse2(void *dst, const void *src, const float *matrix,
+		int n_dst, int n_src, int n_frames)
+{
+	matrix_1_2_f32_sse2(dst, src, matrix, n_frames, false);
+}
+
+static void
+add_matrix_1_2_f32_sse2(void *dst, const void *src, const float *matrix,
+		int n_dst, int n_src, int n_frames)
+{
+	matrix_1_2_f32_sse2(dst, src, matrix, n_frames, true);
+}
+
+static void
+copy_matrix_2_2_f32_sse2(void *dst, const void *src, const float *matrix,
+		int n_dst, int n_src, int n_frames)
+{
+	matrix_2_2_f32_sse2(dst, src, matrix, n_frames, false);
+}
+
+static void
+add_matrix_2_2_f32_sse2(void *dst, const void *src, const float *matrix,
+		int n_dst, int n_src, int n_frames)
+{
+	matrix_2_2_f32_sse2(dst, src, matrix, n_frames, true);
+}
+
+static void
+copy_matrix_6_2_f32_sse2(void *dst, const void *src, const float *matrix,
+		int n_dst, int n_src, int n_frames)
+{
+	matrix_6_2_f32_sse2(dst, src, matrix, n_frames, false);
+}
+
+static void
+add_matrix_6_2_f32_sse2(void *dst, const void *src, const float *matrix,
+		int n_dst, int n_src, int n_frames)
+{
+	matrix_6_2_f32_sse2(dst, src, matrix, n_frames, true);
+}
+
+void spa_audiomixer_get_ops_sse2(struct spa_audiomixer_ops *ops)
+{
+	ops->add[FMT_S16] = add_s16_sse2;
+	ops->add[FMT_F32] = add_f32_sse2;
+	ops->copy_scale[FMT_S16] = copy_scale_s16_sse2;
+	ops->copy_scale[FMT_F32] = copy_scale_f32_sse2;
+	ops->add_scale[FMT_S16] = add_scale_s16_sse2;
+	ops->add_scale[FMT_F32] = add_scale_f32_sse2;
+	ops->copy_ramp[FMT_F32] = copy_ramp_f32_sse2;
+	ops->add_ramp[FMT_F32] = add_ramp_f32_sse2;
+	ops->copy_matrix[FMT_F32][MIX_MATRIX_1_2] = copy_matrix_1_2_f32_sse2;
+	ops->copy_matrix[FMT_F32][MIX_MATRIX_2_2] = copy_matrix_2_2_f32_sse2;
+	ops->copy_matrix[FMT_F32][MIX_MATRIX_6_2] = copy_matrix_6_2_f32_sse2;
+	ops->add_matrix[FMT_F32][MIX_MATRIX_1_2] = add_matrix_1_2_f32_sse2;
+	ops->add_matrix[FMT_F32][MIX_MATRIX_2_2] = add_matrix_2_2_f32_sse2;
+	ops->add_matrix[FMT_F32][MIX_MATRIX_6_2] = add_matrix_6_2_f32_sse2;
+}
@@ -17,8 +17,39 @@
  * Boston, MA 02110-1301, USA.
  */
 
+#if defined (__arm__) && defined (HAVE_NEON)
+#include <sys/auxv.h>
+#endif
+
+#include <endian.h>
+
 #include "mix-ops.h"
 
+#define S24_MIN		-8388608
+#define S24_MAX		8388607
+
+static inline int32_t read_s24(const uint8_t *s)
+{
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+	return (int32_t) (((uint32_t) s[2] << 24) | ((uint32_t) s[1] << 16) | ((uint32_t) s[0] << 8)) >> 8;
+#else
+	return (int32_t) (((uint32_t) s[0] << 24) | ((uint32_t) s[1] << 16) | ((uint32_t) s[2] << 8)) >> 8;
+#endif
+}
+
+static inline void write_s24(uint8_t *d, int32_t v)
+{
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+	d[0] = v;
+	d[1] = v >> 8;
+	d[2] = v >> 16;
+#else
+	d[0] = v >> 16;
+	d[1] = v >> 8;
+	d[2] = v;
+#endif
+}
+
 static void
 clear_s16(void *dst, int n_bytes)
 {
@@ -255,8 +286,977 @@ add_scale_f32_i(void *dst, int dst_stride, const void *src, int src_stride, cons
 	}
 }
 
+static void
+clear_s24(void *dst, int n_bytes)
+{
+	memset(dst, 0, n_bytes);
+}
+
+static void
+copy_s24(void *dst, const void *src, int n_bytes)
+{
+	memcpy(dst, src, n_bytes);
+}
+
+static void
+clear_s24_32(void *dst, int n_bytes)
+{
+	memset(dst, 0, n_bytes);
+}
+
+static void
+copy_s24_32(void *dst, const void *src, int n_bytes)
+{
+	memcpy(dst, src, n_bytes);
+}
+
+static void
+clear_s32(void *dst, int n_bytes)
+{
+	memset(dst, 0, n_bytes);
+}
+
+static void
+copy_s32(void *dst, const void *src, int n_bytes)
+{
+	memcpy(dst, src, n_bytes);
+}
+
+static void
+clear_f64(void *dst, int n_bytes)
+{
+	memset(dst, 0, n_bytes);
+}
+
+static void
+copy_f64(void *dst, const void *src, int n_bytes)
+{
+	memcpy(dst, src, n_bytes);
+}
+
+static void
+add_s24(void *dst, const void *src, int n_bytes)
+{
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+	int32_t t;
+
+	n_bytes /= 3;
+	while (n_bytes--) {
+		t = read_s24(d) + read_s24(s);
+		write_s24(d, SPA_CLAMP(t, S24_MIN, S24_MAX));
+		d += 3;
+		s += 3;
+	}
+}
+
+static void
+copy_scale_s24(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+	int64_t v = scale * (1 << 16), t;
+
+	n_bytes /= 3;
+	while (n_bytes--) {
+		t = ((int64_t) read_s24(s) * v) >> 16;
+		write_s24(d, SPA_CLAMP(t, S24_MIN, S24_MAX));
+		d += 3;
+		s += 3;
+	}
+}
+
+static void
+copy_scale_s24_i(void *dst, int dst_stride, const void *src, int src_stride, const double scale, int n_bytes)
+{
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+	int64_t v = scale * (1 << 16), t;
+
+	n_bytes /= 3;
+	while (n_bytes--) {
+		t = ((int64_t) read_s24(s) * v) >> 16;
+		write_s24(d, SPA_CLAMP(t, S24_MIN, S24_MAX));
+		d += dst_stride * 3;
+		s += src_stride * 3;
+	}
+}
+
+static void
+add_scale_s24(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+	int64_t v = scale * (1 << 16), t;
+
+	n_bytes /= 3;
+	while (n_bytes--) {
+		t = read_s24(d) + (((int64_t) read_s24(s) * v) >> 16);
+		write_s24(d, SPA_CLAMP(t, S24_MIN, S24_MAX));
+		d += 3;
+		s += 3;
+	}
+}
+
+static void
+add_scale_s24_i(void *dst, int dst_stride, const void *src, int src_stride, const double scale, int n_bytes)
+{
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+	int64_t v = scale * (1 << 16), t;
+
+	n_bytes /= 3;
+	while (n_bytes--) {
+		t = read_s24(d) + (((int64_t) read_s24(s) * v) >> 16);
+		write_s24(d, SPA_CLAMP(t, S24_MIN, S24_MAX));
+		d += dst_stride * 3;
+		s += src_stride * 3;
+	}
+}
+
+static void
+copy_s24_i(void *dst, int dst_stride, const void *src, int src_stride, int n_bytes)
+{
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+
+	n_bytes /= 3;
+	while (n_bytes--) {
+		d[0] = s[0];
+		d[1] = s[1];
+		d[2] = s[2];
+		d += dst_stride * 3;
+		s += src_stride * 3;
+	}
+}
+
+static void
+add_s24_i(void *dst, int dst_stride, const void *src, int src_stride, int n_bytes)
+{
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+	int32_t t;
+
+	n_bytes /= 3;
+	while (n_bytes--) {
+		t = read_s24(d) + read_s24(s);
+		write_s24(d, SPA_CLAMP(t, S24_MIN, S24_MAX));
+		d += dst_stride * 3;
+		s += src_stride * 3;
+	}
+}
+
+static void
+copy_s24_32_i(void *dst, int dst_stride, const void *src, int src_stride, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+
+	n_bytes /= sizeof(int32_t);
+	while (n_bytes--) {
+		*d = *s;
+		d += dst_stride;
+		s += src_stride;
+	}
+}
+
+static void
+add_s24_32(void *dst, const void *src, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int32_t t;
+
+	n_bytes /= sizeof(int32_t);
+	while (n_bytes--) {
+		t = *d + *s;
+		*d = SPA_CLAMP(t, S24_MIN, S24_MAX);
+		d++;
+		s++;
+	}
+}
+
+static void
+add_s24_32_i(void *dst, int dst_stride, const void *src, int src_stride, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int32_t t;
+
+	n_bytes /= sizeof(int32_t);
+	while (n_bytes--) {
+		t = *d + *s;
+		*d = SPA_CLAMP(t, S24_MIN, S24_MAX);
+		d += dst_stride;
+		s += src_stride;
+	}
+}
+
+static void
+copy_scale_s24_32(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int64_t v = scale * (1 << 16), t;
+
+	n_bytes /= sizeof(int32_t);
+	while (n_bytes--) {
+		t = (*s * v) >> 16;
+		*d = SPA_CLAMP(t, S24_MIN, S24_MAX);
+		d++;
+		s++;
+	}
+}
+
+static void
+copy_scale_s24_32_i(void *dst, int dst_stride, const void *src, int src_stride, const double scale, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int64_t v = scale * (1 << 16), t;
+
+	n_bytes /= sizeof(int32_t);
+	while (n_bytes--) {
+		t = (*s * v) >> 16;
+		*d = SPA_CLAMP(t, S24_MIN, S24_MAX);
+		d += dst_stride;
+		s += src_stride;
+	}
+}
+
+static void
+add_scale_s24_32(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int64_t v = scale * (1 << 16), t;
+
+	n_bytes /= sizeof(int32_t);
+	while (n_bytes--) {
+		t = *d + ((*s * v) >> 16);
+		*d = SPA_CLAMP(t, S24_MIN, S24_MAX);
+		d++;
+		s++;
+	}
+}
+
+static void
+add_scale_s24_32_i(void *dst, int dst_stride, const void *src, int src_stride, const double scale, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int64_t v = scale * (1 << 16), t;
+
+	n_bytes /= sizeof(int32_t);
+	while (n_bytes--) {
+		t = *d + ((*s * v) >> 16);
+		*d = SPA_CLAMP(t, S24_MIN, S24_MAX);
+		d += dst_stride;
+		s += src_stride;
+	}
+}
+
+static void
+copy_s32_i(void *dst, int dst_stride, const void *src, int src_stride, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+
+	n_bytes /= sizeof(int32_t);
+	while (n_bytes--) {
+		*d = *s;
+		d += dst_stride;
+		s += src_stride;
+	}
+}
+
+static void
+add_s32(void *dst, const void *src, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int64_t t;
+
+	n_bytes /= sizeof(int32_t);
+	while (n_bytes--) {
+		t = (int64_t) *d + *s;
+		*d = SPA_CLAMP(t, INT32_MIN, INT32_MAX);
+		d++;
+		s++;
+	}
+}
+
+static void
+add_s32_i(void *dst, int dst_stride, const void *src, int src_stride, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int64_t t;
+
+	n_bytes /= sizeof(int32_t);
+	while (n_bytes--) {
+		t = (int64_t) *d + *s;
+		*d = SPA_CLAMP(t, INT32_MIN, INT32_MAX);
+		d += dst_stride;
+		s += src_stride;
+	}
+}
+
+static void
+copy_scale_s32(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int64_t v = scale * (1 << 16), t;
+
+	n_bytes /= sizeof(int32_t);
+	while (n_bytes--) {
+		t = (*s * v) >> 16;
+		*d = SPA_CLAMP(t, INT32_MIN, INT32_MAX);
+		d++;
+		s++;
+	}
+}
+
+static void
+copy_scale_s32_i(void *dst, int dst_stride, const void *src, int src_stride, const double scale, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int64_t v = scale * (1 << 16), t;
+
+	n_bytes /= sizeof(int32_t);
+	while (n_bytes--) {
+		t = (*s * v) >> 16;
+		*d = SPA_CLAMP(t, INT32_MIN, INT32_MAX);
+		d += dst_stride;
+		s += src_stride;
+	}
+}
+
+static void
+add_scale_s32(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int64_t v = scale * (1 << 16), t;
+
+	n_bytes /= sizeof(int32_t);
+	while (n_bytes--) {
+		t = *d + ((*s * v) >> 16);
+		*d = SPA_CLAMP(t, INT32_MIN, INT32_MAX);
+		d++;
+		s++;
+	}
+}
+
+static void
+add_scale_s32_i(void *dst, int dst_stride, const void *src, int src_stride, const double scale, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int64_t v = scale * (1 << 16), t;
+
+	n_bytes /= sizeof(int32_t);
+	while (n_bytes--) {
+		t = *d + ((*s * v) >> 16);
+		*d = SPA_CLAMP(t, INT32_MIN, INT32_MAX);
+		d += dst_stride;
+		s += src_stride;
+	}
+}
+
+static void
+copy_f64_i(void *dst, int dst_stride, const void *src, int src_stride, int n_bytes)
+{
+	const double *s = src;
+	double *d = dst;
+
+	n_bytes /= sizeof(double);
+	while (n_bytes--) {
+		*d = *s;
+		d += dst_stride;
+		s += src_stride;
+	}
+}
+
+static void
+add_f64(void *dst, const void *src, int n_bytes)
+{
+	const double *s = src;
+	double *d = dst;
+
+	n_bytes /= sizeof(double);
+	while (n_bytes--) {
+		*d += *s;
+		d++;
+		s++;
+	}
+}
+
+static void
+add_f64_i(void *dst, int dst_stride, const void *src, int src_stride, int n_bytes)
+{
+	const double *s = src;
+	double *d = dst;
+
+	n_bytes /= sizeof(double);
+	while (n_bytes--) {
+		*d += *s;
+		d += dst_stride;
+		s += src_stride;
+	}
+}
+
+static void
+copy_scale_f64(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const double *s = src;
+	double *d = dst;
+
+	n_bytes /= sizeof(double);
+	while (n_bytes--) {
+		*d = *s * scale;
+		d++;
+		s++;
+	}
+}
+
+static void
+copy_scale_f64_i(void *dst, int dst_stride, const void *src, int src_stride, const double scale, int n_bytes)
+{
+	const double *s = src;
+	double *d = dst;
+
+	n_bytes /= sizeof(double);
+	while (n_bytes--) {
+		*d = *s * scale;
+		d += dst_stride;
+		s += src_stride;
+	}
+}
+
+static void
+add_scale_f64(void *dst, const void *src, const double scale, int n_bytes)
+{
+	const double *s = src;
+	double *d = dst;
+
+	n_bytes /= sizeof(double);
+	while (n_bytes--) {
+		*d += *s * scale;
+		d++;
+		s++;
+	}
+}
+
+static void
+add_scale_f64_i(void *dst, int dst_stride, const void *src, int src_stride, const double scale, int n_bytes)
+{
+	const double *s = src;
+	double *d = dst;
+
+	n_bytes /= sizeof(double);
+	while (n_bytes--) {
+		*d += *s * scale;
+		d += dst_stride;
+		s += src_stride;
+	}
+}
+
+static void
+copy_ramp_s16(void *dst, const void *src, int n_channels, double start, double step, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int i, n, n_frames = n_bytes / (sizeof(int16_t) * n_channels);
+	int32_t v, t;
+
+	for (n = 0; n < n_frames; n++) {
+		v = (start + step * n) * (1 << 11);
+
+		for (i = 0; i < n_channels; i++) {
+			t = (*s * v) >> 11;
+			*d++ = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+			s++;
+		}
+	}
+}
+
+static void
+add_ramp_s16(void *dst, const void *src, int n_channels, double start, double step, int n_bytes)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int i, n, n_frames = n_bytes / (sizeof(int16_t) * n_channels);
+	int32_t v, t;
+
+	for (n = 0; n < n_frames; n++) {
+		v = (start + step * n) * (1 << 11);
+
+		for (i = 0; i < n_channels; i++) {
+			t = *d + ((*s * v) >> 11);
+			*d++ = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+			s++;
+		}
+	}
+}
+
+static void
+copy_ramp_s24(void *dst, const void *src, int n_channels, double start, double step, int n_bytes)
+{
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+	int i, n, n_frames = n_bytes / (3 * n_channels);
+	int64_t v, t;
+
+	for (n = 0; n < n_frames; n++) {
+		v = (start + step * n) * (1 << 16);
+
+		for (i = 0; i < n_channels; i++) {
+			t = ((int64_t) read_s24(s) * v) >> 16;
+			write_s24(d, SPA_CLAMP(t, S24_MIN, S24_MAX));
+			d += 3;
+			s += 3;
+		}
+	}
+}
+
+static void
+add_ramp_s24(void *dst, const void *src, int n_channels, double start, double step, int n_bytes)
+{
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+	int i, n, n_frames = n_bytes / (3 * n_channels);
+	int64_t v, t;
+
+	for (n = 0; n < n_frames; n++) {
+		v = (start + step * n) * (1 << 16);
+
+		for (i = 0; i < n_channels; i++) {
+			t = read_s24(d) + (((int64_t) read_s24(s) * v) >> 16);
+			write_s24(d, SPA_CLAMP(t, S24_MIN, S24_MAX));
+			d += 3;
+			s += 3;
+		}
+	}
+}
+
+static void
+copy_ramp_s24_32(void *dst, const void *src, int n_channels, double start, double step, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int i, n, n_frames = n_bytes / (sizeof(int32_t) * n_channels);
+	int64_t v, t;
+
+	for (n = 0; n < n_frames; n++) {
+		v = (start + step * n) * (1 << 16);
+
+		for (i = 0; i < n_channels; i++) {
+			t = (*s * v) >> 16;
+			*d++ = SPA_CLAMP(t, S24_MIN, S24_MAX);
+			s++;
+		}
+	}
+}
+
+static void
+add_ramp_s24_32(void *dst, const void *src, int n_channels, double start, double step, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int i, n, n_frames = n_bytes / (sizeof(int32_t) * n_channels);
+	int64_t v, t;
+
+	for (n = 0; n < n_frames; n++) {
+		v = (start + step * n) * (1 << 16);
+
+		for (i = 0; i < n_channels; i++) {
+			t = *d + ((*s * v) >> 16);
+			*d++ = SPA_CLAMP(t, S24_MIN, S24_MAX);
+			s++;
+		}
+	}
+}
+
+static void
+copy_ramp_s32(void *dst, const void *src, int n_channels, double start, double step, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int i, n, n_frames = n_bytes / (sizeof(int32_t) * n_channels);
+	int64_t v, t;
+
+	for (n = 0; n < n_frames; n++) {
+		v = (start + step * n) * (1 << 16);
+
+		for (i = 0; i < n_channels; i++) {
+			t = (*s * v) >> 16;
+			*d++ = SPA_CLAMP(t, INT32_MIN, INT32_MAX);
+			s++;
+		}
+	}
+}
+
+static void
+add_ramp_s32(void *dst, const void *src, int n_channels, double start, double step, int n_bytes)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int i, n, n_frames = n_bytes / (sizeof(int32_t) * n_channels);
+	int64_t v, t;
+
+	for (n = 0; n < n_frames; n++) {
+		v = (start + step * n) * (1 << 16);
+
+		for (i = 0; i < n_channels; i++) {
+			t = *d + ((*s * v) >> 16);
+			*d++ = SPA_CLAMP(t, INT32_MIN, INT32_MAX);
+			s++;
+		}
+	}
+}
+
+static void
+copy_ramp_f32(void *dst, const void *src, int n_channels, double start, double step, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	int i, n, n_frames = n_bytes / (sizeof(float) * n_channels);
+
+	for (n = 0; n < n_frames; n++) {
+		float v = start + step * n;
+
+		for (i = 0; i < n_channels; i++)
+			*d++ = *s++ * v;
+	}
+}
+
+static void
+add_ramp_f32(void *dst, const void *src, int n_channels, double start, double step, int n_bytes)
+{
+	const float *s = src;
+	float *d = dst;
+	int i, n, n_frames = n_bytes / (sizeof(float) * n_channels);
+
+	for (n = 0; n < n_frames; n++) {
+		float v = start + step * n;
+
+		for (i = 0; i < n_channels; i++)
+			*d++ += *s++ * v;
+	}
+}
+
+static void
+copy_ramp_f64(void *dst, const void *src, int n_channels, double start, double step, int n_bytes)
+{
+	const double *s = src;
+	double *d = dst;
+	int i, n, n_frames = n_bytes / (sizeof(double) * n_channels);
+
+	for (n = 0; n < n_frames; n++) {
+		double v = start + step * n;
+
+		for (i = 0; i < n_channels; i++)
+			*d++ = *s++ * v;
+	}
+}
+
+static void
+add_ramp_f64(void *dst, const void *src, int n_channels, double start, double step, int n_bytes)
+{
+	const double *s = src;
+	double *d = dst;
+	int i, n, n_frames = n_bytes / (sizeof(double) * n_channels);
+
+	for (n = 0; n < n_frames; n++) {
+		double v = start + step * n;
+
+		for (i = 0; i < n_channels; i++)
+			*d++ += *s++ * v;
+	}
+}
+
+static void
+copy_matrix_s16(void *dst, const void *src, const float *matrix,
+		int n_dst, int n_src, int n_frames)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int c, j, n;
+	double t;
+
+	for (n = 0; n < n_frames; n++) {
+		for (c = 0; c < n_dst; c++) {
+			t = 0.0;
+			for (j = 0; j < n_src; j++)
+				t += s[j] * matrix[c * n_src + j];
+			d[c] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+		}
+		d += n_dst;
+		s += n_src;
+	}
+}
+
+static void
+add_matrix_s16(void *dst, const void *src, const float *matrix,
+		int n_dst, int n_src, int n_frames)
+{
+	const int16_t *s = src;
+	int16_t *d = dst;
+	int c, j, n;
+	double t;
+
+	for (n = 0; n < n_frames; n++) {
+		for (c = 0; c < n_dst; c++) {
+			t = d[c];
+			for (j = 0; j < n_src; j++)
+				t += s[j] * matrix[c * n_src + j];
+			d[c] = SPA_CLAMP(t, INT16_MIN, INT16_MAX);
+		}
+		d += n_dst;
+		s += n_src;
+	}
+}
+
+static void
+copy_matrix_s24(void *dst, const void *src, const float *matrix,
+		int n_dst, int n_src, int n_frames)
+{
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+	int c, j, n;
+	double t;
+
+	for (n = 0; n < n_frames; n++) {
+		for (c = 0; c < n_dst; c++) {
+			t = 0.0;
+			for (j = 0; j < n_src; j++)
+				t += read_s24(&s[j * 3]) * matrix[c * n_src + j];
+			write_s24(&d[c * 3], SPA_CLAMP(t, S24_MIN, S24_MAX));
+		}
+		d += n_dst * 3;
+		s += n_src * 3;
+	}
+}
+
+static void
+add_matrix_s24(void *dst, const void *src, const float *matrix,
+		int n_dst, int n_src, int n_frames)
+{
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+	int c, j, n;
+	double t;
+
+	for (n = 0; n < n_frames; n++) {
+		for (c = 0; c < n_dst; c++) {
+			t = read_s24(&d[c * 3]);
+			for (j = 0; j < n_src; j++)
+				t += read_s24(&s[j * 3]) * matrix[c * n_src + j];
+			write_s24(&d[c * 3], SPA_CLAMP(t, S24_MIN, S24_MAX));
+		}
+		d += n_dst * 3;
+		s += n_src * 3;
+	}
+}
+
+static void
+copy_matrix_s24_32(void *dst, const void *src, const float *matrix,
+		int n_dst, int n_src, int n_frames)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int c, j, n;
+	double t;
+
+	for (n = 0; n < n_frames; n++) {
+		for (c = 0; c < n_dst; c++) {
+			t = 0.0;
+			for (j = 0; j < n_src; j++)
+				t += s[j] * matrix[c * n_src + j];
+			d[c] = SPA_CLAMP(t, S24_MIN, S24_MAX);
+		}
+		d += n_dst;
+		s += n_src;
+	}
+}
+
+static void
+add_matrix_s24_32(void *dst, const void *src, const float *matrix,
+		int n_dst, int n_src, int n_frames)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int c, j, n;
+	double t;
+
+	for (n = 0; n < n_frames; n++) {
+		for (c = 0; c < n_dst; c++) {
+			t = d[c];
+			for (j = 0; j < n_src; j++)
+				t += s[j] * matrix[c * n_src + j];
+			d[c] = SPA_CLAMP(t, S24_MIN, S24_MAX);
+		}
+		d += n_dst;
+		s += n_src;
+	}
+}
+
+static void
+copy_matrix_s32(void *dst, const void *src, const float *matrix,
+		int n_dst, int n_src, int n_frames)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int c, j, n;
+	double t;
+
+	for (n = 0; n < n_frames; n++) {
+		for (c = 0; c < n_dst; c++) {
+			t = 0.0;
+			for (j = 0; j < n_src; j++)
+				t += s[j] * matrix[c * n_src + j];
+			d[c] = SPA_CLAMP(t, INT32_MIN, INT32_MAX);
+		}
+		d += n_dst;
+		s += n_src;
+	}
+}
+
+static void
+add_matrix_s32(void *dst, const void *src, const float *matrix,
+		int n_dst, int n_src, int n_frames)
+{
+	const int32_t *s = src;
+	int32_t *d = dst;
+	int c, j, n;
+	double t;
+
+	for (n = 0; n < n_frames; n++) {
+		for (c = 0; c < n_dst; c++) {
+			t = d[c];
+			for (j = 0; j < n_src; j++)
+				t += s[j] * matrix[c * n_src + j];
+			d[c] = SPA_CLAMP(t, INT32_MIN, INT32_MAX);
+		}
+		d += n_dst;
+		s += n_src;
+	}
+}
+
+static void
+copy_matrix_f32(void *dst, const void *src, const float *matrix,
+		int n_dst, int n_src, int n_frames)
+{
+	const float *s = src;
+	float *d = dst;
+	int c, j, n;
+	float t;
+
+	for (n = 0; n < n_frames; n++) {
+		for (c = 0; c < n_dst; c++) {
+			t = 0.0;
+			for (j = 0; j < n_src; j++)
+				t += s[j] * matrix[c * n_src + j];
+			d[c] = t;
+		}
+		d += n_dst;
+		s += n_src;
+	}
+}
+
+static void
+add_matrix_f32(void *dst, const void *src, const float *matrix,
+		int n_dst, int n_src, int n_frames)
+{
+	const float *s = src;
+	float *d = dst;
+	int c, j, n;
+	float t;
+
+	for (n = 0; n < n_frames; n++) {
+		for (c = 0; c < n_dst; c++) {
+			t = d[c];
+			for (j = 0; j < n_src; j++)
+				t += s[j] * matrix[c * n_src + j];
+			d[c] = t;
+		}
+		d += n_dst;
+		s += n_src;
+	}
+}
+
+static void
+copy_matrix_f64(void *dst, const void *src, const float *matrix,
+		int n_dst, int n_src, int n_frames)
+{
+	const double *s = src;
+	double *d = dst;
+	int c, j, n;
+	double t;
+
+	for (n = 0; n < n_frames; n++) {
+		for (c = 0; c < n_dst; c++) {
+			t = 0.0;
+			for (j = 0; j < n_src; j++)
+				t += s[j] * matrix[c * n_src + j];
+			d[c] = t;
+		}
+		d += n_dst;
+		s += n_src;
+	}
+}
+
+static void
+add_matrix_f64(void *dst, const void *src, const float *matrix,
+		int n_dst, int n_src, int n_frames)
+{
+	const double *s = src;
+	double *d = dst;
+	int c, j, n;
+	double t;
+
+	for (n = 0; n < n_frames; n++) {
+		for (c = 0; c < n_dst; c++) {
+			t = d[c];
+			for (j = 0; j < n_src; j++)
+				t += s[j] * matrix[c * n_src + j];
+			d[c] = t;
+		}
+		d += n_dst;
+		s += n_src;
+	}
+}
+
+static uint32_t get_cpu_flags(void)
+{
+	uint32_t flags = 0;
+
+#if defined (__i386__) || defined (__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+		flags |= MIX_CPU_FLAG_SSE2;
+	if (__builtin_cpu_supports("avx2"))
+		flags |= MIX_CPU_FLAG_AVX2;
+#elif defined (__aarch64__)
+	/* NEON is mandatory on aarch64 */
+	flags |= MIX_CPU_FLAG_NEON;
+#elif defined (__arm__) && defined (HAVE_NEON)
+#ifndef HWCAP_ARM_NEON
+#define HWCAP_ARM_NEON	(1 << 12)
+#endif
+	if (getauxval(AT_HWCAP) & HWCAP_ARM_NEON)
+		flags |= MIX_CPU_FLAG_NEON;
+#endif
+	return flags;
+}
+
 void spa_audiomixer_get_ops(struct spa_audiomixer_ops *ops)
 {
+	int i;
+
 	ops->clear[FMT_S16] = clear_s16;
 	ops->clear[FMT_F32] = clear_f32;
 	ops->copy[FMT_S16] = copy_s16;
@@ -275,4 +1275,92 @@ void spa_audiomixer_get_ops(struct spa_audiomixer_ops *ops)
         ops->copy_scale_i[FMT_F32] = copy_scale_f32_i;
         ops->add_scale_i[FMT_S16] = add_scale_s16_i;
         ops->add_scale_i[FMT_F32] = add_scale_f32_i;
+	ops->clear[FMT_S24] = clear_s24;
+	ops->clear[FMT_S24_32] = clear_s24_32;
+	ops->clear[FMT_S32] = clear_s32;
+	ops->clear[FMT_F64] = clear_f64;
+	ops->copy[FMT_S24] = copy_s24;
+	ops->copy[FMT_S24_32] = copy_s24_32;
+	ops->copy[FMT_S32] = copy_s32;
+	ops->copy[FMT_F64] = copy_f64;
+	ops->add[FMT_S24] = add_s24;
+	ops->add[FMT_S24_32] = add_s24_32;
+	ops->add[FMT_S32] = add_s32;
+	ops->add[FMT_F64] = add_f64;
+	ops->copy_scale[FMT_S24] = copy_scale_s24;
+	ops->copy_scale[FMT_S24_32] = copy_scale_s24_32;
+	ops->copy_scale[FMT_S32] = copy_scale_s32;
+	ops->copy_scale[FMT_F64] = copy_scale_f64;
+	ops->add_scale[FMT_S24] = add_scale_s24;
+	ops->add_scale[FMT_S24_32] = add_scale_s24_32;
+	ops->add_scale[FMT_S32] = add_scale_s32;
+	ops->add_scale[FMT_F64] = add_scale_f64;
+	ops->copy_i[FMT_S24] = copy_s24_i;
+	ops->copy_i[FMT_S24_32] = copy_s24_32_i;
+	ops->copy_i[FMT_S32] = copy_s32_i;
+	ops->copy_i[FMT_F64] = copy_f64_i;
+	ops->add_i[FMT_S24] = add_s24_i;
+	ops->add_i[FMT_S24_32] = add_s24_32_i;
+	ops->add_i[FMT_S32] = add_s32_i;
+	ops->add_i[FMT_F64] = add_f64_i;
+	ops->copy_scale_i[FMT_S24] = copy_scale_s24_i;
+	ops->copy_scale_i[FMT_S24_32] = copy_scale_s24_32_i;
+	ops->copy_scale_i[FMT_S32] = copy_scale_s32_i;
+	ops->copy_scale_i[FMT_F64] = copy_scale_f64_i;
+	ops->add_scale_i[FMT_S24] = add_scale_s24_i;
+	ops->add_scale_i[FMT_S24_32] = add_scale_s24_32_i;
+	ops->add_scale_i[FMT_S32] = add_scale_s32_i;
+	ops->add_scale_i[FMT_F64] = add_scale_f64_i;
+	ops->copy_ramp[FMT_S16] = copy_ramp_s16;
+	ops->copy_ramp[FMT_S24] = copy_ramp_s24;
+	ops->copy_ramp[FMT_S24_32] = copy_ramp_s24_32;
+	ops->copy_ramp[FMT_S32] = copy_ramp_s32;
+	ops->copy_ramp[FMT_F32] = copy_ramp_f32;
+	ops->copy_ramp[FMT_F64] = copy_ramp_f64;
+	ops->add_ramp[FMT_S16] = add_ramp_s16;
+	ops->add_ramp[FMT_S24] = add_ramp_s24;
+	ops->add_ramp[FMT_S24_32] = add_ramp_s24_32;
+	ops->add_ramp[FMT_S32] = add_ramp_s32;
+	ops->add_ramp[FMT_F32] = add_ramp_f32;
+	ops->add_ramp[FMT_F64] = add_ramp_f64;
+	for (i = 0; i < MIX_MATRIX_MAX; i++)
+		ops->copy_matrix[FMT_S16][i] = copy_matrix_s16;
+	for (i = 0; i < MIX_MATRIX_MAX; i++)
+		ops->copy_matrix[FMT_S24][i] = copy_matrix_s24;
+	for (i = 0; i < MIX_MATRIX_MAX; i++)
+		ops->copy_matrix[FMT_S24_32][i] = copy_matrix_s24_32;
+	for (i = 0; i < MIX_MATRIX_MAX; i++)
+		ops->copy_matrix[FMT_S32][i] = copy_matrix_s32;
+	for (i = 0; i < MIX_MATRIX_MAX; i++)
+		ops->copy_matrix[FMT_F32][i] = copy_matrix_f32;
+	for (i = 0; i < MIX_MATRIX_MAX; i++)
+		ops->copy_matrix[FMT_F64][i] = copy_matrix_f64;
+	for (i = 0; i < MIX_MATRIX_MAX; i++)
+		ops->add_matrix[FMT_S16][i] = add_matrix_s16;
+	for (i = 0; i < MIX_MATRIX_MAX; i++)
+		ops->add_matrix[FMT_S24][i] = add_matrix_s24;
+	for (i = 0; i < MIX_MATRIX_MAX; i++)
+		ops->add_matrix[FMT_S24_32][i] = add_matrix_s24_32;
+	for (i = 0; i < MIX_MATRIX_MAX; i++)
+		ops->add_matrix[FMT_S32][i] = add_matrix_s32;
+	for (i = 0; i < MIX_MATRIX_MAX; i++)
+		ops->add_matrix[FMT_F32][i] = add_matrix_f32;
+	for (i = 0; i < MIX_MATRIX_MAX; i++)
+		ops->add_matrix[FMT_F64][i] = add_matrix_f64;
+
+	/* override the scalar versions with the best optimized ones
+	 * the cpu supports, the later ones take precedence */
+	ops->cpu_flags = get_cpu_flags();
+#if defined (HAVE_SSE2)
+	if (ops->cpu_flags & MIX_CPU_FLAG_SSE2)
+		spa_audiomixer_get_ops_sse2(ops);
+#endif
+#if defined (HAVE_AVX2)
+	if (ops->cpu_flags & MIX_CPU_FLAG_AVX2)
+		spa_audiomixer_get_ops_avx2(ops);
+#endif
+#if defined (HAVE_NEON)
+	if (ops->cpu_flags & MIX_CPU_FLAG_NEON)
+		spa_audiomixer_get_ops_neon(ops);
+#endif
 }
@@ -25,6 +25,10 @@
 typedef void (*mix_clear_func_t) (void *dst, int n_bytes);
 typedef void (*mix_func_t) (void *dst, const void *src, int n_bytes);
 typedef void (*mix_scale_func_t) (void *dst, const void *src, const double scale, int n_bytes);
+typedef void (*mix_ramp_func_t) (void *dst, const void *src, int n_channels,
+				 double start, double step, int n_bytes);
+typedef void (*mix_matrix_func_t) (void *dst, const void *src, const float *matrix,
+				   int n_dst, int n_src, int n_frames);
 typedef void (*mix_i_func_t) (void *dst, int dst_stride,
 			      const void *src, int src_stride, int n_bytes);
 typedef void (*mix_scale_i_func_t) (void *dst, int dst_stride,
@@ -32,11 +36,41 @@ typedef void (*mix_scale_i_func_t) (void *dst, int dst_stride,
 
 enum {
 	FMT_S16,
+	FMT_S24,
+	FMT_S24_32,
+	FMT_S32,
 	FMT_F32,
+	FMT_F64,
 	FMT_MAX,
 };
 
+/* channel layouts with specialized matrix kernels */
+enum {
+	MIX_MATRIX_ANY,
+	MIX_MATRIX_1_2,
+	MIX_MATRIX_2_2,
+	MIX_MATRIX_6_2,
+	MIX_MATRIX_MAX,
+};
+
+static inline int mix_matrix_shape(int n_dst, int n_src)
+{
+	if (n_dst == 2) {
+		switch (n_src) {
+		case 1:
+			return MIX_MATRIX_1_2;
+		case 2:
+			return MIX_MATRIX_2_2;
+		case 6:
+			return MIX_MATRIX_6_2;
+		}
+	}
+	return MIX_MATRIX_ANY;
+}
+
 struct spa_audiomixer_ops {
+	uint32_t cpu_flags;
+
 	mix_clear_func_t clear[FMT_MAX];
 	mix_func_t copy[FMT_MAX];
 	mix_func_t add[FMT_MAX];
@@ -46,6 +80,28 @@ struct spa_audiomixer_ops {
 	mix_i_func_t add_i[FMT_MAX];
 	mix_scale_i_func_t copy_scale_i[FMT_MAX];
 	mix_scale_i_func_t add_scale_i[FMT_MAX];
+	/* scale with a gain that changes linearly from start, adding step
+	 * after each frame of n_channels samples */
+	mix_ramp_func_t copy_ramp[FMT_MAX];
+	mix_ramp_func_t add_ramp[FMT_MAX];
+	/* remix interleaved frames of n_src channels into n_dst channels,
+	 * matrix has n_dst rows of n_src gains */
+	mix_matrix_func_t copy_matrix[FMT_MAX][MIX_MATRIX_MAX];
+	mix_matrix_func_t add_matrix[FMT_MAX][MIX_MATRIX_MAX];
 };
 
+#define MIX_CPU_FLAG_SSE2	(1 << 0)
+#define MIX_CPU_FLAG_AVX2	(1 << 1)
+#define MIX_CPU_FLAG_NEON	(1 << 2)
+
 void spa_audiomixer_get_ops(struct spa_audiomixer_ops *ops);
+
+#if defined (HAVE_SSE2)
+void spa_audiomixer_get_ops_sse2(struct spa_audiomixer_ops *ops);
+#endif
+#if defined (HAVE_AVX2)
+void spa_audiomixer_get_ops_avx2(struct spa_audiomixer_ops *ops);
+#endif
+#if defined (HAVE_NEON)
+void spa_audiomixer_get_ops_neon(struct spa_audiomixer_ops *ops);
+#endif
@@ -20,6 +20,7 @@
 #include <errno.h>
 #include <string.h>
 #include <stddef.h>
+#include <stdlib.h>
 
 #include <spa/support/log.h>
 #include <spa/support/type-map.h>
@@ -33,10 +34,15 @@
 
 #include <lib/pod.h>
 
+#include "mix-ops.h"
+
 #define NAME "volume"
 
 #define DEFAULT_VOLUME 1.0
 #define DEFAULT_MUTE false
+#define DEFAULT_RAMP_FRAMES 256
+#define MAX_RAMP_FRAMES 65536
+#define MAX_BOUNCE_SIZE 1024
 
 struct props {
 	double volume;
@@ -132,6 +138,20 @@ struct impl {
 	struct spa_audio_info current_format;
 	int bpf;
 
+	struct spa_audiomixer_ops ops;
+	mix_func_t copy;
+	mix_scale_func_t copy_scale;
+	mix_ramp_func_t copy_ramp;
+
+	bool have_volume;
+	double volume;
+	double ramp_target;
+	double ramp_step;
+	uint32_t ramp_left;
+	uint32_t ramp_frames;
+
+	uint8_t bounce[MAX_BOUNCE_SIZE];
+
 	struct port in_ports[1];
 	struct port out_ports[1];
 
@@ -376,8 +396,9 @@ static int port_enum_formats(struct spa_node *node,
 			"I", t->media_type.audio,
 			"I", t->media_subtype.raw,
 			":", t->format_audio.format,  "Ieu", t->audio_format.S16,
-				SPA_POD_PROP_ENUM(2, t->audio_format.S16,
-						     t->audio_format.S32),
+				SPA_POD_PROP_ENUM(3, t->audio_format.S16,
+						     t->audio_format.S32,
+						     t->audio_format.F32),
 			":", t->format_audio.rate,    "iru", 44100,
 				SPA_POD_PROP_MIN_MAX(1, INT32_MAX),
 			":", t->format_audio.channels,"iru", 2,
@@ -557,6 +578,8 @@ static int port_set_format(struct spa_node *node,
 		clear_buffers(this, port);
 	} else {
 		struct spa_audio_info info = { 0 };
+		uint32_t size;
+		int fmt;
 
 		spa_pod_object_parse(format,
 			"I", &info.media_type,
@@ -569,8 +592,27 @@ static int port_set_format(struct spa_node *node,
 		if (spa_format_audio_raw_parse(format, &info.info.raw, &this->type.format_audio) < 0)
 			return -EINVAL;
 
-		this->bpf = 2 * info.info.raw.channels;
+		if (info.info.raw.format == this->type.audio_format.S16) {
+			fmt = FMT_S16;
+			size = sizeof(int16_t);
+		}
+		else if (info.info.raw.format == this->type.audio_format.S32) {
+			fmt = FMT_S32;
+			size = sizeof(int32_t);
+		}
+		else if (info.info.raw.format == this->type.audio_format.F32) {
+			fmt = FMT_F32;
+			size = sizeof(float);
+		}
+		else
+			return -EINVAL;
+
+		this->copy = this->ops.copy[fmt];
+		this->copy_scale = this->ops.copy_scale[fmt];
+		this->copy_ramp = this->ops.copy_ramp[fmt];
+		this->bpf = size * info.info.raw.channels;
 		this->current_format = info;
+		this->have_volume = false;
 		port->have_format = true;
 	}
 
@@ -753,16 +795,32 @@ static struct spa_buffer *find_free_buffer(struct impl *this, struct port *port)
 	return b->outbuf;
 }
 
+/* start a new ramp when the volume or mute changed */
+static void update_volume(struct impl *this)
+{
+	double target = this->props.mute ? 0.0 : this->props.volume;
+
+	if (!this->have_volume || this->ramp_frames == 0) {
+		this->volume = this->ramp_target = target;
+		this->ramp_left = 0;
+		this->have_volume = true;
+	}
+	else if (target != this->ramp_target) {
+		this->ramp_target = target;
+		this->ramp_step = (target - this->volume) / this->ramp_frames;
+		this->ramp_left = this->ramp_frames;
+	}
+}
+
 static void do_volume(struct impl *this, struct spa_buffer *dbuf, struct spa_buffer *sbuf)
 {
-	uint32_t i, n_samples, n_bytes;
+	uint32_t n_bytes, n_frames;
 	struct spa_data *sd, *dd;
-	int16_t *src, *dst;
-	double volume;
+	void *src, *dst;
 	uint32_t written, towrite, savail, davail;
 	uint32_t sindex, dindex;
 
-	volume = this->props.volume;
+	update_volume(this);
 
 	sd = sbuf->datas;
 	dd = dbuf->datas;
@@ -774,21 +832,51 @@ static void do_volume(struct impl *this, struct spa_buffer *dbuf, struct spa_buf
 	davail = dd[0].maxsize - davail;
 
 	towrite = SPA_MIN(savail, davail);
+	towrite -= towrite % this->bpf;
 	written = 0;
 
 	while (written < towrite) {
 		uint32_t soffset = sindex % sd[0].maxsize;
 		uint32_t doffset = dindex % dd[0].maxsize;
 
-		src = SPA_MEMBER(sd[0].data, soffset, int16_t);
-		dst = SPA_MEMBER(dd[0].data, doffset, int16_t);
+		src = SPA_MEMBER(sd[0].data, soffset, void);
+		dst = SPA_MEMBER(dd[0].data, doffset, void);
 
-		n_bytes = SPA_MIN(towrite, sd[0].maxsize - soffset);
+		n_bytes = SPA_MIN(towrite - written, sd[0].maxsize - soffset);
 		n_bytes = SPA_MIN(n_bytes, dd[0].maxsize - doffset);
 
-		n_samples = n_bytes / sizeof(int16_t);
-		for (i = 0; i < n_samples; i++)
-			dst[i] = src[i] * volume;
+		n_frames = n_bytes / this->bpf;
+		if (n_frames == 0) {
+			/* the next source frame wraps around the end of the ring,
+			 * copy it in one piece to the bounce buffer */
+			uint32_t head = sd[0].maxsize - soffset;
+
+			if (this->bpf > MAX_BOUNCE_SIZE) {
+				spa_log_warn(this->log, NAME " %p: frame size %d too large", this, this->bpf);
+				break;
+			}
+			memcpy(this->bounce, src, head);
+			memcpy(this->bounce + head, sd[0].data, this->bpf - head);
+			src = this->bounce;
+			n_frames = 1;
+		}
+		if (this->ramp_left > 0)
+			n_frames = SPA_MIN(n_frames, this->ramp_left);
+		n_bytes = n_frames * this->bpf;
+		spa_assert_se(n_bytes > 0);
+
+		if (this->ramp_left > 0) {
+			this->copy_ramp(dst, src, this->current_format.info.raw.channels,
+					this->volume, this->ramp_step, n_bytes);
+
+			this->ramp_left -= n_frames;
+			this->volume = this->ramp_left > 0 ?
+				this->volume + this->ramp_step * n_frames : this->ramp_target;
+		}
+		else if (this->volume < 0.999 || this->volume > 1.001)
+			this->copy_scale(dst, src, this->volume, n_bytes);
+		else
+			this->copy(dst, src, n_bytes);
 
 		sindex += n_bytes;
 		dindex += n_bytes;
@@ -932,6 +1020,7 @@ impl_init(const struct spa_handle_factory *factory,
 {
 	struct impl *this;
 	uint32_t i;
+	const char *str;
 
 	spa_return_val_if_fail(factory != NULL, -EINVAL);
 	spa_return_val_if_fail(handle != NULL, -EINVAL);
@@ -956,6 +1045,22 @@ impl_init(const struct spa_handle_factory *factory,
 	this->node = impl_node;
 	reset_props(&this->props);
 
+	this->ramp_frames = DEFAULT_RAMP_FRAMES;
+	if (info && (str = spa_dict_lookup(info, "volume.ramp-frames"))) {
+		char *end;
+		unsigned long val;
+
+		errno = 0;
+		val = strtoul(str, &end, 0);
+		if (errno != 0 || end == str || *end != '\0' || str[strspn(str, " \t")] == '-') {
+			spa_log_warn(this->log, NAME " %p: invalid ramp-frames \"%s\"", this, str);
+		} else {
+			this->ramp_frames = SPA_MIN(val, MAX_RAMP_FRAMES);
+		}
+	}
+
+	spa_audiomixer_get_ops(&this->ops);
+
 	this->in_ports[0].info.flags = SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS |
 	    SPA_PORT_INFO_FLAG_IN_PLACE;
 	spa_list_init(&this->in_ports[0].empty);
@@ -0,0 +1,173 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Helpers shared by the benchmark programs. Include this from exactly one
+ * file of the benchmark, it overrides malloc, calloc and realloc to count
+ * the allocations done by the program and the plugins it loads. Counting
+ * needs glibc, elsewhere the allocations are reported as null. */
+
+#ifndef __SPA_TESTS_BENCH_H__
+#define __SPA_TESTS_BENCH_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include <spa/utils/defs.h>
+
+static uint64_t bench_n_allocs;
+
+#ifdef __GLIBC__
+#define BENCH_COUNT_ALLOCS
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+	__atomic_add_fetch(&bench_n_allocs, 1, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	__atomic_add_fetch(&bench_n_allocs, 1, __ATOMIC_RELAXED);
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	__atomic_add_fetch(&bench_n_allocs, 1, __ATOMIC_RELAXED);
+	return __libc_realloc(ptr, size);
+}
+#endif
+
+struct bench {
+	const char *name;
+	uint32_t n_iterations;
+	uint32_t n_samples;
+	uint64_t *samples;
+	uint64_t start;
+	uint64_t last;
+	uint64_t stop;
+	uint64_t allocs;
+};
+
+static inline uint64_t bench_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return SPA_TIMESPEC_TO_TIME(&now);
+}
+
+static inline int bench_init(struct bench *b, const char *name, uint32_t n_iterations)
+{
+	b->name = name;
+	b->n_iterations = n_iterations;
+	b->n_samples = 0;
+	if ((b->samples = calloc(SPA_MAX(n_iterations, 1u), sizeof(uint64_t))) == NULL)
+		return -errno;
+	b->start = b->last = b->stop = 0;
+	b->allocs = 0;
+	return 0;
+}
+
+static inline void bench_clear(struct bench *b)
+{
+	free(b->samples);
+	b->samples = NULL;
+}
+
+static inline void bench_start(struct bench *b)
+{
+	b->n_samples = 0;
+	b->allocs = __atomic_load_n(&bench_n_allocs, __ATOMIC_RELAXED);
+	b->start = b->last = bench_now();
+}
+
+/* record the duration of one cycle, call this once at the end of every cycle */
+static inline void bench_sample(struct bench *b)
+{
+	uint64_t now = bench_now();
+
+	if (b->n_samples < b->n_iterations)
+		b->samples[b->n_samples++] = now - b->last;
+	b->last = now;
+}
+
+static inline void bench_stop(struct bench *b)
+{
+	b->stop = bench_now();
+	b->allocs = __atomic_load_n(&bench_n_allocs, __ATOMIC_RELAXED) - b->allocs;
+}
+
+static int bench_compare(const void *a, const void *b)
+{
+	uint64_t va = *(const uint64_t *) a, vb = *(const uint64_t *) b;
+	return va < vb ? -1 : va > vb;
+}
+
+static inline uint64_t bench_percentile(struct bench *b, uint32_t p)
+{
+	if (b->n_samples == 0)
+		return 0;
+	return b->samples[SPA_MIN((uint64_t) b->n_samples * p / 100, b->n_samples - 1)];
+}
+
+/* Print the results as one line of JSON. The line is appended to the file
+ * in SPA_BENCH_JSON when set, else it goes to stdout. */
+static inline void bench_report(struct bench *b)
+{
+	FILE *f = stdout;
+	const char *str;
+	uint64_t elapsed = b->stop - b->start;
+
+	qsort(b->samples, b->n_samples, sizeof(uint64_t), bench_compare);
+
+	if ((str = getenv("SPA_BENCH_JSON")) && (f = fopen(str, "a")) == NULL) {
+		perror("can't open SPA_BENCH_JSON");
+		f = stdout;
+	}
+
+	fprintf(f, "{ \"name\": \"%s\", \"iterations\": %u, \"elapsed_ns\": %" PRIu64 ", "
+		"\"cycles_per_sec\": %.1f, \"min_ns\": %" PRIu64 ", \"p50_ns\": %" PRIu64 ", "
+		"\"p99_ns\": %" PRIu64 ", \"max_ns\": %" PRIu64 ", ",
+		b->name, b->n_samples, elapsed,
+		elapsed ? b->n_samples * (double) SPA_NSEC_PER_SEC / elapsed : 0.0,
+		bench_percentile(b, 0),
+		bench_percentile(b, 50),
+		bench_percentile(b, 99),
+		b->n_samples ? b->samples[b->n_samples - 1] : 0);
+#ifdef BENCH_COUNT_ALLOCS
+	fprintf(f, "\"allocations\": %" PRIu64 ", \"allocations_per_cycle\": %.3f }\n",
+		b->allocs,
+		b->n_samples ? (double) b->allocs / b->n_samples : 0.0);
+#else
+	fprintf(f, "\"allocations\": null, \"allocations_per_cycle\": null }\n");
+#endif
+
+	if (f != stdout)
+		fclose(f);
+}
+
+#endif /* __SPA_TESTS_BENCH_H__ */
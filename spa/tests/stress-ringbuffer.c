@@ -6,6 +6,8 @@
 
 #include <spa/utils/ringbuffer.h>
 
+#include "bench.h"
+
 #define ARRAY_SIZE 64
 #define MAX_VALUE 0x10000
 
@@ -13,6 +15,10 @@ struct spa_ringbuffer rb;
 uint32_t size;
 uint8_t *data;
 
+struct bench bench;
+unsigned long nfailures;
+bool done;
+
 static int fill_int_array(int *array, int start, int count)
 {
 	int i, j = start;
@@ -38,13 +44,14 @@ static int cmp_array(int *array1, int *array2, int count)
 static void *reader_start(void *arg)
 {
 	int i = 0, a[ARRAY_SIZE], b[ARRAY_SIZE];
-	unsigned long j = 0, nfailures = 0;
+	unsigned long j = 0;
 
 	printf("reader started on cpu: %d\n", sched_getcpu());
 
 	i = fill_int_array(a, i, ARRAY_SIZE);
 
-	while (1) {
+	bench_start(&bench);
+	while (j < bench.n_iterations) {
 		uint32_t index;
 
 		if (spa_ringbuffer_get_read_index(&rb, &index) >= ARRAY_SIZE * sizeof(int)) {
@@ -62,8 +69,12 @@ static void *reader_start(void *arg)
 			j++;
 
 			spa_ringbuffer_read_update(&rb, index + ARRAY_SIZE * sizeof(int));
-		}
+			bench_sample(&bench);
+		} else
+			sched_yield();
 	}
+	bench_stop(&bench);
+	__atomic_store_n(&done, true, __ATOMIC_RELEASE);
 
 	return NULL;
 }
@@ -75,16 +86,19 @@ static void *writer_start(void *arg)
 
 	i = fill_int_array(a, i, ARRAY_SIZE);
 
-	while (1) {
+	while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE)) {
 		uint32_t index;
+		int32_t filled;
 
-		if (spa_ringbuffer_get_write_index(&rb, &index) >= ARRAY_SIZE * sizeof(int)) {
+		filled = spa_ringbuffer_get_write_index(&rb, &index);
+		if (filled >= 0 && size - filled >= ARRAY_SIZE * sizeof(int)) {
 			spa_ringbuffer_write_data(&rb, data, size, index & (size - 1), a,
 						  ARRAY_SIZE * sizeof(int));
 			spa_ringbuffer_write_update(&rb, index + ARRAY_SIZE * sizeof(int));
 
 			i = fill_int_array(a, i, ARRAY_SIZE);
-		}
+		} else
+			sched_yield();
 	}
 
 	return NULL;
@@ -92,22 +106,38 @@ static void *writer_start(void *arg)
 
 int main(int argc, char *argv[])
 {
+	pthread_t reader_thread, writer_thread;
+	uint32_t n_chunks;
+
 	printf("starting ringbuffer stress test\n");
 
-	sscanf(argv[1], "%d", &size);
+	size = argc > 1 ? atoi(argv[1]) : 4096;
+	n_chunks = argc > 2 ? atoi(argv[2]) : 1000000;
+
+	if (size == 0 || (size & (size - 1)) != 0 || size < ARRAY_SIZE * sizeof(int)) {
+		printf("buffer size must be a power of 2 >= %zd\n", ARRAY_SIZE * sizeof(int));
+		return -1;
+	}
 
 	printf("buffer size (bytes): %d\n", size);
 	printf("array size (bytes): %ld\n", sizeof(int) * ARRAY_SIZE);
+	printf("chunks: %d\n", n_chunks);
+
+	if (bench_init(&bench, "stress-ringbuffer", n_chunks) < 0)
+		return -1;
 
 	spa_ringbuffer_init(&rb);
 	data = malloc(size);
 
-	pthread_t reader_thread, writer_thread;
 	pthread_create(&reader_thread, NULL, reader_start, NULL);
 	pthread_create(&writer_thread, NULL, writer_start, NULL);
 
-	while (1)
-		sleep(1);
+	pthread_join(reader_thread, NULL);
+	pthread_join(writer_thread, NULL);
+
+	bench_report(&bench);
+	bench_clear(&bench);
+	free(data);
 
-	return 0;
+	return nfailures > 0 ? -1 : 0;
 }
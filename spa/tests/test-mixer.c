@@ -27,6 +27,7 @@
 #include <errno.h>
 #include <pthread.h>
 #include <poll.h>
+#include <limits.h>
 
 #include <spa/support/log.h>
 #include <spa/support/log-impl.h>
@@ -52,6 +53,8 @@ static SPA_LOG_IMPL(default_log);
 #include <spa/graph/graph.h>
 #include <spa/graph/graph-scheduler1.h>
 
+#include "bench.h"
+
 struct type {
 	uint32_t node;
 	uint32_t props;
@@ -114,6 +117,10 @@ struct data {
 	struct spa_support support[4];
 	uint32_t n_support;
 
+	int iterations;
+	struct bench bench;
+	struct spa_source *sink_source;
+
 	struct spa_graph graph;
 	struct spa_graph_data graph_data;
 	struct spa_graph_node source1_node;
@@ -157,6 +164,8 @@ struct data {
 	unsigned int n_fds;
 };
 
+#define PLUGIN_DIR	"build/spa/plugins"
+
 #define MIN_LATENCY     64
 
 #define BUFFER_SIZE1    MIN_LATENCY
@@ -206,9 +215,15 @@ static int make_node(struct data *data, struct spa_node **node, const char *lib,
 	void *hnd;
 	spa_handle_factory_enum_func_t enum_func;
 	uint32_t i;
+	const char *dir;
+	char path[PATH_MAX];
+
+	if ((dir = getenv("SPA_PLUGIN_DIR")) == NULL)
+		dir = PLUGIN_DIR;
+	snprintf(path, sizeof(path), "%s/%s", dir, lib);
 
-	if ((hnd = dlopen(lib, RTLD_NOW)) == NULL) {
-		printf("can't load %s: %s\n", lib, dlerror());
+	if ((hnd = dlopen(path, RTLD_NOW)) == NULL) {
+		printf("can't load %s: %s\n", path, dlerror());
 		return -errno;
 	}
 	if ((enum_func = dlsym(hnd, SPA_HANDLE_FACTORY_ENUM_FUNC_NAME)) == NULL) {
@@ -356,31 +371,42 @@ static int make_nodes(struct data *data, const char *device)
 	struct spa_pod_builder b = { 0 };
 	uint8_t buffer[128];
 
-	if ((res = make_node(data, &data->sink,
-			     "build/spa/plugins/alsa/libspa-alsa.so", "alsa-sink")) < 0) {
-		printf("can't create alsa-sink: %d\n", res);
-		return res;
-	}
-	spa_node_set_callbacks(data->sink, &sink_callbacks, data);
+	if (data->iterations > 0) {
+		/* benchmark, the fakesink drives the graph as fast as it can */
+		data->sink_source = &data->sources[data->n_sources];
+		if ((res = make_node(data, &data->sink,
+				     "test/libspa-test.so", "fakesink")) < 0) {
+			printf("can't create fakesink: %d\n", res);
+			return res;
+		}
+		spa_node_set_callbacks(data->sink, &sink_callbacks, data);
+	} else {
+		if ((res = make_node(data, &data->sink,
+				     "alsa/libspa-alsa.so", "alsa-sink")) < 0) {
+			printf("can't create alsa-sink: %d\n", res);
+			return res;
+		}
+		spa_node_set_callbacks(data->sink, &sink_callbacks, data);
 
-	spa_pod_builder_init(&b, buffer, sizeof(buffer));
-	props = spa_pod_builder_object(&b,
-		0, data->type.props,
-		":", data->type.props_device,      "s", device ? device : "hw:0",
-		":", data->type.props_min_latency, "i", MIN_LATENCY);
+		spa_pod_builder_init(&b, buffer, sizeof(buffer));
+		props = spa_pod_builder_object(&b,
+			0, data->type.props,
+			":", data->type.props_device,      "s", device ? device : "hw:0",
+			":", data->type.props_min_latency, "i", MIN_LATENCY);
 
-	if ((res = spa_node_set_param(data->sink, data->type.param.idProps, 0, props)) < 0)
-		error(0, -res, "set_param props");
+		if ((res = spa_node_set_param(data->sink, data->type.param.idProps, 0, props)) < 0)
+			error(0, -res, "set_param props");
+	}
 
 	if ((res = make_node(data, &data->mix,
-			     "build/spa/plugins/audiomixer/libspa-audiomixer.so",
+			     "audiomixer/libspa-audiomixer.so",
 			     "audiomixer")) < 0) {
 		printf("can't create audiomixer: %d\n", res);
 		return res;
 	}
 
 	if ((res = make_node(data, &data->source1,
-			     "build/spa/plugins/audiotestsrc/libspa-audiotestsrc.so",
+			     "audiotestsrc/libspa-audiotestsrc.so",
 			     "audiotestsrc")) < 0) {
 		printf("can't create audiotestsrc: %d\n", res);
 		return res;
@@ -397,7 +423,7 @@ static int make_nodes(struct data *data, const char *device)
 		printf("got set_props error %d\n", res);
 
 	if ((res = make_node(data, &data->source2,
-			     "build/spa/plugins/audiotestsrc/libspa-audiotestsrc.so",
+			     "audiotestsrc/libspa-audiotestsrc.so",
 			     "audiotestsrc")) < 0) {
 		printf("can't create audiotestsrc: %d\n", res);
 		return res;
@@ -525,7 +551,9 @@ static int negotiate_formats(struct data *data)
 		":", data->type.format_audio.rate,     "i", 44100,
 		":", data->type.format_audio.channels, "i", 2);
 
-	if ((res =
+	if (data->iterations > 0)
+		format = filter;
+	else if ((res =
 	     spa_node_port_enum_params(data->sink,
 				       SPA_DIRECTION_INPUT, 0,
 				       data->type.param.idEnumFormat, &state,
@@ -699,6 +727,44 @@ static void run_async_sink(struct data *data)
 	}
 }
 
+static void run_sync_sink(struct data *data)
+{
+	int res, i;
+
+	{
+		struct spa_command cmd = SPA_COMMAND_INIT(data->type.command_node.Start);
+		if ((res = spa_node_send_command(data->source1, &cmd)) < 0)
+			printf("got source1 error %d\n", res);
+		if ((res = spa_node_send_command(data->source2, &cmd)) < 0)
+			printf("got source2 error %d\n", res);
+		if ((res = spa_node_send_command(data->mix, &cmd)) < 0)
+			printf("got mix error %d\n", res);
+		if ((res = spa_node_send_command(data->sink, &cmd)) < 0)
+			printf("got sink error %d\n", res);
+	}
+
+	/* dispatch the sink timer without polling, every dispatch is one
+	 * graph cycle */
+	bench_start(&data->bench);
+	for (i = 0; i < data->iterations; i++) {
+		data->sink_source->func(data->sink_source);
+		bench_sample(&data->bench);
+	}
+	bench_stop(&data->bench);
+
+	{
+		struct spa_command cmd = SPA_COMMAND_INIT(data->type.command_node.Pause);
+		if ((res = spa_node_send_command(data->sink, &cmd)) < 0)
+			printf("got error %d\n", res);
+		if ((res = spa_node_send_command(data->mix, &cmd)) < 0)
+			printf("got mix error %d\n", res);
+		if ((res = spa_node_send_command(data->source1, &cmd)) < 0)
+			printf("got source1 error %d\n", res);
+		if ((res = spa_node_send_command(data->source2, &cmd)) < 0)
+			printf("got source2 error %d\n", res);
+	}
+}
+
 int main(int argc, char *argv[])
 {
 	struct data data = { NULL };
@@ -732,6 +798,8 @@ int main(int argc, char *argv[])
 
 	init_type(&data.type, data.map);
 
+	data.iterations = argc > 2 ? atoi(argv[2]) : 0;
+
 	if ((res = make_nodes(&data, argc > 1 ? argv[1] : NULL)) < 0) {
 		printf("can't make nodes: %d\n", res);
 		return -1;
@@ -741,5 +809,16 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
-	run_async_sink(&data);
+	if (data.iterations > 0) {
+		if ((res = bench_init(&data.bench, "test-mixer", data.iterations)) < 0) {
+			printf("can't init bench: %d\n", res);
+			return -1;
+		}
+		run_sync_sink(&data);
+		bench_report(&data.bench);
+		bench_clear(&data.bench);
+	} else
+		run_async_sink(&data);
+
+	return 0;
 }
@@ -25,6 +25,7 @@
 #include <errno.h>
 #include <pthread.h>
 #include <poll.h>
+#include <limits.h>
 
 #include <spa/support/log-impl.h>
 #include <spa/support/loop.h>
@@ -38,6 +39,8 @@
 #include <spa/graph/graph.h>
 #include <spa/graph/graph-scheduler1.h>
 
+#include "bench.h"
+
 #define MODE_SYNC_PUSH          (1<<0)
 #define MODE_SYNC_PULL          (1<<1)
 #define MODE_ASYNC_PUSH         (1<<2)
@@ -107,6 +110,7 @@ struct data {
 	uint32_t n_support;
 
 	int iterations;
+	struct bench bench;
 
 	struct spa_graph graph;
 	struct spa_graph_data graph_data;
@@ -135,6 +139,8 @@ struct data {
 	void *hnd;
 };
 
+#define PLUGIN_DIR	"build/spa/plugins"
+
 #define MIN_LATENCY     64
 
 #define BUFFER_SIZE    MIN_LATENCY
@@ -182,10 +188,16 @@ static int make_node(struct data *data, struct spa_node **node, const char *lib,
 	int res;
 	spa_handle_factory_enum_func_t enum_func;
 	uint32_t i;
+	const char *dir;
+	char path[PATH_MAX];
+
+	if ((dir = getenv("SPA_PLUGIN_DIR")) == NULL)
+		dir = PLUGIN_DIR;
+	snprintf(path, sizeof(path), "%s/%s", dir, lib);
 
 	if (data->hnd == NULL) {
-		if ((data->hnd = dlopen(lib, RTLD_NOW)) == NULL) {
-			printf("can't load %s: %s\n", lib, dlerror());
+		if ((data->hnd = dlopen(path, RTLD_NOW)) == NULL) {
+			printf("can't load %s: %s\n", path, dlerror());
 			return -errno;
 		}
 	}
@@ -233,6 +245,7 @@ static void on_sink_pull(struct data *data)
 	} else {
 		spa_graph_need_input(&data->graph, &data->sink_node);
 	}
+	bench_sample(&data->bench);
 }
 
 static void on_source_push(struct data *data)
@@ -244,6 +257,7 @@ static void on_source_push(struct data *data)
 	} else {
 		spa_graph_have_output(&data->graph, &data->source_node);
 	}
+	bench_sample(&data->bench);
 }
 
 static void on_sink_done(void *_data, int seq, int res)
@@ -344,7 +358,7 @@ static int make_nodes(struct data *data)
 	int res;
 
 	if ((res = make_node(data, &data->sink,
-			     "build/spa/plugins/test/libspa-test.so", "fakesink")) < 0) {
+			     "test/libspa-test.so", "fakesink")) < 0) {
 		printf("can't create fakesink: %d\n", res);
 		return res;
 	}
@@ -353,7 +367,7 @@ static int make_nodes(struct data *data)
 		spa_node_set_callbacks(data->sink, &sink_callbacks, data);
 
 	if ((res = make_node(data, &data->source,
-			     "build/spa/plugins/test/libspa-test.so", "fakesrc")) < 0) {
+			     "test/libspa-test.so", "fakesrc")) < 0) {
 		printf("can't create fakesrc: %d\n", res);
 		return res;
 	}
@@ -491,8 +505,6 @@ static void run_graph(struct data *data)
 {
 	int res;
 	int err, i;
-	struct timespec now;
-	int64_t start, stop;
 
 	{
 		struct spa_command cmd = SPA_COMMAND_INIT(data->type.command_node.Start);
@@ -502,11 +514,10 @@ static void run_graph(struct data *data)
 			printf("got sink error %d\n", res);
 	}
 
-	clock_gettime(CLOCK_MONOTONIC, &now);
-	start = SPA_TIMESPEC_TO_TIME(&now);
-
 	printf("running\n");
 
+	bench_start(&data->bench);
+
 	if (data->mode & MODE_SYNC_PUSH) {
 		for (i = 0; i < data->iterations; i++)
 			on_source_push(data);
@@ -524,10 +535,9 @@ static void run_graph(struct data *data)
 		}
 	}
 
-	clock_gettime(CLOCK_MONOTONIC, &now);
-	stop = SPA_TIMESPEC_TO_TIME(&now);
+	bench_stop(&data->bench);
 
-	printf("stopping, elapsed %" PRIi64 "\n", stop - start);
+	printf("stopping, elapsed %" PRIu64 "\n", data->bench.stop - data->bench.start);
 
 	{
 		struct spa_command cmd = SPA_COMMAND_INIT(data->type.command_node.Pause);
@@ -585,5 +595,15 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
+	if ((res = bench_init(&data.bench, "test-perf", data.iterations)) < 0) {
+		printf("can't init bench: %d\n", res);
+		return -1;
+	}
+
 	run_graph(&data);
+
+	bench_report(&data.bench);
+	bench_clear(&data.bench);
+
+	return 0;
 }
@@ -0,0 +1,667 @@
+/* Simple Plugin API
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <dlfcn.h>
+
+#include <spa/support/type-map-impl.h>
+#include <spa/support/log-impl.h>
+#include <spa/support/loop.h>
+#include <spa/node/node.h>
+#include <spa/node/io.h>
+#include <spa/buffer/buffer.h>
+#include <spa/param/param.h>
+#include <spa/param/audio/format-utils.h>
+
+static SPA_TYPE_MAP_IMPL(default_map, 4096);
+static SPA_LOG_IMPL(default_log);
+
+#define MAX_PORTS	64
+#define MAX_DATAS	64
+#define N_BUFFERS	2
+
+struct type {
+	uint32_t node;
+	uint32_t format;
+	struct spa_type_io io;
+	struct spa_type_param param;
+	struct spa_type_meta meta;
+	struct spa_type_data data;
+	struct spa_type_media_type media_type;
+	struct spa_type_media_subtype media_subtype;
+	struct spa_type_format_audio format_audio;
+	struct spa_type_audio_format audio_format;
+	struct spa_type_command_node command_node;
+};
+
+static inline void init_type(struct type *type, struct spa_type_map *map)
+{
+	type->node = spa_type_map_get_id(map, SPA_TYPE__Node);
+	type->format = spa_type_map_get_id(map, SPA_TYPE__Format);
+	spa_type_io_map(map, &type->io);
+	spa_type_param_map(map, &type->param);
+	spa_type_meta_map(map, &type->meta);
+	spa_type_data_map(map, &type->data);
+	spa_type_media_type_map(map, &type->media_type);
+	spa_type_media_subtype_map(map, &type->media_subtype);
+	spa_type_format_audio_map(map, &type->format_audio);
+	spa_type_audio_format_map(map, &type->audio_format);
+	spa_type_command_node_map(map, &type->command_node);
+}
+
+struct buffer {
+	struct spa_buffer buffer;
+	struct spa_meta metas[1];
+	struct spa_meta_header header;
+	struct spa_data datas[MAX_DATAS];
+	struct spa_chunk chunks[MAX_DATAS];
+};
+
+struct port {
+	enum spa_direction direction;
+	uint32_t id;
+	struct spa_io_buffers io;
+	struct buffer buffers[N_BUFFERS];
+	struct spa_buffer *bufs[N_BUFFERS];
+	uint32_t next;
+};
+
+struct data {
+	struct type type;
+
+	struct spa_support support[4];
+	uint32_t n_support;
+	struct spa_type_map *map;
+	struct spa_log *log;
+	struct spa_loop loop;
+
+	const char *format_name;
+	uint32_t format;
+	uint32_t sample_size;
+	uint32_t rate;
+	uint32_t channels;
+	bool planar;
+	uint32_t samples;
+	uint32_t n_inputs;
+	uint32_t iterations;
+	uint32_t warmup;
+
+	void *hnd;
+	struct spa_handle *handle;
+	struct spa_node *node;
+
+	struct port in_ports[MAX_PORTS];
+	uint32_t n_in_ports;
+	struct port out_ports[MAX_PORTS];
+	uint32_t n_out_ports;
+
+	uint64_t *times;
+};
+
+static int do_add_source(struct spa_loop *loop, struct spa_source *source)
+{
+	return 0;
+}
+
+static int do_update_source(struct spa_source *source)
+{
+	return 0;
+}
+
+static void do_remove_source(struct spa_source *source)
+{
+}
+
+static uint64_t get_time_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * SPA_NSEC_PER_SEC + now.tv_nsec;
+}
+
+static int parse_format(struct data *data, const char *name)
+{
+	struct spa_type_audio_format *af = &data->type.audio_format;
+	static const struct {
+		const char *name;
+		size_t offset;
+		uint32_t size;
+	} formats[] = {
+		{ "S16", offsetof(struct spa_type_audio_format, S16), sizeof(int16_t) },
+		{ "S24", offsetof(struct spa_type_audio_format, S24), 3 },
+		{ "S24_32", offsetof(struct spa_type_audio_format, S24_32), sizeof(int32_t) },
+		{ "S32", offsetof(struct spa_type_audio_format, S32), sizeof(int32_t) },
+		{ "F32", offsetof(struct spa_type_audio_format, F32), sizeof(float) },
+		{ "F64", offsetof(struct spa_type_audio_format, F64), sizeof(double) },
+	};
+	uint32_t i;
+
+	for (i = 0; i < SPA_N_ELEMENTS(formats); i++) {
+		if (strcmp(name, formats[i].name) == 0) {
+			data->format = *SPA_MEMBER(af, formats[i].offset, uint32_t);
+			data->sample_size = formats[i].size;
+			data->format_name = formats[i].name;
+			return 0;
+		}
+	}
+	return -EINVAL;
+}
+
+/* a quiet sine so that the float kernels don't run into denormals and the
+ * integer kernels don't clip */
+static void fill_data(struct data *data, void *ptr, uint32_t n_samples)
+{
+	uint32_t i;
+	uint8_t *d = ptr;
+
+	for (i = 0; i < n_samples; i++) {
+		double v = sin(i * 2.0 * M_PI / 128.0) * 0.25;
+
+		if (data->format == data->type.audio_format.F32)
+			((float *) d)[i] = v;
+		else if (data->format == data->type.audio_format.F64)
+			((double *) d)[i] = v;
+		else if (data->format == data->type.audio_format.S16)
+			((int16_t *) d)[i] = v * INT16_MAX;
+		else if (data->format == data->type.audio_format.S32)
+			((int32_t *) d)[i] = v * INT32_MAX;
+		else if (data->format == data->type.audio_format.S24_32)
+			((int32_t *) d)[i] = v * 8388607;
+		else {
+			int32_t s = v * 8388607;
+			d[i * 3] = s;
+			d[i * 3 + 1] = s >> 8;
+			d[i * 3 + 2] = s >> 16;
+		}
+	}
+}
+
+static void init_buffers(struct data *data, struct port *port)
+{
+	uint32_t i, j, n_datas, size;
+
+	n_datas = data->planar ? data->channels : 1;
+	size = data->samples * data->sample_size * (data->planar ? 1 : data->channels);
+
+	for (i = 0; i < N_BUFFERS; i++) {
+		struct buffer *b = &port->buffers[i];
+
+		port->bufs[i] = &b->buffer;
+
+		b->buffer.id = i;
+		b->buffer.n_metas = 1;
+		b->buffer.metas = b->metas;
+		b->buffer.n_datas = n_datas;
+		b->buffer.datas = b->datas;
+
+		b->header.flags = 0;
+		b->header.seq = 0;
+		b->header.pts = 0;
+		b->header.dts_offset = 0;
+		b->metas[0].type = data->type.meta.Header;
+		b->metas[0].data = &b->header;
+		b->metas[0].size = sizeof(b->header);
+
+		for (j = 0; j < n_datas; j++) {
+			b->datas[j].type = data->type.data.MemPtr;
+			b->datas[j].flags = 0;
+			b->datas[j].fd = -1;
+			b->datas[j].mapoffset = 0;
+			b->datas[j].maxsize = size;
+			b->datas[j].data = calloc(1, size);
+			b->datas[j].chunk = &b->chunks[j];
+			b->datas[j].chunk->offset = 0;
+			b->datas[j].chunk->size = size;
+			b->datas[j].chunk->stride = 0;
+
+			if (port->direction == SPA_DIRECTION_INPUT)
+				fill_data(data, b->datas[j].data, size / data->sample_size);
+		}
+	}
+}
+
+static void clear_buffers(struct data *data, struct port *port)
+{
+	uint32_t i, j;
+
+	for (i = 0; i < N_BUFFERS; i++) {
+		struct buffer *b = &port->buffers[i];
+
+		for (j = 0; j < b->buffer.n_datas; j++) {
+			free(b->datas[j].data);
+			b->datas[j].data = NULL;
+		}
+		b->buffer.n_datas = 0;
+	}
+}
+
+static int make_node(struct data *data, const char *lib, const char *name)
+{
+	struct spa_handle *handle;
+	spa_handle_factory_enum_func_t enum_func;
+	void *hnd, *iface;
+	uint32_t i;
+	int res;
+
+	if ((hnd = dlopen(lib, RTLD_NOW)) == NULL) {
+		printf("can't load %s: %s\n", lib, dlerror());
+		return -errno;
+	}
+	if ((enum_func = dlsym(hnd, SPA_HANDLE_FACTORY_ENUM_FUNC_NAME)) == NULL) {
+		printf("can't find enum function\n");
+		dlclose(hnd);
+		return -errno;
+	}
+	data->hnd = hnd;
+
+	for (i = 0;;) {
+		const struct spa_handle_factory *factory;
+
+		if ((res = enum_func(&factory, &i)) <= 0) {
+			if (res != 0)
+				printf("can't enumerate factories: %s\n", spa_strerror(res));
+			break;
+		}
+		if (strcmp(factory->name, name))
+			continue;
+
+		handle = calloc(1, factory->size);
+		if ((res = spa_handle_factory_init(factory, handle, NULL,
+						   data->support, data->n_support)) < 0) {
+			printf("can't make factory instance: %s\n", spa_strerror(res));
+			free(handle);
+			return res;
+		}
+		data->handle = handle;
+
+		if ((res = spa_handle_get_interface(handle, data->type.node, &iface)) < 0) {
+			printf("can't get node interface: %s\n", spa_strerror(res));
+			return res;
+		}
+		data->node = iface;
+		return 0;
+	}
+	printf("can't find factory %s in %s\n", name, lib);
+	return -ENOENT;
+}
+
+static int setup_port(struct data *data, struct port *port, struct spa_pod *format)
+{
+	struct spa_node *node = data->node;
+	int res;
+
+	if ((res = spa_node_port_set_param(node, port->direction, port->id,
+					   data->type.param.idFormat, 0, format)) < 0) {
+		printf("can't set format on %s port %d: %s\n",
+		       port->direction == SPA_DIRECTION_INPUT ? "input" : "output",
+		       port->id, spa_strerror(res));
+		return res;
+	}
+
+	port->io = SPA_IO_BUFFERS_INIT;
+	if ((res = spa_node_port_set_io(node, port->direction, port->id,
+					data->type.io.Buffers, &port->io, sizeof(port->io))) < 0) {
+		printf("can't set io on port %d: %s\n", port->id, spa_strerror(res));
+		return res;
+	}
+
+	init_buffers(data, port);
+	if ((res = spa_node_port_use_buffers(node, port->direction, port->id,
+					     port->bufs, N_BUFFERS)) < 0) {
+		printf("can't use buffers on port %d: %s\n", port->id, spa_strerror(res));
+		return res;
+	}
+	return 0;
+}
+
+static int setup_node(struct data *data)
+{
+	struct spa_node *node = data->node;
+	struct type *t = &data->type;
+	uint32_t i, n_input, max_input, n_output, max_output;
+	uint32_t in_ids[MAX_PORTS], out_ids[MAX_PORTS];
+	uint8_t buffer[1024];
+	struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+	struct spa_pod *format;
+	int res;
+
+	if ((res = spa_node_get_n_ports(node, &n_input, &max_input, &n_output, &max_output)) < 0) {
+		printf("can't get n_ports: %s\n", spa_strerror(res));
+		return res;
+	}
+
+	/* add ports to nodes with dynamic inputs, like the mixer */
+	for (i = n_input; i < data->n_inputs && i < max_input && i < MAX_PORTS; i++) {
+		if ((res = spa_node_add_port(node, SPA_DIRECTION_INPUT, i)) < 0) {
+			printf("can't add input port %d: %s\n", i, spa_strerror(res));
+			return res;
+		}
+	}
+
+	spa_node_get_n_ports(node, &n_input, &max_input, &n_output, &max_output);
+	data->n_in_ports = SPA_MIN(n_input, MAX_PORTS);
+	data->n_out_ports = SPA_MIN(n_output, MAX_PORTS);
+
+	if ((res = spa_node_get_port_ids(node, in_ids, data->n_in_ports,
+					 out_ids, data->n_out_ports)) < 0) {
+		printf("can't get port ids: %s\n", spa_strerror(res));
+		return res;
+	}
+
+	format = spa_pod_builder_object(&b,
+		t->param.idFormat, t->format,
+		"I", t->media_type.audio,
+		"I", t->media_subtype.raw,
+		":", t->format_audio.format,   "I", data->format,
+		":", t->format_audio.layout,   "i", data->planar ?
+						SPA_AUDIO_LAYOUT_NON_INTERLEAVED :
+						SPA_AUDIO_LAYOUT_INTERLEAVED,
+		":", t->format_audio.rate,     "i", data->rate,
+		":", t->format_audio.channels, "i", data->channels);
+
+	/* outputs first, the mixer takes its format from the first port */
+	for (i = 0; i < data->n_out_ports; i++) {
+		struct port *port = &data->out_ports[i];
+
+		port->direction = SPA_DIRECTION_OUTPUT;
+		port->id = out_ids[i];
+		if ((res = setup_port(data, port, format)) < 0)
+			return res;
+	}
+	for (i = 0; i < data->n_in_ports; i++) {
+		struct port *port = &data->in_ports[i];
+
+		port->direction = SPA_DIRECTION_INPUT;
+		port->id = in_ids[i];
+		if ((res = setup_port(data, port, format)) < 0)
+			return res;
+	}
+	if (data->n_in_ports == 0 && data->n_out_ports == 0) {
+		printf("node has no ports\n");
+		return -EINVAL;
+	}
+
+	{
+		struct spa_command cmd = SPA_COMMAND_INIT(t->command_node.Start);
+		if ((res = spa_node_send_command(node, &cmd)) < 0)
+			printf("can't start node: %s\n", spa_strerror(res));
+	}
+	return 0;
+}
+
+/* one cycle: the fake sources hand a buffer to every input, the node is
+ * scheduled and the fake sinks return the output buffers */
+static int do_cycle(struct data *data)
+{
+	struct spa_node *node = data->node;
+	uint32_t i;
+	int res;
+
+	for (i = 0; i < data->n_in_ports; i++) {
+		struct port *port = &data->in_ports[i];
+
+		port->io.status = SPA_STATUS_HAVE_BUFFER;
+		port->io.buffer_id = port->next;
+		port->next = (port->next + 1) % N_BUFFERS;
+	}
+	for (i = 0; i < data->n_out_ports; i++)
+		data->out_ports[i].io.status = SPA_STATUS_NEED_BUFFER;
+
+	if (data->n_in_ports > 0)
+		res = spa_node_process_input(node);
+	else
+		res = spa_node_process_output(node);
+
+	if (res < 0)
+		return res;
+
+	for (i = 0; i < data->n_out_ports; i++) {
+		struct port *port = &data->out_ports[i];
+
+		if (port->io.status == SPA_STATUS_HAVE_BUFFER &&
+		    port->io.buffer_id < N_BUFFERS) {
+			spa_node_port_reuse_buffer(node, port->id, port->io.buffer_id);
+			port->io.buffer_id = SPA_ID_INVALID;
+		}
+	}
+	return 0;
+}
+
+static void clear_node(struct data *data)
+{
+	uint32_t i;
+
+	if (data->node) {
+		struct spa_command cmd = SPA_COMMAND_INIT(data->type.command_node.Pause);
+		spa_node_send_command(data->node, &cmd);
+	}
+	for (i = 0; i < data->n_in_ports; i++) {
+		spa_node_port_use_buffers(data->node, SPA_DIRECTION_INPUT,
+					  data->in_ports[i].id, NULL, 0);
+		clear_buffers(data, &data->in_ports[i]);
+	}
+	for (i = 0; i < data->n_out_ports; i++) {
+		spa_node_port_use_buffers(data->node, SPA_DIRECTION_OUTPUT,
+					  data->out_ports[i].id, NULL, 0);
+		clear_buffers(data, &data->out_ports[i]);
+	}
+	if (data->handle) {
+		spa_handle_clear(data->handle);
+		free(data->handle);
+	}
+	if (data->hnd)
+		dlclose(data->hnd);
+}
+
+static int compare_times(const void *a, const void *b)
+{
+	uint64_t ta = *(const uint64_t *) a, tb = *(const uint64_t *) b;
+	return ta < tb ? -1 : ta > tb ? 1 : 0;
+}
+
+static uint64_t percentile(struct data *data, uint32_t p)
+{
+	return data->times[SPA_MIN((uint64_t) data->iterations * p / 100, data->iterations - 1)];
+}
+
+static int run(struct data *data)
+{
+	uint32_t i;
+	uint64_t start, t, total = 0;
+	double secs, samples;
+	int res;
+
+	for (i = 0; i < data->warmup; i++) {
+		if ((res = do_cycle(data)) < 0) {
+			printf("process failed: %s\n", spa_strerror(res));
+			return res;
+		}
+	}
+	for (i = 0; i < data->iterations; i++) {
+		start = get_time_ns();
+		res = do_cycle(data);
+		t = get_time_ns() - start;
+
+		if (res < 0) {
+			printf("process failed: %s\n", spa_strerror(res));
+			return res;
+		}
+		data->times[i] = t;
+		total += t;
+	}
+	qsort(data->times, data->iterations, sizeof(uint64_t), compare_times);
+
+	secs = (double) total / SPA_NSEC_PER_SEC;
+	samples = (double) data->iterations * data->samples * data->channels;
+
+	printf("format:      %s %s %d channels %dHz\n", data->format_name,
+	       data->planar ? "planar" : "interleaved", data->channels, data->rate);
+	printf("ports:       %d inputs %d outputs\n", data->n_in_ports, data->n_out_ports);
+	printf("cycles:      %d of %d samples\n", data->iterations, data->samples);
+	printf("ns/cycle:    %.1f\n", (double) total / data->iterations);
+	printf("samples/sec: %.0f\n", samples / secs);
+	printf("realtime:    %.1fx\n", (samples / data->channels / data->rate) / secs);
+	printf("min:         %" PRIu64 " ns\n", data->times[0]);
+	printf("p50:         %" PRIu64 " ns\n", percentile(data, 50));
+	printf("p90:         %" PRIu64 " ns\n", percentile(data, 90));
+	printf("p99:         %" PRIu64 " ns\n", percentile(data, 99));
+	printf("max:         %" PRIu64 " ns\n", data->times[data->iterations - 1]);
+
+	return 0;
+}
+
+static void show_help(const char *name)
+{
+	printf("usage: %s [options] <plugin.so> <factory>\n"
+	       "  -h, --help                 Show this help\n"
+	       "  -f, --format=FORMAT        Sample format S16, S24, S24_32, S32, F32 or F64 (F32)\n"
+	       "  -r, --rate=RATE            Sample rate (48000)\n"
+	       "  -c, --channels=CHANNELS    Number of channels (2)\n"
+	       "  -p, --planar               Use planar buffers\n"
+	       "  -s, --samples=SAMPLES      Samples per channel per cycle (1024)\n"
+	       "  -i, --inputs=INPUTS        Input ports to add on nodes with dynamic ports (2)\n"
+	       "  -n, --iterations=N         Number of measured cycles (10000)\n"
+	       "  -w, --warmup=N             Number of cycles before measuring (100)\n",
+	       name);
+}
+
+int main(int argc, char *argv[])
+{
+	struct data data = { 0 };
+	static const struct option long_options[] = {
+		{ "help",	no_argument,		NULL, 'h' },
+		{ "format",	required_argument,	NULL, 'f' },
+		{ "rate",	required_argument,	NULL, 'r' },
+		{ "channels",	required_argument,	NULL, 'c' },
+		{ "planar",	no_argument,		NULL, 'p' },
+		{ "samples",	required_argument,	NULL, 's' },
+		{ "inputs",	required_argument,	NULL, 'i' },
+		{ "iterations",	required_argument,	NULL, 'n' },
+		{ "warmup",	required_argument,	NULL, 'w' },
+		{ NULL, 0, NULL, 0 }
+	};
+	const char *str, *format = "F32";
+	int c, res;
+
+	data.map = &default_map.map;
+	data.log = &default_log.log;
+	data.loop.version = SPA_VERSION_LOOP;
+	data.loop.add_source = do_add_source;
+	data.loop.update_source = do_update_source;
+	data.loop.remove_source = do_remove_source;
+
+	/* keep the info messages of the plugins out of the results */
+	data.log->level = SPA_LOG_LEVEL_WARN;
+	if ((str = getenv("SPA_DEBUG")))
+		data.log->level = atoi(str);
+
+	data.support[0].type = SPA_TYPE__TypeMap;
+	data.support[0].data = data.map;
+	data.support[1].type = SPA_TYPE__Log;
+	data.support[1].data = data.log;
+	data.support[2].type = SPA_TYPE_LOOP__MainLoop;
+	data.support[2].data = &data.loop;
+	data.support[3].type = SPA_TYPE_LOOP__DataLoop;
+	data.support[3].data = &data.loop;
+	data.n_support = 4;
+
+	init_type(&data.type, data.map);
+
+	data.rate = 48000;
+	data.channels = 2;
+	data.samples = 1024;
+	data.n_inputs = 2;
+	data.iterations = 10000;
+	data.warmup = 100;
+
+	while ((c = getopt_long(argc, argv, "hf:r:c:ps:i:n:w:", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'h':
+			show_help(argv[0]);
+			return 0;
+		case 'f':
+			format = optarg;
+			break;
+		case 'r':
+			data.rate = atoi(optarg);
+			break;
+		case 'c':
+			data.channels = atoi(optarg);
+			break;
+		case 'p':
+			data.planar = true;
+			break;
+		case 's':
+			data.samples = atoi(optarg);
+			break;
+		case 'i':
+			data.n_inputs = atoi(optarg);
+			break;
+		case 'n':
+			data.iterations = atoi(optarg);
+			break;
+		case 'w':
+			data.warmup = atoi(optarg);
+			break;
+		default:
+			show_help(argv[0]);
+			return -1;
+		}
+	}
+	if (argc - optind < 2) {
+		show_help(argv[0]);
+		return -1;
+	}
+	if (parse_format(&data, format) < 0) {
+		printf("unknown format %s\n", format);
+		return -1;
+	}
+	if (data.rate == 0 || data.channels == 0 || data.samples == 0 ||
+	    data.iterations == 0 || (data.planar && data.channels > MAX_DATAS)) {
+		printf("invalid arguments\n");
+		return -1;
+	}
+
+	if ((res = make_node(&data, argv[optind], argv[optind + 1])) < 0)
+		goto exit;
+
+	if ((res = setup_node(&data)) < 0)
+		goto exit;
+
+	if ((data.times = calloc(data.iterations, sizeof(uint64_t))) == NULL) {
+		res = -errno;
+		goto exit;
+	}
+
+	res = run(&data);
+
+      exit:
+	free(data.times);
+	clear_node(&data);
+
+	return res < 0 ? -1 : 0;
+}
@@ -24,6 +24,9 @@
 extern "C" {
 #endif
 
+#include <errno.h>
+#include <time.h>
+
 #include <spa/utils/defs.h>
 #include <spa/param/param.h>
 #include <spa/node/node.h>
@@ -34,16 +37,84 @@ struct pw_client_node_proxy;
 
 #define PW_TYPE_INTERFACE__ClientNode		PW_TYPE_INTERFACE_BASE "ClientNode"
 
-#define PW_VERSION_CLIENT_NODE			0
+#define PW_VERSION_CLIENT_NODE			1
+
+/** number of deadlines a client node can miss in a row before it is made
+ * async, read from the core properties. 0 disables the watchdog. The node is
+ * waited for again when it keeps up for a while */
+#define PW_CLIENT_NODE_PROP_MAX_MISSES		"pipewire.client-node.max-misses"
+/** "true" on the node while it is async, "false" when it recovered */
+#define PW_CLIENT_NODE_PROP_ASYNC		"pipewire.client-node.async"
+/** number of times the data thread checks for the next signal of the peer
+ * after it handled one before it waits on the eventfd again, read from the
+ * core properties. Default 0 always uses the eventfd */
+#define PW_CLIENT_NODE_PROP_SPIN		"pipewire.client-node.spin"
 
 struct pw_client_node_message;
 
+/** Signal for one direction of the transport \memberof pw_client_node */
+struct pw_client_node_signal {
+	uint32_t seq;			/**< incremented for each signal, futex word */
+	uint32_t flags;			/**< flags set by the receiver */
+#define PW_CLIENT_NODE_SIGNAL_FLAG_FUTEX	(1 << 0)	/**< the receiver waits on the
+								  *  futex instead of the eventfd */
+#define PW_CLIENT_NODE_SIGNAL_FLAG_WAITING	(1 << 1)	/**< the receiver sleeps on
+								  *  the futex */
+};
+
+/** Info about one message ringbuffer of the transport \memberof pw_client_node */
+struct pw_client_node_ring_info {
+	uint32_t size;			/**< size of the ringbuffer memory, a power of 2 */
+	uint32_t max_filled;		/**< most bytes that were in the ringbuffer */
+	uint32_t overflows;		/**< number of messages dropped because the
+					  *  ringbuffer was full */
+	uint32_t padding;
+};
+
+/** Activation record of one side of the node. The peer sets the pending
+ * activations and signals the transport, no message is added for them
+ * \memberof pw_client_node */
+struct pw_client_node_activation {
+	uint32_t status;		/**< bitmask of pending activations, a bit
+					  *  for each pw_client_node_message_type */
+	uint32_t count;			/**< number of activations by the peer */
+	uint32_t handled;		/**< number of handled activations */
+	uint32_t padding;
+	uint64_t signal_time;		/**< time of the last activation */
+	uint64_t awake_time;		/**< time the last activation was handled */
+};
+
+/** Position of the driver of the graph, written by the server in each cycle
+ * before the client is activated. The seq is odd while the server writes,
+ * use \ref pw_client_node_position_read() to get a consistent copy.
+ * \memberof pw_client_node */
+struct pw_client_node_position {
+	uint32_t seq;			/**< incremented before and after each update */
+	uint32_t flags;
+#define PW_CLIENT_NODE_POSITION_FLAG_LIVE	(1 << 0)	/**< the ticks come from
+								  *  the clock of a live driver */
+	int32_t rate;			/**< number of ticks per second */
+	uint32_t padding;
+	int64_t ticks;			/**< the ticks of the driver at monotonic */
+	int64_t monotonic;		/**< the monotonic time in nanoseconds */
+	uint64_t quantum;		/**< time between the last two cycles in nanoseconds */
+	int64_t delay;			/**< ticks between the position and the moment the
+					  *  data of the cycle is rendered, 0 when unknown */
+};
+
 /** Shared structure between client and server \memberof pw_client_node */
 struct pw_client_node_area {
 	uint32_t max_input_ports;	/**< max input ports of the node */
 	uint32_t n_input_ports;		/**< number of input ports of the node */
 	uint32_t max_output_ports;	/**< max output ports of the node */
 	uint32_t n_output_ports;	/**< number of output ports of the node */
+	struct pw_client_node_signal signal[2];	/**< signal for the messages to the client
+						  *  and to the server */
+	struct pw_client_node_activation activation[2];	/**< activation of the client
+							  *  and of the server */
+	struct pw_client_node_ring_info ring[2];	/**< ringbuffer to the client and
+							  *  to the server */
+	struct pw_client_node_position position;	/**< position of the driver */
 };
 
 /** \class pw_client_node_transport
@@ -62,6 +133,13 @@ struct pw_client_node_transport {
 	struct spa_ringbuffer *input_buffer;	/**< ringbuffer for input memory */
 	void *output_data;			/**< output memory for ringbuffer */
 	struct spa_ringbuffer *output_buffer;	/**< ringbuffer for output memory */
+	struct pw_client_node_signal *input_signal;	/**< signal for the input messages */
+	struct pw_client_node_signal *output_signal;	/**< signal for the output messages */
+	struct pw_client_node_activation *input_activation;	/**< our activation */
+	struct pw_client_node_activation *output_activation;	/**< activation of the peer */
+	struct pw_client_node_ring_info *input_info;	/**< info of the input ringbuffer */
+	struct pw_client_node_ring_info *output_info;	/**< info of the output ringbuffer */
+	struct pw_client_node_position *position;	/**< position of the driver */
 
 	/** Destroy a transport
 	 * \param trans a transport to destroy
@@ -74,7 +152,9 @@ struct pw_client_node_transport {
 	 * \param message the message to add
 	 * \return 0 on success, < 0 on error
 	 *
-	 * Write \a message to the shared ringbuffer.
+	 * Write \a message to the shared ringbuffer. When the ringbuffer is
+	 * full, -ENOSPC is returned and the overflows of output_info are
+	 * incremented.
 	 */
 	int (*add_message) (struct pw_client_node_transport *trans, struct pw_client_node_message *message);
 
@@ -100,12 +180,43 @@ struct pw_client_node_transport {
 	 * Use this function after \ref next_message().
 	 */
 	int (*parse_message) (struct pw_client_node_transport *trans, void *message);
+
+	/** Signal the peer that messages were added
+	 * \param trans the transport
+	 * \param fd the eventfd of the peer
+	 * \return 0 on success, < 0 on error
+	 *
+	 * When the peer waits with \ref wait() it is woken up with the futex
+	 * if it sleeps and nothing is done when it is busy. Else \a fd is
+	 * written.
+	 */
+	int (*signal) (struct pw_client_node_transport *trans, int fd);
+
+	/** Wait for a signal of the peer
+	 * \param trans the transport
+	 * \param spin the number of times to check for a signal before
+	 *        sleeping on the futex
+	 * \param block if the futex is used after the spin
+	 * \return 0 on success, -EAGAIN when \a block is false and there was
+	 *         no signal, < 0 on error
+	 *
+	 * While it waits, the peer signals the futex in the transport area
+	 * instead of the eventfd. With \a block true the peer keeps using the
+	 * futex after the call, this is for clients that handle the messages
+	 * in their own thread. With \a block false only signals sent after
+	 * the start of the call are seen and the peer writes the eventfd again
+	 * after it, this is used to catch a quick reply before going back to
+	 * the loop.
+	 */
+	int (*wait) (struct pw_client_node_transport *trans, uint32_t spin, bool block);
 };
 
 #define pw_client_node_transport_destroy(t)		((t)->destroy((t)))
 #define pw_client_node_transport_add_message(t,m)	((t)->add_message((t), (m)))
 #define pw_client_node_transport_next_message(t,m)	((t)->next_message((t), (m)))
 #define pw_client_node_transport_parse_message(t,m)	((t)->parse_message((t), (m)))
+#define pw_client_node_transport_signal(t,f)		((t)->signal((t), (f)))
+#define pw_client_node_transport_wait(t,s,b)		((t)->wait((t), (s), (b)))
 
 enum pw_client_node_message_type {
 	PW_CLIENT_NODE_MESSAGE_HAVE_OUTPUT,		/*< signal that the node has output */
@@ -135,6 +246,87 @@ struct pw_client_node_message_port_reuse_buffer {
 	struct pw_client_node_message_port_reuse_buffer_body body;
 };
 
+/** Activate the peer
+ * \param a the activation of the peer
+ * \param type the message type to activate
+ *
+ * The io areas of the transport must be updated before. Signal the
+ * transport to wake up the peer.
+ */
+static inline void
+pw_client_node_activation_trigger(struct pw_client_node_activation *a,
+				  enum pw_client_node_message_type type)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	a->signal_time = SPA_TIMESPEC_TO_TIME(&now);
+	a->count++;
+	__atomic_or_fetch(&a->status, 1u << type, __ATOMIC_RELEASE);
+}
+
+/** Take the pending activations
+ * \param a our activation
+ * \return a bitmask of the pending message types
+ */
+static inline uint32_t
+pw_client_node_activation_take(struct pw_client_node_activation *a)
+{
+	uint32_t status = __atomic_exchange_n(&a->status, 0, __ATOMIC_ACQUIRE);
+	struct timespec now;
+
+	if (status == 0)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	a->awake_time = SPA_TIMESPEC_TO_TIME(&now);
+	a->handled += __builtin_popcount(status);
+
+	return status;
+}
+
+/** Start an update of the position, only the server writes the position */
+static inline void
+pw_client_node_position_write_begin(struct pw_client_node_position *p)
+{
+	__atomic_store_n(&p->seq, p->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/** Complete an update of the position */
+static inline void
+pw_client_node_position_write_end(struct pw_client_node_position *p)
+{
+	__atomic_store_n(&p->seq, p->seq + 1, __ATOMIC_RELEASE);
+}
+
+/** Get a consistent copy of the position
+ * \param p the position in the transport area
+ * \param[out] copy the copy of the position
+ * \return 0 on success, -EAGAIN when the server kept updating the position
+ *
+ * This does not lock and can be called from any thread of the client.
+ */
+static inline int
+pw_client_node_position_read(const struct pw_client_node_position *p,
+			     struct pw_client_node_position *copy)
+{
+	uint32_t seq, retry;
+
+	for (retry = 0; retry < 64; retry++) {
+		seq = __atomic_load_n(&p->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+
+		*copy = *p;
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&p->seq, __ATOMIC_RELAXED) == seq)
+			return 0;
+	}
+	return -EAGAIN;
+}
+
 #define PW_CLIENT_NODE_MESSAGE_TYPE(message)	(((struct pw_client_node_message*)(message))->body.type.value)
 
 #define PW_CLIENT_NODE_MESSAGE_INIT(message) (struct pw_client_node_message)			\
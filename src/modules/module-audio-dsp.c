@@ -31,6 +31,7 @@
 #include <spa/lib/pod.h>
 #include <spa/lib/debug.h>
 
+#include "pipewire/array.h"
 #include "pipewire/core.h"
 #include "pipewire/link.h"
 #include "pipewire/log.h"
@@ -40,8 +41,7 @@
 
 #define NAME "dsp"
 
-#define MAX_PORTS	256
-#define MAX_BUFFERS	8
+#define MAX_BUFFERS	64
 
 struct type {
 	struct spa_type_media_type media_type;
@@ -96,9 +96,11 @@ struct port {
 	struct spa_port_info info;
 
 	struct spa_io_buffers *io;
+	bool active;
 
-	struct buffer buffers[MAX_BUFFERS];
+	struct buffer *buffers;
 	uint32_t n_buffers;
+	uint32_t max_buffers;	/**< number of allocated buffers */
         struct spa_list queue;
 
 	struct spa_buffer *bufs[1];
@@ -107,13 +109,16 @@ struct port {
 	struct spa_chunk chunk[1];
 };
 
-#define GET_IN_PORT(n,p)          (n->in_ports[p])
-#define GET_OUT_PORT(n,p)         (n->out_ports[p])
+#define GET_PORT_AT(a,p)          (pw_array_check_index(a,p,struct port *) ?	\
+					*pw_array_get_unchecked(a,p,struct port *) : NULL)
+#define GET_IN_PORT(n,p)          GET_PORT_AT(&n->in_ports,p)
+#define GET_OUT_PORT(n,p)         GET_PORT_AT(&n->out_ports,p)
 #define GET_PORT(n,d,p)           (d == SPA_DIRECTION_INPUT ? GET_IN_PORT(n,p) : GET_OUT_PORT(n,p))
 
 struct node {
 	struct spa_list link;
 	struct pw_node *node;
+	struct spa_hook node_listener;
 
 	struct impl *impl;
 
@@ -123,11 +128,16 @@ struct node {
 
 	struct spa_node node_impl;
 
-	struct port *in_ports[MAX_PORTS];
+	struct pw_array in_ports;	/* struct port * indexed by port_id */
 	int n_in_ports;
-	struct port *out_ports[MAX_PORTS];
+	struct pw_array out_ports;
 	int n_out_ports;
 
+	/* input ports with io, the only ones the processing looks at. There is
+	 * room for all input ports so that this never allocates */
+	struct pw_array in_active;
+	int n_in_active;
+
 	int port_count[2];
 };
 
@@ -190,11 +200,11 @@ static int node_get_port_ids(struct spa_node *node,
 	struct node *n = SPA_CONTAINER_OF(node, struct node, node_impl);
 	uint32_t i, c;
 
-	for (c = i = 0; i < n->n_in_ports && c < n_input_ids; i++) {
+	for (c = i = 0; i < pw_array_get_len(&n->in_ports, struct port *) && c < n_input_ids; i++) {
 		if (GET_IN_PORT(n, i))
 			input_ids[c++] = i;
 	}
-	for (c = i = 0; i < n->n_out_ports && c < n_output_ids; i++) {
+	for (c = i = 0; i < pw_array_get_len(&n->out_ports, struct port *) && c < n_output_ids; i++) {
 		if (GET_OUT_PORT(n, i))
 			output_ids[c++] = i;
 	}
@@ -279,6 +289,7 @@ static int node_process_input(struct spa_node *node)
 	struct spa_io_buffers *outio = outp->io;
 	struct buffer *out;
 	int16_t *op;
+	uint32_t n_frames;
 	int i;
 
 	pw_log_trace(NAME " %p: process input", this);
@@ -292,30 +303,43 @@ static int node_process_input(struct spa_node *node)
 		return -EPIPE;
 	}
 
+	/* the memory of buffers that the peer allocated can move in each cycle */
+	op = out->outbuf->datas[0].data;
+	if (op == NULL) {
+		pw_log_warn(NAME " %p: no memory on buffer %u", this, out->outbuf->id);
+		spa_list_prepend(&outp->queue, &out->link);
+		return -EIO;
+	}
+
+	/* never write more stereo frames than the buffer can hold */
+	n_frames = SPA_MIN(n->buffer_size,
+			   out->outbuf->datas[0].maxsize / (2 * sizeof(int16_t)));
+
 	outio->buffer_id = out->outbuf->id;
 	outio->status = SPA_STATUS_HAVE_BUFFER;
 
-	op = out->ptr;
+	/* channels of ports without io are not written below */
+	if (n->n_in_active < n->n_in_ports)
+		fill_s16(op, n_frames * 2, 1);
 
-	for (i = 0; i < n->n_in_ports; i++) {
-		struct port *inp = GET_IN_PORT(n, i);
+	for (i = 0; i < n->n_in_active; i++) {
+		struct port *inp = *pw_array_get_unchecked(&n->in_active, i, struct port *);
 		struct spa_io_buffers *inio = inp->io;
 		struct buffer *in;
 		int stride = 2;
 
 		if (inio->buffer_id < inp->n_buffers && inio->status == SPA_STATUS_HAVE_BUFFER) {
 			in = &inp->buffers[inio->buffer_id];
-			conv_f32_s16(op, in->ptr, n->buffer_size, stride);
+			conv_f32_s16(op + inp->port->port_id, in->ptr, n_frames, stride);
 		}
 		else {
-			fill_s16(op, n->buffer_size, stride);
+			fill_s16(op + inp->port->port_id, n_frames, stride);
 		}
-		op++;
 		inio->status = SPA_STATUS_NEED_BUFFER;
 	}
 
 	out->outbuf->datas[0].chunk->offset = 0;
-	out->outbuf->datas[0].chunk->size = n->buffer_size * sizeof(int16_t) * 2;
+	out->outbuf->datas[0].chunk->size = n_frames * sizeof(int16_t) * 2;
 	out->outbuf->datas[0].chunk->stride = 0;
 
 	return outio->status;
@@ -339,19 +363,40 @@ static int node_process_output(struct spa_node *node)
 		outio->buffer_id = SPA_ID_INVALID;
 	}
 
-	for (i = 0; i < n->n_in_ports; i++) {
-		struct port *inp = GET_IN_PORT(n, i);
-		struct spa_io_buffers *inio = inp->io;
+	for (i = 0; i < n->n_in_active; i++) {
+		struct port *inp = *pw_array_get_unchecked(&n->in_active, i, struct port *);
 
-		if (inio == NULL || inp->n_buffers == 0)
+		if (inp->n_buffers == 0)
 			continue;
 
-		inio->status = SPA_STATUS_NEED_BUFFER;
+		inp->io->status = SPA_STATUS_NEED_BUFFER;
 	}
 	return outio->status = SPA_STATUS_NEED_BUFFER;
 }
 
 
+/* keep the input ports with io in the active list */
+static void update_active(struct node *n, struct port *p, bool active)
+{
+	struct port **active_ports = n->in_active.data;
+	int i;
+
+	if (active == p->active)
+		return;
+
+	if (active) {
+		active_ports[n->n_in_active++] = p;
+	} else {
+		for (i = 0; i < n->n_in_active; i++) {
+			if (active_ports[i] == p) {
+				active_ports[i] = active_ports[--n->n_in_active];
+				break;
+			}
+		}
+	}
+	p->active = active;
+}
+
 static int port_set_io(struct spa_node *node,
 		       enum spa_direction direction, uint32_t port_id,
 		       uint32_t id, void *data, size_t size)
@@ -360,8 +405,11 @@ static int port_set_io(struct spa_node *node,
 	struct pw_type *t = n->impl->t;
 	struct port *p = GET_PORT(n, direction, port_id);
 
-	if (id == t->io.Buffers)
+	if (id == t->io.Buffers) {
 		p->io = data;
+		if (direction == SPA_DIRECTION_INPUT)
+			update_active(n, p, data != NULL);
+	}
 	else
 		return -ENOENT;
 
@@ -538,17 +586,30 @@ static int port_use_buffers(struct spa_node *node, enum spa_direction direction,
 
 	pw_log_debug("use_buffers %d", n_buffers);
 
+	if (n_buffers > MAX_BUFFERS)
+		return -EINVAL;
+
 	clear_buffers(n, p);
 
+	if (n_buffers > p->max_buffers) {
+		struct buffer *buffers;
+
+		if ((buffers = realloc(p->buffers, n_buffers * sizeof(struct buffer))) == NULL)
+			return -errno;
+		p->buffers = buffers;
+		p->max_buffers = n_buffers;
+	}
+
 	for (i = 0; i < n_buffers; i++) {
                 struct buffer *b;
 		struct spa_data *d = buffers[i]->datas;
 
                 b = &p->buffers[i];
 		b->outbuf = buffers[i];
-		if ((d[0].type == t->data.MemPtr ||
-		     d[0].type == t->data.MemFd ||
-		     d[0].type == t->data.DmaBuf) && d[0].data != NULL) {
+		if ((d[0].type == t->data.MemPtr && direction == SPA_DIRECTION_OUTPUT) ||
+		    ((d[0].type == t->data.MemPtr ||
+		      d[0].type == t->data.MemFd ||
+		      d[0].type == t->data.DmaBuf) && d[0].data != NULL)) {
 			b->ptr = d[0].data;
 		} else {
 			pw_log_error(NAME " %p: invalid memory on buffer %p", p, buffers[i]);
@@ -693,12 +754,14 @@ static void port_free(void *data)
 	struct pw_port *port = p->port;
 
 	if (port->direction == PW_DIRECTION_INPUT) {
-		n->in_ports[port->port_id] = NULL;
+		update_active(n, p, false);
+		*pw_array_get_unchecked(&n->in_ports, port->port_id, struct port *) = NULL;
 		n->n_in_ports--;
 	} else {
-		n->out_ports[port->port_id] = NULL;
+		*pw_array_get_unchecked(&n->out_ports, port->port_id, struct port *) = NULL;
 		n->n_out_ports--;
 	}
+	free(p->buffers);
 }
 
 static const struct pw_port_events port_events = {
@@ -709,8 +772,19 @@ static const struct pw_port_events port_events = {
 static struct port *make_port(struct node *n, enum pw_direction direction,
 		uint32_t id, uint32_t flags, struct pw_properties *props)
 {
+	struct pw_array *ports = direction == PW_DIRECTION_INPUT ? &n->in_ports : &n->out_ports;
 	struct pw_port *port;
-	struct port *p;
+	struct port *p, **pp;
+
+	/* make room for the port and, for inputs, for the port in the active list */
+	while (!pw_array_check_index(ports, id, struct port *)) {
+		if ((pp = pw_array_add(ports, sizeof(struct port *))) == NULL)
+			goto no_mem;
+		*pp = NULL;
+	}
+	if (direction == PW_DIRECTION_INPUT &&
+	    !pw_array_ensure_size(&n->in_active, (n->n_in_ports + 1) * sizeof(struct port *)))
+		goto no_mem;
 
 	port = pw_port_new(direction, id, props, sizeof(struct port));
         if (port == NULL)
@@ -722,19 +796,38 @@ static struct port *make_port(struct node *n, enum pw_direction direction,
 	p->flags = flags;
 	spa_list_init(&p->queue);
 
-	if (direction == PW_DIRECTION_INPUT) {
-		n->in_ports[id] = p;
+	*pw_array_get_unchecked(ports, id, struct port *) = p;
+	if (direction == PW_DIRECTION_INPUT)
 		n->n_in_ports++;
-	} else {
-		n->out_ports[id] = p;
+	else
 		n->n_out_ports++;
-	}
+
 	pw_port_add_listener(port, &p->port_listener, &port_events, p);
 	pw_port_add(port, n->node);
 
 	return p;
+
+      no_mem:
+	if (props)
+		pw_properties_free(props);
+	return NULL;
 }
 
+static void node_free(void *data)
+{
+	struct node *n = data;
+
+	spa_list_remove(&n->link);
+	pw_array_clear(&n->in_ports);
+	pw_array_clear(&n->out_ports);
+	pw_array_clear(&n->in_active);
+}
+
+static const struct pw_node_events node_events = {
+	PW_VERSION_NODE_EVENTS,
+	.free = node_free,
+};
+
 static struct pw_node *make_node(struct impl *impl, const struct pw_properties *props,
 		enum pw_direction direction)
 {
@@ -767,6 +860,11 @@ static struct pw_node *make_node(struct impl *impl, const struct pw_properties *
 	n->channels = 2;
 	n->sample_rate = 44100;
 	n->buffer_size = 1024 / sizeof(float);
+	pw_array_init(&n->in_ports, 8 * sizeof(struct port *));
+	pw_array_init(&n->out_ports, 8 * sizeof(struct port *));
+	pw_array_init(&n->in_active, 8 * sizeof(struct port *));
+	spa_list_init(&n->link);
+	pw_node_add_listener(node, &n->node_listener, &node_events, n);
 	pw_node_set_implementation(node, &n->node_impl);
 
 	p = make_port(n, direction, 0, 0, NULL);
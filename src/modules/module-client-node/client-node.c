@@ -21,6 +21,8 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <dlfcn.h>
@@ -42,24 +44,31 @@
 
 /** \cond */
 
-#define MAX_INPUTS       64
-#define MAX_OUTPUTS      64
+#define MAX_PORTS		1024
+#define MAX_BUFFERS		64
 
-#define MAX_BUFFERS      64
+#define DEFAULT_MAX_MISSES	8
+#define MAX_MISSES		1024
+#define RECOVER_CYCLES		256
+#define MAX_SPIN		(1 << 20)
+#define MAX_SPIN_ROUNDS		16
 
-#define CHECK_IN_PORT_ID(this,d,p)       ((d) == SPA_DIRECTION_INPUT && (p) < MAX_INPUTS)
-#define CHECK_OUT_PORT_ID(this,d,p)      ((d) == SPA_DIRECTION_OUTPUT && (p) < MAX_OUTPUTS)
+#define CHECK_IN_PORT_ID(this,d,p)       ((d) == SPA_DIRECTION_INPUT && \
+					  pw_array_check_index(&(this)->in_ports, p, struct port *))
+#define CHECK_OUT_PORT_ID(this,d,p)      ((d) == SPA_DIRECTION_OUTPUT && \
+					  pw_array_check_index(&(this)->out_ports, p, struct port *))
 #define CHECK_PORT_ID(this,d,p)          (CHECK_IN_PORT_ID(this,d,p) || CHECK_OUT_PORT_ID(this,d,p))
-#define CHECK_FREE_IN_PORT(this,d,p)     (CHECK_IN_PORT_ID(this,d,p) && !(this)->in_ports[p].valid)
-#define CHECK_FREE_OUT_PORT(this,d,p)    (CHECK_OUT_PORT_ID(this,d,p) && !(this)->out_ports[p].valid)
+#define CHECK_FREE_IN_PORT(this,d,p)     (CHECK_IN_PORT_ID(this,d,p) && GET_IN_PORT(this,p) == NULL)
+#define CHECK_FREE_OUT_PORT(this,d,p)    (CHECK_OUT_PORT_ID(this,d,p) && GET_OUT_PORT(this,p) == NULL)
 #define CHECK_FREE_PORT(this,d,p)        (CHECK_FREE_IN_PORT (this,d,p) || CHECK_FREE_OUT_PORT (this,d,p))
-#define CHECK_IN_PORT(this,d,p)          (CHECK_IN_PORT_ID(this,d,p) && (this)->in_ports[p].valid)
-#define CHECK_OUT_PORT(this,d,p)         (CHECK_OUT_PORT_ID(this,d,p) && (this)->out_ports[p].valid)
+#define CHECK_IN_PORT(this,d,p)          (CHECK_IN_PORT_ID(this,d,p) && GET_IN_PORT(this,p) != NULL)
+#define CHECK_OUT_PORT(this,d,p)         (CHECK_OUT_PORT_ID(this,d,p) && GET_OUT_PORT(this,p) != NULL)
 #define CHECK_PORT(this,d,p)             (CHECK_IN_PORT (this,d,p) || CHECK_OUT_PORT (this,d,p))
 
-#define GET_IN_PORT(this,p)	(&this->in_ports[p])
-#define GET_OUT_PORT(this,p)	(&this->out_ports[p])
+#define GET_IN_PORT(this,p)	(*pw_array_get_unchecked(&(this)->in_ports, p, struct port *))
+#define GET_OUT_PORT(this,p)	(*pw_array_get_unchecked(&(this)->out_ports, p, struct port *))
 #define GET_PORT(this,d,p)	(d == SPA_DIRECTION_INPUT ? GET_IN_PORT(this,p) : GET_OUT_PORT(this,p))
+#define GET_PORTS(this,d)	(d == SPA_DIRECTION_INPUT ? &(this)->in_ports : &(this)->out_ports)
 
 #define CHECK_PORT_BUFFER(this,b,p)      (b < p->n_buffers)
 
@@ -81,7 +90,6 @@ struct buffer {
 };
 
 struct port {
-	bool valid;
 	struct spa_port_info info;
 	struct pw_properties *properties;
 
@@ -91,7 +99,8 @@ struct port {
 	struct spa_io_buffers *io;
 
 	uint32_t n_buffers;
-	struct buffer buffers[MAX_BUFFERS];
+	uint32_t max_buffers;	/**< number of allocated buffers */
+	struct buffer *buffers;
 };
 
 struct node {
@@ -115,8 +124,10 @@ struct node {
 	uint32_t n_inputs;
 	uint32_t max_outputs;
 	uint32_t n_outputs;
-	struct port in_ports[MAX_INPUTS];
-	struct port out_ports[MAX_OUTPUTS];
+	/* struct port * indexed by port_id, sized for the ports the client
+	 * announces, slots of unused port ids are NULL */
+	struct pw_array in_ports;
+	struct pw_array out_ports;
 
 	uint32_t n_params;
 	struct spa_pod **params;
@@ -146,6 +157,25 @@ struct impl {
 
 	uint32_t input_ready;
 	bool out_pending;
+
+	/* deadline watchdog, see check_deadline() */
+	uint32_t spin;			/**< checks for a quick reply of the client */
+	uint32_t max_misses;		/**< misses before the node is made async, 0 disables */
+	uint32_t misses;		/**< deadlines missed in a row */
+	uint32_t hits;			/**< deadlines met in a row while async */
+	uint64_t cycle_time;		/**< start of the last cycle */
+	uint64_t quantum;		/**< time between the last two cycles */
+	uint64_t request_time;		/**< time output was asked from the client */
+	uint64_t response;		/**< time the client took to make the last output */
+	bool async;			/**< the graph does not wait for the client */
+	bool have_async_output;		/**< the client made output for the next cycle */
+	struct spa_source *async_event;	/**< tells the main loop async changed */
+
+	/* position of the driver, published in the transport, see update_position() */
+	struct pw_node *clock_node;	/**< live peer with a clock, main thread */
+	struct spa_hook clock_listener;
+	struct spa_clock *clock;	/**< clock of clock_node, data thread */
+	uint64_t position_time;		/**< time of the last position update */
 };
 
 /** \endcond */
@@ -266,10 +296,10 @@ static int impl_node_set_param(struct spa_node *node, uint32_t id, uint32_t flag
 
 static inline void do_flush(struct node *this)
 {
-	uint64_t cmd = 1;
-	if (write(this->writefd, &cmd, 8) != 8)
-		spa_log_warn(this->log, "node %p: error flushing : %s", this, strerror(errno));
+	int res;
 
+	if ((res = pw_client_node_transport_signal(this->impl->transport, this->writefd)) < 0)
+		spa_log_warn(this->log, "node %p: error flushing : %s", this, spa_strerror(res));
 }
 
 static int impl_node_send_command(struct spa_node *node, const struct spa_command *command)
@@ -357,21 +387,58 @@ impl_node_get_port_ids(struct spa_node *node,
 	this = SPA_CONTAINER_OF(node, struct node, node);
 
 	if (input_ids) {
-		for (c = 0, i = 0; i < MAX_INPUTS && c < n_input_ids; i++) {
-			if (this->in_ports[i].valid)
+		for (c = 0, i = 0; CHECK_IN_PORT_ID(this, SPA_DIRECTION_INPUT, i) && c < n_input_ids; i++) {
+			if (GET_IN_PORT(this, i))
 				input_ids[c++] = i;
 		}
 	}
 	if (output_ids) {
-		for (c = 0, i = 0; i < MAX_OUTPUTS && c < n_output_ids; i++) {
-			if (this->out_ports[i].valid)
+		for (c = 0, i = 0; CHECK_OUT_PORT_ID(this, SPA_DIRECTION_OUTPUT, i) && c < n_output_ids; i++) {
+			if (GET_OUT_PORT(this, i))
 				output_ids[c++] = i;
 		}
 	}
 	return 0;
 }
 
-static void
+/* make room for at least n_ports ports in ports */
+static int ensure_ports(struct pw_array *ports, uint32_t n_ports)
+{
+	struct port **p;
+
+	while (pw_array_get_len(ports, struct port *) < n_ports) {
+		if ((p = pw_array_add(ports, sizeof(struct port *))) == NULL)
+			return -ENOMEM;
+		*p = NULL;
+	}
+	return 0;
+}
+
+/* port ids index the port arrays and the io areas of the transport */
+static int check_port_id(struct node *this, enum spa_direction direction, uint32_t port_id)
+{
+	struct impl *impl = this->impl;
+	uint32_t max_ports;
+
+	if (direction == SPA_DIRECTION_INPUT) {
+		max_ports = this->max_inputs == 0 ? MAX_PORTS : this->max_inputs;
+		if (impl->transport)
+			max_ports = SPA_MIN(max_ports, impl->transport->area->max_input_ports);
+	} else {
+		max_ports = this->max_outputs == 0 ? MAX_PORTS : this->max_outputs;
+		if (impl->transport)
+			max_ports = SPA_MIN(max_ports, impl->transport->area->max_output_ports);
+	}
+	if (port_id >= max_ports) {
+		spa_log_error(this->log, "node %p: invalid %s port %u, max %u", this,
+			      direction == SPA_DIRECTION_INPUT ? "input" : "output",
+			      port_id, max_ports);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static int
 do_update_port(struct node *this,
 	       enum spa_direction direction,
 	       uint32_t port_id,
@@ -382,8 +449,27 @@ do_update_port(struct node *this,
 {
 	struct port *port;
 	struct pw_type *t = this->impl->t;
+	int res;
+
+	if (!CHECK_PORT(this, direction, port_id) &&
+	    (res = check_port_id(this, direction, port_id)) < 0)
+		return res;
+
+	if ((res = ensure_ports(GET_PORTS(this, direction), port_id + 1)) < 0)
+		return res;
 
 	port = GET_PORT(this, direction, port_id);
+	if (port == NULL) {
+		spa_log_info(this->log, "node %p: adding port %d", this, port_id);
+		if ((port = calloc(1, sizeof(struct port))) == NULL)
+			return -errno;
+
+		*pw_array_get_unchecked(GET_PORTS(this, direction), port_id, struct port *) = port;
+		if (direction == SPA_DIRECTION_INPUT)
+			this->n_inputs++;
+		else
+			this->n_outputs++;
+	}
 
 	if (change_mask & PW_CLIENT_NODE_PORT_UPDATE_PARAMS) {
 		int i;
@@ -418,17 +504,7 @@ do_update_port(struct node *this,
 			}
 		}
 	}
-
-	if (!port->valid) {
-		spa_log_info(this->log, "node %p: adding port %d", this, port_id);
-		port->have_format = false;
-		port->valid = true;
-
-		if (direction == SPA_DIRECTION_INPUT)
-			this->n_inputs++;
-		else
-			this->n_outputs++;
-	}
+	return 0;
 }
 
 static void
@@ -445,26 +521,26 @@ clear_port(struct node *this,
 
 static void do_uninit_port(struct node *this, enum spa_direction direction, uint32_t port_id)
 {
-	struct port *port;
+	struct port *port = GET_PORT(this, direction, port_id);
 
 	spa_log_info(this->log, "node %p: removing port %d", this, port_id);
 
-	if (direction == SPA_DIRECTION_INPUT) {
-		port = GET_IN_PORT(this, port_id);
+	if (direction == SPA_DIRECTION_INPUT)
 		this->n_inputs--;
-	} else {
-		port = GET_OUT_PORT(this, port_id);
+	else
 		this->n_outputs--;
-	}
+
 	clear_port(this, port, direction, port_id);
-	port->valid = false;
+	*pw_array_get_unchecked(GET_PORTS(this, direction), port_id, struct port *) = NULL;
+	free(port->params);
+	free(port->buffers);
+	free(port);
 }
 
 static int
 impl_node_add_port(struct spa_node *node, enum spa_direction direction, uint32_t port_id)
 {
 	struct node *this;
-	struct port *port;
 
 	if (node == NULL)
 		return -EINVAL;
@@ -474,10 +550,9 @@ impl_node_add_port(struct spa_node *node, enum spa_direction direction, uint32_t
 	if (!CHECK_FREE_PORT(this, direction, port_id))
 		return -EINVAL;
 
-	port = GET_PORT(this, direction, port_id);
-	clear_port(this, port, direction, port_id);
-
-	return 0;
+	return do_update_port(this, direction, port_id,
+			      PW_CLIENT_NODE_PORT_UPDATE_PARAMS |
+			      PW_CLIENT_NODE_PORT_UPDATE_INFO, 0, NULL, NULL);
 }
 
 static int
@@ -652,7 +727,7 @@ impl_node_port_use_buffers(struct spa_node *node,
 	struct impl *impl;
 	struct port *port;
 	uint32_t i, j;
-	struct pw_client_node_buffer *mb;
+	struct pw_client_node_buffer mb[MAX_BUFFERS];
 	struct pw_type *t;
 
 	this = SPA_CONTAINER_OF(node, struct node, node);
@@ -669,12 +744,21 @@ impl_node_port_use_buffers(struct spa_node *node,
 	if (!port->have_format)
 		return -EIO;
 
+	if (n_buffers > MAX_BUFFERS) {
+		spa_log_error(this->log, "node %p: too many buffers %u, max %u", this,
+			      n_buffers, MAX_BUFFERS);
+		return -EINVAL;
+	}
+
 	clear_buffers(this, port);
 
-	if (n_buffers > 0) {
-		mb = alloca(n_buffers * sizeof(struct pw_client_node_buffer));
-	} else {
-		mb = NULL;
+	if (n_buffers > port->max_buffers) {
+		struct buffer *b;
+
+		if ((b = realloc(port->buffers, n_buffers * sizeof(struct buffer))) == NULL)
+			return -errno;
+		port->buffers = b;
+		port->max_buffers = n_buffers;
 	}
 
 	port->n_buffers = n_buffers;
@@ -709,10 +793,17 @@ impl_node_port_use_buffers(struct spa_node *node,
 			data_size += buffers[i]->metas[j].size;
 		}
 		for (j = 0; j < buffers[i]->n_datas; j++) {
-			struct spa_data *d = buffers[i]->datas;
+			struct spa_data *d = &buffers[i]->datas[j];
 			data_size += sizeof(struct spa_chunk);
-			if (d->type == t->data.MemPtr)
-				data_size += d->maxsize;
+			if (d->type != t->data.MemPtr)
+				continue;
+			/* the client only sees memory of the buffer memblock */
+			if (d->data == NULL || pw_memblock_find(d->data) != mem) {
+				spa_log_error(this->log, "node %p: buffer %u data %u is not shared",
+					      this, i, j);
+				return -EINVAL;
+			}
+			data_size += d->maxsize;
 		}
 
 		m = ensure_mem(impl, mem->fd, t->data.MemFd, mem->flags);
@@ -834,6 +925,40 @@ impl_node_port_send_command(struct spa_node *node,
 	return 0;
 }
 
+/* Publish the position of the driver to the client, once per cycle before
+ * the client is activated. Without a live clock the ticks stay 0 like in
+ * the clock updates. */
+static void update_position(struct impl *impl)
+{
+	struct pw_client_node_position *pos = impl->transport->position;
+	struct spa_clock *clock = impl->clock;
+	struct timespec ts;
+	int32_t rate = 1;
+	int64_t ticks = 0, monotonic;
+	uint64_t now;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = monotonic = SPA_TIMESPEC_TO_TIME(&ts);
+
+	if (clock && spa_clock_get_time(clock, &rate, &ticks, &monotonic) < 0) {
+		clock = NULL;
+		rate = 1;
+		ticks = 0;
+		monotonic = now;
+	}
+
+	pw_client_node_position_write_begin(pos);
+	pos->flags = clock ? PW_CLIENT_NODE_POSITION_FLAG_LIVE : 0;
+	pos->rate = rate;
+	pos->ticks = ticks;
+	pos->monotonic = monotonic;
+	pos->quantum = impl->position_time ? now - impl->position_time : 0;
+	pos->delay = 0;
+	pw_client_node_position_write_end(pos);
+
+	impl->position_time = now;
+}
+
 static int impl_node_process_input(struct spa_node *node)
 {
 	struct node *this = SPA_CONTAINER_OF(node, struct node, node);
@@ -851,6 +976,8 @@ static int impl_node_process_input(struct spa_node *node)
 		res = SPA_STATUS_NEED_BUFFER;
 	}
 	else {
+		update_position(impl);
+
 		spa_list_for_each(p, &n->ports[SPA_DIRECTION_INPUT], link) {
 			struct spa_io_buffers *io = p->io;
 
@@ -862,8 +989,8 @@ static int impl_node_process_input(struct spa_node *node)
 		                spa_node_port_reuse_buffer(pp->node->implementation,
 						pp->port_id, io->buffer_id);
 		}
-		pw_client_node_transport_add_message(impl->transport,
-			       &PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_PROCESS_INPUT));
+		pw_client_node_activation_trigger(impl->transport->output_activation,
+						  PW_CLIENT_NODE_MESSAGE_PROCESS_INPUT);
 		do_flush(this);
 
 		impl->input_ready--;
@@ -872,6 +999,116 @@ static int impl_node_process_input(struct spa_node *node)
 	return res;
 }
 
+/* Wait for the client again. The output it made for the next cycle is given
+ * back to the client, this cycle asks for new output like a sync node does. */
+static void recover_sync(struct impl *impl)
+{
+	struct spa_graph_node *n = &impl->this.node->rt.node;
+	struct spa_graph_port *p;
+
+	if (impl->have_async_output) {
+		spa_list_for_each(p, &n->ports[SPA_DIRECTION_OUTPUT], link) {
+			struct spa_io_buffers *io = &impl->transport->outputs[p->port_id];
+
+			if (io->status != SPA_STATUS_HAVE_BUFFER || io->buffer_id == SPA_ID_INVALID)
+				continue;
+
+			pw_client_node_transport_add_message(impl->transport,
+				(struct pw_client_node_message *)
+				&PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFER_INIT(p->port_id,
+									       io->buffer_id));
+		}
+		impl->have_async_output = false;
+	}
+	pw_log_info("client-node %p: %u deadlines met, making node sync", &impl->this,
+		    impl->hits);
+
+	impl->async = false;
+	impl->misses = impl->hits = 0;
+	pw_loop_signal_event(impl->core->main_loop, impl->async_event);
+}
+
+/* Called at the start of each cycle. The client missed its deadline when it
+ * did not make the output that was asked in the previous cycle, so it took
+ * longer than the quantum. After max_misses misses in a row the node is made
+ * async. An async node that answered within half the quantum for
+ * RECOVER_CYCLES cycles in a row is made sync again. */
+static void check_deadline(struct impl *impl)
+{
+	struct timespec ts;
+	uint64_t now;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = SPA_TIMESPEC_TO_TIME(&ts);
+	if (impl->cycle_time != 0)
+		impl->quantum = now - impl->cycle_time;
+	impl->cycle_time = now;
+
+	if (impl->max_misses == 0)
+		return;
+
+	if (impl->async) {
+		if (impl->out_pending || impl->response > impl->quantum / 2)
+			impl->hits = 0;
+		else if (++impl->hits >= RECOVER_CYCLES)
+			recover_sync(impl);
+		return;
+	}
+
+	if (!impl->out_pending) {
+		impl->misses = 0;
+		return;
+	}
+	pw_log_trace("client-node %p: deadline missed %u", &impl->this, impl->misses + 1);
+
+	if (++impl->misses < impl->max_misses)
+		return;
+
+	pw_log_warn("client-node %p: %u deadlines missed, last response %" PRIu64
+		    " ns, quantum %" PRIu64 " ns, making node async", &impl->this,
+		    impl->misses, impl->response, impl->quantum);
+	impl->async = true;
+	impl->hits = 0;
+	pw_loop_signal_event(impl->core->main_loop, impl->async_event);
+}
+
+static void ask_output(struct impl *impl)
+{
+	impl->out_pending = true;
+	pw_client_node_activation_trigger(impl->transport->output_activation,
+					  PW_CLIENT_NODE_MESSAGE_PROCESS_OUTPUT);
+	impl->request_time = impl->transport->output_activation->signal_time;
+	do_flush(&impl->node);
+}
+
+/* The graph does not wait for an async node. The output that the client made
+ * since the last cycle is given to the graph, so it is one cycle late, and
+ * the client is asked for the next one. There is no output for the cycle
+ * when the client is still busy. */
+static int process_output_async(struct impl *impl)
+{
+	struct spa_graph_node *n = &impl->this.node->rt.node;
+	struct spa_graph_port *p;
+	int res;
+
+	if (impl->out_pending)
+		return SPA_STATUS_NEED_BUFFER;
+
+	spa_list_for_each(p, &n->ports[SPA_DIRECTION_OUTPUT], link) {
+		struct spa_io_buffers *io = p->io, request = *io;
+
+		if (impl->have_async_output)
+			*io = impl->transport->outputs[p->port_id];
+		impl->transport->outputs[p->port_id] = request;
+	}
+	res = impl->have_async_output ? SPA_STATUS_HAVE_BUFFER : SPA_STATUS_NEED_BUFFER;
+	impl->have_async_output = false;
+
+	ask_output(impl);
+
+	return res;
+}
+
 static int impl_node_process_output(struct spa_node *node)
 {
 	struct node *this;
@@ -883,10 +1120,21 @@ static int impl_node_process_output(struct spa_node *node)
 	impl = this->impl;
 	n = &impl->this.node->rt.node;
 
-	if (impl->out_pending)
-		goto done;
+	check_deadline(impl);
 
-	impl->out_pending = true;
+	/* nodes with inputs get the position in process_input */
+	if (spa_list_is_empty(&n->ports[SPA_DIRECTION_INPUT]))
+		update_position(impl);
+
+	if (impl->async)
+		return process_output_async(impl);
+
+	if (impl->out_pending) {
+		pw_client_node_activation_trigger(impl->transport->output_activation,
+						  PW_CLIENT_NODE_MESSAGE_PROCESS_OUTPUT);
+		do_flush(this);
+		return SPA_STATUS_OK;
+	}
 
 	spa_list_for_each(p, &n->ports[SPA_DIRECTION_OUTPUT], link) {
 		struct spa_io_buffers *io = p->io;
@@ -897,11 +1145,7 @@ static int impl_node_process_output(struct spa_node *node)
 				impl->transport->outputs[p->port_id].status,
 				impl->transport->outputs[p->port_id].buffer_id);
 	}
-
-      done:
-	pw_client_node_transport_add_message(impl->transport,
-			       &PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_PROCESS_OUTPUT));
-	do_flush(this);
+	ask_output(impl);
 
 	return SPA_STATUS_OK;
 }
@@ -916,6 +1160,14 @@ static int handle_node_message(struct node *this, struct pw_client_node_message
 
 	switch (PW_CLIENT_NODE_MESSAGE_TYPE(message)) {
 	case PW_CLIENT_NODE_MESSAGE_HAVE_OUTPUT:
+		impl->response = impl->transport->input_activation->signal_time -
+			impl->request_time;
+		if (impl->async) {
+			/* keep the output in the transport for the next cycle */
+			impl->out_pending = false;
+			impl->have_async_output = true;
+			break;
+		}
 		spa_list_for_each(p, &n->ports[SPA_DIRECTION_OUTPUT], link) {
 			*p->io = impl->transport->outputs[p->port_id];
 			pw_log_trace("have output %d %d", p->io->status, p->io->buffer_id);
@@ -955,11 +1207,32 @@ static void setup_transport(struct impl *impl)
 
 	spa_node_get_n_ports(&impl->node.node, &n_inputs, &max_inputs, &n_outputs, &max_outputs);
 
-	impl->transport = pw_client_node_transport_new(max_inputs, max_outputs);
+	impl->transport = pw_client_node_transport_new(max_inputs, max_outputs, 0);
 	impl->transport->area->n_input_ports = n_inputs;
 	impl->transport->area->n_output_ports = n_outputs;
 }
 
+/* the client only maps the transport once, so it can only be made bigger
+ * for more ports until it is sent to the client */
+static void update_transport(struct impl *impl)
+{
+	struct pw_client_node_area *a;
+
+	if (impl->transport == NULL || impl->node.data_source.fd != -1)
+		return;
+
+	a = impl->transport->area;
+	if (impl->node.max_inputs <= a->max_input_ports &&
+	    impl->node.max_outputs <= a->max_output_ports)
+		return;
+
+	pw_log_debug("client-node %p: grow transport to %u %u ports", impl,
+		     impl->node.max_inputs, impl->node.max_outputs);
+
+	pw_client_node_transport_destroy(impl->transport);
+	setup_transport(impl);
+}
+
 static void
 client_node_done(void *data, int seq, int res)
 {
@@ -983,9 +1256,18 @@ client_node_update(void *data,
 	struct impl *impl = data;
 	struct node *this = &impl->node;
 
-	if (change_mask & PW_CLIENT_NODE_UPDATE_MAX_INPUTS)
+	if (max_input_ports > MAX_PORTS || max_output_ports > MAX_PORTS) {
+		spa_log_warn(this->log, "node %p: max ports %u %u clamped to %u", this,
+			     max_input_ports, max_output_ports, MAX_PORTS);
+		max_input_ports = SPA_MIN(max_input_ports, MAX_PORTS);
+		max_output_ports = SPA_MIN(max_output_ports, MAX_PORTS);
+	}
+
+	if ((change_mask & PW_CLIENT_NODE_UPDATE_MAX_INPUTS) &&
+	    ensure_ports(&this->in_ports, max_input_ports) == 0)
 		this->max_inputs = max_input_ports;
-	if (change_mask & PW_CLIENT_NODE_UPDATE_MAX_OUTPUTS)
+	if ((change_mask & PW_CLIENT_NODE_UPDATE_MAX_OUTPUTS) &&
+	    ensure_ports(&this->out_ports, max_output_ports) == 0)
 		this->max_outputs = max_output_ports;
 	if (change_mask & PW_CLIENT_NODE_UPDATE_PARAMS) {
 		int i;
@@ -1001,6 +1283,8 @@ client_node_update(void *data,
 	}
 	spa_log_info(this->log, "node %p: got node update max_in %u, max_out %u", this,
 		     this->max_inputs, this->max_outputs);
+
+	update_transport(impl);
 }
 
 static void
@@ -1017,19 +1301,22 @@ client_node_port_update(void *data,
 	bool remove;
 
 	spa_log_info(this->log, "node %p: got port update", this);
-	if (!CHECK_PORT_ID(this, direction, port_id))
+	if (direction != SPA_DIRECTION_INPUT && direction != SPA_DIRECTION_OUTPUT)
 		return;
 
 	remove = (change_mask == 0);
 
 	if (remove) {
+		if (!CHECK_PORT(this, direction, port_id))
+			return;
 		do_uninit_port(this, direction, port_id);
-	} else {
-		do_update_port(this,
-			       direction,
-			       port_id,
-			       change_mask,
-			       n_params, params, info);
+	} else if (do_update_port(this,
+				  direction,
+				  port_id,
+				  change_mask,
+				  n_params, params, info) < 0) {
+		spa_log_error(this->log, "node %p: can't update port %d", this, port_id);
+		return;
 	}
 	pw_node_update_ports(impl->this.node);
 }
@@ -1063,6 +1350,27 @@ static struct pw_client_node_proxy_methods client_node_methods = {
 	.destroy = client_node_destroy,
 };
 
+static void handle_transport(struct node *this)
+{
+	struct impl *impl = this->impl;
+	struct pw_client_node_message message;
+	uint32_t status;
+
+	while (pw_client_node_transport_next_message(impl->transport, &message) == 1) {
+		struct pw_client_node_message *msg = alloca(SPA_POD_SIZE(&message));
+		pw_client_node_transport_parse_message(impl->transport, msg);
+		handle_node_message(this, msg);
+	}
+
+	status = pw_client_node_activation_take(impl->transport->input_activation);
+	if (status & (1 << PW_CLIENT_NODE_MESSAGE_HAVE_OUTPUT))
+		handle_node_message(this,
+			&PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_HAVE_OUTPUT));
+	if (status & (1 << PW_CLIENT_NODE_MESSAGE_NEED_INPUT))
+		handle_node_message(this,
+			&PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_NEED_INPUT));
+}
+
 static void node_on_data_fd_events(struct spa_source *source)
 {
 	struct node *this = source->data;
@@ -1074,18 +1382,19 @@ static void node_on_data_fd_events(struct spa_source *source)
 	}
 
 	if (source->rmask & SPA_IO_IN) {
-		struct pw_client_node_message message;
 		uint64_t cmd;
+		uint32_t rounds = 0;
 
 		if (read(this->data_source.fd, &cmd, sizeof(uint64_t)) != sizeof(uint64_t))
 			spa_log_warn(this->log, "node %p: error reading message: %s",
 					this, strerror(errno));
 
-		while (pw_client_node_transport_next_message(impl->transport, &message) == 1) {
-			struct pw_client_node_message *msg = alloca(SPA_POD_SIZE(&message));
-			pw_client_node_transport_parse_message(impl->transport, msg);
-			handle_node_message(this, msg);
-		}
+		/* handle the signals of the client that come in quickly without
+		 * the eventfd, a few times so that the loop is not starved */
+		do {
+			handle_transport(this);
+		} while (impl->spin > 0 && ++rounds < MAX_SPIN_ROUNDS &&
+			 pw_client_node_transport_wait(impl->transport, impl->spin, false) == 0);
 	}
 }
 
@@ -1139,6 +1448,9 @@ node_init(struct node *this,
 
 	this->node = impl_node;
 
+	pw_array_init(&this->in_ports, 16 * sizeof(struct port *));
+	pw_array_init(&this->out_ports, 16 * sizeof(struct port *));
+
 	this->data_source.func = node_on_data_fd_events;
 	this->data_source.data = this;
 	this->data_source.fd = -1;
@@ -1154,14 +1466,16 @@ static int node_clear(struct node *this)
 {
 	uint32_t i;
 
-	for (i = 0; i < MAX_INPUTS; i++) {
-		if (this->in_ports[i].valid)
-			clear_port(this, &this->in_ports[i], SPA_DIRECTION_INPUT, i);
+	for (i = 0; CHECK_IN_PORT_ID(this, SPA_DIRECTION_INPUT, i); i++) {
+		if (GET_IN_PORT(this, i))
+			do_uninit_port(this, SPA_DIRECTION_INPUT, i);
 	}
-	for (i = 0; i < MAX_OUTPUTS; i++) {
-		if (this->out_ports[i].valid)
-			clear_port(this, &this->out_ports[i], SPA_DIRECTION_OUTPUT, i);
+	for (i = 0; CHECK_OUT_PORT_ID(this, SPA_DIRECTION_OUTPUT, i); i++) {
+		if (GET_OUT_PORT(this, i))
+			do_uninit_port(this, SPA_DIRECTION_OUTPUT, i);
 	}
+	pw_array_clear(&this->in_ports);
+	pw_array_clear(&this->out_ports);
 
 	return 0;
 }
@@ -1226,6 +1540,106 @@ static void node_initialized(void *data)
 					  impl->transport);
 }
 
+/* str as a number up to max, def when it is missing or invalid */
+static uint32_t parse_uint(const char *str, uint32_t def, uint32_t max)
+{
+	char *end;
+	long long val;
+
+	if (str == NULL)
+		return def;
+
+	errno = 0;
+	val = strtoll(str, &end, 0);
+	if (errno != 0 || end == str || *end != '\0' || val < 0 || val > max) {
+		pw_log_warn("client-node: invalid value \"%s\", expected 0-%u, using %u",
+			    str, max, def);
+		return def;
+	}
+	return val;
+}
+
+static void on_async_event(void *data, uint64_t count)
+{
+	struct impl *impl = data;
+	struct spa_dict_item items[1];
+
+	items[0] = SPA_DICT_ITEM_INIT(PW_CLIENT_NODE_PROP_ASYNC, impl->async ? "true" : "false");
+	pw_node_update_properties(impl->this.node, &SPA_DICT_INIT(items, 1));
+}
+
+static int do_set_clock(struct spa_loop *loop,
+			bool async,
+			uint32_t seq,
+			const void *data,
+			size_t size,
+			void *user_data)
+{
+	struct impl *impl = user_data;
+	impl->clock = impl->clock_node ? impl->clock_node->clock : NULL;
+	return 0;
+}
+
+static void clock_node_destroy(void *data);
+
+static const struct pw_node_events clock_node_events = {
+	PW_VERSION_NODE_EVENTS,
+	.destroy = clock_node_destroy,
+};
+
+static void set_clock_node(struct impl *impl, struct pw_node *node)
+{
+	if (impl->clock_node == node)
+		return;
+
+	pw_log_debug("client-node %p: clock node %p", &impl->this, node);
+
+	if (impl->clock_node)
+		spa_hook_remove(&impl->clock_listener);
+	impl->clock_node = node;
+	if (node)
+		pw_node_add_listener(node, &impl->clock_listener, &clock_node_events, impl);
+
+	pw_loop_invoke(impl->this.node->data_loop,
+		       do_set_clock, SPA_ID_INVALID, NULL, 0, true, impl);
+}
+
+static void clock_node_destroy(void *data)
+{
+	struct impl *impl = data;
+	set_clock_node(impl, NULL);
+}
+
+/* the driver is the first live peer with a clock */
+static struct pw_node *find_clock_node(struct pw_node *node)
+{
+	struct pw_port *port;
+	struct pw_link *link;
+
+	spa_list_for_each(port, &node->input_ports, link) {
+		spa_list_for_each(link, &port->links, input_link) {
+			if (link->output->node->clock && link->output->node->live)
+				return link->output->node;
+		}
+	}
+	spa_list_for_each(port, &node->output_ports, link) {
+		spa_list_for_each(link, &port->links, output_link) {
+			if (link->input->node->clock && link->input->node->live)
+				return link->input->node;
+		}
+	}
+	return NULL;
+}
+
+static void node_state_changed(void *data, enum pw_node_state old,
+			       enum pw_node_state state, const char *error)
+{
+	struct impl *impl = data;
+
+	set_clock_node(impl, state == PW_NODE_STATE_RUNNING ?
+			find_clock_node(impl->this.node) : NULL);
+}
+
 static void node_free(void *data)
 {
 	struct impl *impl = data;
@@ -1233,8 +1647,21 @@ static void node_free(void *data)
 	pw_log_debug("client-node %p: free", &impl->this);
 	node_clear(&impl->node);
 
-	if (impl->transport)
-		pw_client_node_transport_destroy(impl->transport);
+	if (impl->clock_node)
+		spa_hook_remove(&impl->clock_listener);
+
+	pw_loop_destroy_source(impl->core->main_loop, impl->async_event);
+
+	if (impl->transport) {
+		struct pw_client_node_transport *t = impl->transport;
+
+		pw_log_debug("client-node %p: ringbuffers of %u/%u bytes, max filled %u/%u, "
+			     "overflows %u/%u", &impl->this,
+			     t->input_info->size, t->output_info->size,
+			     t->input_info->max_filled, t->output_info->max_filled,
+			     t->input_info->overflows, t->output_info->overflows);
+		pw_client_node_transport_destroy(t);
+	}
 
 	spa_hook_remove(&impl->node_listener);
 
@@ -1251,6 +1678,7 @@ static const struct pw_node_events node_events = {
 	PW_VERSION_NODE_EVENTS,
 	.free = node_free,
 	.initialized = node_initialized,
+	.state_changed = node_state_changed,
 };
 
 static const struct pw_resource_events resource_events = {
@@ -1302,6 +1730,14 @@ struct pw_client_node *pw_client_node_new(struct pw_resource *resource,
 	if ((name = pw_properties_get(properties, "node.name")) == NULL)
 		name = "client-node";
 
+	/* the client node is run from the data loop of the core with the
+	 * support of the core, it can't drive a partition of its own */
+	if (properties) {
+		pw_properties_set(properties, PW_NODE_PROP_DRIVER, NULL);
+		pw_properties_set(properties, PW_NODE_PROP_DRIVER_PRIORITY, NULL);
+		pw_properties_set(properties, PW_NODE_PROP_PARTITION, NULL);
+	}
+
 	this->resource = resource;
 	this->node = pw_spa_node_new(core,
 				     pw_resource_get_client(this->resource),
@@ -1317,6 +1753,13 @@ struct pw_client_node *pw_client_node_new(struct pw_resource *resource,
 	str = pw_properties_get(properties, "pipewire.client.reuse");
 	impl->client_reuse = str && pw_properties_parse_bool(str);
 
+	str = pw_properties_get(pw_core_get_properties(core), PW_CLIENT_NODE_PROP_SPIN);
+	impl->spin = parse_uint(str, 0, MAX_SPIN);
+
+	str = pw_properties_get(pw_core_get_properties(core), PW_CLIENT_NODE_PROP_MAX_MISSES);
+	impl->max_misses = parse_uint(str, DEFAULT_MAX_MISSES, MAX_MISSES);
+	impl->async_event = pw_loop_add_event(core->main_loop, on_async_event, impl);
+
 	pw_resource_add_listener(this->resource,
 				 &impl->resource_listener,
 				 &resource_events,
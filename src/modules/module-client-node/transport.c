@@ -19,7 +19,10 @@
 
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include <spa/utils/ringbuffer.h>
 #include <spa/node/io.h>
@@ -30,8 +33,9 @@
 
 /** \cond */
 
-#define INPUT_BUFFER_SIZE       (1<<12)
-#define OUTPUT_BUFFER_SIZE      (1<<12)
+#define MIN_BUFFER_SIZE		(1<<12)
+#define MAX_BUFFER_SIZE		(1<<20)
+#define BUFFERS_PER_PORT	64
 
 struct transport {
 	struct pw_client_node_transport trans;
@@ -41,9 +45,29 @@ struct transport {
 
 	struct pw_client_node_message current;
 	uint32_t current_index;
+
+	uint32_t input_seq;	/**< last seen seq of the input signal */
+
+	/* sizes of the ringbuffers, not read from the shared area because the
+	 * peer can change it */
+	uint32_t input_size;
+	uint32_t output_size;
 };
 /** \endcond */
 
+/* make room for a reuse message for all the buffers of all ports */
+static uint32_t default_buffer_size(uint32_t n_ports)
+{
+	size_t needed, size;
+
+	needed = (size_t) n_ports * BUFFERS_PER_PORT *
+		sizeof(struct pw_client_node_message_port_reuse_buffer);
+
+	for (size = MIN_BUFFER_SIZE; size < needed && size < MAX_BUFFER_SIZE; size <<= 1);
+
+	return size;
+}
+
 static size_t area_get_size(struct pw_client_node_area *area)
 {
 	size_t size;
@@ -51,14 +75,27 @@ static size_t area_get_size(struct pw_client_node_area *area)
 	size += area->max_input_ports * sizeof(struct spa_io_buffers);
 	size += area->max_output_ports * sizeof(struct spa_io_buffers);
 	size += sizeof(struct spa_ringbuffer);
-	size += INPUT_BUFFER_SIZE;
+	size += area->ring[1].size;
 	size += sizeof(struct spa_ringbuffer);
-	size += OUTPUT_BUFFER_SIZE;
+	size += area->ring[0].size;
 	return size;
 }
 
+static bool check_ring_size(uint32_t size)
+{
+	return size >= MIN_BUFFER_SIZE && size <= MAX_BUFFER_SIZE && (size & (size - 1)) == 0;
+}
+
+static bool check_area(struct pw_client_node_area *area, size_t size)
+{
+	return check_ring_size(area->ring[0].size) &&
+	       check_ring_size(area->ring[1].size) &&
+	       area_get_size(area) <= size;
+}
+
 static void transport_setup_area(void *p, struct pw_client_node_transport *trans)
 {
+	struct transport *impl = (struct transport *) trans;
 	struct pw_client_node_area *a;
 
 	trans->area = a = p;
@@ -74,13 +111,25 @@ static void transport_setup_area(void *p, struct pw_client_node_transport *trans
 	p = SPA_MEMBER(p, sizeof(struct spa_ringbuffer), void);
 
 	trans->input_data = p;
-	p = SPA_MEMBER(p, INPUT_BUFFER_SIZE, void);
+	p = SPA_MEMBER(p, a->ring[1].size, void);
 
 	trans->output_buffer = p;
 	p = SPA_MEMBER(p, sizeof(struct spa_ringbuffer), void);
 
 	trans->output_data = p;
-	p = SPA_MEMBER(p, OUTPUT_BUFFER_SIZE, void);
+	p = SPA_MEMBER(p, a->ring[0].size, void);
+
+	trans->input_signal = &a->signal[1];
+	trans->output_signal = &a->signal[0];
+
+	trans->input_activation = &a->activation[1];
+	trans->output_activation = &a->activation[0];
+
+	trans->input_info = &a->ring[1];
+	trans->output_info = &a->ring[0];
+	trans->position = &a->position;
+	impl->input_size = a->ring[1].size;
+	impl->output_size = a->ring[0].size;
 }
 
 static void transport_reset_area(struct pw_client_node_transport *trans)
@@ -98,6 +147,11 @@ static void transport_reset_area(struct pw_client_node_transport *trans)
 	}
 	spa_ringbuffer_init(trans->input_buffer);
 	spa_ringbuffer_init(trans->output_buffer);
+	spa_zero(a->signal);
+	spa_zero(a->activation);
+	spa_zero(a->position);
+	a->ring[0].max_filled = a->ring[0].overflows = 0;
+	a->ring[1].max_filled = a->ring[1].overflows = 0;
 }
 
 static void destroy(struct pw_client_node_transport *trans)
@@ -120,16 +174,23 @@ static int add_message(struct pw_client_node_transport *trans, struct pw_client_
 		return -EINVAL;
 
 	filled = spa_ringbuffer_get_write_index(trans->output_buffer, &index);
-	avail = OUTPUT_BUFFER_SIZE - filled;
+	avail = impl->output_size - filled;
 	size = SPA_POD_SIZE(message);
-	if (avail < size)
+	if (avail < size) {
+		if (trans->output_info->overflows++ == 0)
+			pw_log_warn("transport %p: ringbuffer of %u bytes is full",
+				    trans, impl->output_size);
 		return -ENOSPC;
+	}
 
 	spa_ringbuffer_write_data(trans->output_buffer,
-				  trans->output_data, OUTPUT_BUFFER_SIZE,
-				  index & (OUTPUT_BUFFER_SIZE - 1), message, size);
+				  trans->output_data, impl->output_size,
+				  index & (impl->output_size - 1), message, size);
 	spa_ringbuffer_write_update(trans->output_buffer, index + size);
 
+	if (filled + size > trans->output_info->max_filled)
+		trans->output_info->max_filled = filled + size;
+
 	return 0;
 }
 
@@ -146,8 +207,8 @@ static int next_message(struct pw_client_node_transport *trans, struct pw_client
 		return 0;
 
 	spa_ringbuffer_read_data(trans->input_buffer,
-				 trans->input_data, INPUT_BUFFER_SIZE,
-				 impl->current_index & (INPUT_BUFFER_SIZE - 1),
+				 trans->input_data, impl->input_size,
+				 impl->current_index & (impl->input_size - 1),
 				 &impl->current, sizeof(struct pw_client_node_message));
 
 	if (avail < SPA_POD_SIZE(&impl->current))
@@ -169,36 +230,122 @@ static int parse_message(struct pw_client_node_transport *trans, void *message)
 	size = SPA_POD_SIZE(&impl->current);
 
 	spa_ringbuffer_read_data(trans->input_buffer,
-				 trans->input_data, INPUT_BUFFER_SIZE,
-				 impl->current_index & (INPUT_BUFFER_SIZE - 1), message, size);
+				 trans->input_data, impl->input_size,
+				 impl->current_index & (impl->input_size - 1), message, size);
 	spa_ringbuffer_read_update(trans->input_buffer, impl->current_index + size);
 
 	return 0;
 }
 
+/* the area is shared between processes, so no private futex ops */
+static int futex_wait(uint32_t *addr, uint32_t val)
+{
+	if (syscall(SYS_futex, addr, FUTEX_WAIT, val, NULL, NULL, 0) < 0 &&
+	    errno != EAGAIN && errno != EINTR)
+		return -errno;
+	return 0;
+}
+
+static int futex_wake(uint32_t *addr)
+{
+	if (syscall(SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0) < 0)
+		return -errno;
+	return 0;
+}
+
+static int do_signal(struct pw_client_node_transport *trans, int fd)
+{
+	struct pw_client_node_signal *s = trans->output_signal;
+	uint64_t cmd = 1;
+	uint32_t flags;
+
+	/* pairs with the WAITING flag and the seq check in do_wait() */
+	__atomic_add_fetch(&s->seq, 1, __ATOMIC_SEQ_CST);
+	flags = __atomic_load_n(&s->flags, __ATOMIC_SEQ_CST);
+
+	if (flags & PW_CLIENT_NODE_SIGNAL_FLAG_FUTEX) {
+		if (flags & PW_CLIENT_NODE_SIGNAL_FLAG_WAITING)
+			return futex_wake(&s->seq);
+		return 0;
+	}
+	if (write(fd, &cmd, 8) != 8)
+		return -errno;
+	return 0;
+}
+
+static int do_wait(struct pw_client_node_transport *trans, uint32_t spin, bool block)
+{
+	struct transport *impl = (struct transport *) trans;
+	struct pw_client_node_signal *s = trans->input_signal;
+	uint32_t seq, i;
+	int res = 0;
+
+	/* signals before this went to the eventfd */
+	if (!block)
+		impl->input_seq = __atomic_load_n(&s->seq, __ATOMIC_SEQ_CST);
+
+	if (!(s->flags & PW_CLIENT_NODE_SIGNAL_FLAG_FUTEX))
+		__atomic_or_fetch(&s->flags, PW_CLIENT_NODE_SIGNAL_FLAG_FUTEX, __ATOMIC_SEQ_CST);
+
+	for (i = 0; i < spin; i++) {
+		if ((seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE)) != impl->input_seq)
+			goto done;
+	}
+
+	if (!block) {
+		/* pairs with the seq and flags in do_signal(), a signal is either
+		 * seen here or written to the eventfd */
+		__atomic_and_fetch(&s->flags, ~PW_CLIENT_NODE_SIGNAL_FLAG_FUTEX, __ATOMIC_SEQ_CST);
+		if ((seq = __atomic_load_n(&s->seq, __ATOMIC_SEQ_CST)) != impl->input_seq)
+			goto done;
+		return -EAGAIN;
+	}
+
+	__atomic_or_fetch(&s->flags, PW_CLIENT_NODE_SIGNAL_FLAG_WAITING, __ATOMIC_SEQ_CST);
+	while ((seq = __atomic_load_n(&s->seq, __ATOMIC_SEQ_CST)) == impl->input_seq) {
+		if ((res = futex_wait(&s->seq, seq)) < 0)
+			break;
+	}
+	__atomic_and_fetch(&s->flags, ~PW_CLIENT_NODE_SIGNAL_FLAG_WAITING, __ATOMIC_SEQ_CST);
+
+      done:
+	impl->input_seq = seq;
+	return res;
+}
+
 /** Create a new transport
  * \param max_input_ports maximum number of input_ports
  * \param max_output_ports maximum number of output_ports
+ * \param buffer_size minimum size of the message ringbuffers or 0 to size them
+ *        for the number of ports
  * \return a newly allocated \ref pw_client_node_transport
  * \memberof pw_client_node_transport
  */
 struct pw_client_node_transport *
-pw_client_node_transport_new(uint32_t max_input_ports, uint32_t max_output_ports)
+pw_client_node_transport_new(uint32_t max_input_ports, uint32_t max_output_ports,
+			     uint32_t buffer_size)
 {
 	struct transport *impl;
 	struct pw_client_node_transport *trans;
 	struct pw_client_node_area area = { 0 };
+	uint32_t size;
 
 	area.max_input_ports = max_input_ports;
 	area.n_input_ports = 0;
 	area.max_output_ports = max_output_ports;
 	area.n_output_ports = 0;
 
+	size = default_buffer_size(max_input_ports + max_output_ports);
+	while (size < buffer_size && size < MAX_BUFFER_SIZE)
+		size <<= 1;
+	area.ring[0].size = area.ring[1].size = size;
+
 	impl = calloc(1, sizeof(struct transport));
 	if (impl == NULL)
 		return NULL;
 
-	pw_log_debug("transport %p: new %d %d", impl, max_input_ports, max_output_ports);
+	pw_log_debug("transport %p: new %d %d, buffer size %u", impl,
+		     max_input_ports, max_output_ports, size);
 
 	trans = &impl->trans;
 	impl->offset = 0;
@@ -213,11 +360,14 @@ pw_client_node_transport_new(uint32_t max_input_ports, uint32_t max_output_ports
 	memcpy(impl->mem->ptr, &area, sizeof(struct pw_client_node_area));
 	transport_setup_area(impl->mem->ptr, trans);
 	transport_reset_area(trans);
+	impl->input_seq = trans->input_signal->seq;
 
 	trans->destroy = destroy;
 	trans->add_message = add_message;
 	trans->next_message = next_message;
 	trans->parse_message = parse_message;
+	trans->signal = do_signal;
+	trans->wait = do_wait;
 
 	return trans;
 }
@@ -228,6 +378,7 @@ pw_client_node_transport_new_from_info(struct pw_client_node_transport_info *inf
 	struct transport *impl;
 	struct pw_client_node_transport *trans;
 	void *tmp;
+	uint32_t size;
 	int res;
 
 	impl = calloc(1, sizeof(struct transport));
@@ -249,6 +400,12 @@ pw_client_node_transport_new_from_info(struct pw_client_node_transport_info *inf
 
 	impl->offset = info->offset;
 
+	if (!check_area(impl->mem->ptr, info->size)) {
+		pw_log_warn("transport %p: invalid area", impl);
+		res = -EINVAL;
+		goto invalid_area;
+	}
+
 	transport_setup_area(impl->mem->ptr, trans);
 
 	tmp = trans->output_buffer;
@@ -259,13 +416,35 @@ pw_client_node_transport_new_from_info(struct pw_client_node_transport_info *inf
 	trans->output_data = trans->input_data;
 	trans->input_data = tmp;
 
+	tmp = trans->output_signal;
+	trans->output_signal = trans->input_signal;
+	trans->input_signal = tmp;
+
+	tmp = trans->output_activation;
+	trans->output_activation = trans->input_activation;
+	trans->input_activation = tmp;
+
+	tmp = trans->output_info;
+	trans->output_info = trans->input_info;
+	trans->input_info = tmp;
+
+	size = impl->output_size;
+	impl->output_size = impl->input_size;
+	impl->input_size = size;
+
+	impl->input_seq = trans->input_signal->seq;
+
 	trans->destroy = destroy;
 	trans->add_message = add_message;
 	trans->next_message = next_message;
 	trans->parse_message = parse_message;
+	trans->signal = do_signal;
+	trans->wait = do_wait;
 
 	return trans;
 
+      invalid_area:
+	pw_memblock_free(impl->mem);
       mmap_failed:
 	free(impl);
 	errno = -res;
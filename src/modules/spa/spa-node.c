@@ -252,6 +252,8 @@ struct pw_node *pw_spa_node_load(struct pw_core *core,
 	const struct spa_support *support;
 	uint32_t n_support;
 	struct pw_type *t = pw_core_get_type(core);
+	struct pw_partition *partition = NULL;
+	const char *str;
 
 	if ((dir = getenv("SPA_PLUGIN_DIR")) == NULL)
 		dir = PLUGINDIR;
@@ -277,7 +279,14 @@ struct pw_node *pw_spa_node_load(struct pw_core *core,
 			break;
 	}
 
-	support = pw_core_get_support(core, &n_support);
+	/* the plugin has to use the data loop of its partition */
+	if ((str = pw_partition_name(core, name, properties)) != NULL &&
+	    (partition = pw_partition_get(core, str, properties)) != NULL) {
+		support = partition->support;
+		n_support = partition->n_support;
+	}
+	else
+		support = pw_core_get_support(core, &n_support);
 
 	handle = calloc(1, factory->size);
 	if ((res = spa_handle_factory_init(factory,
@@ -312,12 +321,17 @@ struct pw_node *pw_spa_node_load(struct pw_core *core,
 	impl->lib = filename;
 	impl->factory_name = strdup(factory_name);
 
+	if (partition)
+		pw_partition_unref(partition);
+
 	return this;
 
       interface_failed:
 	spa_handle_clear(handle);
       init_failed:
 	free(handle);
+	if (partition)
+		pw_partition_unref(partition);
       enum_failed:
       no_symbol:
 	dlclose(hnd);
@@ -33,9 +33,18 @@
 #include <pipewire/core.h>
 #include <pipewire/data-loop.h>
 
-#include <spa/graph/graph-scheduler6.h>
+#include <spa/graph/graph-scheduler7.h>
 
 /** \cond */
+struct impl {
+	struct pw_core this;
+
+	struct spa_graph_data graph_data;
+	struct pw_executor *executor;
+
+	struct spa_source *profile_timer;
+};
+
 struct resource_data {
 	struct spa_hook resource_listener;
 };
@@ -350,6 +359,45 @@ static const struct pw_global_events global_events = {
 	.bind = global_bind,
 };
 
+struct graph_size {
+	struct spa_graph *graph;
+	uint32_t n_nodes;
+	uint32_t n_links;
+};
+
+static int
+do_count_graph(struct spa_loop *loop,
+	       bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct graph_size *s = user_data;
+	spa_graph_plan_count(s->graph, &s->n_nodes, &s->n_links);
+	return 0;
+}
+
+int pw_graph_reserve(struct pw_loop *loop, struct spa_graph *graph,
+		     uint32_t n_nodes, uint32_t n_ports)
+{
+	struct spa_graph_data *data = graph->callbacks_data;
+	struct graph_size s = { graph, 0, 0 };
+
+	if (data == NULL)
+		return 0;
+
+	/* count in the data thread, after the pending changes */
+	pw_loop_invoke(loop, do_count_graph, 1, NULL, 0, true, &s);
+
+	return spa_graph_data_reserve(data, s.n_nodes + n_nodes, s.n_links + n_ports);
+}
+
+static void profile_timeout(void *data, uint64_t expirations)
+{
+	struct pw_core *this = data;
+	struct pw_node *node;
+
+	spa_list_for_each(node, &this->node_list, link)
+		pw_node_update_profile(node);
+}
+
 /** Create a new core object
  *
  * \param main_loop the main loop to use
@@ -360,13 +408,16 @@ static const struct pw_global_events global_events = {
  */
 struct pw_core *pw_core_new(struct pw_loop *main_loop, struct pw_properties *properties)
 {
+	struct impl *impl;
 	struct pw_core *this;
-	const char *name;
+	const char *name, *str;
 
-	this = calloc(1, sizeof(struct pw_core));
-	if (this == NULL)
+	impl = calloc(1, sizeof(struct impl));
+	if (impl == NULL)
 		return NULL;
 
+	this = &impl->this;
+
 	pw_log_debug("core %p: new", this);
 
 	if (properties == NULL)
@@ -386,8 +437,44 @@ struct pw_core *pw_core_new(struct pw_loop *main_loop, struct pw_properties *pro
 	pw_type_init(&this->type);
 	pw_map_init(&this->globals, 128, 32);
 
+	if ((str = pw_properties_get(properties, PW_CORE_PROP_GRAPH_PLAN)) != NULL)
+		this->graph_plan = pw_properties_parse_bool(str);
+
 	spa_graph_init(&this->rt.graph);
-	spa_graph_set_callbacks(&this->rt.graph, &spa_graph_impl_default, NULL);
+	spa_graph_data_init(&impl->graph_data, &this->rt.graph);
+	if (this->graph_plan)
+		spa_graph_set_callbacks(&this->rt.graph, &spa_graph_impl_default, &impl->graph_data);
+	else
+		spa_graph_set_callbacks(&this->rt.graph, &pw_graph_default_callbacks, NULL);
+
+	if ((str = pw_properties_get(properties, PW_CORE_PROP_GRAPH_WORKERS)) != NULL &&
+	    atoi(str) > 0) {
+		if (!this->graph_plan) {
+			pw_log_warn("core %p: graph workers need the graph plan", this);
+		}
+		else if ((impl->executor = pw_executor_new(this->data_loop_impl,
+							   &impl->graph_data, atoi(str))) == NULL) {
+			pw_log_warn("core %p: can't create graph workers", this);
+		}
+	}
+
+	if ((str = pw_properties_get(properties, PW_CORE_PROP_PROFILE)) != NULL &&
+	    atoi(str) > 0) {
+		if (this->graph_plan)
+			this->profile = atoi(str);
+		else
+			pw_log_warn("core %p: profiling needs the graph plan", this);
+	}
+	if (this->profile > 0) {
+		struct timespec value;
+
+		spa_graph_data_set_profile(&impl->graph_data, true, 0);
+
+		value.tv_sec = this->profile / 1000;
+		value.tv_nsec = (this->profile % 1000) * SPA_NSEC_PER_MSEC;
+		impl->profile_timer = pw_loop_add_timer(main_loop, profile_timeout, this);
+		pw_loop_update_timer(main_loop, impl->profile_timer, &value, &value, false);
+	}
 
 	spa_debug_set_type_map(this->type.map);
 
@@ -415,6 +502,7 @@ struct pw_core *pw_core_new(struct pw_loop *main_loop, struct pw_properties *pro
 	spa_list_init(&this->link_list);
 	spa_list_init(&this->control_list[0]);
 	spa_list_init(&this->control_list[1]);
+	spa_list_init(&this->partition_list);
 	spa_hook_list_init(&this->listener_list);
 
 	if ((name = pw_properties_get(properties, PW_CORE_PROP_NAME)) == NULL) {
@@ -456,7 +544,7 @@ struct pw_core *pw_core_new(struct pw_loop *main_loop, struct pw_properties *pro
 
       no_mem:
       no_data_loop:
-	free(this);
+	free(impl);
 	return NULL;
 }
 
@@ -468,6 +556,7 @@ struct pw_core *pw_core_new(struct pw_loop *main_loop, struct pw_properties *pro
  */
 void pw_core_destroy(struct pw_core *core)
 {
+	struct impl *impl = SPA_CONTAINER_OF(core, struct impl, this);
 	struct pw_global *global, *t;
 	struct pw_module *module, *tm;
 	struct pw_remote *remote, *tr;
@@ -478,6 +567,9 @@ void pw_core_destroy(struct pw_core *core)
 
 	spa_hook_remove(&core->global_listener);
 
+	if (impl->profile_timer)
+		pw_loop_destroy_source(core->main_loop, impl->profile_timer);
+
 	spa_list_for_each_safe(remote, tr, &core->remote_list, link)
 		pw_remote_destroy(remote);
 
@@ -494,12 +586,16 @@ void pw_core_destroy(struct pw_core *core)
 
 	pw_data_loop_destroy(core->data_loop_impl);
 
+	if (impl->executor)
+		pw_executor_destroy(impl->executor);
+	spa_graph_data_clear(&impl->graph_data);
+
 	pw_properties_free(core->properties);
 
 	pw_map_clear(&core->globals);
 
 	pw_log_debug("core %p: free", core);
-	free(core);
+	free(impl);
 }
 
 const struct pw_core_info *pw_core_get_info(struct pw_core *core)
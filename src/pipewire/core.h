@@ -110,6 +110,15 @@ struct pw_core_events {
 #define PW_CORE_PROP_VERSION	"pipewire.core.version"
 /** If the core should listen for connections, boolean default false */
 #define PW_CORE_PROP_DAEMON	"pipewire.daemon"
+/** If the graph is scheduled from a flat execution plan, needed for
+ * graph workers, profiling and partitions, boolean default false */
+#define PW_CORE_PROP_GRAPH_PLAN	"pipewire.core.graph-plan"
+/** The number of extra threads that run independent parts of the graph
+ * in parallel, needs PW_CORE_PROP_GRAPH_PLAN, default 0 */
+#define PW_CORE_PROP_GRAPH_WORKERS	"pipewire.core.graph-workers"
+/** The interval in milliseconds to update the profile properties of the
+ * nodes, needs PW_CORE_PROP_GRAPH_PLAN, default 0 to disable profiling */
+#define PW_CORE_PROP_PROFILE	"pipewire.core.profile"
 
 /** Make a new core object for a given main_loop. Ownership of the properties is taken */
 struct pw_core * pw_core_new(struct pw_loop *main_loop, struct pw_properties *props);
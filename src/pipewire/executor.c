@@ -0,0 +1,203 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <pthread.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "pipewire/log.h"
+#include "pipewire/private.h"
+
+#include <spa/graph/graph-scheduler7.h>
+
+#define NAME "executor"
+
+/** \cond */
+struct worker {
+	struct pw_executor *executor;
+	uint32_t id;
+	pthread_t thread;
+	bool started;
+};
+
+struct pw_executor {
+	struct pw_data_loop *loop;
+	struct spa_graph_data *data;
+
+	uint32_t seq;		/**< incremented for each cycle, workers wait on it */
+	bool running;
+
+	uint32_t n_workers;
+	struct worker workers[0];
+};
+/** \endcond */
+
+static void futex_wait(uint32_t *addr, uint32_t val)
+{
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(uint32_t *addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/* run the workers with the same scheduling as the data loop, which is
+ * usually made realtime after it started */
+static void update_sched(struct worker *w)
+{
+	struct pw_data_loop *loop = w->executor->loop;
+	struct sched_param sp;
+	int policy, err;
+
+	if (!loop->running)
+		return;
+	if ((err = pthread_getschedparam(loop->thread, &policy, &sp)) != 0 ||
+	    (err = pthread_setschedparam(pthread_self(), policy, &sp)) != 0)
+		pw_log_warn(NAME " %p: worker %d can't set scheduling: %s",
+				w->executor, w->id, strerror(err));
+}
+
+static void *do_work(void *user_data)
+{
+	struct worker *w = user_data;
+	struct pw_executor *this = w->executor;
+	uint32_t seq = __atomic_load_n(&this->seq, __ATOMIC_ACQUIRE);
+	bool first = true;
+
+	pw_log_debug(NAME " %p: worker %d enter thread", this, w->id);
+
+	while (true) {
+		uint32_t s;
+
+		while ((s = __atomic_load_n(&this->seq, __ATOMIC_ACQUIRE)) == seq)
+			futex_wait(&this->seq, seq);
+		seq = s;
+
+		if (!__atomic_load_n(&this->running, __ATOMIC_ACQUIRE))
+			break;
+
+		if (first) {
+			update_sched(w);
+			first = false;
+		}
+		spa_graph_data_work(this->data, w->id);
+	}
+	pw_log_debug(NAME " %p: worker %d leave thread", this, w->id);
+
+	return NULL;
+}
+
+static void do_wakeup(void *data)
+{
+	struct pw_executor *this = data;
+
+	__atomic_add_fetch(&this->seq, 1, __ATOMIC_RELEASE);
+	futex_wake(&this->seq);
+}
+
+static const struct spa_graph_executor_callbacks executor_callbacks = {
+	SPA_VERSION_GRAPH_EXECUTOR_CALLBACKS,
+	.wakeup = do_wakeup,
+};
+
+static void stop_workers(struct pw_executor *this)
+{
+	uint32_t i;
+
+	__atomic_store_n(&this->running, false, __ATOMIC_RELEASE);
+	do_wakeup(this);
+
+	for (i = 0; i < this->n_workers; i++) {
+		if (this->workers[i].started)
+			pthread_join(this->workers[i].thread, NULL);
+	}
+}
+
+/** Make a new executor
+ * \param loop the data loop that runs the graph
+ * \param data the scheduler data of the graph
+ * \param n_workers the number of worker threads
+ * \return a new executor or NULL on error
+ *
+ * The worker threads run independent parts of the graph in parallel with
+ * the thread that starts the cycle. This must be called when no cycle is
+ * running.
+ */
+struct pw_executor *pw_executor_new(struct pw_data_loop *loop,
+				    struct spa_graph_data *data,
+				    uint32_t n_workers)
+{
+	struct pw_executor *this;
+	uint32_t i;
+	int res;
+
+	this = calloc(1, sizeof(struct pw_executor) + n_workers * sizeof(struct worker));
+	if (this == NULL)
+		return NULL;
+
+	pw_log_debug(NAME " %p: new with %d workers", this, n_workers);
+
+	this->loop = loop;
+	this->data = data;
+	this->running = true;
+	this->n_workers = n_workers;
+
+	for (i = 0; i < n_workers; i++) {
+		struct worker *w = &this->workers[i];
+
+		w->executor = this;
+		w->id = i + 1;
+		if ((res = pthread_create(&w->thread, NULL, do_work, w)) != 0) {
+			pw_log_error(NAME " %p: can't create worker: %s", this, strerror(res));
+			goto error;
+		}
+		w->started = true;
+	}
+
+	if ((res = spa_graph_data_set_workers(data, n_workers, &executor_callbacks, this)) < 0) {
+		pw_log_error(NAME " %p: can't set workers: %s", this, strerror(-res));
+		goto error;
+	}
+	return this;
+
+      error:
+	stop_workers(this);
+	free(this);
+	return NULL;
+}
+
+/** Destroy an executor
+ * \param executor the executor to destroy
+ *
+ * The graph is run by the thread that starts the cycle again. This must be
+ * called when no cycle is running.
+ */
+void pw_executor_destroy(struct pw_executor *executor)
+{
+	pw_log_debug(NAME " %p: destroy", executor);
+
+	spa_graph_data_set_workers(executor->data, 0, NULL, NULL);
+	stop_workers(executor);
+	free(executor);
+}
@@ -33,7 +33,8 @@
 #include "link.h"
 #include "work-queue.h"
 
-#define MAX_BUFFERS     16
+#define DEFAULT_BUFFERS 16
+#define MAX_BUFFERS	64
 
 /** \cond */
 struct impl {
@@ -597,11 +598,13 @@ static int do_allocation(struct pw_link *this, uint32_t in_state, uint32_t out_s
 			offset += SPA_ROUND_UP_N(SPA_POD_SIZE(params[i]), 8);
 		}
 
-		max_buffers = MAX_BUFFERS;
+		/* the number of buffers is what the ports negotiated, they limit it
+		 * to what they can handle in the Buffers param */
+		max_buffers = DEFAULT_BUFFERS;
 		minsize = stride = 0;
 		param = find_param(params, n_params, t->param_buffers.Buffers);
 		if (param) {
-			uint32_t qmax_buffers = max_buffers,
+			uint32_t qmax_buffers = 0,
 			    qminsize = minsize, qstride = stride;
 
 			spa_pod_object_parse(param,
@@ -609,9 +612,8 @@ static int do_allocation(struct pw_link *this, uint32_t in_state, uint32_t out_s
 				":", t->param_buffers.stride, "i", &qstride,
 				":", t->param_buffers.buffers, "i", &qmax_buffers, NULL);
 
-			max_buffers =
-			    qmax_buffers == 0 ? max_buffers : SPA_MIN(qmax_buffers,
-							      max_buffers);
+			if (qmax_buffers > 0)
+				max_buffers = SPA_MIN(qmax_buffers, MAX_BUFFERS);
 			minsize = SPA_MAX(minsize, qminsize);
 			stride = SPA_MAX(stride, qstride);
 
@@ -743,6 +745,9 @@ static int do_start(struct pw_link *this, uint32_t in_state, uint32_t out_state)
 
 	pw_loop_invoke(output->node->data_loop,
 		       do_activate_link, SPA_ID_INVALID, NULL, 0, false, this);
+	if (this->async)
+		pw_loop_invoke(input->node->data_loop,
+			       do_activate_link, SPA_ID_INVALID, NULL, 0, false, this);
 
 	if (in_state == PW_PORT_STATE_PAUSED) {
 		if  ((res = pw_node_set_state(input->node, PW_NODE_STATE_RUNNING)) < 0) {
@@ -858,6 +863,8 @@ do_remove_input(struct spa_loop *loop,
 	        bool async, uint32_t seq, const void *data, size_t size, void *user_data)
 {
 	struct pw_link *this = user_data;
+	if (this->input->rt.handoff_port == &this->rt.in_port)
+		this->input->rt.handoff_port = NULL;
 	spa_graph_port_remove(&this->rt.in_port);
 	return 0;
 }
@@ -973,6 +980,9 @@ int pw_link_deactivate(struct pw_link *this)
 	pw_log_debug("link %p: deactivate", this);
 	pw_loop_invoke(this->output->node->data_loop,
 		       do_deactivate_link, SPA_ID_INVALID, NULL, 0, true, this);
+	if (this->async)
+		pw_loop_invoke(this->input->node->data_loop,
+			       do_deactivate_link, SPA_ID_INVALID, NULL, 0, true, this);
 
 	input_node = this->input->node;
 	output_node = this->output->node;
@@ -1163,6 +1173,11 @@ struct pw_link *pw_link_new(struct pw_core *core,
 
 	this->io = SPA_IO_BUFFERS_INIT;
 
+	/* nodes in different partitions are run from different data loops, they
+	 * only exchange buffers through the io area and the reuse ring */
+	this->async = output_node->rt.graph != input_node->rt.graph;
+	spa_ringbuffer_init(&this->rt.reuse);
+
 	this->rt.out_port.port_id = pw_map_insert_new(&output->mix_port_map, NULL);
 	this->rt.in_port.port_id = pw_map_insert_new(&input->mix_port_map, NULL);
 
@@ -1173,12 +1188,14 @@ struct pw_link *pw_link_new(struct pw_core *core,
 	spa_graph_port_init(&this->rt.out_port,
 			    PW_DIRECTION_OUTPUT,
 			    this->rt.out_port.port_id,
-			    SPA_GRAPH_PORT_FLAG_DISABLED,
+			    SPA_GRAPH_PORT_FLAG_DISABLED |
+			    (this->async ? SPA_GRAPH_PORT_FLAG_ASYNC : 0),
 			    &this->io);
 	spa_graph_port_init(&this->rt.in_port,
 			    PW_DIRECTION_INPUT,
 			    this->rt.in_port.port_id,
-			    SPA_GRAPH_PORT_FLAG_DISABLED,
+			    SPA_GRAPH_PORT_FLAG_DISABLED |
+			    (this->async ? SPA_GRAPH_PORT_FLAG_ASYNC : 0),
 			    &this->io);
 	spa_graph_port_link(&this->rt.out_port, &this->rt.in_port);
 
@@ -1186,6 +1203,8 @@ struct pw_link *pw_link_new(struct pw_core *core,
 	this->rt.out_port.scheduler_data = this;
 
 	/* nodes can be in different data loops so we do this twice */
+	pw_graph_reserve(output_node->data_loop, output->rt.graph, 0, 1);
+	pw_graph_reserve(input_node->data_loop, input->rt.graph, 0, 1);
 	pw_loop_invoke(output_node->data_loop, do_add_link,
 		       SPA_ID_INVALID, &output, sizeof(struct pw_port *), false, this);
 	pw_loop_invoke(input_node->data_loop, do_add_link,
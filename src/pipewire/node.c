@@ -21,6 +21,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
+#include <inttypes.h>
 
 #include <spa/clock/clock.h>
 #include <spa/lib/debug.h>
@@ -347,6 +348,7 @@ int pw_node_register(struct pw_node *this,
 
 	pw_node_update_ports(this);
 
+	pw_graph_reserve(this->data_loop, this->rt.graph, 1, 0);
 	pw_loop_invoke(this->data_loop, do_node_add, 1, NULL, 0, false, this);
 
 	if ((str = pw_properties_get(this->properties, "media.class")) != NULL)
@@ -400,6 +402,7 @@ struct pw_node *pw_node_new(struct pw_core *core,
 {
 	struct impl *impl;
 	struct pw_node *this;
+	const char *str;
 
 	impl = calloc(1, sizeof(struct impl) + user_data_size);
 	if (impl == NULL)
@@ -425,9 +428,17 @@ struct pw_node *pw_node_new(struct pw_core *core,
 	impl->work = pw_work_queue_new(this->core->main_loop);
 	this->info.name = strdup(name);
 
-	this->data_loop = core->data_loop;
+	if ((str = pw_partition_name(core, name, properties)) != NULL &&
+	    (this->partition = pw_partition_get(core, str, properties)) == NULL)
+		pw_log_warn("node %p: can't get partition %s", this, str);
 
-	this->rt.graph = &core->rt.graph;
+	if (this->partition) {
+		this->data_loop = this->partition->data_loop;
+		this->rt.graph = &this->partition->rt.graph;
+	} else {
+		this->data_loop = core->data_loop;
+		this->rt.graph = &core->rt.graph;
+	}
 
 	spa_list_init(&this->resource_list);
 
@@ -442,6 +453,8 @@ struct pw_node *pw_node_new(struct pw_core *core,
 	pw_map_init(&this->output_port_map, 64, 64);
 
 	spa_graph_node_init(&this->rt.node);
+	if (core->profile > 0)
+		this->rt.node.stats = &this->rt.stats;
 
 	return this;
 
@@ -499,6 +512,51 @@ int pw_node_update_properties(struct pw_node *node, const struct spa_dict *dict)
 	return 0;
 }
 
+void pw_node_update_profile(struct pw_node *node)
+{
+	struct spa_graph_node_stats stats;
+	struct spa_dict_item items[7];
+	char last[32], avg[32], max[32], quantum[32], count[16], xruns[16], queued[16];
+	struct pw_port *port;
+	struct pw_link *link;
+	uint32_t n_queued = 0;
+
+	/* the data thread keeps updating the stats, try again on the next
+	 * update when it was too busy */
+	if (node->rt.node.stats == NULL ||
+	    spa_graph_node_stats_read(node->rt.node.stats, &stats) < 0)
+		return;
+
+	if (stats.count == node->profile_count)
+		return;
+	node->profile_count = stats.count;
+
+	spa_list_for_each(port, &node->input_ports, link) {
+		spa_list_for_each(link, &port->links, input_link) {
+			if (link->io.status == SPA_STATUS_HAVE_BUFFER)
+				n_queued++;
+		}
+	}
+
+	snprintf(last, sizeof(last), "%" PRIu64, stats.last);
+	snprintf(avg, sizeof(avg), "%" PRIu64, stats.avg);
+	snprintf(max, sizeof(max), "%" PRIu64, stats.max);
+	snprintf(quantum, sizeof(quantum), "%" PRIu64, stats.quantum);
+	snprintf(count, sizeof(count), "%u", stats.count);
+	snprintf(xruns, sizeof(xruns), "%u", stats.xruns);
+	snprintf(queued, sizeof(queued), "%u", n_queued);
+
+	items[0] = SPA_DICT_ITEM_INIT(PW_NODE_PROP_PROFILE_LAST, last);
+	items[1] = SPA_DICT_ITEM_INIT(PW_NODE_PROP_PROFILE_AVG, avg);
+	items[2] = SPA_DICT_ITEM_INIT(PW_NODE_PROP_PROFILE_MAX, max);
+	items[3] = SPA_DICT_ITEM_INIT(PW_NODE_PROP_PROFILE_QUANTUM, quantum);
+	items[4] = SPA_DICT_ITEM_INIT(PW_NODE_PROP_PROFILE_COUNT, count);
+	items[5] = SPA_DICT_ITEM_INIT(PW_NODE_PROP_PROFILE_XRUNS, xruns);
+	items[6] = SPA_DICT_ITEM_INIT(PW_NODE_PROP_PROFILE_QUEUED, queued);
+
+	pw_node_update_properties(node, &SPA_DICT_INIT(items, 7));
+}
+
 static void node_done(void *data, int seq, int res)
 {
 	struct pw_node *node = data;
@@ -647,6 +705,9 @@ void pw_node_destroy(struct pw_node *node)
 	pw_log_debug("node %p: free", node);
 	spa_hook_list_call(&node->listener_list, struct pw_node_events, free);
 
+	if (node->partition)
+		pw_partition_unref(node->partition);
+
 	pw_work_queue_destroy(impl->work);
 
 	pw_map_clear(&node->input_port_map);
@@ -95,6 +95,31 @@ struct pw_node_events {
 #define PW_NODE_PROP_AUTOCONNECT	"pipewire.autoconnect"
 /** Try to connect the node to this node id */
 #define PW_NODE_PROP_TARGET_NODE	"pipewire.target.node"
+/** The node drives its own partition of the graph with its own data loop,
+ * boolean default false */
+#define PW_NODE_PROP_DRIVER		"pipewire.node.driver"
+/** The realtime priority of the data loop of a driver, default is the
+ * priority of the data loop of the core */
+#define PW_NODE_PROP_DRIVER_PRIORITY	"pipewire.node.driver.priority"
+/** Run the node in the partition of the driver with this name */
+#define PW_NODE_PROP_PARTITION		"pipewire.node.partition"
+
+/* Profile of the node, updated when profiling is enabled on the core with
+ * PW_CORE_PROP_PROFILE. Times are in nanoseconds. */
+/** time of the last process call */
+#define PW_NODE_PROP_PROFILE_LAST	"pipewire.node.profile.last"
+/** average time of the process calls */
+#define PW_NODE_PROP_PROFILE_AVG	"pipewire.node.profile.avg"
+/** max time of the process calls */
+#define PW_NODE_PROP_PROFILE_MAX	"pipewire.node.profile.max"
+/** time between the last two cycles of the graph */
+#define PW_NODE_PROP_PROFILE_QUANTUM	"pipewire.node.profile.quantum"
+/** number of process calls */
+#define PW_NODE_PROP_PROFILE_COUNT	"pipewire.node.profile.count"
+/** number of times the node finished after the deadline of the cycle */
+#define PW_NODE_PROP_PROFILE_XRUNS	"pipewire.node.profile.xruns"
+/** number of buffers on the input links that the node did not consume yet */
+#define PW_NODE_PROP_PROFILE_QUEUED	"pipewire.node.profile.queued"
 
 /** Create a new node \memberof pw_node */
 struct pw_node *
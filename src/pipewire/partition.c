@@ -0,0 +1,229 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "pipewire/log.h"
+#include "pipewire/data-loop.h"
+#include "pipewire/core.h"
+#include "pipewire/node.h"
+#include "pipewire/private.h"
+
+#include <spa/graph/graph-scheduler7.h>
+
+#define NAME "partition"
+
+/** \cond */
+struct impl {
+	struct pw_partition this;
+
+	struct spa_graph_data graph_data;
+	struct pw_executor *executor;
+};
+/** \endcond */
+
+const char *pw_partition_name(struct pw_core *core, const char *name,
+			      struct pw_properties *properties)
+{
+	const char *str;
+
+	/* the default scheduler runs async links synchronously */
+	if (properties == NULL || !core->graph_plan)
+		return NULL;
+
+	if ((str = pw_properties_get(properties, PW_NODE_PROP_PARTITION)) != NULL)
+		return str;
+	if ((str = pw_properties_get(properties, PW_NODE_PROP_DRIVER)) != NULL &&
+	    pw_properties_parse_bool(str))
+		return name;
+
+	return NULL;
+}
+
+/* the priority of a driver is not higher than the priority of the data
+ * loop of the core when that is realtime or else the realtime limit */
+static int clamp_priority(struct pw_partition *this, int priority)
+{
+	struct pw_data_loop *loop = this->core->data_loop_impl;
+	struct sched_param sp;
+	struct rlimit rl;
+	int policy, min, max;
+
+	min = sched_get_priority_min(SCHED_FIFO);
+	max = sched_get_priority_max(SCHED_FIFO);
+
+	if (loop->running &&
+	    pthread_getschedparam(loop->thread, &policy, &sp) == 0 &&
+	    (policy == SCHED_FIFO || policy == SCHED_RR))
+		max = SPA_MIN(max, sp.sched_priority);
+	else if (getrlimit(RLIMIT_RTPRIO, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+		max = SPA_MIN(max, (int) rl.rlim_cur);
+
+	if (priority < min || priority > max)
+		pw_log_warn(NAME " %p: priority %d not in range %d-%d", this, priority, min, max);
+
+	return SPA_CLAMP(priority, min, SPA_MAX(min, max));
+}
+
+/* give the data loop the priority of the driver or else the scheduling of
+ * the data loop of the core, which is usually made realtime */
+static void update_sched(struct pw_partition *this, struct pw_properties *properties)
+{
+	struct pw_data_loop *loop = this->core->data_loop_impl;
+	struct sched_param sp;
+	const char *str;
+	int policy, err;
+
+	spa_zero(sp);
+	if (properties &&
+	    (str = pw_properties_get(properties, PW_NODE_PROP_DRIVER_PRIORITY)) != NULL) {
+		policy = SCHED_FIFO | SCHED_RESET_ON_FORK;
+		sp.sched_priority = clamp_priority(this, pw_properties_parse_int(str));
+	}
+	else if (!loop->running)
+		return;
+	else if ((err = pthread_getschedparam(loop->thread, &policy, &sp)) != 0)
+		goto error;
+
+	if ((err = pthread_setschedparam(this->data_loop_impl->thread, policy, &sp)) != 0)
+		goto error;
+
+	pw_log_debug(NAME " %p: policy %d priority %d", this, policy, sp.sched_priority);
+	return;
+
+      error:
+	pw_log_warn(NAME " %p: can't set scheduling: %s", this, strerror(err));
+}
+
+static struct pw_partition *partition_new(struct pw_core *core, const char *name,
+					  struct pw_properties *properties)
+{
+	struct impl *impl;
+	struct pw_partition *this;
+	const char *str;
+	uint32_t i;
+
+	impl = calloc(1, sizeof(struct impl));
+	if (impl == NULL)
+		return NULL;
+
+	this = &impl->this;
+	pw_log_debug(NAME " %p: new \"%s\"", this, name);
+
+	this->core = core;
+	this->name = strdup(name);
+	this->ref = 1;
+
+	this->data_loop_impl = pw_data_loop_new(NULL);
+	if (this->data_loop_impl == NULL)
+		goto no_data_loop;
+	this->data_loop = pw_data_loop_get_loop(this->data_loop_impl);
+
+	spa_graph_init(&this->rt.graph);
+	spa_graph_data_init(&impl->graph_data, &this->rt.graph);
+	spa_graph_set_callbacks(&this->rt.graph, &spa_graph_impl_default, &impl->graph_data);
+	spa_graph_data_set_profile(&impl->graph_data, core->profile > 0, 0);
+
+	/* plugins of the partition add their sources to our data loop */
+	for (i = 0; i < core->n_support; i++) {
+		this->support[i] = core->support[i];
+		if (strcmp(this->support[i].type, SPA_TYPE_LOOP__DataLoop) == 0)
+			this->support[i].data = this->data_loop->loop;
+	}
+	this->n_support = core->n_support;
+
+	if ((str = pw_properties_get(core->properties, PW_CORE_PROP_GRAPH_WORKERS)) != NULL &&
+	    atoi(str) > 0) {
+		impl->executor = pw_executor_new(this->data_loop_impl, &impl->graph_data, atoi(str));
+		if (impl->executor == NULL)
+			pw_log_warn(NAME " %p: can't create graph workers", this);
+	}
+
+	if (pw_data_loop_start(this->data_loop_impl) < 0)
+		goto no_thread;
+
+	update_sched(this, properties);
+
+	spa_list_append(&core->partition_list, &this->link);
+
+	return this;
+
+      no_thread:
+	if (impl->executor)
+		pw_executor_destroy(impl->executor);
+	spa_graph_data_clear(&impl->graph_data);
+	pw_data_loop_destroy(this->data_loop_impl);
+      no_data_loop:
+	free(this->name);
+	free(impl);
+	return NULL;
+}
+
+/** Get a partition
+ * \param core the core
+ * \param name the name of the partition
+ * \param properties properties of the driver, used when the partition is made
+ * \return the partition with a new reference or NULL on error
+ *
+ * Release the partition with pw_partition_unref()
+ */
+struct pw_partition *
+pw_partition_get(struct pw_core *core, const char *name, struct pw_properties *properties)
+{
+	struct pw_partition *p;
+
+	spa_list_for_each(p, &core->partition_list, link) {
+		if (strcmp(p->name, name) == 0) {
+			p->ref++;
+			return p;
+		}
+	}
+	return partition_new(core, name, properties);
+}
+
+/** Release a reference on a partition
+ * \param partition the partition
+ *
+ * The data loop of the partition is stopped and the partition is freed
+ * when the last node is gone.
+ */
+void pw_partition_unref(struct pw_partition *partition)
+{
+	struct impl *impl = SPA_CONTAINER_OF(partition, struct impl, this);
+
+	if (--partition->ref > 0)
+		return;
+
+	pw_log_debug(NAME " %p: destroy", partition);
+
+	spa_list_remove(&partition->link);
+
+	pw_data_loop_destroy(partition->data_loop_impl);
+
+	if (impl->executor)
+		pw_executor_destroy(impl->executor);
+	spa_graph_data_clear(&impl->graph_data);
+
+	free(partition->name);
+	free(impl);
+}
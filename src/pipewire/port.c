@@ -49,17 +49,68 @@ static void port_update_state(struct pw_port *port, enum pw_port_state state)
 	}
 }
 
+/* give a buffer back to the node of the port */
+static void port_reuse_buffer(struct pw_port *this, uint32_t buffer_id)
+{
+	struct spa_graph_port *pp;
+
+	if ((pp = this->rt.mix_port.peer) != NULL)
+		spa_node_port_reuse_buffer(pp->node->implementation, pp->port_id, buffer_id);
+}
+
+/* recycle the buffers that peers in other partitions are done with */
+static void tee_recycle_async(struct pw_port *this)
+{
+	struct spa_graph_node *node = &this->rt.mix_node;
+	struct spa_graph_port *p;
+	uint32_t buffer_id;
+
+	spa_list_for_each(p, &node->ports[SPA_DIRECTION_OUTPUT], link) {
+		if (!(p->flags & SPA_GRAPH_PORT_FLAG_ASYNC))
+			continue;
+		while (pw_link_dequeue_reuse(p->scheduler_data, &buffer_id)) {
+			pw_log_trace("node %p: tee recycle async %d", node, buffer_id);
+			port_reuse_buffer(this, buffer_id);
+		}
+	}
+}
+
+/* leave a buffer for a peer in another partition. The buffer is not given
+ * when the peer did not take the previous one yet */
+static bool tee_handoff(struct spa_graph_port *p, struct spa_io_buffers *io)
+{
+	if (io->status != SPA_STATUS_HAVE_BUFFER ||
+	    __atomic_load_n(&p->io->status, __ATOMIC_ACQUIRE) == SPA_STATUS_HAVE_BUFFER)
+		return false;
+
+	p->io->buffer_id = io->buffer_id;
+	__atomic_store_n(&p->io->status, SPA_STATUS_HAVE_BUFFER, __ATOMIC_RELEASE);
+	return true;
+}
+
 static int schedule_tee_input(struct spa_node *data)
 {
 	struct pw_port *this = SPA_CONTAINER_OF(data, struct pw_port, mix_node);
 	struct spa_graph_node *node = &this->rt.mix_node;
 	struct spa_graph_port *p;
 	struct spa_io_buffers *io = this->rt.mix_port.io;
+	bool used = false;
 
 	if (!spa_list_is_empty(&node->ports[SPA_DIRECTION_OUTPUT])) {
 		pw_log_trace("node %p: tee input %d %d", node, io->status, io->buffer_id);
-		spa_list_for_each(p, &node->ports[SPA_DIRECTION_OUTPUT], link)
-			*p->io = *io;
+		tee_recycle_async(this);
+		spa_list_for_each(p, &node->ports[SPA_DIRECTION_OUTPUT], link) {
+			if (p->flags & SPA_GRAPH_PORT_FLAG_ASYNC) {
+				used |= tee_handoff(p, io);
+			} else {
+				*p->io = *io;
+				used = true;
+			}
+		}
+		if (!used && io->buffer_id != SPA_ID_INVALID) {
+			pw_log_trace("node %p: tee drop %d", node, io->buffer_id);
+			port_reuse_buffer(this, io->buffer_id);
+		}
 		io->buffer_id = SPA_ID_INVALID;
 	}
 	else
@@ -74,8 +125,11 @@ static int schedule_tee_output(struct spa_node *data)
 	struct spa_graph_port *p;
 	struct spa_io_buffers *io = this->rt.mix_port.io;
 
-	spa_list_for_each(p, &node->ports[SPA_DIRECTION_OUTPUT], link)
-		*io = *p->io;
+	tee_recycle_async(this);
+	spa_list_for_each(p, &node->ports[SPA_DIRECTION_OUTPUT], link) {
+		if (!(p->flags & SPA_GRAPH_PORT_FLAG_ASYNC))
+			*io = *p->io;
+	}
 	pw_log_trace("node %p: tee output %d %d", node, io->status, io->buffer_id);
 	return io->status;
 }
@@ -101,6 +155,19 @@ static const struct spa_node schedule_tee_node = {
 	.port_reuse_buffer = schedule_tee_reuse_buffer,
 };
 
+/* send the buffer that came from a peer in another partition back to it */
+static void mix_recycle_async(struct pw_port *this, uint32_t buffer_id)
+{
+	struct spa_graph_port *p = this->rt.handoff_port;
+
+	this->rt.handoff_port = NULL;
+	if (buffer_id == SPA_ID_INVALID)
+		return;
+
+	if (pw_link_queue_reuse(p->scheduler_data, buffer_id) < 0)
+		pw_log_warn("mix %p: can't recycle async buffer %d", &this->rt.mix_node, buffer_id);
+}
+
 static int schedule_mix_input(struct spa_node *data)
 {
 	struct pw_port *this = SPA_CONTAINER_OF(data, struct pw_port, mix_node);
@@ -109,6 +176,19 @@ static int schedule_mix_input(struct spa_node *data)
 	struct spa_io_buffers *io = this->rt.mix_port.io;
 
 	spa_list_for_each(p, &node->ports[SPA_DIRECTION_INPUT], link) {
+		if (p->flags & SPA_GRAPH_PORT_FLAG_ASYNC) {
+			/* take the buffer and free the io area for the peer */
+			if (__atomic_load_n(&p->io->status, __ATOMIC_ACQUIRE) !=
+			    SPA_STATUS_HAVE_BUFFER)
+				continue;
+			pw_log_trace("mix %p: input async %p %d", node, p, p->io->buffer_id);
+			io->status = SPA_STATUS_HAVE_BUFFER;
+			io->buffer_id = p->io->buffer_id;
+			p->io->buffer_id = SPA_ID_INVALID;
+			__atomic_store_n(&p->io->status, SPA_STATUS_NEED_BUFFER, __ATOMIC_RELEASE);
+			this->rt.handoff_port = p;
+			break;
+		}
 		pw_log_trace("mix %p: input %p %p->%p %d %d", node,
 				p, p->io, io, p->io->status, p->io->buffer_id);
 		*io = *p->io;
@@ -126,8 +206,14 @@ static int schedule_mix_output(struct spa_node *data)
 	struct spa_io_buffers *io = this->rt.mix_port.io;
 
 	if (!spa_list_is_empty(&node->ports[SPA_DIRECTION_INPUT])) {
-		spa_list_for_each(p, &node->ports[SPA_DIRECTION_INPUT], link)
-			*p->io = *io;
+		if (this->rt.handoff_port) {
+			mix_recycle_async(this, io->buffer_id);
+			io->buffer_id = SPA_ID_INVALID;
+		}
+		spa_list_for_each(p, &node->ports[SPA_DIRECTION_INPUT], link) {
+			if (!(p->flags & SPA_GRAPH_PORT_FLAG_ASYNC))
+				*p->io = *io;
+		}
 	}
 	else {
 		io->status = SPA_STATUS_HAVE_BUFFER;
@@ -143,11 +229,15 @@ static int schedule_mix_reuse_buffer(struct spa_node *data, uint32_t port_id, ui
 	struct spa_graph_node *node = &this->rt.mix_node;
 	struct spa_graph_port *p, *pp;
 
+	if (this->rt.handoff_port) {
+		mix_recycle_async(this, buffer_id);
+		return 0;
+	}
 	spa_list_for_each(p, &node->ports[SPA_DIRECTION_INPUT], link) {
-		if ((pp = p->peer) != NULL) {
-			pw_log_trace("mix %p: reuse buffer %d %d", node, port_id, buffer_id);
-			spa_node_port_reuse_buffer(pp->node->implementation, port_id, buffer_id);
-		}
+		if ((p->flags & SPA_GRAPH_PORT_FLAG_ASYNC) || (pp = p->peer) == NULL)
+			continue;
+		pw_log_trace("mix %p: reuse buffer %d %d", node, port_id, buffer_id);
+		spa_node_port_reuse_buffer(pp->node->implementation, port_id, buffer_id);
 	}
 	return 0;
 }
@@ -465,6 +555,8 @@ int pw_port_add(struct pw_port *port, struct pw_node *node)
 				pw_properties_copy(port->properties));
 
 	port->rt.graph = node->rt.graph;
+	/* the port and the mix node with its port */
+	pw_graph_reserve(node->data_loop, port->rt.graph, 1, 2);
 	pw_loop_invoke(node->data_loop, do_add_port, SPA_ID_INVALID, NULL, 0, false, port);
 
 	if (port->state <= PW_PORT_STATE_INIT)
@@ -24,6 +24,7 @@
 extern "C" {
 #endif
 
+#include <errno.h>
 #include <sys/socket.h>
 #include <sys/types.h> /* for pthread_t */
 
@@ -37,6 +38,7 @@ extern "C" {
 #endif
 
 #include <spa/graph/graph.h>
+#include <spa/utils/ringbuffer.h>
 
 struct pw_command;
 
@@ -150,6 +152,7 @@ struct pw_core {
 	struct spa_list factory_list;		/**< list of factories */
 	struct spa_list link_list;		/**< list of links */
 	struct spa_list control_list[2];	/**< list of controls, indexed by direction */
+	struct spa_list partition_list;		/**< list of graph partitions */
 
 	struct spa_hook_list listener_list;
 
@@ -164,6 +167,30 @@ struct pw_core {
 
 	long sc_pagesize;
 
+	bool graph_plan;		/**< the graph is scheduled from a plan */
+	uint32_t profile;		/**< profile update interval in milliseconds
+					  *  or 0 when profiling is disabled */
+
+	struct {
+		struct spa_graph graph;
+	} rt;
+};
+
+/** A part of the graph that is driven by one driver node. It has its own
+ * data loop and graph, links to nodes in other partitions are async. */
+struct pw_partition {
+	struct pw_core *core;		/**< the core */
+	struct spa_list link;		/**< link in core partition_list */
+	char *name;			/**< name of the partition */
+	int ref;
+
+	struct pw_data_loop *data_loop_impl;
+	struct pw_loop *data_loop;	/**< data loop of the partition */
+
+	struct spa_support support[16];	/**< support for spa plugins, with the data
+					  *  loop of the partition */
+	uint32_t n_support;
+
 	struct {
 		struct spa_graph graph;
 	} rt;
@@ -228,6 +255,7 @@ struct pw_link {
 	struct spa_list resource_list;	/**< list of bound resources */
 
 	struct spa_io_buffers io;	/**< link io area */
+	bool async;			/**< the ports are in different partitions */
 
 	struct pw_port *output;		/**< output port */
 	struct spa_list output_link;	/**< link in output port links */
@@ -239,11 +267,43 @@ struct pw_link {
 	struct {
 		struct spa_graph_port out_port;
 		struct spa_graph_port in_port;
+#define PW_LINK_MAX_REUSE	64
+		struct spa_ringbuffer reuse;	/**< buffers to recycle on async links */
+		uint32_t reuse_ids[PW_LINK_MAX_REUSE];
 	} rt;
 
 	void *user_data;
 };
 
+/** Queue a buffer to be recycled by the output side of an async link,
+ * called from the data loop of the input node */
+static inline int pw_link_queue_reuse(struct pw_link *link, uint32_t buffer_id)
+{
+	uint32_t index;
+	int32_t filled;
+
+	filled = spa_ringbuffer_get_write_index(&link->rt.reuse, &index);
+	if (filled < 0 || filled >= PW_LINK_MAX_REUSE)
+		return -ENOSPC;
+
+	link->rt.reuse_ids[index & (PW_LINK_MAX_REUSE - 1)] = buffer_id;
+	spa_ringbuffer_write_update(&link->rt.reuse, index + 1);
+	return 0;
+}
+
+/** Dequeue a buffer to recycle, called from the data loop of the output node */
+static inline bool pw_link_dequeue_reuse(struct pw_link *link, uint32_t *buffer_id)
+{
+	uint32_t index;
+
+	if (spa_ringbuffer_get_read_index(&link->rt.reuse, &index) <= 0)
+		return false;
+
+	*buffer_id = link->rt.reuse_ids[index & (PW_LINK_MAX_REUSE - 1)];
+	spa_ringbuffer_read_update(&link->rt.reuse, index + 1);
+	return true;
+}
+
 struct pw_module {
 	struct pw_core *core;           /**< the core object */
 	struct spa_list link;           /**< link in the core module_list */
@@ -290,11 +350,17 @@ struct pw_node {
 
 	struct spa_hook_list listener_list;
 
+	struct pw_partition *partition;		/**< partition of the node, NULL when the
+						  *  node is in the graph of the core */
 	struct pw_loop *data_loop;		/**< the data loop for this node */
 
+	uint32_t profile_count;			/**< process count of the last profile
+						  *  update */
+
 	struct {
 		struct spa_graph *graph;
 		struct spa_graph_node node;
+		struct spa_graph_node_stats stats;	/**< updated when profiling */
 	} rt;
 
         void *user_data;                /**< extra user data */
@@ -339,6 +405,8 @@ struct pw_port {
 		struct spa_graph_port port;	/**< this graph port, linked to mix_port */
 		struct spa_graph_port mix_port;	/**< port from the mixer */
 		struct spa_graph_node mix_node;	/**< mixer node */
+		struct spa_graph_port *handoff_port;	/**< async port of the buffer in
+							  *  the mixer */
 	} rt;					/**< data only accessed from the data thread */
 
         void *user_data;                /**< extra user data */
@@ -559,6 +627,10 @@ void pw_node_update_state(struct pw_node *node, enum pw_node_state state, char *
 
 int pw_node_update_ports(struct pw_node *node);
 
+/** Update the profile properties of the node when it processed since the
+ * last update */
+void pw_node_update_profile(struct pw_node *node);
+
 /** Activate a link \memberof pw_link
   * Starts the negotiation of formats and buffers on \a link and then
   * starts data streaming */
@@ -575,6 +647,38 @@ pw_control_new(struct pw_core *core,
 
 void pw_control_destroy(struct pw_control *control);
 
+/** callbacks of the default graph scheduler, the data is not used */
+extern const struct spa_graph_callbacks pw_graph_default_callbacks;
+
+struct spa_graph_data;
+
+/** Run the graph with worker threads */
+struct pw_executor *
+pw_executor_new(struct pw_data_loop *loop,	/**< data loop running the graph */
+		struct spa_graph_data *data,	/**< scheduler data of the graph */
+		uint32_t n_workers);
+
+void pw_executor_destroy(struct pw_executor *executor);
+
+/** Make room in the scheduler of \a graph before \a n_nodes nodes and
+ * \a n_ports ports are added to it. The scheduler does not allocate memory
+ * in the data thread. */
+int pw_graph_reserve(struct pw_loop *loop,		/**< data loop of the graph */
+		     struct spa_graph *graph,
+		     uint32_t n_nodes, uint32_t n_ports);
+
+/** The name of the partition of a node with \a name and \a properties or
+ * NULL when the node is in the graph of the core */
+const char *pw_partition_name(struct pw_core *core, const char *name,
+			      struct pw_properties *properties);
+
+/** Get the partition with \a name, it is made when it does not exist */
+struct pw_partition *
+pw_partition_get(struct pw_core *core, const char *name,
+		 struct pw_properties *properties	/**< properties of the driver */);
+
+void pw_partition_unref(struct pw_partition *partition);
+
 /** \endcond */
 
 #ifdef __cplusplus
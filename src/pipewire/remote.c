@@ -40,6 +40,10 @@
 #include "extensions/client-node.h"
 
 /** \cond */
+
+#define MAX_SPIN		(1 << 20)
+#define MAX_SPIN_ROUNDS		16
+
 struct remote {
 	struct pw_remote this;
 	uint32_t type_client_node;
@@ -83,6 +87,7 @@ struct node_data {
 
 	int rtwritefd;
 	struct spa_source *rtsocket_source;
+	uint32_t spin;			/**< checks for a quick signal of the server */
         struct pw_client_node_transport *trans;
 
 	struct spa_node out_node_impl;
@@ -524,6 +529,27 @@ static void handle_rtnode_message(struct pw_proxy *proxy, struct pw_client_node_
 	}
 }
 
+static void handle_rtnode_transport(struct pw_proxy *proxy)
+{
+	struct node_data *data = proxy->user_data;
+	struct pw_client_node_message message;
+	uint32_t status;
+
+	while (pw_client_node_transport_next_message(data->trans, &message) == 1) {
+		struct pw_client_node_message *msg = alloca(SPA_POD_SIZE(&message));
+		pw_client_node_transport_parse_message(data->trans, msg);
+		handle_rtnode_message(proxy, msg);
+	}
+
+	status = pw_client_node_activation_take(data->trans->input_activation);
+	if (status & (1 << PW_CLIENT_NODE_MESSAGE_PROCESS_INPUT))
+		handle_rtnode_message(proxy,
+			&PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_PROCESS_INPUT));
+	if (status & (1 << PW_CLIENT_NODE_MESSAGE_PROCESS_OUTPUT))
+		handle_rtnode_message(proxy,
+			&PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_PROCESS_OUTPUT));
+}
+
 static void
 on_rtsocket_condition(void *user_data, int fd, enum spa_io mask)
 {
@@ -537,8 +563,8 @@ on_rtsocket_condition(void *user_data, int fd, enum spa_io mask)
 	}
 
 	if (mask & SPA_IO_IN) {
-		struct pw_client_node_message message;
 		uint64_t cmd;
+		uint32_t rounds = 0;
 
 		if (read(fd, &cmd, sizeof(uint64_t)) != sizeof(uint64_t))
 			pw_log_warn("proxy %p: read failed %m", proxy);
@@ -546,12 +572,12 @@ on_rtsocket_condition(void *user_data, int fd, enum spa_io mask)
 		if (cmd > 1)
 			pw_log_warn("proxy %p: %ld messages", proxy, cmd);
 
-
-		while (pw_client_node_transport_next_message(data->trans, &message) == 1) {
-			struct pw_client_node_message *msg = alloca(SPA_POD_SIZE(&message));
-			pw_client_node_transport_parse_message(data->trans, msg);
-			handle_rtnode_message(proxy, msg);
-		}
+		/* handle the signals of the server that come in quickly without
+		 * the eventfd, a few times so that the loop is not starved */
+		do {
+			handle_rtnode_transport(proxy);
+		} while (data->spin > 0 && ++rounds < MAX_SPIN_ROUNDS &&
+			 pw_client_node_transport_wait(data->trans, data->spin, false) == 0);
 	}
 }
 
@@ -711,6 +737,9 @@ static void client_node_transport(void *object, uint32_t node_id,
 	pw_log_info("remote-node %p: create transport %p with fds %d %d for node %u",
 		proxy, data->trans, readfd, writefd, node_id);
 
+	pw_graph_reserve(proxy->remote->core->data_loop, data->node->rt.graph, 0,
+			 data->node->info.n_input_ports + data->node->info.n_output_ports);
+
 	data->in_ports = calloc(data->trans->area->max_input_ports,
 				 sizeof(struct port));
 	data->out_ports = calloc(data->trans->area->max_output_ports,
@@ -844,19 +873,17 @@ static void client_node_event(void *object, const struct spa_event *event)
 static void node_need_input(void *data)
 {
 	struct node_data *d = data;
-        uint64_t cmd = 1;
-	pw_client_node_transport_add_message(d->trans,
-				&PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_NEED_INPUT));
-        write(d->rtwritefd, &cmd, 8);
+	pw_client_node_activation_trigger(d->trans->output_activation,
+					  PW_CLIENT_NODE_MESSAGE_NEED_INPUT);
+	pw_client_node_transport_signal(d->trans, d->rtwritefd);
 }
 
 static void node_have_output(void *data)
 {
 	struct node_data *d = data;
-        uint64_t cmd = 1;
-        pw_client_node_transport_add_message(d->trans,
-                               &PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_HAVE_OUTPUT));
-        write(d->rtwritefd, &cmd, 8);
+	pw_client_node_activation_trigger(d->trans->output_activation,
+					  PW_CLIENT_NODE_MESSAGE_HAVE_OUTPUT);
+	pw_client_node_transport_signal(d->trans, d->rtwritefd);
 }
 
 static void client_node_command(void *object, uint32_t seq, const struct spa_command *command)
@@ -1327,6 +1354,7 @@ struct pw_proxy *pw_remote_export(struct pw_remote *remote,
 	struct remote *impl = SPA_CONTAINER_OF(remote, struct remote, this);
 	struct pw_proxy *proxy;
 	struct node_data *data;
+	const char *str;
 
 	proxy = pw_core_proxy_create_object(remote->core_proxy,
 					    "client-node",
@@ -1343,6 +1371,9 @@ struct pw_proxy *pw_remote_export(struct pw_remote *remote,
 	data->core = pw_node_get_core(node);
 	data->t = pw_core_get_type(data->core);
 	data->node_proxy = (struct pw_client_node_proxy *)proxy;
+	if ((str = pw_properties_get(pw_core_get_properties(data->core),
+				     PW_CLIENT_NODE_PROP_SPIN)) != NULL)
+		data->spin = SPA_MIN(strtoul(str, NULL, 0), MAX_SPIN);
 	data->in_node_impl = node_impl;
 	data->out_node_impl = node_impl;
 
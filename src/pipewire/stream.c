@@ -41,6 +41,8 @@
 #define MAX_FDS         32
 #define MAX_INPUTS      64
 #define MAX_OUTPUTS     64
+#define MAX_SPIN        (1 << 20)
+#define MAX_SPIN_ROUNDS 16
 
 struct mem_id {
 	uint32_t id;
@@ -62,10 +64,17 @@ struct buffer_id {
 	struct mem_id **mem;
 };
 
-struct stream {
-	struct pw_stream this;
+/** Lock-free queue of buffer ids with one producer and one consumer thread */
+struct queue {
+	struct spa_ringbuffer ring;
+	uint32_t size;			/**< number of ids, a power of 2 */
+	uint32_t *ids;
+};
 
-	uint32_t type_client_node;
+/** A port of the stream, each port has its own format and buffers */
+struct port {
+	uint32_t id;
+	struct spa_hook_list listener_list;	/**< port 0 uses the stream listeners */
 
 	uint32_t n_init_params;
 	struct spa_pod **init_params;
@@ -74,16 +83,42 @@ struct stream {
 	struct spa_pod **params;
 
 	struct spa_pod *format;
+	uint32_t pending_seq;
 
 	struct spa_port_info port_info;
+
+	struct pw_array buffer_ids;
+	bool in_order;
+	/* when the ids are not in order, an open addressing table of the index
+	 * in buffer_ids + 1 of each id, 0 is a free slot */
+	uint32_t *buffer_index;
+	uint32_t buffer_index_mask;
+	struct spa_io_buffers *io;
+
+	struct spa_list free;
+
+	/* with PW_STREAM_FLAG_QUEUE, buffers go from the data thread to the
+	 * application in dequeued and back in queued */
+	struct queue dequeued;
+	struct queue queued;
+};
+
+#define GET_PORT(impl,id)	(*pw_array_get_unchecked(&(impl)->ports, id, struct port *))
+#define N_PORTS(impl)		pw_array_get_len(&(impl)->ports, struct port *)
+
+struct stream {
+	struct pw_stream this;
+
+	uint32_t type_client_node;
+
 	enum spa_direction direction;
-	uint32_t port_id;
-	uint32_t pending_seq;
+	struct pw_array ports;		/**< array of struct port *, the port id is the index */
 
 	enum pw_stream_flags flags;
 
 	int rtwritefd;
 	struct spa_source *rtsocket_source;
+	uint32_t spin;			/**< checks for a quick signal of the server */
 
 	struct pw_client_node_proxy *node_proxy;
 	bool disconnecting;
@@ -92,19 +127,17 @@ struct stream {
 
 	struct pw_client_node_transport *trans;
 
-	struct spa_source *timeout_source;
+	struct spa_source *timeout_source;	/**< asks for clock updates, main thread */
 
 	struct pw_array mem_ids;
-	struct pw_array buffer_ids;
-	bool in_order;
-	struct spa_io_buffers *io;
 
 	bool client_reuse;
 
-	struct spa_list free;
 	bool in_need_buffer;
 	bool in_new_buffer;
 
+	struct spa_source *queue_event;	/**< tells the data thread about queued buffers */
+
 	int64_t last_ticks;
 	int32_t last_rate;
 	int64_t last_monotonic;
@@ -182,15 +215,69 @@ static void clear_mems(struct pw_stream *stream)
 	impl->mem_ids.size = 0;
 }
 
-static void clear_buffers(struct pw_stream *stream)
+static int queue_init(struct queue *q, uint32_t n_ids)
+{
+	uint32_t size = 1, *ids;
+
+	while (size < n_ids)
+		size <<= 1;
+	if (size > q->size) {
+		if ((ids = realloc(q->ids, size * sizeof(uint32_t))) == NULL)
+			return -errno;
+		q->ids = ids;
+		q->size = size;
+	}
+	spa_ringbuffer_init(&q->ring);
+	return 0;
+}
+
+static int queue_push(struct queue *q, uint32_t id)
+{
+	uint32_t index;
+
+	if (spa_ringbuffer_get_write_index(&q->ring, &index) >= (int32_t) q->size)
+		return -ENOSPC;
+
+	q->ids[index & (q->size - 1)] = id;
+	spa_ringbuffer_write_update(&q->ring, index + 1);
+	return 0;
+}
+
+static uint32_t queue_pop(struct queue *q)
+{
+	uint32_t index, id;
+
+	if (spa_ringbuffer_get_read_index(&q->ring, &index) < 1)
+		return SPA_ID_INVALID;
+
+	id = q->ids[index & (q->size - 1)];
+	spa_ringbuffer_read_update(&q->ring, index + 1);
+	return id;
+}
+
+/* port 0 emits its events on the listeners of the stream */
+static inline struct spa_hook_list *port_listeners(struct pw_stream *stream, struct port *port)
+{
+	return port->id == 0 ? &stream->listener_list : &port->listener_list;
+}
+
+static struct port *find_port(struct stream *impl, enum spa_direction direction, uint32_t port_id)
+{
+	if (direction != impl->direction ||
+	    !pw_array_check_index(&impl->ports, port_id, struct port *))
+		return NULL;
+	return GET_PORT(impl, port_id);
+}
+
+static void clear_buffers(struct pw_stream *stream, struct port *port)
 {
-	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
 	struct buffer_id *bid;
 
-	pw_log_debug("stream %p: clear buffers", stream);
+	pw_log_debug("stream %p: clear buffers of port %u", stream, port->id);
 
-	pw_array_for_each(bid, &impl->buffer_ids) {
-		spa_hook_list_call(&stream->listener_list, struct pw_stream_events, remove_buffer, bid->id);
+	pw_array_for_each(bid, &port->buffer_ids) {
+		spa_hook_list_call(port_listeners(stream, port), struct pw_stream_events,
+				   remove_buffer, bid->id);
 		if (bid->ptr != NULL)
 			if (munmap(bid->ptr, bid->map.size) < 0)
 				pw_log_warn("failed to unmap buffer: %m");
@@ -199,9 +286,78 @@ static void clear_buffers(struct pw_stream *stream)
 		bid->buf = NULL;
 		bid->used = false;
 	}
-	impl->buffer_ids.size = 0;
-	impl->in_order = true;
-	spa_list_init(&impl->free);
+	port->buffer_ids.size = 0;
+	port->in_order = true;
+	spa_list_init(&port->free);
+	spa_ringbuffer_init(&port->dequeued.ring);
+	spa_ringbuffer_init(&port->queued.ring);
+}
+
+static int
+do_clear_buffers(struct spa_loop *loop,
+		 bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct pw_stream *stream = *(struct pw_stream **) data;
+
+	clear_buffers(stream, user_data);
+	return 0;
+}
+
+/* clear the buffers of a port in the data thread that uses them */
+static void clear_port_buffers(struct pw_stream *stream, struct port *port)
+{
+	pw_loop_invoke(stream->remote->core->data_loop,
+		       do_clear_buffers, SPA_ID_INVALID, &stream, sizeof(stream), true, port);
+}
+
+static uint32_t n_ports_with_buffers(struct stream *impl)
+{
+	struct port **p;
+	uint32_t n = 0;
+
+	pw_array_for_each(p, &impl->ports) {
+		if (pw_array_get_len(&(*p)->buffer_ids, struct buffer_id) > 0)
+			n++;
+	}
+	return n;
+}
+
+static uint32_t n_ports_with_format(struct stream *impl)
+{
+	struct port **p;
+	uint32_t n = 0;
+
+	pw_array_for_each(p, &impl->ports) {
+		if ((*p)->format)
+			n++;
+	}
+	return n;
+}
+
+static struct port *new_port(struct stream *impl)
+{
+	struct port *port, **p;
+
+	if ((port = calloc(1, sizeof(struct port))) == NULL)
+		return NULL;
+
+	if ((p = pw_array_add(&impl->ports, sizeof(struct port *))) == NULL) {
+		free(port);
+		return NULL;
+	}
+	*p = port;
+
+	port->id = N_PORTS(impl) - 1;
+	spa_hook_list_init(&port->listener_list);
+	port->pending_seq = SPA_ID_INVALID;
+	pw_array_init(&port->buffer_ids, 32);
+	pw_array_ensure_size(&port->buffer_ids, sizeof(struct buffer_id) * 64);
+	port->in_order = true;
+	spa_list_init(&port->free);
+
+	pw_log_debug("stream %p: new port %u", impl, port->id);
+
+	return port;
 }
 
 static bool stream_set_state(struct pw_stream *stream, enum pw_stream_state state, char *error)
@@ -277,21 +433,29 @@ struct pw_stream *pw_stream_new(struct pw_remote *remote,
 	str = pw_properties_get(props, "pipewire.client.reuse");
 	impl->client_reuse = str && pw_properties_parse_bool(str);
 
+	str = pw_properties_get(pw_core_get_properties(remote->core), PW_CLIENT_NODE_PROP_SPIN);
+	impl->spin = str ? SPA_MIN(strtoul(str, NULL, 0), MAX_SPIN) : 0;
+
 	spa_hook_list_init(&this->listener_list);
 
 	this->state = PW_STREAM_STATE_UNCONNECTED;
 
 	pw_array_init(&impl->mem_ids, 64);
 	pw_array_ensure_size(&impl->mem_ids, sizeof(struct mem_id) * 64);
-	pw_array_init(&impl->buffer_ids, 32);
-	pw_array_ensure_size(&impl->buffer_ids, sizeof(struct buffer_id) * 64);
-	impl->pending_seq = SPA_ID_INVALID;
-	spa_list_init(&impl->free);
+
+	pw_array_init(&impl->ports, 4 * sizeof(struct port *));
+	if (new_port(impl) == NULL)
+		goto no_port;
 
 	spa_list_append(&remote->stream_list, &this->link);
 
 	return this;
 
+      no_port:
+	pw_array_clear(&impl->ports);
+	pw_array_clear(&impl->mem_ids);
+	pw_properties_free(props);
+	free(this->name);
       no_mem:
 	free(impl);
 	return NULL;
@@ -333,9 +497,9 @@ do_remove_sources(struct spa_loop *loop,
 		pw_loop_destroy_source(stream->remote->core->data_loop, impl->rtsocket_source);
 		impl->rtsocket_source = NULL;
 	}
-	if (impl->timeout_source) {
-		pw_loop_destroy_source(stream->remote->core->data_loop, impl->timeout_source);
-		impl->timeout_source = NULL;
+	if (impl->queue_event) {
+		pw_loop_destroy_source(stream->remote->core->data_loop, impl->queue_event);
+		impl->queue_event = NULL;
 	}
 	if (impl->rtwritefd != -1) {
 		close(impl->rtwritefd);
@@ -353,49 +517,67 @@ static void unhandle_socket(struct pw_stream *stream)
 }
 
 static void
-set_init_params(struct pw_stream *stream,
+set_init_params(struct port *port,
 		     int n_init_params,
 		     const struct spa_pod **init_params)
 {
-	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
 	int i;
 
-	if (impl->init_params) {
-		for (i = 0; i < impl->n_init_params; i++)
-			free(impl->init_params[i]);
-		free(impl->init_params);
-		impl->init_params = NULL;
+	if (port->init_params) {
+		for (i = 0; i < port->n_init_params; i++)
+			free(port->init_params[i]);
+		free(port->init_params);
+		port->init_params = NULL;
 	}
-	impl->n_init_params = n_init_params;
+	port->n_init_params = n_init_params;
 	if (n_init_params > 0) {
-		impl->init_params = malloc(n_init_params * sizeof(struct spa_pod *));
+		port->init_params = malloc(n_init_params * sizeof(struct spa_pod *));
 		for (i = 0; i < n_init_params; i++)
-			impl->init_params[i] = pw_spa_pod_copy(init_params[i]);
+			port->init_params[i] = pw_spa_pod_copy(init_params[i]);
 	}
 }
 
-static void set_params(struct pw_stream *stream, int n_params, struct spa_pod **params)
+static void set_params(struct port *port, int n_params, struct spa_pod **params)
 {
-	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
 	int i;
 
-	if (impl->params) {
-		for (i = 0; i < impl->n_params; i++)
-			free(impl->params[i]);
-		free(impl->params);
-		impl->params = NULL;
+	if (port->params) {
+		for (i = 0; i < port->n_params; i++)
+			free(port->params[i]);
+		free(port->params);
+		port->params = NULL;
 	}
-	impl->n_params = n_params;
+	port->n_params = n_params;
 	if (n_params > 0) {
-		impl->params = malloc(n_params * sizeof(struct spa_pod *));
+		port->params = malloc(n_params * sizeof(struct spa_pod *));
 		for (i = 0; i < n_params; i++)
-			impl->params[i] = pw_spa_pod_copy(params[i]);
+			port->params[i] = pw_spa_pod_copy(params[i]);
 	}
 }
 
+static void free_port(struct pw_stream *stream, struct port *port)
+{
+	pw_log_debug("stream %p: free port %u", stream, port->id);
+
+	clear_buffers(stream, port);
+	pw_array_clear(&port->buffer_ids);
+	free(port->buffer_index);
+	free(port->dequeued.ids);
+	free(port->queued.ids);
+
+	set_init_params(port, 0, NULL);
+	set_params(port, 0, NULL);
+
+	if (port->format)
+		free(port->format);
+
+	free(port);
+}
+
 void pw_stream_destroy(struct pw_stream *stream)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct port **p;
 
 	pw_log_debug("stream %p: destroy", stream);
 
@@ -408,17 +590,12 @@ void pw_stream_destroy(struct pw_stream *stream)
 
 	spa_list_remove(&stream->link);
 
-	set_init_params(stream, 0, NULL);
-	set_params(stream, 0, NULL);
-
-	if (impl->format)
-		free(impl->format);
-
 	if (stream->error)
 		free(stream->error);
 
-	clear_buffers(stream);
-	pw_array_clear(&impl->buffer_ids);
+	pw_array_for_each(p, &impl->ports)
+		free_port(stream, *p);
+	pw_array_clear(&impl->ports);
 
 	clear_mems(stream);
 	pw_array_clear(&impl->mem_ids);
@@ -438,73 +615,70 @@ static void add_node_update(struct pw_stream *stream, uint32_t change_mask)
 	uint32_t max_input_ports = 0, max_output_ports = 0;
 
 	if (change_mask & PW_CLIENT_NODE_UPDATE_MAX_INPUTS)
-		max_input_ports = impl->direction == SPA_DIRECTION_INPUT ? 1 : 0;
+		max_input_ports = impl->direction == SPA_DIRECTION_INPUT ? N_PORTS(impl) : 0;
 	if (change_mask & PW_CLIENT_NODE_UPDATE_MAX_OUTPUTS)
-		max_output_ports = impl->direction == SPA_DIRECTION_OUTPUT ? 1 : 0;
+		max_output_ports = impl->direction == SPA_DIRECTION_OUTPUT ? N_PORTS(impl) : 0;
 
 	pw_client_node_proxy_update(impl->node_proxy,
 				    change_mask, max_input_ports, max_output_ports,
 				    0, NULL);
 }
 
-static void add_port_update(struct pw_stream *stream, uint32_t change_mask)
+static void add_port_update(struct pw_stream *stream, struct port *port, uint32_t change_mask)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
 	uint32_t n_params;
 	struct spa_pod **params;
 	int i, j;
 
-	n_params = impl->n_params + impl->n_init_params;
-	if (impl->format)
+	n_params = port->n_params + port->n_init_params;
+	if (port->format)
 		n_params += 1;
 
 	params = alloca(n_params * sizeof(struct spa_pod *));
 
 	j = 0;
-	for (i = 0; i < impl->n_init_params; i++)
-		params[j++] = impl->init_params[i];
-	if (impl->format)
-		params[j++] = impl->format;
-	for (i = 0; i < impl->n_params; i++)
-		params[j++] = impl->params[i];
+	for (i = 0; i < port->n_init_params; i++)
+		params[j++] = port->init_params[i];
+	if (port->format)
+		params[j++] = port->format;
+	for (i = 0; i < port->n_params; i++)
+		params[j++] = port->params[i];
 
 	pw_client_node_proxy_port_update(impl->node_proxy,
 					 impl->direction,
-					 impl->port_id,
+					 port->id,
 					 change_mask,
 					 n_params,
 					 (const struct spa_pod **) params,
-					 &impl->port_info);
+					 &port->port_info);
 }
 
 static inline void send_need_input(struct pw_stream *stream)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
-	uint64_t cmd = 1;
 
-	pw_client_node_transport_add_message(impl->trans,
-			       &PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_NEED_INPUT));
-	write(impl->rtwritefd, &cmd, 8);
+	pw_client_node_activation_trigger(impl->trans->output_activation,
+					  PW_CLIENT_NODE_MESSAGE_NEED_INPUT);
+	pw_client_node_transport_signal(impl->trans, impl->rtwritefd);
 }
 
 static inline void send_have_output(struct pw_stream *stream)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
-	uint64_t cmd = 1;
 
-	pw_client_node_transport_add_message(impl->trans,
-			       &PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_HAVE_OUTPUT));
-	write(impl->rtwritefd, &cmd, 8);
+	pw_client_node_activation_trigger(impl->trans->output_activation,
+					  PW_CLIENT_NODE_MESSAGE_HAVE_OUTPUT);
+	pw_client_node_transport_signal(impl->trans, impl->rtwritefd);
 }
 
-static inline void send_reuse_buffer(struct pw_stream *stream, uint32_t id)
+static inline void send_reuse_buffer(struct pw_stream *stream, struct port *port, uint32_t id)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
-	uint64_t cmd = 1;
 
 	pw_client_node_transport_add_message(impl->trans, (struct pw_client_node_message*)
-			       &PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFER_INIT(impl->port_id, id));
-	write(impl->rtwritefd, &cmd, 8);
+			       &PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFER_INIT(port->id, id));
+	pw_client_node_transport_signal(impl->trans, impl->rtwritefd);
 }
 
 static void add_request_clock_update(struct pw_stream *stream)
@@ -529,14 +703,17 @@ static void add_async_complete(struct pw_stream *stream, uint32_t seq, int res)
 static void do_node_init(struct pw_stream *stream)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct port **p;
 
 	add_node_update(stream, PW_CLIENT_NODE_UPDATE_MAX_INPUTS |
 			PW_CLIENT_NODE_UPDATE_MAX_OUTPUTS);
 
-	impl->port_info.flags = SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS;
+	pw_array_for_each(p, &impl->ports) {
+		(*p)->port_info.flags = SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS;
 
-	add_port_update(stream, PW_CLIENT_NODE_PORT_UPDATE_PARAMS |
-				PW_CLIENT_NODE_PORT_UPDATE_INFO);
+		add_port_update(stream, *p, PW_CLIENT_NODE_PORT_UPDATE_PARAMS |
+					    PW_CLIENT_NODE_PORT_UPDATE_INFO);
+	}
 
 	add_async_complete(stream, 0, 0);
 	if (!(impl->flags & PW_STREAM_FLAG_INACTIVE))
@@ -546,41 +723,173 @@ static void do_node_init(struct pw_stream *stream)
 static void on_timeout(void *data, uint64_t expirations)
 {
 	struct pw_stream *stream = data;
-	add_request_clock_update(stream);
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+
+	if (impl->node_proxy)
+		add_request_clock_update(stream);
 }
 
-static struct buffer_id *find_buffer(struct pw_stream *stream, uint32_t id)
+static inline uint32_t buffer_index_hash(struct port *port, uint32_t id)
 {
-	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	return (id * 2654435761u) & port->buffer_index_mask;
+}
 
-	if (impl->in_order && pw_array_check_index(&impl->buffer_ids, id, struct buffer_id)) {
-		return pw_array_get_unchecked(&impl->buffer_ids, id, struct buffer_id);
-	} else {
-		struct buffer_id *bid;
+/* make the table at least twice as big as the number of buffers so that
+ * the probe sequences stay short */
+static int init_buffer_index(struct port *port, uint32_t n_buffers)
+{
+	uint32_t size = 1, *index;
 
-		pw_array_for_each(bid, &impl->buffer_ids) {
-			if (bid->id == id)
-				return bid;
-		}
+	while (size < n_buffers * 2)
+		size <<= 1;
+
+	if (port->buffer_index == NULL || size > port->buffer_index_mask + 1) {
+		if ((index = realloc(port->buffer_index, size * sizeof(uint32_t))) == NULL)
+			return -errno;
+		port->buffer_index = index;
+		port->buffer_index_mask = size - 1;
+	}
+	memset(port->buffer_index, 0, (port->buffer_index_mask + 1) * sizeof(uint32_t));
+	return 0;
+}
+
+static void add_buffer_index(struct port *port, struct buffer_id *bid)
+{
+	uint32_t h;
+
+	for (h = buffer_index_hash(port, bid->id);
+	     port->buffer_index[h] != 0;
+	     h = (h + 1) & port->buffer_index_mask);
+
+	/* store the position + 1, 0 marks a free slot */
+	port->buffer_index[h] = bid - (struct buffer_id *) port->buffer_ids.data + 1;
+}
+
+static struct buffer_id *find_buffer(struct port *port, uint32_t id)
+{
+	struct buffer_id *bid;
+	uint32_t h, i;
+
+	if (port->in_order) {
+		if (pw_array_check_index(&port->buffer_ids, id, struct buffer_id))
+			return pw_array_get_unchecked(&port->buffer_ids, id, struct buffer_id);
+		return NULL;
+	}
+	for (h = buffer_index_hash(port, id); (i = port->buffer_index[h]) != 0;
+	     h = (h + 1) & port->buffer_index_mask) {
+		bid = pw_array_get_unchecked(&port->buffer_ids, i - 1, struct buffer_id);
+		if (bid->id == id)
+			return bid;
 	}
 	return NULL;
 }
 
-static inline void reuse_buffer(struct pw_stream *stream, uint32_t id)
+/* give a buffer to the application, only the data thread adds to dequeued */
+static int push_dequeued(struct pw_stream *stream, struct port *port, uint32_t id)
+{
+	int res;
+
+	if ((res = queue_push(&port->dequeued, id)) < 0)
+		pw_log_warn("stream %p: can't dequeue buffer %u on port %u: %s", stream,
+			    id, port->id, spa_strerror(res));
+	return res;
+}
+
+static inline void reuse_buffer(struct pw_stream *stream, struct port *port, uint32_t id)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
 	struct buffer_id *bid;
 
-	if ((bid = find_buffer(stream, id)) && bid->used) {
-		pw_log_trace("stream %p: reuse buffer %u", stream, id);
+	if ((bid = find_buffer(port, id)) && bid->used) {
+		pw_log_trace("stream %p: reuse buffer %u on port %u", stream, id, port->id);
 		bid->used = false;
-		spa_list_append(&impl->free, &bid->link);
+		if (!(impl->flags & PW_STREAM_FLAG_QUEUE) ||
+		    push_dequeued(stream, port, id) < 0)
+			spa_list_append(&port->free, &bid->link);
 		impl->in_new_buffer = true;
-		spa_hook_list_call(&stream->listener_list, struct pw_stream_events, new_buffer, id);
+		spa_hook_list_call(port_listeners(stream, port), struct pw_stream_events,
+				   new_buffer, id);
 		impl->in_new_buffer = false;
 	}
 }
 
+/* place the first buffer that the application queued when the output is free */
+static bool send_queued(struct pw_stream *stream, struct port *port)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct spa_io_buffers *output = &impl->trans->outputs[port->id];
+	struct buffer_id *bid;
+	uint32_t id;
+
+	if (output->buffer_id != SPA_ID_INVALID)
+		return false;
+
+	while ((id = queue_pop(&port->queued)) != SPA_ID_INVALID) {
+		if ((bid = find_buffer(port, id)) == NULL || bid->used)
+			continue;
+
+		bid->used = true;
+		output->buffer_id = id;
+		output->status = SPA_STATUS_HAVE_BUFFER;
+		pw_log_trace("stream %p: send queued buffer %d on port %u", stream, id, port->id);
+		return true;
+	}
+	return false;
+}
+
+/* send the queued buffers of all ports with one wakeup */
+static void send_all_queued(struct pw_stream *stream)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct port **p;
+	bool sent = false;
+
+	pw_array_for_each(p, &impl->ports)
+		sent |= send_queued(stream, *p);
+
+	if (sent)
+		send_have_output(stream);
+}
+
+/* recycle the buffers that the application queued */
+static void recycle_queued(struct pw_stream *stream, struct port *port)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct buffer_id *bid;
+	uint32_t id;
+
+	while ((id = queue_pop(&port->queued)) != SPA_ID_INVALID) {
+		if ((bid = find_buffer(port, id)) == NULL || !bid->used)
+			continue;
+
+		pw_log_trace("stream %p: recycle queued buffer %d on port %u", stream, id, port->id);
+		bid->used = false;
+		/* the server only waits for the buffer when the client reuses */
+		if (impl->client_reuse)
+			send_reuse_buffer(stream, port, id);
+	}
+}
+
+static void recycle_all_queued(struct pw_stream *stream)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct port **p;
+
+	pw_array_for_each(p, &impl->ports)
+		recycle_queued(stream, *p);
+}
+
+static void on_queue_event(void *data, uint64_t count)
+{
+	struct pw_stream *stream = data;
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+
+	if (impl->direction == SPA_DIRECTION_OUTPUT)
+		send_all_queued(stream);
+	else
+		recycle_all_queued(stream);
+}
+
 static void handle_rtnode_message(struct pw_stream *stream, struct pw_client_node_message *message)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
@@ -590,27 +899,42 @@ static void handle_rtnode_message(struct pw_stream *stream, struct pw_client_nod
 	{
 		int i;
 
+		if (impl->flags & PW_STREAM_FLAG_QUEUE)
+			recycle_all_queued(stream);
+
 		for (i = 0; i < impl->trans->area->n_input_ports; i++) {
 			struct spa_io_buffers *input = &impl->trans->inputs[i];
 			struct buffer_id *bid;
+			struct port *port;
 			uint32_t buffer_id;
 
+			if ((port = find_port(impl, SPA_DIRECTION_INPUT, i)) == NULL)
+				continue;
+
 			buffer_id = input->buffer_id;
 
-			pw_log_trace("stream %p: process input %d %d", stream, input->status,
-				     buffer_id);
+			pw_log_trace("stream %p: process input %d %d %d", stream, i,
+				     input->status, buffer_id);
 
-			if ((bid = find_buffer(stream, buffer_id)) == NULL)
+			if ((bid = find_buffer(port, buffer_id)) == NULL)
 				continue;
 
 			if (impl->client_reuse)
 				input->buffer_id = SPA_ID_INVALID;
 
 			if (input->status == SPA_STATUS_HAVE_BUFFER) {
+				if (impl->flags & PW_STREAM_FLAG_QUEUE &&
+				    push_dequeued(stream, port, buffer_id) < 0) {
+					/* the application can't take it, give it back */
+					if (impl->client_reuse)
+						input->buffer_id = buffer_id;
+					input->status = SPA_STATUS_NEED_BUFFER;
+					continue;
+				}
 				bid->used = true;
 				impl->in_new_buffer = true;
-				spa_hook_list_call(&stream->listener_list, struct pw_stream_events,
-					 new_buffer, buffer_id);
+				spa_hook_list_call(port_listeners(stream, port),
+						   struct pw_stream_events, new_buffer, buffer_id);
 				impl->in_new_buffer = false;
 			}
 
@@ -625,30 +949,34 @@ static void handle_rtnode_message(struct pw_stream *stream, struct pw_client_nod
 
 		for (i = 0; i < impl->trans->area->n_output_ports; i++) {
 			struct spa_io_buffers *output = &impl->trans->outputs[i];
+			struct port *port;
 
 			if (output->buffer_id == SPA_ID_INVALID)
 				continue;
 
-			reuse_buffer(stream, output->buffer_id);
+			if ((port = find_port(impl, SPA_DIRECTION_OUTPUT, i)) != NULL)
+				reuse_buffer(stream, port, output->buffer_id);
 			output->buffer_id = SPA_ID_INVALID;
 		}
 		pw_log_trace("stream %p: process output", stream);
 		impl->in_need_buffer = true;
 		spa_hook_list_call(&stream->listener_list, struct pw_stream_events, need_buffer);
 		impl->in_need_buffer = false;
+
+		if (impl->flags & PW_STREAM_FLAG_QUEUE)
+			send_all_queued(stream);
 		break;
 	}
 	case PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFER:
 	{
 		struct pw_client_node_message_port_reuse_buffer *p =
 		    (struct pw_client_node_message_port_reuse_buffer *) message;
+		struct port *port;
 
-		if (p->body.port_id.value != impl->port_id)
-			return;
-		if (impl->direction != SPA_DIRECTION_OUTPUT)
+		if ((port = find_port(impl, SPA_DIRECTION_OUTPUT, p->body.port_id.value)) == NULL)
 			return;
 
-		reuse_buffer(stream, p->body.buffer_id.value);
+		reuse_buffer(stream, port, p->body.buffer_id.value);
 		break;
 	}
 	default:
@@ -657,6 +985,27 @@ static void handle_rtnode_message(struct pw_stream *stream, struct pw_client_nod
 	}
 }
 
+static void handle_rtnode_transport(struct pw_stream *stream)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct pw_client_node_message message;
+	uint32_t status;
+
+	while (pw_client_node_transport_next_message(impl->trans, &message) == 1) {
+		struct pw_client_node_message *msg = alloca(SPA_POD_SIZE(&message));
+		pw_client_node_transport_parse_message(impl->trans, msg);
+		handle_rtnode_message(stream, msg);
+	}
+
+	status = pw_client_node_activation_take(impl->trans->input_activation);
+	if (status & (1 << PW_CLIENT_NODE_MESSAGE_PROCESS_INPUT))
+		handle_rtnode_message(stream,
+			&PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_PROCESS_INPUT));
+	if (status & (1 << PW_CLIENT_NODE_MESSAGE_PROCESS_OUTPUT))
+		handle_rtnode_message(stream,
+			&PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_PROCESS_OUTPUT));
+}
+
 static void
 on_rtsocket_condition(void *data, int fd, enum spa_io mask)
 {
@@ -670,17 +1019,18 @@ on_rtsocket_condition(void *data, int fd, enum spa_io mask)
 	}
 
 	if (mask & SPA_IO_IN) {
-		struct pw_client_node_message message;
 		uint64_t cmd;
+		uint32_t rounds = 0;
 
 		if (read(fd, &cmd, sizeof(uint64_t)) != sizeof(uint64_t))
 			pw_log_warn("stream %p: read failed %m", impl);
 
-		while (pw_client_node_transport_next_message(impl->trans, &message) == 1) {
-			struct pw_client_node_message *msg = alloca(SPA_POD_SIZE(&message));
-			pw_client_node_transport_parse_message(impl->trans, msg);
-			handle_rtnode_message(stream, msg);
-		}
+		/* handle the signals of the server that come in quickly without
+		 * the eventfd, a few times so that the loop is not starved */
+		do {
+			handle_rtnode_transport(stream);
+		} while (impl->spin > 0 && ++rounds < MAX_SPIN_ROUNDS &&
+			 pw_client_node_transport_wait(impl->trans, impl->spin, false) == 0);
 	}
 }
 
@@ -695,7 +1045,11 @@ static void handle_socket(struct pw_stream *stream, int rtreadfd, int rtwritefd)
 					       SPA_IO_ERR | SPA_IO_HUP,
 					       true, on_rtsocket_condition, stream);
 
-	if (impl->flags & PW_STREAM_FLAG_CLOCK_UPDATE) {
+	if (impl->flags & PW_STREAM_FLAG_QUEUE)
+		impl->queue_event = pw_loop_add_event(stream->remote->core->data_loop,
+						      on_queue_event, stream);
+
+	if (impl->flags & PW_STREAM_FLAG_CLOCK_UPDATE && impl->timeout_source == NULL) {
 		impl->timeout_source = pw_loop_add_timer(stream->remote->core->main_loop, on_timeout, stream);
 		interval.tv_sec = 0;
 		interval.tv_nsec = 100000000;
@@ -798,35 +1152,43 @@ client_node_port_set_param(void *data,
 	struct stream *impl = data;
 	struct pw_stream *stream = &impl->this;
 	struct pw_type *t = &stream->remote->core->type;
+	struct port *port;
+
+	if ((port = find_port(impl, direction, port_id)) == NULL) {
+		pw_log_warn("stream %p: unknown port %u", stream, port_id);
+		add_async_complete(stream, seq, -EINVAL);
+		return;
+	}
 
 	if (id == t->param.idFormat) {
 		int count;
 
-		pw_log_debug("stream %p: format changed %d", stream, seq);
+		pw_log_debug("stream %p: format changed on port %u %d", stream, port_id, seq);
 
-		if (impl->format)
-			free(impl->format);
+		if (port->format)
+			free(port->format);
 
 		if (spa_pod_is_object_type(param, t->spa_format)) {
-			impl->format = pw_spa_pod_copy(param);
-			((struct spa_pod_object*)impl->format)->body.id = id;
+			port->format = pw_spa_pod_copy(param);
+			((struct spa_pod_object*)port->format)->body.id = id;
 		}
 		else
-			impl->format = NULL;
+			port->format = NULL;
 
-		impl->pending_seq = seq;
+		port->pending_seq = seq;
 
-		count = spa_hook_list_call(&stream->listener_list,
+		count = spa_hook_list_call(port_listeners(stream, port),
 				   struct pw_stream_events,
-				   format_changed, impl->format);
+				   format_changed, port->format);
 
 		if (count == 0)
-			pw_stream_finish_format(stream, 0, NULL, 0);
+			pw_stream_finish_port_format(stream, port->id, 0, NULL, 0);
 
-		if (impl->format)
-			stream_set_state(stream, PW_STREAM_STATE_READY, NULL);
-		else
+		/* the stream is ready when all ports have a format */
+		if (port->format == NULL)
 			stream_set_state(stream, PW_STREAM_STATE_CONFIGURE, NULL);
+		else if (n_ports_with_format(impl) == N_PORTS(impl))
+			stream_set_state(stream, PW_STREAM_STATE_READY, NULL);
 	}
 	else
 		pw_log_warn("set param not implemented");
@@ -858,25 +1220,47 @@ client_node_add_mem(void *data,
 	m->ptr = NULL;
 }
 
-static void
-client_node_port_use_buffers(void *data,
-			     uint32_t seq,
-			     enum spa_direction direction, uint32_t port_id,
-			     uint32_t n_buffers, struct pw_client_node_buffer *buffers)
+struct use_buffers {
+	struct pw_stream *stream;
+	struct port *port;
+	uint32_t n_buffers;
+	struct pw_client_node_buffer *buffers;
+};
+
+/* runs in the data thread, the buffers, the index and the queues of the port
+ * are only changed where the data thread uses them */
+static int
+do_use_buffers(struct spa_loop *loop,
+	       bool async, uint32_t seq, const void *data, size_t size, void *user_data)
 {
-	struct stream *impl = data;
-	struct pw_stream *stream = &impl->this;
+	struct use_buffers *ub = user_data;
+	struct pw_stream *stream = ub->stream;
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
 	struct pw_core *core = stream->remote->core;
 	struct pw_type *t = &core->type;
+	struct port *port = ub->port;
+	struct pw_client_node_buffer *buffers = ub->buffers;
+	uint32_t n_buffers = ub->n_buffers;
 	struct buffer_id *bid;
 	uint32_t i, j, len;
 	struct spa_buffer *b;
 	int prot;
 
-	prot = PROT_READ | (direction == SPA_DIRECTION_OUTPUT ? PROT_WRITE : 0);
+	prot = PROT_READ | (impl->direction == SPA_DIRECTION_OUTPUT ? PROT_WRITE : 0);
 
 	/* clear previous buffers */
-	clear_buffers(stream);
+	clear_buffers(stream, port);
+
+	if (init_buffer_index(port, n_buffers) < 0) {
+		pw_log_error("stream %p: can't index %u buffers", stream, n_buffers);
+		return -ENOMEM;
+	}
+	if (impl->flags & PW_STREAM_FLAG_QUEUE &&
+	    (queue_init(&port->dequeued, n_buffers) < 0 ||
+	     queue_init(&port->queued, n_buffers) < 0)) {
+		pw_log_error("stream %p: can't allocate queues for %u buffers", stream, n_buffers);
+		return -ENOMEM;
+	}
 
 	for (i = 0; i < n_buffers; i++) {
 		off_t offset;
@@ -887,11 +1271,13 @@ client_node_port_use_buffers(void *data,
 			continue;
 		}
 
-		len = pw_array_get_len(&impl->buffer_ids, struct buffer_id);
-		bid = pw_array_add(&impl->buffer_ids, sizeof(struct buffer_id));
+		len = pw_array_get_len(&port->buffer_ids, struct buffer_id);
+		bid = pw_array_add(&port->buffer_ids, sizeof(struct buffer_id));
 		if (impl->direction == SPA_DIRECTION_OUTPUT) {
 			bid->used = false;
-			spa_list_append(&impl->free, &bid->link);
+			if (!(impl->flags & PW_STREAM_FLAG_QUEUE) ||
+			    push_dequeued(stream, port, buffers[i].buffer->id) < 0)
+				spa_list_append(&port->free, &bid->link);
 		} else {
 			bid->used = true;
 		}
@@ -934,10 +1320,11 @@ client_node_port_use_buffers(void *data,
 			bid->mem[bid->n_mem++] = mid;
 		}
 		bid->id = b->id;
+		add_buffer_index(port, bid);
 
 		if (bid->id != len) {
 			pw_log_warn("unexpected id %u found, expected %u", bid->id, len);
-			impl->in_order = false;
+			port->in_order = false;
 		}
 		pw_log_debug("add buffer %d %d %u %u", mid->id,
 				bid->id, bid->map.offset, bid->map.size);
@@ -974,15 +1361,50 @@ client_node_port_use_buffers(void *data,
 				pw_log_warn("unknown buffer data type %d", d->type);
 			}
 		}
-		spa_hook_list_call(&stream->listener_list, struct pw_stream_events, add_buffer, bid->id);
+		spa_hook_list_call(port_listeners(stream, port), struct pw_stream_events,
+				   add_buffer, bid->id);
+	}
+	return 0;
+}
+
+static void
+client_node_port_use_buffers(void *data,
+			     uint32_t seq,
+			     enum spa_direction direction, uint32_t port_id,
+			     uint32_t n_buffers, struct pw_client_node_buffer *buffers)
+{
+	struct stream *impl = data;
+	struct pw_stream *stream = &impl->this;
+	struct use_buffers ub;
+	struct port *port;
+	int res;
+
+	if ((port = find_port(impl, direction, port_id)) == NULL) {
+		pw_log_warn("stream %p: unknown port %u", stream, port_id);
+		add_async_complete(stream, seq, -EINVAL);
+		return;
 	}
 
-	add_async_complete(stream, seq, 0);
+	ub.stream = stream;
+	ub.port = port;
+	ub.n_buffers = n_buffers;
+	ub.buffers = buffers;
+	res = pw_loop_invoke(stream->remote->core->data_loop,
+			     do_use_buffers, SPA_ID_INVALID, NULL, 0, true, &ub);
 
-	if (n_buffers)
-		stream_set_state(stream, PW_STREAM_STATE_PAUSED, NULL);
+	add_async_complete(stream, seq, res);
+	if (res < 0)
+		return;
+
+	/* the stream is paused when all ports have buffers, the memory is
+	 * shared between the ports and is only cleared when no port uses it */
+	if (n_buffers) {
+		if (n_ports_with_buffers(impl) == N_PORTS(impl))
+			stream_set_state(stream, PW_STREAM_STATE_PAUSED, NULL);
+	}
 	else {
-		clear_mems(stream);
+		if (n_ports_with_buffers(impl) == 0)
+			clear_mems(stream);
 		stream_set_state(stream, PW_STREAM_STATE_READY, NULL);
 	}
 }
@@ -1029,10 +1451,17 @@ static void client_node_port_set_io(void *data,
 	struct pw_stream *stream = &impl->this;
 	struct pw_core *core = stream->remote->core;
 	struct pw_type *t = &core->type;
+	struct port *port;
 	struct mem_id *m;
 	void *ptr;
 	int res;
 
+	if ((port = find_port(impl, direction, port_id)) == NULL) {
+		pw_log_warn("stream %p: unknown port %u", stream, port_id);
+		res = -EINVAL;
+		goto exit;
+	}
+
 	if (mem_id == SPA_ID_INVALID) {
 		ptr = NULL;
 		size = 0;
@@ -1051,8 +1480,8 @@ static void client_node_port_set_io(void *data,
 	}
 
 	if (id == t->io.Buffers) {
-		impl->io = ptr;
-		pw_log_debug("stream %p: set io id %u %p", stream, id, ptr);
+		port->io = ptr;
+		pw_log_debug("stream %p: set io id %u on port %u %p", stream, id, port_id, ptr);
 	}
 
 	res = 0;
@@ -1105,10 +1534,9 @@ pw_stream_connect(struct pw_stream *stream,
 
 	impl->direction =
 	    direction == PW_DIRECTION_INPUT ? SPA_DIRECTION_INPUT : SPA_DIRECTION_OUTPUT;
-	impl->port_id = 0;
 	impl->flags = flags;
 
-	set_init_params(stream, n_params, params);
+	set_init_params(GET_PORT(impl, 0), n_params, params);
 
 	stream_set_state(stream, PW_STREAM_STATE_CONNECTING, NULL);
 
@@ -1135,35 +1563,95 @@ pw_stream_connect(struct pw_stream *stream,
 	return 0;
 }
 
+int
+pw_stream_add_port(struct pw_stream *stream,
+		   const struct spa_pod **params,
+		   uint32_t n_params)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct port *port;
+
+	/* the transport is made for the ports that exist when connecting */
+	if (impl->node_proxy)
+		return -EBUSY;
+
+	if ((port = new_port(impl)) == NULL)
+		return -ENOMEM;
+
+	set_init_params(port, n_params, params);
+
+	return port->id;
+}
+
+uint32_t pw_stream_get_n_ports(struct pw_stream *stream)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	return N_PORTS(impl);
+}
+
+int pw_stream_add_port_listener(struct pw_stream *stream,
+				uint32_t port_id,
+				struct spa_hook *listener,
+				const struct pw_stream_events *events,
+				void *data)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct port *port;
+
+	if ((port = find_port(impl, impl->direction, port_id)) == NULL)
+		return -EINVAL;
+
+	spa_hook_list_append(port_listeners(stream, port), listener, events, data);
+	return 0;
+}
+
 uint32_t
 pw_stream_get_node_id(struct pw_stream *stream)
 {
 	return stream->node_id;
 }
 
-void
-pw_stream_finish_format(struct pw_stream *stream,
-			int res,
-			struct spa_pod **params,
-			uint32_t n_params)
+int
+pw_stream_finish_port_format(struct pw_stream *stream,
+			     uint32_t port_id,
+			     int res,
+			     struct spa_pod **params,
+			     uint32_t n_params)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct port *port;
 
-	pw_log_debug("stream %p: finish format %d %d", stream, res, impl->pending_seq);
+	if ((port = find_port(impl, impl->direction, port_id)) == NULL)
+		return -EINVAL;
+
+	pw_log_debug("stream %p: finish format on port %u %d %d", stream, port_id,
+		     res, port->pending_seq);
 
-	set_params(stream, n_params, params);
+	set_params(port, n_params, params);
 
 	if (SPA_RESULT_IS_OK(res)) {
-		add_port_update(stream, PW_CLIENT_NODE_PORT_UPDATE_PARAMS);
+		add_port_update(stream, port, PW_CLIENT_NODE_PORT_UPDATE_PARAMS);
 
-		if (!impl->format) {
-			clear_buffers(stream);
-			clear_mems(stream);
+		if (!port->format) {
+			clear_port_buffers(stream, port);
+			if (n_ports_with_buffers(impl) == 0)
+				clear_mems(stream);
 		}
 	}
-	add_async_complete(stream, impl->pending_seq, res);
+	add_async_complete(stream, port->pending_seq, res);
 
-	impl->pending_seq = SPA_ID_INVALID;
+	port->pending_seq = SPA_ID_INVALID;
+
+	return 0;
+}
+
+void
+pw_stream_finish_format(struct pw_stream *stream,
+			int res,
+			struct spa_pod **params,
+			uint32_t n_params)
+{
+	pw_stream_finish_port_format(stream, 0, res, params, n_params);
 }
 
 int pw_stream_disconnect(struct pw_stream *stream)
@@ -1172,6 +1660,10 @@ int pw_stream_disconnect(struct pw_stream *stream)
 
 	impl->disconnecting = true;
 
+	if (impl->timeout_source) {
+		pw_loop_destroy_source(stream->remote->core->main_loop, impl->timeout_source);
+		impl->timeout_source = NULL;
+	}
 	unhandle_socket(stream);
 
 	if (impl->node_proxy) {
@@ -1192,87 +1684,137 @@ int pw_stream_set_active(struct pw_stream *stream, bool active)
 	return 0;
 }
 
-int pw_stream_get_time(struct pw_stream *stream, struct pw_time *time)
+int pw_stream_get_time_ex(struct pw_stream *stream, struct pw_time_ex *time)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct pw_client_node_position pos;
 	int64_t elapsed;
 	struct timespec ts;
 
+	/* use the position that the server publishes in each cycle, the last
+	 * clock update is only used until the first cycle */
+	if (impl->trans == NULL ||
+	    pw_client_node_position_read(impl->trans->position, &pos) < 0 ||
+	    pos.monotonic == 0) {
+		pos.rate = impl->last_rate;
+		pos.ticks = impl->last_ticks;
+		pos.monotonic = impl->last_monotonic;
+		pos.quantum = 0;
+		pos.delay = 0;
+	}
+
 	clock_gettime(CLOCK_MONOTONIC, &ts);
-	time->now = SPA_TIMESPEC_TO_TIME(&ts);
-	elapsed = (time->now - impl->last_monotonic) / 1000;
+	time->time.now = SPA_TIMESPEC_TO_TIME(&ts);
+	elapsed = (time->time.now - pos.monotonic) / 1000;
 
-	time->ticks = impl->last_ticks + (elapsed * impl->last_rate) / SPA_USEC_PER_SEC;
-	time->rate = impl->last_rate;
+	time->time.ticks = pos.ticks + (elapsed * pos.rate) / SPA_USEC_PER_SEC;
+	time->time.rate = pos.rate;
+	time->quantum = pos.quantum;
+	time->delay = pos.delay;
 
 	return 0;
 }
 
-uint32_t pw_stream_get_empty_buffer(struct pw_stream *stream)
+int pw_stream_get_time(struct pw_stream *stream, struct pw_time *time)
+{
+	struct pw_time_ex t;
+	int res;
+
+	if ((res = pw_stream_get_time_ex(stream, &t)) < 0)
+		return res;
+
+	*time = t.time;
+	return 0;
+}
+
+uint32_t pw_stream_get_port_empty_buffer(struct pw_stream *stream, uint32_t port_id)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
 	struct buffer_id *bid;
+	struct port *port;
 
-	if (spa_list_is_empty(&impl->free))
+	if ((port = find_port(impl, impl->direction, port_id)) == NULL ||
+	    spa_list_is_empty(&port->free))
 		return SPA_ID_INVALID;
 
-	bid = spa_list_first(&impl->free, struct buffer_id, link);
+	bid = spa_list_first(&port->free, struct buffer_id, link);
 
 	return bid->id;
 }
 
-int pw_stream_recycle_buffer(struct pw_stream *stream, uint32_t id)
+uint32_t pw_stream_get_empty_buffer(struct pw_stream *stream)
+{
+	return pw_stream_get_port_empty_buffer(stream, 0);
+}
+
+int pw_stream_recycle_port_buffer(struct pw_stream *stream, uint32_t port_id, uint32_t id)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
 	struct buffer_id *bid;
+	struct port *port;
 
-	if ((bid = find_buffer(stream, id)) == NULL || !bid->used)
+	if ((port = find_port(impl, impl->direction, port_id)) == NULL ||
+	    (bid = find_buffer(port, id)) == NULL || !bid->used)
 		return -EINVAL;
 
 	bid->used = false;
-	spa_list_append(&impl->free, &bid->link);
+	spa_list_append(&port->free, &bid->link);
 
-	if (impl->in_new_buffer) {
-		int i;
-
-		for (i = 0; i < impl->trans->area->n_input_ports; i++) {
-			struct spa_io_buffers *input = &impl->trans->inputs[i];
-			input->buffer_id = id;
-		}
-	} else {
-		send_reuse_buffer(stream, id);
-	}
+	if (impl->in_new_buffer)
+		impl->trans->inputs[port->id].buffer_id = id;
+	else
+		send_reuse_buffer(stream, port, id);
 
 	return 0;
 }
 
-struct spa_buffer *pw_stream_peek_buffer(struct pw_stream *stream, uint32_t id)
+int pw_stream_recycle_buffer(struct pw_stream *stream, uint32_t id)
 {
+	return pw_stream_recycle_port_buffer(stream, 0, id);
+}
+
+struct spa_buffer *
+pw_stream_peek_port_buffer(struct pw_stream *stream, uint32_t port_id, uint32_t id)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
 	struct buffer_id *bid;
+	struct port *port;
 
-	if ((bid = find_buffer(stream, id)))
+	if ((port = find_port(impl, impl->direction, port_id)) &&
+	    (bid = find_buffer(port, id)))
 		return bid->buf;
 
 	return NULL;
 }
 
-int pw_stream_send_buffer(struct pw_stream *stream, uint32_t id)
+struct spa_buffer *pw_stream_peek_buffer(struct pw_stream *stream, uint32_t id)
+{
+	return pw_stream_peek_port_buffer(stream, 0, id);
+}
+
+int pw_stream_send_port_buffer(struct pw_stream *stream, uint32_t port_id, uint32_t id)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct spa_io_buffers *output;
 	struct buffer_id *bid;
+	struct port *port;
+
+	if ((port = find_port(impl, SPA_DIRECTION_OUTPUT, port_id)) == NULL)
+		return -EINVAL;
 
-	if (impl->trans->outputs[0].buffer_id != SPA_ID_INVALID) {
-		pw_log_debug("can't send %u, pending buffer %u", id,
-			     impl->trans->outputs[0].buffer_id);
+	output = &impl->trans->outputs[port->id];
+	if (output->buffer_id != SPA_ID_INVALID) {
+		pw_log_debug("can't send %u on port %u, pending buffer %u", id,
+			     port->id, output->buffer_id);
 		return -EIO;
 	}
 
-	if ((bid = find_buffer(stream, id)) && !bid->used) {
+	if ((bid = find_buffer(port, id)) && !bid->used) {
 		bid->used = true;
 		spa_list_remove(&bid->link);
-		impl->trans->outputs[0].buffer_id = id;
-		impl->trans->outputs[0].status = SPA_STATUS_HAVE_BUFFER;
-		pw_log_trace("stream %p: send buffer %d", stream, id);
+		output->buffer_id = id;
+		output->status = SPA_STATUS_HAVE_BUFFER;
+		pw_log_trace("stream %p: send buffer %d on port %u", stream, id, port->id);
 		if (!impl->in_need_buffer)
 			send_have_output(stream);
 	} else {
@@ -1281,3 +1823,54 @@ int pw_stream_send_buffer(struct pw_stream *stream, uint32_t id)
 
 	return 0;
 }
+
+int pw_stream_send_buffer(struct pw_stream *stream, uint32_t id)
+{
+	return pw_stream_send_port_buffer(stream, 0, id);
+}
+
+struct spa_buffer *pw_stream_dequeue_port_buffer(struct pw_stream *stream, uint32_t port_id)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct buffer_id *bid;
+	struct port *port;
+	uint32_t id;
+
+	if ((port = find_port(impl, impl->direction, port_id)) == NULL)
+		return NULL;
+
+	while ((id = queue_pop(&port->dequeued)) != SPA_ID_INVALID) {
+		if ((bid = find_buffer(port, id)) != NULL)
+			return bid->buf;
+	}
+	return NULL;
+}
+
+struct spa_buffer *pw_stream_dequeue_buffer(struct pw_stream *stream)
+{
+	return pw_stream_dequeue_port_buffer(stream, 0);
+}
+
+int pw_stream_queue_port_buffer(struct pw_stream *stream, uint32_t port_id,
+				struct spa_buffer *buffer)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct port *port;
+	int res;
+
+	if (impl->queue_event == NULL ||
+	    (port = find_port(impl, impl->direction, port_id)) == NULL ||
+	    find_buffer(port, buffer->id) == NULL)
+		return -EINVAL;
+
+	if ((res = queue_push(&port->queued, buffer->id)) < 0)
+		return res;
+
+	pw_loop_signal_event(stream->remote->core->data_loop, impl->queue_event);
+	return 0;
+}
+
+int pw_stream_queue_buffer(struct pw_stream *stream, struct spa_buffer *buffer)
+{
+	return pw_stream_queue_port_buffer(stream, 0, buffer);
+}
@@ -30,7 +30,7 @@ extern "C" {
  *
  * Media streams are used to exchange data with the PipeWire server. A
  * stream is a wrapper around a proxy for a \ref pw_client_node with
- * just one port.
+ * one port or with a few ports of the same direction.
  *
  * Streams can be used to:
  *
@@ -107,7 +107,9 @@ extern "C" {
  * between client and server.
  *
  * With the add_buffer event, a stream will be notified of a new buffer
- * that can be used for data transport.
+ * that can be used for data transport. The add_buffer and remove_buffer
+ * events are emited from the data thread, like the new_buffer and
+ * need_buffer events.
  *
  * Afer the buffers are negotiated, the stream will transition to the
  * \ref PW_STREAM_STATE_PAUSED state.
@@ -147,6 +149,38 @@ extern "C" {
  * The new_buffer event is emited when PipeWire no longer uses the buffer
  * and it can be safely reused.
  *
+ * \subsection ssec_queue Exchange buffers from another thread
+ *
+ * A stream that is connected with \ref PW_STREAM_FLAG_QUEUE also puts its
+ * buffers in lock-free queues. The application can then take buffers with
+ * \ref pw_stream_dequeue_buffer() and give them back with
+ * \ref pw_stream_queue_buffer() from its own thread, without locking the
+ * loop of the stream. A capture stream dequeues buffers with data and queues
+ * them to recycle them, a playback stream dequeues empty buffers and queues
+ * them when they are filled. The events are still emited and can be used to
+ * wake up the thread of the application.
+ *
+ * The buffers are added and removed in the data thread, which is also the
+ * only thread that adds buffers to the queues. Buffers that were taken
+ * before the remove_buffer event of their id are invalid, and the queues are
+ * emptied when the buffers change, so the application should not take
+ * buffers while the format or the buffers are renegotiated.
+ *
+ * \subsection ssec_ports Streams with more ports
+ *
+ * A stream has one port by default. Related data, such as the channels
+ * of planar audio or the metadata of a video stream, can be exchanged
+ * on extra ports that are added with \ref pw_stream_add_port() before
+ * the stream is connected. All ports share one client node, transport
+ * and wakeup per cycle, each port negotiates its own format and has
+ * its own buffers.
+ *
+ * The events of port 0 are emited on the listeners of the stream. Use
+ * \ref pw_stream_add_port_listener() to get the format_changed, add_buffer,
+ * remove_buffer and new_buffer events of the other ports, need_buffer is
+ * emited once on the stream for all ports. The functions with port in
+ * their name take the port id, the other functions work on port 0.
+ *
  * \section sec_stream_disconnect Disconnect
  *
  * Use \ref pw_stream_disconnect() to disconnect a stream after use.
@@ -213,8 +247,12 @@ enum pw_stream_flags {
 	PW_STREAM_FLAG_AUTOCONNECT	= (1 << 0),	/**< try to automatically connect
 							  *  this stream */
 	PW_STREAM_FLAG_CLOCK_UPDATE	= (1 << 1),	/**< request periodic clock updates for
-							  *  this stream */
+							  *  this stream, they keep the live and
+							  *  latency properties up to date */
 	PW_STREAM_FLAG_INACTIVE		= (1 << 2),	/**< start the stream inactive */
+	PW_STREAM_FLAG_QUEUE		= (1 << 3),	/**< exchange buffers with
+							  *  pw_stream_dequeue_buffer() and
+							  *  pw_stream_queue_buffer() */
 };
 
 /** A time structure \memberof pw_stream */
@@ -224,6 +262,15 @@ struct pw_time {
 	int32_t rate;		/**< the rate of \a ticks */
 };
 
+/** The time of a stream with the timing of the graph, see
+ * \ref pw_stream_get_time_ex() \memberof pw_stream */
+struct pw_time_ex {
+	struct pw_time time;	/**< the time, like \ref pw_stream_get_time() */
+	uint64_t quantum;	/**< time between the last two cycles in nanoseconds */
+	int64_t delay;		/**< delay in ticks until the data of the cycle is
+				  *  rendered, 0 when unknown */
+};
+
 /** Create a new unconneced \ref pw_stream \memberof pw_stream
  * \return a newly allocated \ref pw_stream */
 struct pw_stream *
@@ -269,6 +316,27 @@ pw_stream_connect(struct pw_stream *stream,		/**< a \ref pw_stream */
 							  *  formats. */
 		  uint32_t n_params			/**< number of items in \a params */);
 
+/** Add a port to the stream \memberof pw_stream
+ * \return the id of the new port or < 0 on error
+ *
+ * Ports can only be added before the stream is connected, port 0 is
+ * made with the stream and uses the params of \ref pw_stream_connect(). */
+int
+pw_stream_add_port(struct pw_stream *stream,		/**< a \ref pw_stream */
+		   const struct spa_pod **params,	/**< an array with params of the port */
+		   uint32_t n_params			/**< number of items in \a params */);
+
+/** Get the number of ports of the stream \memberof pw_stream */
+uint32_t pw_stream_get_n_ports(struct pw_stream *stream);
+
+/** Listen for the events of a port \memberof pw_stream
+ * \return 0 on success, < 0 when \a port_id is invalid */
+int pw_stream_add_port_listener(struct pw_stream *stream,
+				uint32_t port_id,
+				struct spa_hook *listener,
+				const struct pw_stream_events *events,
+				void *data);
+
 /** Get the node ID of the stream. \memberof pw_stream
  * \return node ID. */
 uint32_t
@@ -291,21 +359,44 @@ pw_stream_finish_format(struct pw_stream *stream,	/**< a \ref pw_stream */
 							  *  buffer allocation. */
 			uint32_t n_params		/**< number of elements in \a params */);
 
+/** Complete the format negotiation of \a port_id \memberof pw_stream
+ * \return 0 on success, < 0 when \a port_id is invalid */
+int
+pw_stream_finish_port_format(struct pw_stream *stream,
+			     uint32_t port_id,
+			     int res,
+			     struct spa_pod **params,
+			     uint32_t n_params);
+
 /** Activate or deactivate the stream \memberof pw_stream */
 int pw_stream_set_active(struct pw_stream *stream, bool active);
 
-/** Query the time on the stream \memberof pw_stream */
+/** Query the time on the stream \memberof pw_stream
+ *
+ * The time is extrapolated from the position of the driver that the server
+ * publishes in shared memory in each cycle. This does not lock or do IPC
+ * and can be called from any thread. */
 int pw_stream_get_time(struct pw_stream *stream, struct pw_time *time);
 
+/** Query the time and the timing of the graph on the stream \memberof pw_stream
+ *
+ * Like \ref pw_stream_get_time() but also gets the quantum and the delay
+ * of the graph. */
+int pw_stream_get_time_ex(struct pw_stream *stream, struct pw_time_ex *time);
+
 /** Get the id of an empty buffer that can be filled \memberof pw_stream
  * \return the id of an empty buffer or \ref SPA_ID_INVALID when no buffer is
  * available.  */
 uint32_t pw_stream_get_empty_buffer(struct pw_stream *stream);
+/** Get the id of an empty buffer of \a port_id \memberof pw_stream */
+uint32_t pw_stream_get_port_empty_buffer(struct pw_stream *stream, uint32_t port_id);
 
 /** Recycle the buffer with \a id \memberof pw_stream
  * \return 0 on success, < 0 when \a id is invalid or not a used buffer
  * Let the PipeWire server know that it can reuse the buffer with \a id. */
 int pw_stream_recycle_buffer(struct pw_stream *stream, uint32_t id);
+/** Recycle the buffer with \a id of \a port_id \memberof pw_stream */
+int pw_stream_recycle_port_buffer(struct pw_stream *stream, uint32_t port_id, uint32_t id);
 
 /** Get the buffer with \a id from \a stream \memberof pw_stream
  * \return a \ref spa_buffer or NULL when there is no buffer
@@ -313,6 +404,9 @@ int pw_stream_recycle_buffer(struct pw_stream *stream, uint32_t id);
  * This function should be called from the new-buffer event. */
 struct spa_buffer *
 pw_stream_peek_buffer(struct pw_stream *stream, uint32_t id);
+/** Get the buffer with \a id of \a port_id \memberof pw_stream */
+struct spa_buffer *
+pw_stream_peek_port_buffer(struct pw_stream *stream, uint32_t port_id, uint32_t id);
 
 /** Send a buffer with \a id to \a stream \memberof pw_stream
  * \return 0 when \a id was handled, < 0 on error
@@ -320,6 +414,37 @@ pw_stream_peek_buffer(struct pw_stream *stream, uint32_t id);
  * For provider or playback streams, this function should be called whenever
  * there is a new buffer available. */
 int pw_stream_send_buffer(struct pw_stream *stream, uint32_t id);
+/** Send a buffer with \a id on \a port_id \memberof pw_stream
+ *
+ * Buffers that are sent from the need_buffer event go to the server
+ * together, with one wakeup for all ports. */
+int pw_stream_send_port_buffer(struct pw_stream *stream, uint32_t port_id, uint32_t id);
+
+/** Take a buffer from \a stream \memberof pw_stream
+ * \return a buffer or NULL when there is no buffer
+ *
+ * The stream must be connected with \ref PW_STREAM_FLAG_QUEUE. This is a
+ * buffer with data for capture streams and an empty buffer for playback
+ * streams. Give the buffer back with \ref pw_stream_queue_buffer().
+ *
+ * This function does not lock and can be called from any thread, but only
+ * from one thread at a time. */
+struct spa_buffer *pw_stream_dequeue_buffer(struct pw_stream *stream);
+/** Take a buffer from \a port_id \memberof pw_stream */
+struct spa_buffer *pw_stream_dequeue_port_buffer(struct pw_stream *stream, uint32_t port_id);
+
+/** Give a buffer back to \a stream \memberof pw_stream
+ * \return 0 on success, < 0 on error
+ *
+ * Capture streams recycle the buffer and playback streams send it. The data
+ * thread of the stream handles the buffer when it wakes up.
+ *
+ * This function does not lock and can be called from any thread, but only
+ * from one thread at a time. */
+int pw_stream_queue_buffer(struct pw_stream *stream, struct spa_buffer *buffer);
+/** Give a buffer back to \a port_id \memberof pw_stream */
+int pw_stream_queue_port_buffer(struct pw_stream *stream, uint32_t port_id,
+				struct spa_buffer *buffer);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,357 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Shows the profile of the nodes of a PipeWire daemon. The daemon publishes
+ * the profile in the node properties when it runs with pipewire.core.profile
+ * set, this tool only listens for the node info and redraws the table. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <inttypes.h>
+
+#include <pipewire/pipewire.h>
+#include <pipewire/interfaces.h>
+#include <pipewire/type.h>
+
+#define REFRESH_MSEC	500
+#define MAX_NODES	1024
+
+struct data {
+	struct pw_main_loop *loop;
+	struct pw_core *core;
+
+	struct pw_remote *remote;
+	struct spa_hook remote_listener;
+
+	struct pw_core_proxy *core_proxy;
+
+	struct pw_registry_proxy *registry_proxy;
+	struct spa_hook registry_listener;
+
+	struct spa_source *timer;
+	bool changed;
+
+	struct spa_list node_list;
+};
+
+struct node {
+	struct spa_list link;
+	struct data *data;
+	struct pw_proxy *proxy;
+	struct spa_hook proxy_listener;
+	struct spa_hook node_listener;
+
+	uint32_t id;
+	char *name;
+	char *partition;
+	enum pw_node_state state;
+	bool driver;
+
+	bool profiled;
+	uint64_t last;
+	uint64_t avg;
+	uint64_t max;
+	uint64_t quantum;
+	uint32_t count;
+	uint32_t xruns;
+	uint32_t queued;
+};
+
+static uint64_t get_u64(const struct spa_dict *props, const char *key)
+{
+	const char *str = spa_dict_lookup(props, key);
+	return str ? strtoull(str, NULL, 10) : 0;
+}
+
+static uint32_t node_load(struct node *n)
+{
+	return n->quantum ? n->avg * 100 / n->quantum : 0;
+}
+
+static int compare_node(const void *a, const void *b)
+{
+	struct node *na = *(struct node **) a, *nb = *(struct node **) b;
+	uint32_t la = node_load(na), lb = node_load(nb);
+
+	if (la != lb)
+		return la < lb ? 1 : -1;
+	return na->id < nb->id ? -1 : na->id > nb->id;
+}
+
+static void print_drivers(struct data *d)
+{
+	struct node *n;
+
+	spa_list_for_each(n, &d->node_list, link) {
+		if (!n->driver)
+			continue;
+
+		printf("driver %u \"%s\": ", n->id, n->name ? n->name : "");
+		if (n->quantum)
+			printf("quantum %.1f us, %.1f cycles/s\n",
+			       n->quantum / 1000.0, (double) SPA_NSEC_PER_SEC / n->quantum);
+		else
+			printf("not running\n");
+	}
+}
+
+static void print_nodes(struct data *d)
+{
+	struct node *n, *nodes[MAX_NODES];
+	uint32_t i, n_nodes = 0, n_profiled = 0;
+
+	spa_list_for_each(n, &d->node_list, link) {
+		if (n_nodes < MAX_NODES)
+			nodes[n_nodes++] = n;
+		if (n->profiled)
+			n_profiled++;
+	}
+	qsort(nodes, n_nodes, sizeof(struct node *), compare_node);
+
+	/* clear the screen and move to the top */
+	printf("\033[H\033[2J");
+	print_drivers(d);
+	if (n_nodes > 0 && n_profiled == 0)
+		printf("no profile, start the daemon with %s set\n", PW_CORE_PROP_PROFILE);
+
+	printf("\n%5s %-24s %-10s %-10s %8s %8s %8s %8s %5s %6s %5s\n",
+	       "ID", "NAME", "STATE", "PARTITION", "QUANT", "LAST", "AVG", "MAX",
+	       "LOAD", "XRUNS", "QUEUE");
+
+	for (i = 0; i < n_nodes; i++) {
+		n = nodes[i];
+
+		printf("%5u %-24.24s %-10.10s %-10.10s", n->id, n->name ? n->name : "",
+		       pw_node_state_as_string(n->state), n->partition ? n->partition : "-");
+		if (n->profiled)
+			printf(" %8.1f %8.1f %8.1f %8.1f %4u%% %6u %5u\n",
+			       n->quantum / 1000.0, n->last / 1000.0,
+			       n->avg / 1000.0, n->max / 1000.0,
+			       node_load(n), n->xruns, n->queued);
+		else
+			printf(" %8s %8s %8s %8s %5s %6s %5s\n",
+			       "-", "-", "-", "-", "-", "-", "-");
+	}
+	printf("\ntimes in microseconds, load is the average process time of the quantum\n");
+	fflush(stdout);
+}
+
+static void on_timeout(void *data, uint64_t expirations)
+{
+	struct data *d = data;
+
+	if (!d->changed)
+		return;
+	d->changed = false;
+	print_nodes(d);
+}
+
+static void node_event_info(void *object, struct pw_node_info *info)
+{
+	struct node *n = object;
+	const char *str;
+
+	if (info->change_mask & PW_NODE_CHANGE_MASK_NAME) {
+		free(n->name);
+		n->name = info->name ? strdup(info->name) : NULL;
+	}
+	if (info->change_mask & PW_NODE_CHANGE_MASK_STATE)
+		n->state = info->state;
+
+	if ((info->change_mask & PW_NODE_CHANGE_MASK_PROPS) && info->props) {
+		if ((str = spa_dict_lookup(info->props, PW_NODE_PROP_DRIVER)) != NULL)
+			n->driver = pw_properties_parse_bool(str);
+
+		free(n->partition);
+		if ((str = spa_dict_lookup(info->props, PW_NODE_PROP_PARTITION)) != NULL)
+			n->partition = strdup(str);
+		else if (n->driver && n->name)
+			n->partition = strdup(n->name);
+		else
+			n->partition = NULL;
+
+		if (spa_dict_lookup(info->props, PW_NODE_PROP_PROFILE_COUNT) != NULL) {
+			n->profiled = true;
+			n->last = get_u64(info->props, PW_NODE_PROP_PROFILE_LAST);
+			n->avg = get_u64(info->props, PW_NODE_PROP_PROFILE_AVG);
+			n->max = get_u64(info->props, PW_NODE_PROP_PROFILE_MAX);
+			n->quantum = get_u64(info->props, PW_NODE_PROP_PROFILE_QUANTUM);
+			n->count = get_u64(info->props, PW_NODE_PROP_PROFILE_COUNT);
+			n->xruns = get_u64(info->props, PW_NODE_PROP_PROFILE_XRUNS);
+			n->queued = get_u64(info->props, PW_NODE_PROP_PROFILE_QUEUED);
+		}
+	}
+	n->data->changed = true;
+}
+
+static const struct pw_node_proxy_events node_events = {
+	PW_VERSION_NODE_PROXY_EVENTS,
+	.info = node_event_info,
+};
+
+static void destroy_proxy(void *data)
+{
+	struct node *n = data;
+
+	spa_list_remove(&n->link);
+	free(n->name);
+	free(n->partition);
+	n->data->changed = true;
+}
+
+static const struct pw_proxy_events proxy_events = {
+	PW_VERSION_PROXY_EVENTS,
+	.destroy = destroy_proxy,
+};
+
+static void registry_event_global(void *data, uint32_t id, uint32_t parent_id,
+				  uint32_t permissions, uint32_t type, uint32_t version,
+				  const struct spa_dict *props)
+{
+	struct data *d = data;
+	struct pw_type *t = pw_core_get_type(d->core);
+	struct pw_proxy *proxy;
+	struct node *n;
+
+	if (type != t->node)
+		return;
+
+	proxy = pw_registry_proxy_bind(d->registry_proxy, id, type,
+				       PW_VERSION_NODE, sizeof(struct node));
+	if (proxy == NULL) {
+		fprintf(stderr, "failed to create proxy\n");
+		return;
+	}
+
+	n = pw_proxy_get_user_data(proxy);
+	n->data = d;
+	n->proxy = proxy;
+	n->id = id;
+	spa_list_append(&d->node_list, &n->link);
+
+	pw_proxy_add_proxy_listener(proxy, &n->node_listener, &node_events, n);
+	pw_proxy_add_listener(proxy, &n->proxy_listener, &proxy_events, n);
+}
+
+static void registry_event_global_remove(void *object, uint32_t id)
+{
+	struct data *d = object;
+	struct node *n;
+
+	spa_list_for_each(n, &d->node_list, link) {
+		if (n->id == id) {
+			pw_proxy_destroy(n->proxy);
+			break;
+		}
+	}
+}
+
+static const struct pw_registry_proxy_events registry_events = {
+	PW_VERSION_REGISTRY_PROXY_EVENTS,
+	.global = registry_event_global,
+	.global_remove = registry_event_global_remove,
+};
+
+static void on_state_changed(void *_data, enum pw_remote_state old,
+			     enum pw_remote_state state, const char *error)
+{
+	struct data *data = _data;
+	struct pw_type *t = pw_core_get_type(data->core);
+
+	switch (state) {
+	case PW_REMOTE_STATE_ERROR:
+		fprintf(stderr, "remote error: %s\n", error);
+		pw_main_loop_quit(data->loop);
+		break;
+
+	case PW_REMOTE_STATE_CONNECTED:
+		data->core_proxy = pw_remote_get_core_proxy(data->remote);
+		data->registry_proxy = pw_core_proxy_get_registry(data->core_proxy,
+								  t->registry,
+								  PW_VERSION_REGISTRY, 0);
+		pw_registry_proxy_add_listener(data->registry_proxy,
+					       &data->registry_listener,
+					       &registry_events, data);
+		break;
+
+	default:
+		break;
+	}
+}
+
+static const struct pw_remote_events remote_events = {
+	PW_VERSION_REMOTE_EVENTS,
+	.state_changed = on_state_changed,
+};
+
+static void do_quit(void *data, int signal_number)
+{
+	struct data *d = data;
+	pw_main_loop_quit(d->loop);
+}
+
+int main(int argc, char *argv[])
+{
+	struct data data = { 0 };
+	struct pw_loop *l;
+	struct pw_properties *props = NULL;
+	struct timespec value;
+
+	pw_init(&argc, &argv);
+
+	data.loop = pw_main_loop_new(NULL);
+	if (data.loop == NULL)
+		return -1;
+
+	l = pw_main_loop_get_loop(data.loop);
+	pw_loop_add_signal(l, SIGINT, do_quit, &data);
+	pw_loop_add_signal(l, SIGTERM, do_quit, &data);
+
+	data.core = pw_core_new(l, NULL);
+	if (data.core == NULL)
+		return -1;
+
+	spa_list_init(&data.node_list);
+
+	data.timer = pw_loop_add_timer(l, on_timeout, &data);
+	value.tv_sec = 0;
+	value.tv_nsec = REFRESH_MSEC * SPA_NSEC_PER_MSEC;
+	pw_loop_update_timer(l, data.timer, &value, &value, false);
+
+	if (argc > 1)
+		props = pw_properties_new(PW_REMOTE_PROP_REMOTE_NAME, argv[1], NULL);
+
+	data.remote = pw_remote_new(data.core, props, 0);
+	if (data.remote == NULL)
+		return -1;
+
+	pw_remote_add_listener(data.remote, &data.remote_listener, &remote_events, &data);
+	if (pw_remote_connect(data.remote) < 0)
+		return -1;
+
+	pw_main_loop_run(data.loop);
+
+	pw_remote_destroy(data.remote);
+	pw_core_destroy(data.core);
+	pw_main_loop_destroy(data.loop);
+
+	return 0;
+}